@@ -44,6 +44,17 @@ public:
   //
   virtual T eval (const TexCoords &tex_coords) const;
 
+  // Evaluate this texture at each of the NUM coordinates in TEX_COORDS,
+  // storing the results into RESULTS.
+  //
+  virtual void eval_batch (const TexCoords *tex_coords, T *results,
+			   unsigned num)
+    const;
+
+  // Return the result of applying operation OP to VAL1 and VAL2.
+  //
+  static T apply (Op op, const T &val1, const T &val2);
+
   // The operation.
   //
   Op op;
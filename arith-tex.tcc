@@ -28,9 +28,75 @@ template<typename T>
 T
 ArithTex<T>::eval (const TexCoords &tex_coords) const
 {
-  T val1 = arg1.eval (tex_coords);
-  T val2 = arg2.eval (tex_coords);
+  return apply (op, arg1.eval (tex_coords), arg2.eval (tex_coords));
+}
+
+// Evaluate this texture at each of the NUM coordinates in TEX_COORDS,
+// storing the results into RESULTS.
+//
+template<typename T>
+void
+ArithTex<T>::eval_batch (const TexCoords *tex_coords, T *results,
+			 unsigned num)
+  const
+{
+  T vals2[Tex<T>::BATCH_CHUNK];
+
+  while (num > 0)
+    {
+      unsigned chunk = num;
+      if (chunk > Tex<T>::BATCH_CHUNK)
+	chunk = Tex<T>::BATCH_CHUNK;
+
+      arg1.eval_batch (tex_coords, results, chunk);
+      arg2.eval_batch (tex_coords, vals2, chunk);
 
+      // The most common operations get their own loops; everything
+      // else uses ArithTex::apply for each element.
+      //
+      switch (op)
+	{
+	case ADD:
+	  for (unsigned i = 0; i < chunk; i++)
+	    results[i] = results[i] + vals2[i];
+	  break;
+	case SUB:
+	  for (unsigned i = 0; i < chunk; i++)
+	    results[i] = results[i] - vals2[i];
+	  break;
+	case MUL:
+	  for (unsigned i = 0; i < chunk; i++)
+	    results[i] = results[i] * vals2[i];
+	  break;
+	case MIN:
+	  for (unsigned i = 0; i < chunk; i++)
+	    results[i] = min (results[i], vals2[i]);
+	  break;
+	case MAX:
+	  for (unsigned i = 0; i < chunk; i++)
+	    results[i] = max (results[i], vals2[i]);
+	  break;
+	case AVG:
+	  for (unsigned i = 0; i < chunk; i++)
+	    results[i] = (results[i] + vals2[i]) / 2;
+	  break;
+	default:
+	  for (unsigned i = 0; i < chunk; i++)
+	    results[i] = apply (op, results[i], vals2[i]);
+	}
+
+      tex_coords += chunk;
+      results += chunk;
+      num -= chunk;
+    }
+}
+
+// Return the result of applying operation OP to VAL1 and VAL2.
+//
+template<typename T>
+T
+ArithTex<T>::apply (Op op, const T &val1, const T &val2)
+{
   switch (op)
     {
     case ADD:
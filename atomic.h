@@ -0,0 +1,100 @@
+// atomic.h -- atomic variable wrapper
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+//
+// If c++0x std threads are used, Atomic is a wrapper for std::atomic.
+// Otherwise, it's a plain variable protected by a Mutex (which, if
+// threading is not enabled at all, does nothing).
+//
+
+
+#ifndef __ATOMIC_H__
+#define __ATOMIC_H__
+
+#include "config.h"
+
+#if USE_STD_THREAD
+#include <atomic>
+#endif
+
+#include "mutex.h"
+
+
+namespace snogray {
+
+
+#if USE_STD_THREAD
+
+// Atomic is a thin wrapper that just inherits a selected set of
+// operations from std::atomic.  The main intent of the wrapper is to
+// export only those few operations we use, so that they can also be
+// provided when std::atomic isn't available.
+//
+template<typename T>
+class Atomic : std::atomic<T>
+{
+public:
+
+  Atomic (T val = T ()) : std::atomic<T> (val) { }
+
+  using std::atomic<T>::load;
+  using std::atomic<T>::store;
+  using std::atomic<T>::exchange;
+
+  // Increment or decrement the value, and return the new value.
+  //
+  T operator++ () { return std::atomic<T>::operator++ (); }
+  T operator-- () { return std::atomic<T>::operator-- (); }
+};
+
+#else // !USE_STD_THREAD
+
+// An Atomic implementation for when std::atomic isn't available,
+// which simply protects every operation with a mutex.
+//
+template<typename T>
+class Atomic
+{
+public:
+
+  Atomic (T _val = T ()) : val (_val) { }
+
+  T load () const { LockGuard guard (mutex); return val; }
+  void store (T new_val) { LockGuard guard (mutex); val = new_val; }
+
+  T exchange (T new_val)
+  {
+    LockGuard guard (mutex);
+    T old_val = val;
+    val = new_val;
+    return old_val;
+  }
+
+  // Increment or decrement the value, and return the new value.
+  //
+  T operator++ () { LockGuard guard (mutex); return ++val; }
+  T operator-- () { LockGuard guard (mutex); return --val; }
+
+private:
+
+  T val;
+
+  mutable Mutex mutex;
+};
+
+#endif // !USE_STD_THREAD
+
+
+}
+
+
+#endif // __ATOMIC_H__
@@ -0,0 +1,826 @@
+// bdpt-integ.cc -- Bidirectional path-tracing surface integrator
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include "bsdf.h"
+#include "scene.h"
+#include "light.h"
+#include "material.h"
+#include "mis-sample-weight.h"
+
+#include "bdpt-integ.h"
+
+
+using namespace snogray;
+
+
+
+// Constructors etc
+
+BdptInteg::GlobalState::GlobalState (const GlobalRenderState &rstate,
+				     const ValTable &params)
+  : SurfaceInteg::GlobalState (rstate),
+    min_path_len (params.get_uint ("min-len", 3)),
+    max_path_len (params.get_uint ("max-len", 100)),
+    max_light_path_len (params.get_uint ("light-len", 8)),
+    russian_roulette (params, min_path_len)
+{
+}
+
+// Integrator state for rendering a group of related samples.
+//
+BdptInteg::BdptInteg (RenderContext &context, GlobalState &global_state)
+  : SurfaceInteg (context),
+    global (global_state),
+    light_path_select_channel (context.samples.add_channel<float> ()),
+    light_path_pos_channel (context.samples.add_channel<UV> ()),
+    light_path_dir_channel (context.samples.add_channel<UV> ()),
+    light_path_media (context.default_medium),
+    eye_base (0), light_base (0)
+{
+  light_select_channels.reserve (global.min_path_len);
+  light_sample_channels.reserve (global.min_path_len);
+  bsdf_sample_channels.reserve (global.min_path_len);
+
+  for (unsigned i = 0; i < global.min_path_len; i++)
+    {
+      light_select_channels.push_back (context.samples.add_channel<float> ());
+      light_sample_channels.push_back (context.samples.add_channel<UV> ());
+      bsdf_sample_channels.push_back (context.samples.add_channel<UV> ());
+    }
+}
+
+// Return a new integrator, allocated in context.
+//
+SurfaceInteg *
+BdptInteg::GlobalState::make_integrator (RenderContext &context)
+{
+  return new BdptInteg (context, *this);
+}
+
+BdptInteg::Vertex::Vertex (const Intersect &_isec,
+			   const Color &_transmittance, float _pdf_fwd)
+  : isec (0),
+    pos (_isec.normal_frame.origin), normal (_isec.normal_frame.z),
+    transmittance (_transmittance),
+    pdf_fwd (_pdf_fwd), pdf_rev (0),
+    specular (! (_isec.bsdf->supports () & (Bsdf::GLOSSY | Bsdf::DIFFUSE)))
+{
+}
+
+
+// Pdf helper functions
+
+// Return the pdf PDF, which is per unit solid angle at the position
+// FROM, converted to a pdf per unit area at the position TO, where the
+// surface normal is TO_NORMAL.
+//
+static float
+area_pdf (float pdf, const Pos &from, const Pos &to, const Vec &to_normal)
+{
+  Vec vec = from - to;
+  dist_t dist_sq = vec.length_squared ();
+  if (dist_sq == 0)
+    return 0;
+  return pdf * abs (dot (to_normal, vec)) / (dist_sq * sqrt (dist_sq));
+}
+
+// Return the pdf with which the BSDF at ISEC would sample the direction
+// ISEC.v, if the viewing direction were VIEW instead (both in ISEC's
+// normal frame).  This is used to find the pdf of generating a path
+// vertex from the opposite direction as the path was actually
+// traced.
+//
+static float
+reverse_pdf (const Intersect &isec, const Vec &view)
+{
+  // Make a copy of ISEC with a different viewing direction.  Like
+  // Intersect::normal_frame, the copy's normal frame is flipped if
+  // necessary to keep the viewing direction on the same side as the
+  // normal.
+  //
+  Intersect *rev = new (isec) Intersect (isec);
+
+  Vec dir = isec.v;
+  rev->v = view;
+
+  if (view.z < 0)
+    {
+      rev->v.z = -rev->v.z;
+      rev->normal_frame.z = -rev->normal_frame.z;
+      rev->back = !rev->back;
+      dir.z = -dir.z;
+    }
+
+  rev->bsdf = rev->material.get_bsdf (*rev);
+  if (! rev->bsdf)
+    return 0;
+
+  return rev->bsdf->eval (dir).pdf;
+}
+
+// Return PDF, or 1 if it is zero.  Zero pdfs are used for specular
+// samples, and for values that aren't known; replacing them by 1 in
+// ratios of pdfs effectively cancels them out.
+//
+static inline double
+remap_zero (float pdf)
+{
+  return (pdf == 0) ? 1 : pdf;
+}
+
+
+// BdptInteg::mis_weight
+
+// Set MIS_VERTICES to hold the current eye path and the first
+// NUM_LIGHT_VERTICES vertices of the current light path.
+//
+void
+BdptInteg::set_mis_vertices (unsigned num_light_vertices)
+{
+  mis_vertices.clear ();
+
+  for (std::vector<Vertex>::const_iterator v = eye_vertices.begin () + eye_base;
+       v != eye_vertices.end (); ++v)
+    mis_vertices.push_back (MisVertex (v->pdf_fwd, v->pdf_rev, v->specular));
+
+  // Light-path pdfs are the other way round, as the light path was
+  // traced in the opposite direction.
+  //
+  for (unsigned i = num_light_vertices; i > 0; i--)
+    {
+      const Vertex &v = light_vertices[light_base + i - 1];
+      mis_vertices.push_back (MisVertex (v.pdf_rev, v.pdf_fwd, v.specular));
+    }
+}
+
+// Return the MIS weight for a complete path using the power
+// heuristic, where the surface vertices of the path are in
+// MIS_VERTICES (starting from the eye), its end on a light is
+// described by END, and the path was generated by a strategy which
+// took NUM_LIGHT_VERTICES vertices from the light side (zero means the
+// eye path hit the light, and one means the light was sampled from
+// the eye path).
+//
+// Only the ratios of the pdfs of the various strategies matter, so
+// rather than calculating each pdf, we calculate the pdf of each
+// strategy relative to that of sampling the light from the eye path;
+// each further vertex taken from the light side changes that ratio by
+// the ratio of the light-side and eye-side pdfs of the vertex.
+// Strategies which can't generate the path (because they would
+// have to connect a specular vertex, or need a path longer than we
+// ever trace) are omitted.
+//
+float
+BdptInteg::mis_weight (const LightEnd &end, unsigned num_light_vertices) const
+{
+  unsigned num_verts = mis_vertices.size ();
+  const MisVertex &last = mis_vertices[num_verts - 1];
+  unsigned max_eye_verts = global.max_path_len + 1;
+  bool point_light = end.light->is_point_light ();
+  double light_pdf = remap_zero (end.light_pdf);
+
+  // The sum of the squared relative pdfs of all usable strategies, and
+  // the relative pdf of the strategy being weighted.
+  //
+  double sum = 0, rel_pdf = 0;
+
+  // The eye path hitting the light.
+  //
+  if (!point_light && num_verts <= max_eye_verts)
+    {
+      double q = remap_zero (end.bsdf_pdf) / light_pdf;
+      sum += q * q;
+      if (num_light_vertices == 0)
+	rel_pdf = q;
+    }
+
+  // Sampling the light from the eye path.
+  //
+  if (!last.specular && num_verts <= max_eye_verts)
+    sum += 1;
+  if (num_light_vertices == 1)
+    rel_pdf = 1;
+
+  // Connecting the eye path to the light path.  Q starts out as the
+  // relative pdf of connecting to the first light-path vertex, which
+  // uses free-sampling of the light instead of Light::sample.
+  //
+  double q = end.free_pdf * end.cos / (light_pdf * remap_zero (last.eye_pdf));
+  if (point_light && end.dist != 0)
+    q /= end.dist * end.dist;
+
+  for (unsigned s = 2; s <= num_verts; s++)
+    {
+      const MisVertex &light_end = mis_vertices[num_verts + 1 - s];
+      const MisVertex &eye_end = mis_vertices[num_verts - s];
+
+      if (s > 2)
+	q *= remap_zero (light_end.light_pdf) / remap_zero (light_end.eye_pdf);
+
+      if (!light_end.specular && !eye_end.specular
+	  && s - 1 <= global.max_light_path_len
+	  && num_verts + 1 - s <= max_eye_verts)
+	sum += q * q;
+
+      if (s == num_light_vertices)
+	rel_pdf = q;
+    }
+
+  return mis_sample_weight (rel_pdf, sum);
+}
+
+
+// BdptInteg::trace_light_path
+
+// Trace a light path using the sampling parameters in SAMPLE, adding
+// its vertices to LIGHT_VERTICES, and recording information about its
+// light in LIGHT_PATH_END.
+//
+void
+BdptInteg::trace_light_path (const SampleSet::Sample &sample)
+{
+  const Scene &scene = context.scene;
+  dist_t min_dist = context.params.min_trace;
+  unsigned num_lights = scene.num_lights ();
+
+  light_path_end = LightEnd ();
+
+  if (num_lights == 0 || global.max_light_path_len == 0)
+    return;
+
+  // Choose a light, and a free sample from it, as PhotonShooter does.
+  //
+  unsigned light_num
+    = min (unsigned (sample.get (light_path_select_channel) * num_lights),
+	   num_lights - 1);
+  const Light *light = scene.lights[light_num];
+
+  Light::FreeSample samp = light->sample (sample.get (light_path_pos_channel),
+					  sample.get (light_path_dir_channel));
+  if (samp.val == 0 || samp.pdf == 0)
+    return;
+
+  light_path_end.light = light;
+
+  // The eye-ray spread in CONTEXT is meant for the first intersection
+  // of the eye-ray, so keep it from being used by the light path.
+  //
+  float eye_ray_spread = context.eye_ray_spread;
+  context.eye_ray_spread = 0;
+
+  const Media *innermost_media = &light_path_media;
+
+  Color path_transmittance = samp.val * float (num_lights) / samp.pdf;
+  float initial_intens = path_transmittance.max_component ();
+
+  Ray ray (samp.pos, samp.dir, min_dist, scene.horizon);
+
+  // The pdf, per unit solid angle, of the BSDF sample used to reach the
+  // current vertex (zero if it was specular).
+  //
+  float prev_pdf = 0;
+
+  for (unsigned path_len = 0; ; path_len++)
+    {
+      const Surface::IsecInfo *isec_info = scene.intersect (ray, context);
+      if (! isec_info)
+	break;
+
+      const Media &media = *innermost_media;
+
+      path_transmittance
+	*= context.volume_integ->transmittance (ray, media.medium);
+
+      // Light-path vertices are used after we're done tracing them, so
+      // they must be allocated in CONTEXT.  Copying an Intersect
+      // doesn't copy its BSDF, which refers to the original, so we
+      // need to get a new one.
+      //
+      Intersect *isec
+	= new (context) Intersect (isec_info->make_intersect (media, context));
+      if (isec->bsdf)
+	isec->bsdf = isec->material.get_bsdf (*isec);
+      if (! isec->bsdf)
+	break;
+
+      Pos pos = isec->normal_frame.origin;
+
+      float pdf_fwd
+	= (path_len == 0) ? 0 : area_pdf (prev_pdf, ray.origin, pos,
+					  isec->normal_frame.z);
+
+      light_vertices.push_back (Vertex (*isec, path_transmittance, pdf_fwd));
+      light_vertices.back ().isec = isec;
+
+      // Remember how the first vertex could have been reached from the
+      // light using other strategies.
+      //
+      if (path_len == 0)
+	{
+	  if (light->is_point_light ())
+	    light_path_end.light_pdf = 1 / float (num_lights);
+	  else
+	    light_path_end.light_pdf
+	      = light->eval (*isec, isec->v).pdf / float (num_lights);
+
+	  light_path_end.free_pdf
+	    = light->free_sample_pdf (pos, -ray.dir) / float (num_lights);
+	  light_path_end.cos = abs (isec->cos_n (isec->v));
+	  light_path_end.dist = light->is_environ_light () ? 0 : ray.t1;
+	}
+
+      if (path_len + 1 == global.max_light_path_len)
+	break;
+
+      Bsdf::Sample bsdf_samp
+	= isec->bsdf->sample (UV (context.random (), context.random ()));
+
+      if (bsdf_samp.val == 0 || bsdf_samp.pdf == 0)
+	break;
+
+      bool specular_samp = (bsdf_samp.flags & Bsdf::SPECULAR);
+
+      // Now that we know where the path goes next, we can calculate the
+      // pdf of the eye side sampling the previous vertex from here.
+      //
+      float rev_pdf = specular_samp ? 0 : reverse_pdf (*isec, bsdf_samp.dir);
+      if (path_len == 0)
+	light_path_end.bsdf_pdf = rev_pdf;
+      else
+	{
+	  Vertex &prev = light_vertices.end ()[-2];
+	  prev.pdf_rev = area_pdf (rev_pdf, pos, prev.pos, prev.normal);
+	}
+
+      path_transmittance
+	*= bsdf_samp.val * abs (isec->cos_n (bsdf_samp.dir)) / bsdf_samp.pdf;
+
+      // Use russian roulette to terminate long paths, relative to the
+      // path's initial intensity.
+      //
+      if (global.russian_roulette.applies (path_len)
+	  && global.russian_roulette.terminate (context.random (),
+						path_transmittance,
+						initial_intens))
+	break;
+
+      prev_pdf = specular_samp ? 0 : bsdf_samp.pdf;
+
+      ray = Ray (pos, isec->normal_frame.from (bsdf_samp.dir),
+		 min_dist, scene.horizon);
+
+      if (bsdf_samp.flags & Bsdf::TRANSMISSIVE)
+	Media::update_stack_for_transmission (innermost_media, *isec);
+    }
+
+  context.eye_ray_spread = eye_ray_spread;
+}
+
+
+// BdptInteg::sample_light
+
+// Return the light from a randomly chosen light arriving at the
+// eye-path vertex ISEC (the last entry in EYE_VERTICES), using
+// the sampling parameters LIGHT_SELECT_PARAM and LIGHT_PARAM, and
+// weighted for multiple importance sampling.
+//
+Color
+BdptInteg::sample_light (const Intersect &isec, float light_select_param,
+			 const UV &light_param)
+{
+  const Scene &scene = context.scene;
+  dist_t min_dist = context.params.min_trace;
+  unsigned num_lights = scene.num_lights ();
+
+  if (num_lights == 0)
+    return 0;
+
+  unsigned light_num
+    = min (unsigned (light_select_param * num_lights), num_lights - 1);
+  const Light *light = scene.lights[light_num];
+
+  Light::Sample lsamp = light->sample (isec, light_param);
+  if (lsamp.pdf == 0 || lsamp.val == 0)
+    return 0;
+
+  Bsdf::Value bsdf_val = isec.bsdf->eval (lsamp.dir);
+  if (bsdf_val.val == 0)
+    return 0;
+
+  const Vertex &vertex = eye_vertices.back ();
+
+  Color radiance
+    = (vertex.transmittance * bsdf_val.val * lsamp.val
+       * abs (isec.cos_n (lsamp.dir)) * float (num_lights) / lsamp.pdf);
+
+  dist_t max_dist = lsamp.dist ? lsamp.dist - min_dist : scene.horizon;
+  Ray ray (vertex.pos, isec.normal_frame.from (lsamp.dir), min_dist, max_dist);
+
+  Color transmittance = 1;
+  if (scene.occludes (ray, isec.media.medium, transmittance,
+		      context.shadow_occluders[light->num], context))
+    return 0;
+
+  radiance *= transmittance;
+  radiance *= context.volume_integ->transmittance (ray, isec.media.medium);
+
+  // Calculate the MIS weight.
+  //
+  set_mis_vertices (0);
+
+  unsigned num_eye_verts = eye_vertices.size () - eye_base;
+  if (num_eye_verts >= 2)
+    {
+      const Vertex &prev = eye_vertices.end ()[-2];
+      mis_vertices[num_eye_verts - 2].light_pdf
+	= area_pdf (reverse_pdf (isec, lsamp.dir), vertex.pos,
+		    prev.pos, prev.normal);
+    }
+
+  LightEnd end;
+  end.light = light;
+  end.light_pdf = ((light->is_point_light () ? 1 : lsamp.pdf)
+		   / float (num_lights));
+  end.bsdf_pdf = bsdf_val.pdf;
+  end.free_pdf
+    = light->free_sample_pdf (vertex.pos, ray.dir) / float (num_lights);
+  end.cos = abs (isec.cos_n (lsamp.dir));
+  end.dist = lsamp.dist;
+
+  return radiance * mis_weight (end, 1);
+}
+
+
+// BdptInteg::connect
+
+// Return the light arriving at the eye-path vertex ISEC (the last
+// entry in EYE_VERTICES) from the light-path vertex LIGHT_VERTICES[INDEX],
+// weighted for multiple importance sampling.
+//
+Color
+BdptInteg::connect (const Intersect &isec, unsigned index)
+{
+  dist_t min_dist = context.params.min_trace;
+
+  const Vertex &eye_vertex = eye_vertices.back ();
+  const Vertex &light_vertex = light_vertices[index];
+  const Intersect &light_isec = *light_vertex.isec;
+
+  Vec vec = light_vertex.pos - eye_vertex.pos;
+  dist_t dist_sq = vec.length_squared ();
+  if (dist_sq == 0)
+    return 0;
+  dist_t dist = sqrt (dist_sq);
+  Vec dir = vec / dist;
+
+  // DIR in the normal frames of the two vertices.
+  //
+  Vec eye_dir = isec.normal_frame.to (dir);
+  Vec light_dir = light_isec.normal_frame.to (-dir);
+
+  Bsdf::Value eye_bsdf_val = isec.bsdf->eval (eye_dir);
+  if (eye_bsdf_val.val == 0)
+    return 0;
+
+  Bsdf::Value light_bsdf_val = light_isec.bsdf->eval (light_dir);
+  if (light_bsdf_val.val == 0)
+    return 0;
+
+  // The geometry term of the connecting segment.
+  //
+  float geom
+    = abs (isec.cos_n (eye_dir)) * abs (light_isec.cos_n (light_dir)) / dist_sq;
+
+  Color radiance
+    = (eye_vertex.transmittance * eye_bsdf_val.val * geom
+       * light_bsdf_val.val * light_vertex.transmittance);
+
+  if (radiance == 0)
+    return 0;
+
+  Ray ray (eye_vertex.pos, dir, min_dist, dist - min_dist);
+
+  Color transmittance = 1;
+  if (context.scene.occludes (ray, isec.media.medium, transmittance, context))
+    return 0;
+
+  radiance *= transmittance;
+  radiance *= context.volume_integ->transmittance (ray, isec.media.medium);
+
+  // Calculate the MIS weight.  Besides the pdfs of the connected
+  // vertices themselves, the pdfs of each of the vertices before
+  // them depend on the connection.
+  //
+  unsigned num_light_verts = index - light_base + 1;
+  set_mis_vertices (num_light_verts);
+
+  unsigned num_eye_verts = eye_vertices.size () - eye_base;
+
+  mis_vertices[num_eye_verts - 1].light_pdf
+    = area_pdf (light_bsdf_val.pdf, light_vertex.pos,
+		eye_vertex.pos, eye_vertex.normal);
+  mis_vertices[num_eye_verts].eye_pdf
+    = area_pdf (eye_bsdf_val.pdf, eye_vertex.pos,
+		light_vertex.pos, light_vertex.normal);
+
+  if (num_eye_verts >= 2)
+    {
+      const Vertex &prev = eye_vertices.end ()[-2];
+      mis_vertices[num_eye_verts - 2].light_pdf
+	= area_pdf (reverse_pdf (isec, eye_dir), eye_vertex.pos,
+		    prev.pos, prev.normal);
+    }
+
+  LightEnd end = light_path_end;
+
+  float light_rev_pdf = reverse_pdf (light_isec, light_dir);
+  if (num_light_verts >= 2)
+    {
+      const Vertex &prev = light_vertices[index - 1];
+      mis_vertices[num_eye_verts + 1].eye_pdf
+	= area_pdf (light_rev_pdf, light_vertex.pos, prev.pos, prev.normal);
+    }
+  else
+    end.bsdf_pdf = light_rev_pdf;
+
+  return radiance * mis_weight (end, num_light_verts + 1);
+}
+
+
+// BdptInteg::hit_lights
+
+// Return the light emitted by lights towards the eye-path vertex ISEC
+// (the last entry in EYE_VERTICES) along the BSDF sample BSDF_SAMP,
+// weighted for multiple importance sampling.  RAY is the ray for
+// BSDF_SAMP, and ISEC_INFO the result of intersecting it with the
+// scene (zero if it hit nothing).
+//
+Color
+BdptInteg::hit_lights (const Intersect &isec, const Bsdf::Sample &bsdf_samp,
+		       const Ray &ray, const Surface::IsecInfo *isec_info)
+{
+  const Scene &scene = context.scene;
+  dist_t min_dist = context.params.min_trace;
+  unsigned num_lights = scene.num_lights ();
+
+  const Vertex &vertex = eye_vertices.back ();
+
+  Color transmittance
+    = (vertex.transmittance * bsdf_samp.val
+       * abs (isec.cos_n (bsdf_samp.dir)) / bsdf_samp.pdf);
+
+  Color radiance = 0;
+  bool mis_vertices_set = false;
+
+  for (unsigned i = 0; i < num_lights; i++)
+    {
+      const Light *light = scene.lights[i];
+
+      if (light->is_point_light ())
+	continue;
+
+      Light::Value lval = light->eval (isec, bsdf_samp.dir);
+      if (lval.val == 0)
+	continue;
+
+      // RAY must reach the light without hitting anything else.
+      // Environmental lights (with zero distance) are only visible if
+      // RAY hits nothing at all.
+      //
+      if (isec_info && (lval.dist == 0 || ray.t1 < lval.dist - min_dist))
+	continue;
+
+      Ray light_ray (ray, lval.dist ? lval.dist : scene.horizon);
+      Color light_radiance
+	= (lval.val * transmittance
+	   * context.volume_integ->transmittance (light_ray,
+						  isec.media.medium));
+
+      if (! mis_vertices_set)
+	{
+	  set_mis_vertices (0);
+	  mis_vertices_set = true;
+	}
+
+      LightEnd end;
+      end.light = light;
+      end.light_pdf = lval.pdf / float (num_lights);
+      end.bsdf_pdf = (bsdf_samp.flags & Bsdf::SPECULAR) ? 0 : bsdf_samp.pdf;
+      end.free_pdf
+	= light->free_sample_pdf (vertex.pos, ray.dir) / float (num_lights);
+      end.cos = abs (isec.cos_n (bsdf_samp.dir));
+      end.dist = lval.dist;
+
+      radiance += light_radiance * mis_weight (end, 0);
+    }
+
+  return radiance;
+}
+
+
+// BdptInteg::Li
+
+// Return the light arriving at RAY's origin from the direction it
+// points in (the length of RAY is ignored).  MEDIA is the media
+// environment through which the ray travels.
+//
+// This method also calls the volume-integrator's Li method, and
+// includes any light it returns for RAY as well.
+//
+// "Li" means "Light incoming".
+//
+Tint
+BdptInteg::Li (const Ray &ray, const Media &orig_media,
+	       const SampleSet::Sample &sample)
+{
+  const Scene &scene = context.scene;
+  dist_t min_dist = context.params.min_trace;
+
+  // Save the state of any outer call, and start new paths after any
+  // vertices it's using.
+  //
+  unsigned outer_eye_base = eye_base, outer_light_base = light_base;
+  LightEnd outer_light_path_end = light_path_end;
+
+  eye_base = eye_vertices.size ();
+  light_base = light_vertices.size ();
+
+  // Trace the light path first, so that we can connect each eye-path
+  // vertex to it as soon as we find it.
+  //
+  trace_light_path (sample);
+
+  const Media *innermost_media = &orig_media;
+
+  Ray isec_ray (ray, scene.horizon);
+  const Surface::IsecInfo *isec_info = scene.intersect (isec_ray, context);
+
+  // Length of the current eye path.
+  //
+  unsigned path_len = 0;
+
+  // The transmittance of the eye path from the beginning to the
+  // current vertex.
+  //
+  Color path_transmittance = 1;
+
+  // The pdf, per unit solid angle, of the BSDF sample used to reach the
+  // current vertex (zero if it was specular).
+  //
+  float prev_pdf = 0;
+
+  Color radiance = 0;
+
+  // The alpha value; this is always 1 except in the case where a camera
+  // ray directly hits the scene background.
+  //
+  float alpha = 1;
+
+  for (;;)
+    {
+      const Media &media = *innermost_media;
+
+      radiance
+	+= (context.volume_integ->Li (isec_ray, media.medium, sample)
+	    * path_transmittance);
+
+      path_transmittance
+	*= context.volume_integ->transmittance (isec_ray, media.medium);
+
+      // Emitters are only directly included at the first vertex; after
+      // that, they're found by BdptInteg::hit_lights.
+      //
+      if (! isec_info)
+	{
+	  if (path_len == 0)
+	    {
+	      radiance += scene.background (isec_ray) * path_transmittance;
+
+	      if (radiance == 0)
+		alpha = context.global_state.bg_alpha;
+	    }
+
+	  break;
+	}
+
+      Intersect isec = isec_info->make_intersect (media, context);
+
+      if (path_len == 0)
+	radiance += isec.material.Le (isec) * path_transmittance;
+
+      if (! isec.bsdf)
+	break;
+
+      float pdf_fwd
+	= ((path_len == 0)
+	   ? 0
+	   : area_pdf (prev_pdf, isec_ray.origin, isec.normal_frame.origin,
+		       isec.normal_frame.z));
+
+      eye_vertices.push_back (Vertex (isec, path_transmittance, pdf_fwd));
+
+      // Add light sampled from this vertex, and from connections to
+      // each light-path vertex.
+      //
+      if (! eye_vertices.back ().specular)
+	{
+	  if (path_len < global.min_path_len)
+	    radiance
+	      += sample_light (isec,
+			       sample.get (light_select_channels[path_len]),
+			       sample.get (light_sample_channels[path_len]));
+	  else
+	    radiance
+	      += sample_light (isec, context.random (),
+			       UV (context.random (), context.random ()));
+
+	  for (unsigned i = light_base; i < light_vertices.size (); i++)
+	    radiance += connect (isec, i);
+	}
+
+      UV bsdf_samp_param =
+	((path_len < global.min_path_len)
+	 ? sample.get (bsdf_sample_channels[path_len])
+	 : UV (context.random (), context.random ()));
+
+      Bsdf::Sample bsdf_samp = isec.bsdf->sample (bsdf_samp_param);
+
+      if (bsdf_samp.pdf == 0 || bsdf_samp.val == 0)
+	break;
+
+      bool specular_samp = (bsdf_samp.flags & Bsdf::SPECULAR);
+
+      // Now that we know where the path goes next, we can calculate the
+      // pdf of the light side sampling the previous vertex from here.
+      //
+      if (path_len > 0)
+	{
+	  Vertex &prev = eye_vertices.end ()[-2];
+	  prev.pdf_rev
+	    = (specular_samp
+	       ? 0
+	       : area_pdf (reverse_pdf (isec, bsdf_samp.dir),
+			   isec.normal_frame.origin, prev.pos, prev.normal));
+	}
+
+      // Trace the next ray now, so that we can tell whether it hits a
+      // light.
+      //
+      Ray next_ray (isec.normal_frame.origin,
+		    isec.normal_frame.from (bsdf_samp.dir),
+		    min_dist, scene.horizon);
+      const Surface::IsecInfo *next_isec_info
+	= scene.intersect (next_ray, context);
+
+      radiance += hit_lights (isec, bsdf_samp, next_ray, next_isec_info);
+
+      path_transmittance
+	*= bsdf_samp.val * abs (isec.cos_n (bsdf_samp.dir)) / bsdf_samp.pdf;
+
+      // Use russian roulette to terminate long paths, as in PathInteg.
+      //
+      if (global.russian_roulette.applies (path_len)
+	  && global.russian_roulette.terminate (context.random (),
+						path_transmittance))
+	{
+	  context.stats.path.rr_terminations++;
+	  break;
+	}
+      if (path_len == global.max_path_len)
+	{
+	  context.stats.path.max_len_terminations++;
+	  break;
+	}
+
+      prev_pdf = specular_samp ? 0 : bsdf_samp.pdf;
+
+      if (bsdf_samp.flags & Bsdf::TRANSMISSIVE)
+	Media::update_stack_for_transmission (innermost_media, isec);
+
+      isec_ray = next_ray;
+      isec_info = next_isec_info;
+
+      path_len++;
+    }
+
+  context.stats.path.add_path (path_len);
+
+  eye_vertices.erase (eye_vertices.begin () + eye_base, eye_vertices.end ());
+  light_vertices.erase (light_vertices.begin () + light_base,
+			light_vertices.end ());
+
+  eye_base = outer_eye_base;
+  light_base = outer_light_base;
+  light_path_end = outer_light_path_end;
+
+  return Tint (radiance, alpha);
+}
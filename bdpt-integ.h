@@ -0,0 +1,285 @@
+// bdpt-integ.h -- Bidirectional path-tracing surface integrator
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef __BDPT_INTEG_H__
+#define __BDPT_INTEG_H__
+
+#include <vector>
+
+#include "surface-integ.h"
+#include "media.h"
+#include "russian-roulette.h"
+
+
+namespace snogray {
+
+
+class Light;
+
+
+// A bidirectional path tracer.
+//
+// For each eye-ray, a "light path" is traced starting from a randomly
+// chosen light, and an "eye path" is traced starting from the eye-ray.
+// Complete paths from the light to the eye are then formed in several
+// ways:  by eye-path vertices hitting a light, by sampling a light
+// from an eye-path vertex (as in PathInteg), and by connecting every
+// eye-path vertex to every light-path vertex with a shadow ray.  The
+// contributions of all these strategies are combined using multiple
+// importance sampling, so each is used where it works best.
+//
+// Strategies which connect the light path directly to the camera are
+// not used, because a SurfaceInteg can only return light for the
+// sample it's called with.
+//
+class BdptInteg : public SurfaceInteg
+{
+public:
+
+  // Global state for this integrator, for rendering an entire scene.
+  //
+  class GlobalState : public SurfaceInteg::GlobalState
+  {
+  public:
+
+    GlobalState (const GlobalRenderState &rstate, const ValTable &params);
+
+    // Return a new integrator, allocated in context.
+    //
+    virtual SurfaceInteg *make_integrator (RenderContext &context);
+
+  private:
+
+    friend class BdptInteg;
+
+    // We will try to extend eye paths to at least this many vertices
+    // before using russian roulette to terminate them.  This parameter
+    // also controls the number of eye-path vertices for which we
+    // pre-calculate well-distributed sampling parameters.
+    //
+    unsigned min_path_len;
+
+    // Eye-path length at which we just give up.
+    //
+    unsigned max_path_len;
+
+    // Maximum number of surface vertices in a light path.
+    //
+    unsigned max_light_path_len;
+
+    // Russian-roulette termination of eye and light paths over
+    // MIN_PATH_LEN, as for PathInteg.
+    //
+    RussianRoulette russian_roulette;
+  };
+
+  // Return the light arriving at RAY's origin from the direction it
+  // points in (the length of RAY is ignored).  MEDIA is the media
+  // environment through which the ray travels.
+  //
+  // This method also calls the volume-integrator's Li method, and
+  // includes any light it returns for RAY as well.
+  //
+  // "Li" means "Light incoming".
+  //
+  virtual Tint Li (const Ray &ray, const Media &media,
+		   const SampleSet::Sample &sample);
+
+private:
+
+  // A vertex in an eye path or light path.
+  //
+  struct Vertex
+  {
+    Vertex (const Intersect &isec, const Color &_transmittance,
+	    float _pdf_fwd);
+
+    // The intersection at this vertex.  This is only kept for light
+    // paths; for eye paths, it is zero.
+    //
+    const Intersect *isec;
+
+    // Position and (shading) normal of the vertex, in world coordinates.
+    //
+    Pos pos;
+    Vec normal;
+
+    // The transmittance of the path from its start up to (but not
+    // including the BSDF at) this vertex.
+    //
+    Color transmittance;
+
+    // The pdf, per unit area at this vertex, of generating it by
+    // sampling from the previous vertex in the same path (PDF_FWD), or
+    // from the next vertex, as the other kind of path would (PDF_REV).
+    // Zero means unknown or specular.
+    //
+    float pdf_fwd, pdf_rev;
+
+    // True if the BSDF at this vertex is purely specular, so it can't
+    // be connected to anything.
+    //
+    bool specular;
+  };
+
+  // Information about the light which started the current light path,
+  // and the end of a complete path which is on a light, used to
+  // calculate MIS weights (see BdptInteg::mis_weight).  All pdfs are per
+  // unit solid angle at the last surface vertex of the path.
+  //
+  struct LightEnd
+  {
+    LightEnd ()
+      : light (0), light_pdf (0), bsdf_pdf (0), free_pdf (0), cos (0),
+	dist (0)
+    { }
+
+    // The light.
+    //
+    const Light *light;
+
+    // The pdf of choosing the light and sampling the path's last
+    // segment using Light::sample (for non-point lights).
+    //
+    float light_pdf;
+
+    // The pdf of sampling the path's last segment using the BSDF at
+    // the last surface vertex.
+    //
+    float bsdf_pdf;
+
+    // The pdf of choosing the light and generating the path's last
+    // segment using free-sampling, as Light::free_sample_pdf.
+    //
+    float free_pdf;
+
+    // The absolute cosine between the last segment and the normal at
+    // the last surface vertex.
+    //
+    float cos;
+
+    // Length of the path's last segment, or zero for environmental
+    // lights.
+    //
+    dist_t dist;
+  };
+
+  // The information about each surface vertex of a complete path
+  // needed by BdptInteg::mis_weight:  the pdfs, per unit area, of
+  // generating it from the eye side (EYE_PDF) and from the light side
+  // (LIGHT_PDF), and whether it is specular.
+  //
+  struct MisVertex
+  {
+    MisVertex (float _eye_pdf, float _light_pdf, bool _specular)
+      : eye_pdf (_eye_pdf), light_pdf (_light_pdf), specular (_specular)
+    { }
+
+    float eye_pdf, light_pdf;
+    bool specular;
+  };
+
+  // Integrator state for rendering a group of related samples.
+  //
+  BdptInteg (RenderContext &context, GlobalState &global_state);
+
+  // Trace a light path using the sampling parameters in SAMPLE, adding
+  // its vertices to LIGHT_VERTICES, and recording information about its
+  // light in LIGHT_PATH_END.
+  //
+  void trace_light_path (const SampleSet::Sample &sample);
+
+  // Return the light from a randomly chosen light arriving at the
+  // eye-path vertex ISEC (the last entry in EYE_VERTICES), using
+  // the sampling parameters LIGHT_SELECT_PARAM and LIGHT_PARAM, and
+  // weighted for multiple importance sampling.
+  //
+  Color sample_light (const Intersect &isec, float light_select_param,
+		      const UV &light_param);
+
+  // Return the light arriving at the eye-path vertex ISEC (the last
+  // entry in EYE_VERTICES) from the light-path vertex LIGHT_VERTICES[INDEX],
+  // weighted for multiple importance sampling.
+  //
+  Color connect (const Intersect &isec, unsigned index);
+
+  // Return the light emitted by lights towards the eye-path vertex ISEC
+  // (the last entry in EYE_VERTICES) along the BSDF sample BSDF_SAMP,
+  // weighted for multiple importance sampling.  RAY is the ray for
+  // BSDF_SAMP, and ISEC_INFO the result of intersecting it with the
+  // scene (zero if it hit nothing).
+  //
+  Color hit_lights (const Intersect &isec, const Bsdf::Sample &bsdf_samp,
+		    const Ray &ray, const Surface::IsecInfo *isec_info);
+
+  // Return the MIS weight for a complete path using the power
+  // heuristic, where the surface vertices of the path are in
+  // MIS_VERTICES (starting from the eye), its end on a light is
+  // described by END, and the path was generated by a strategy which
+  // took NUM_LIGHT_VERTICES vertices from the light side (zero means the
+  // eye path hit the light, and one means the light was sampled from
+  // the eye path).
+  //
+  float mis_weight (const LightEnd &end, unsigned num_light_vertices) const;
+
+  // Set MIS_VERTICES to hold the current eye path and the first
+  // NUM_LIGHT_VERTICES vertices of the current light path.
+  //
+  void set_mis_vertices (unsigned num_light_vertices);
+
+  // Pointer to our global state info.
+  //
+  const GlobalState &global;
+
+  // Sample-channels used for starting light paths.
+  //
+  SampleSet::Channel<float> light_path_select_channel;
+  SampleSet::Channel<UV> light_path_pos_channel, light_path_dir_channel;
+
+  // Sample-channels used for the first MIN_PATH_LEN eye-path vertices.
+  //
+  SampleSet::ChannelVec<float> light_select_channels;
+  SampleSet::ChannelVec<UV> light_sample_channels;
+  SampleSet::ChannelVec<UV> bsdf_sample_channels;
+
+  // The media light paths start in.
+  //
+  Media light_path_media;
+
+  //
+  // The following fields are modified by BdptInteg::Li, but are only
+  // fields to avoid allocation in BdptInteg::Li, which is called once
+  // per eye-ray.  For reentrancy (BdptInteg::Li may be called
+  // recursively by VolumeInteg::Li), BdptInteg::Li only uses vector
+  // entries after those present when it was called, and restores the
+  // other fields before returning.
+  //
+
+  // The current eye path and light path, and the index of the first
+  // entry in each belonging to the current call to BdptInteg::Li.
+  //
+  std::vector<Vertex> eye_vertices, light_vertices;
+  unsigned eye_base, light_base;
+
+  // The light which started the current light path.
+  //
+  LightEnd light_path_end;
+
+  // Scratch space used for calculating MIS weights.
+  //
+  std::vector<MisVertex> mis_vertices;
+};
+
+
+}
+
+#endif // __BDPT_INTEG_H__
@@ -317,6 +317,23 @@ public:
   //
   Ray eye_ray (const UV &film_loc, const UV &focus_param) const;
 
+  // Return the approximate angle, in radians, between eye-rays for
+  // locations on the film plane which are FILM_DELTA apart, near
+  // FILM_LOC.  If FILM_DELTA is the size of the area a single eye-ray
+  // represents, this is the eye-ray's angular "spread".
+  //
+  float eye_ray_spread (const UV &film_loc, const UV &film_delta) const
+  {
+    Vec v = eye_vec (film_loc).unit ();
+    Vec du = eye_vec (film_loc + UV (film_delta.u, 0)).unit () - v;
+    Vec dv = eye_vec (film_loc + UV (0, film_delta.v)).unit () - v;
+
+    // For small angles, the chord length is a good approximation of the
+    // angle.  Use the geometric mean of the two directions.
+    //
+    return sqrt (du.length () * dv.length ());
+  }
+
   Format format;
 
   Pos pos;
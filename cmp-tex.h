@@ -39,6 +39,10 @@ public:
   //
   virtual T eval (const TexCoords &coords) const;
 
+  // Return the result of comparing C1 and C2 using OP.
+  //
+  static bool compare (Op op, const T &c1, const T &c2);
+
   // The operation.
   //
   Op op;
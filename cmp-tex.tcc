@@ -30,24 +30,32 @@ CmpTex<T>::eval (const TexCoords &coords) const
   T c1 = cval1.eval (coords);
   T c2 = cval2.eval (coords);
 
-  bool cmp_result = false;
+  return compare (op, c1, c2) ? rval1.eval (coords) : rval2.eval (coords);
+}
+
+// Return the result of comparing C1 and C2 using OP.
+//
+template<typename T>
+bool
+CmpTex<T>::compare (Op op, const T &c1, const T &c2)
+{
   switch (op)
     {
     case EQ:
-      cmp_result = (c1 == c2); break;
+      return (c1 == c2);
     case NE:
-      cmp_result = (c1 != c2); break;
+      return (c1 != c2);
     case LT:
-      cmp_result = (c1 <  c2); break;
+      return (c1 <  c2);
     case LE:
-      cmp_result = (c1 <= c2); break;
+      return (c1 <= c2);
     case GT:
-      cmp_result = (c1 >  c2); break;
+      return (c1 >  c2);
     case GE:
-      cmp_result = (c1 >= c2); break;
+      return (c1 >= c2);
     }
 
-  return cmp_result ? rval1.eval (coords) : rval2.eval (coords);
+  return false;
 }
 
 
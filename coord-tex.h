@@ -42,6 +42,32 @@ public:
       }
   }
 
+  virtual void eval_batch (const TexCoords *coords, float *results,
+			   unsigned num)
+    const
+  {
+    switch (kind)
+      {
+      case X:
+	for (unsigned i = 0; i < num; i++) results[i] = coords[i].pos.x;
+	break;
+      case Y:
+	for (unsigned i = 0; i < num; i++) results[i] = coords[i].pos.y;
+	break;
+      case Z:
+	for (unsigned i = 0; i < num; i++) results[i] = coords[i].pos.z;
+	break;
+      case U:
+	for (unsigned i = 0; i < num; i++) results[i] = coords[i].uv.u;
+	break;
+      case V:
+	for (unsigned i = 0; i < num; i++) results[i] = coords[i].uv.v;
+	break;
+      default:
+	for (unsigned i = 0; i < num; i++) results[i] = 0;
+      }
+  }
+
 private:
 
   Kind kind;
@@ -10,11 +10,16 @@
 // Written by Miles Bader <miles@gnu.org>
 //
 
+#include <stdexcept>
+#include <algorithm>
+
 #include "scene.h"
 #include "bsdf.h"
 #include "light.h"
 #include "media.h"
 #include "mis-sample-weight.h"
+#include "radical-inverse.h"
+#include "global-render-state.h"
 
 #include "direct-illum.h"
 
@@ -30,34 +35,169 @@ DirectIllum::GlobalState::GlobalState (unsigned _num_light_samples)
 {
 }
 
+// Constructor that uses NUM_LIGHT_SAMPLES samples, and chooses how to
+// divide them among lights using the "light-select" parameter in
+// PARAMS (or, if it's not there, in RSTATE's params).
+//
+DirectIllum::GlobalState::GlobalState (const GlobalRenderState &rstate,
+				       const ValTable &params,
+				       unsigned _num_light_samples)
+  : num_light_samples (_num_light_samples)
+{
+  std::string select
+    = params.get_string ("light-select",
+			 rstate.params.get_string ("light-select", "all"));
+
+  if (select == "power")
+    calc_light_power_dist (rstate.scene);
+  else if (select != "all")
+    throw std::runtime_error ("Unknown light-select mode \"" + select + "\"");
+}
+
+
+// DirectIllum::GlobalState::calc_light_power_dist
+
+// The fraction of the light-selection probability which is divided
+// evenly among all lights, regardless of their power.  This ensures
+// that every light is sometimes sampled, even if its power estimate
+// is bad (for instance a dim light very close to a surface, or a
+// light whose power couldn't be estimated at all).
+//
+static const float UNIFORM_LIGHT_SELECT_FRACTION = 0.1f;
+
+// The number of "free samples" of each light used to estimate its power.
+//
+static const unsigned NUM_POWER_SAMPLES = 256;
+
+// Calculate the light-selection distribution for the lights in SCENE,
+// based on their power.
+//
+void
+DirectIllum::GlobalState::calc_light_power_dist (const Scene &scene)
+{
+  unsigned num_lights = scene.num_lights ();
+
+  // With fewer than two lights, there's nothing to choose.
+  //
+  if (num_lights < 2)
+    return;
+
+  // Estimate the power of each light as the average of the value /
+  // pdf of a set of "free samples" of the light (which is the same
+  // estimate the photon-shooter uses for photon power).  Samples are
+  // distributed using a Halton sequence.
+  //
+  std::vector<double> powers (num_lights);
+  double total_power = 0;
+  for (unsigned i = 0; i < num_lights; i++)
+    {
+      const Light *light = scene.lights[i];
+
+      double power = 0;
+      for (unsigned j = 0; j < NUM_POWER_SAMPLES; j++)
+	{
+	  UV param (radical_inverse (j, 2), radical_inverse (j, 3));
+	  UV dir_param (radical_inverse (j, 5), radical_inverse (j, 7));
+
+	  Light::FreeSample samp = light->sample (param, dir_param);
+	  if (samp.pdf > 0)
+	    power += samp.val.intensity () / samp.pdf;
+	}
+
+      powers[i] = power / NUM_POWER_SAMPLES;
+      total_power += powers[i];
+    }
+
+  float uniform_prob, power_scale;
+  if (total_power > 0)
+    {
+      uniform_prob = UNIFORM_LIGHT_SELECT_FRACTION / num_lights;
+      power_scale = (1 - UNIFORM_LIGHT_SELECT_FRACTION) / total_power;
+    }
+  else
+    {
+      uniform_prob = 1.f / num_lights;
+      power_scale = 0;
+    }
+
+  light_select_probs.resize (num_lights);
+  light_select_cdf.resize (num_lights);
+
+  float sum = 0;
+  for (unsigned i = 0; i < num_lights; i++)
+    {
+      light_select_probs[i] = uniform_prob + powers[i] * power_scale;
+      sum += light_select_probs[i];
+      light_select_cdf[i] = sum;
+    }
+
+  // Make sure the final entry is exactly 1, so any parameter value
+  // finds some light.
+  //
+  light_select_cdf.back () = 1;
+}
+
+
+// DirectIllum::GlobalState::select_light
+
+// Return the index of a light chosen using PARAM, and set PROB to the
+// probability of choosing it.
+//
+unsigned
+DirectIllum::GlobalState::select_light (float param, float &prob) const
+{
+  unsigned num = light_select_cdf.size ();
+  unsigned index
+    = std::upper_bound (light_select_cdf.begin (), light_select_cdf.end (),
+			param)
+      - light_select_cdf.begin ();
+  index = std::min (index, num - 1);
+
+  prob = light_select_probs[index];
+
+  return index;
+}
+
+
+
+// DirectIllum constructors
 
 DirectIllum::DirectIllum (RenderContext &context,
-			  const GlobalState &global_state)
-  : light_select_chan (context.samples.add_channel<float> ())
+			  const GlobalState &_global_state)
+  : global_state (_global_state),
+    light_select_chan (
+      context.samples.add_channel<float> (
+	_global_state.selects_lights () ? _global_state.num_light_samples : 1))
 {
-  finish_init (context.samples, context, global_state);
+  finish_init (context.samples, context);
 }
 
 // Variant constructor which allows specifying a SampleSet other than the
 // one in CONTEXT.
 //
 DirectIllum::DirectIllum (SampleSet &samples, RenderContext &context,
-			  const GlobalState &global_state)
-  : light_select_chan (samples.add_channel<float> ())
+			  const GlobalState &_global_state)
+  : global_state (_global_state),
+    light_select_chan (
+      samples.add_channel<float> (
+	_global_state.selects_lights () ? _global_state.num_light_samples : 1))
 {
-  finish_init (samples, context, global_state);
+  finish_init (samples, context);
 }
     
 // Common portion of constructors.
 //
 void
-DirectIllum::finish_init (SampleSet &samples, RenderContext &context,
-			  const GlobalState &global_state)
+DirectIllum::finish_init (SampleSet &samples, RenderContext &context)
 {
-  unsigned num_lights = context.scene.num_lights ();
+  // If lights are being selected, all samples share a single set of
+  // channels, as each sample may come from any light.
+  //
+  unsigned num_channels
+    = global_state.selects_lights () ? 1 : context.scene.num_lights ();
   unsigned num_lsamples = global_state.num_light_samples;
 
-  for (unsigned i = 0; i < num_lights; i++)
+  for (unsigned i = 0; i < num_channels; i++)
     {
       light_samp_channels.push_back (samples.add_channel<UV> (num_lsamples));
       bsdf_samp_channels.push_back (samples.add_channel<UV> (num_lsamples));
@@ -110,6 +250,105 @@ DirectIllum::sample_all_lights (const Intersect &isec,
 }
 
 
+// DirectIllum::sample_selected_lights
+
+// Given the intersection ISEC, resulting from a cast ray, take the
+// usual number of light samples, choosing a single light for each
+// sample using GlobalState::select_light, and return the (weighted)
+// sum of their contribution in that ray's direction.  FLAGS specifies
+// what part of the BSDF will be used.
+//
+Color
+DirectIllum::sample_selected_lights (const Intersect &isec,
+				     const SampleSet::Sample &sample,
+				     unsigned flags)
+  const
+{
+  RenderContext &context = isec.context;
+
+  context.stats.illum_calls++;
+
+  const SampleSet::Channel<UV> &light_chan = light_samp_channels[0];
+  const SampleSet::Channel<UV> &bsdf_chan = bsdf_samp_channels[0];
+  const SampleSet::Channel<float> &bsdf_layer_chan = bsdf_layer_channels[0];
+  unsigned num_samples = light_chan.size;
+
+  std::vector<float>::const_iterator si = sample.begin (light_select_chan);
+  std::vector<UV>::const_iterator li = sample.begin (light_chan);
+  std::vector<UV>::const_iterator bi = sample.begin (bsdf_chan);
+  std::vector<float>::const_iterator bli = sample.begin (bsdf_layer_chan);
+
+  Color radiance = 0;
+  for (unsigned j = 0; j < num_samples; j++)
+    {
+      float select_prob;
+      unsigned light_num = global_state.select_light (*si++, select_prob);
+      const Light *light = context.scene.lights[light_num];
+
+      // Dividing by SELECT_PROB accounts for the other lights which
+      // weren't chosen for this sample.
+      //
+      radiance
+	+= sample_light (isec, light, *li++, *bi++, *bli++, flags)
+	   / select_prob;
+    }
+
+  return radiance / float (num_samples);
+}
+
+
+// Shadow testing
+
+// Return true if some surface completely occludes RAY, a shadow ray
+// from ISEC towards LIGHT.  If not, then return false, and multiply
+// TRANSMITTANCE by the transmittance of any surfaces which partially
+// occlude RAY.
+//
+// The surface which last occluded a shadow ray towards LIGHT is tested
+// first (see RenderContext::shadow_occluders).  If LIGHT is an
+// environmental light, and the environment-visibility cache is
+// enabled, the cache is consulted before that, and RAY is only
+// actually traced if the cache doesn't know the result.
+//
+static bool
+shadow_occluded (const Intersect &isec, const Light *light, const Ray &ray,
+		 Color &transmittance)
+{
+  RenderContext &context = isec.context;
+  const Scene &scene = context.scene;
+  const Surface *&occluder = context.shadow_occluders[light->num];
+  EnvVisCache *cache = context.env_vis_cache.get ();
+
+  if (!cache || !light->is_environ_light ())
+    return scene.occludes (ray, isec.media.medium, transmittance, occluder,
+			   context);
+
+  context.stats.env_vis_cache_lookups++;
+
+  unsigned char &vis_bin
+    = cache->bin (isec.normal_frame.origin, isec.normal_frame.z, ray.dir);
+
+  EnvVisCache::Vis vis = cache->vis (vis_bin);
+  if (vis != EnvVisCache::UNKNOWN)
+    {
+      context.stats.env_vis_cache_hits++;
+      return vis == EnvVisCache::OCCLUDED;
+    }
+
+  Color ray_transmittance = 1;
+  bool occluded
+    = scene.occludes (ray, isec.media.medium, ray_transmittance, occluder,
+		      context);
+
+  bool partial = !occluded && ray_transmittance != 1;
+  EnvVisCache::record (vis_bin, occluded, partial);
+
+  transmittance *= ray_transmittance;
+
+  return occluded;
+}
+
+
 // DirectIllum::sample_light
 
 // Use multiple-importance-sampling to estimate the radiance of
@@ -165,7 +404,7 @@ DirectIllum::sample_light (const Intersect &isec, const Light *light,
 		   min_dist, max_dist);
 
 	  Color transmittance = 1;
-	  if (! scene.occludes (ray, isec.media.medium, transmittance, context))
+	  if (! shadow_occluded (isec, light, ray, transmittance))
 	    {
 	      // The sample is not occluded, calculate the actual radiance.
 
@@ -236,8 +475,7 @@ DirectIllum::sample_light (const Intersect &isec, const Light *light,
 		       min_dist, max_dist);
 
 	      Color transmittance = 1;
-	      if (! scene.occludes (ray, isec.media.medium, transmittance,
-				    context))
+	      if (! shadow_occluded (isec, light, ray, transmittance))
 		{
 		  // The sample is not occluded
 
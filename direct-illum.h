@@ -13,6 +13,8 @@
 #ifndef __DIRECT_ILLUM_H__
 #define __DIRECT_ILLUM_H__
 
+#include <vector>
+
 #include "color.h"
 #include "bsdf.h"
 #include "sample-set.h"
@@ -24,6 +26,8 @@ namespace snogray {
 class Intersect;
 class ValTable;
 class Light;
+class GlobalRenderState;
+class Scene;
 
 
 class DirectIllum
@@ -40,7 +44,45 @@ public:
     //
     GlobalState (unsigned num_light_samples);
 
+    // Constructor that uses NUM_LIGHT_SAMPLES samples, and chooses how
+    // to divide them among lights using the "light-select" parameter
+    // in PARAMS (or, if it's not there, in RSTATE's params):
+    //
+    //   "all"   -- (the default) every light gets NUM_LIGHT_SAMPLES
+    //              samples
+    //   "power" -- NUM_LIGHT_SAMPLES samples total, each from a
+    //              single light chosen randomly in proportion to the
+    //              light's total emitted power, so the cost doesn't
+    //              grow with the number of lights
+    //
+    GlobalState (const GlobalRenderState &rstate, const ValTable &params,
+		 unsigned num_light_samples);
+
+    // Return true if lights are chosen randomly for each sample using
+    // GlobalState::select_light, instead of sampling every light.
+    //
+    bool selects_lights () const { return !light_select_cdf.empty (); }
+
+    // Return the index of a light chosen using PARAM, and set PROB to
+    // the probability of choosing it.
+    //
+    unsigned select_light (float param, float &prob) const;
+
     unsigned num_light_samples;
+
+  private:
+
+    // Calculate the light-selection distribution for the lights in
+    // SCENE, based on their power.
+    //
+    void calc_light_power_dist (const Scene &scene);
+
+    // The probability of choosing each light, and the cumulative sum of
+    // those probabilities (which ends with 1).  Both are empty unless
+    // lights are being selected by power.
+    //
+    std::vector<float> light_select_probs;
+    std::vector<float> light_select_cdf;
   };
 
   DirectIllum (RenderContext &context, const GlobalState &global_state);
@@ -59,12 +101,10 @@ public:
 		       unsigned flags = (Bsdf::ALL & ~Bsdf::SPECULAR))
     const
   {
-    // XXX  For now, just do all lights.  In the future we should add a way
-    // to limit the number of light samples in the case where there are
-    // many lights (e.g., divide the desired number of light samples among
-    // lights in the scene).
-    //
-    return sample_all_lights (isec, sample, flags);
+    if (global_state.selects_lights ())
+      return sample_selected_lights (isec, sample, flags);
+    else
+      return sample_all_lights (isec, sample, flags);
   }
 
   // Given the intersection ISEC, resulting from a cast ray, sample
@@ -77,6 +117,17 @@ public:
 			   unsigned flags = (Bsdf::ALL & ~Bsdf::SPECULAR))
     const;
 
+  // Given the intersection ISEC, resulting from a cast ray, take the
+  // usual number of light samples, choosing a single light for each
+  // sample using GlobalState::select_light, and return the (weighted)
+  // sum of their contribution in that ray's direction.  FLAGS
+  // specifies what part of the BSDF will be used.
+  //
+  Color sample_selected_lights (const Intersect &isec,
+				const SampleSet::Sample &sample,
+				unsigned flags = (Bsdf::ALL & ~Bsdf::SPECULAR))
+    const;
+
   // Use multiple-importance-sampling to estimate the radiance of
   // LIGHT towards ISEC, using LIGHT_PARAM, BSDF_PARAM, and
   // BSDF_LAYER_PARAM to sample both the light and the BSDF.
@@ -92,10 +143,15 @@ private:
 
   // Common portion of constructors.
   //
-  void finish_init (SampleSet &samples, RenderContext &context,
-		    const GlobalState &global_state);
+  void finish_init (SampleSet &samples, RenderContext &context);
+
+  // Global state for this illuminator.
+  //
+  const GlobalState &global_state;
 
-  // Sample channels for light sampling.
+  // Sample channels for light sampling.  If lights are being
+  // selected, there's just one channel for all lights, otherwise
+  // there's one per light.
   //
   SampleSet::ChannelVec<UV> light_samp_channels;
   SampleSet::Channel<float> light_select_chan;
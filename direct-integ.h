@@ -69,7 +69,8 @@ public:
 
   GlobalState (const GlobalRenderState &rstate, const ValTable &params)
     : SurfaceInteg::GlobalState (rstate),
-      direct_illum (params.get_uint ("light-samples,samples,samps",
+      direct_illum (rstate, params,
+		    params.get_uint ("light-samples,samples,samps",
 				     rstate.params.get_uint ("light-samples",
 							     16)))
   { }
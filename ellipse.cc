@@ -26,14 +26,43 @@ using namespace snogray;
 //
 const Surface::IsecInfo *
 Ellipse::intersect (Ray &ray, RenderContext &context) const
+{
+  IsecParams isec_params;
+  if (find_intersection (ray, isec_params, context))
+    return make_isec_info (ray, isec_params, context);
+  else
+    return 0;
+}
+
+// "Two-phase" version of Surface::intersect:  If this surface
+// intersects RAY, change RAY's maximum bound (Ray::t1) to reflect the
+// point of intersection, store the intersection's parameters in
+// ISEC_PARAMS, and return true; otherwise return false.
+//
+bool
+Ellipse::find_intersection (Ray &ray, IsecParams &,
+			    RenderContext &)
+  const
 {
   dist_t t, u, v;
   if (intersects (ray, t, u, v))
     {
       ray.t1 = t;
-      return new (context) IsecInfo (ray, *this);
+      return true;
     }
-  return 0;
+  return false;
+}
+
+// Return a Surface::IsecInfo object describing the intersection of
+// this surface with RAY, found by a previous call to
+// Ellipse::find_intersection which returned ISEC_PARAMS.
+//
+const Surface::IsecInfo *
+Ellipse::make_isec_info (const Ray &ray, const IsecParams &,
+			 RenderContext &context)
+  const
+{
+  return new (context) IsecInfo (ray, *this);
 }
 
 
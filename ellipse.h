@@ -51,6 +51,18 @@ public:
   //
   virtual const IsecInfo *intersect (Ray &ray, RenderContext &context) const;
 
+  // "Two-phase" version of Surface::intersect, used when searching for
+  // the closest intersection.  See Surface::find_intersection and
+  // Surface::make_isec_info.
+  //
+  virtual bool find_intersection (Ray &ray, IsecParams &isec_params,
+				  RenderContext &context)
+    const;
+  virtual const IsecInfo *make_isec_info (const Ray &ray,
+					  const IsecParams &isec_params,
+					  RenderContext &context)
+    const;
+
   // Return true if this surface intersects RAY.
   //
   virtual bool intersects (const Ray &ray, RenderContext &context) const;
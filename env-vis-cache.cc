@@ -0,0 +1,110 @@
+// env-vis-cache.cc -- Cache of environment-light visibility
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include <cstring>
+
+#include "scene.h"
+#include "val-table.h"
+#include "snogmath.h"
+
+#include "env-vis-cache.h"
+
+
+using namespace snogray;
+
+
+// Make a cache for rendering SCENE, using parameters from PARAMS.
+//
+EnvVisCache::EnvVisCache (const Scene &scene, const ValTable &params)
+  : min_probes (clamp (params.get_uint ("env-vis-cache-probes", 8), 1u, 15u)),
+    entries (TABLE_SIZE)
+{
+  BBox bbox = scene.surfaces.bbox ();
+
+  dist_t cell_size
+    = params.get_float ("env-vis-cache-spacing", bbox.max_size () / 2000);
+
+  // Guard against empty scenes or silly parameters.
+  //
+  if (! (cell_size > 0 && cell_size < scene.horizon))
+    {
+      grid_origin = Pos (0, 0, 0);
+      cell_size = 1;
+    }
+  else
+    grid_origin = bbox.min;
+
+  inv_cell_size = 1 / cell_size;
+}
+
+
+// Return the index of the octahedral-map bin containing direction
+// DIR, in a map with RES x RES bins.
+//
+unsigned
+EnvVisCache::dir_bin (const Vec &dir, unsigned res)
+{
+  // Project DIR onto the octahedron |x| + |y| + |z| = 1, and then
+  // unfold the lower half over the corners of the upper half, giving
+  // coordinates in the square [-1, 1] x [-1, 1].
+  //
+  float inv_l1 = 1 / float (abs (dir.x) + abs (dir.y) + abs (dir.z));
+  float u = float (dir.x) * inv_l1, v = float (dir.y) * inv_l1;
+  if (dir.z < 0)
+    {
+      float fu = (1 - abs (v)) * (u < 0 ? -1 : 1);
+      float fv = (1 - abs (u)) * (v < 0 ? -1 : 1);
+      u = fu;
+      v = fv;
+    }
+
+  int col = clamp (int ((u + 1) * 0.5f * res), 0, int (res) - 1);
+  int row = clamp (int ((v + 1) * 0.5f * res), 0, int (res) - 1);
+
+  return row * res + col;
+}
+
+
+// Return a reference to the bin holding visibility information for
+// the direction DIR from the point POS, on a surface with normal
+// NORMAL (all in world coordinates).  The result may be passed to
+// EnvVisCache::vis and EnvVisCache::record.
+//
+// If the cache entry for POS and NORMAL doesn't exist, it's created,
+// replacing any other entry that hashed to the same location.
+//
+unsigned char &
+EnvVisCache::bin (const Pos &pos, const Vec &normal, const Vec &dir)
+{
+  Vec offs = (pos - grid_origin) * inv_cell_size;
+  int x = int (floor (offs.x));
+  int y = int (floor (offs.y));
+  int z = int (floor (offs.z));
+  unsigned normal_bin = dir_bin (normal, NORMAL_RES);
+
+  unsigned hash = (unsigned (x) * 73856093u) ^ (unsigned (y) * 19349663u)
+    ^ (unsigned (z) * 83492791u) ^ (normal_bin * 2654435761u);
+
+  Entry &entry = entries[hash % TABLE_SIZE];
+
+  if (entry.normal_bin != normal_bin
+      || entry.x != x || entry.y != y || entry.z != z)
+    {
+      entry.x = x;
+      entry.y = y;
+      entry.z = z;
+      entry.normal_bin = normal_bin;
+      memset (entry.dir_bins, 0, sizeof entry.dir_bins);
+    }
+
+  return entry.dir_bins[dir_bin (dir, DIR_RES)];
+}
@@ -0,0 +1,173 @@
+// env-vis-cache.h -- Cache of environment-light visibility
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef __ENV_VIS_CACHE_H__
+#define __ENV_VIS_CACHE_H__
+
+#include <vector>
+
+#include "pos.h"
+#include "vec.h"
+
+
+namespace snogray {
+
+
+class Scene;
+class ValTable;
+
+
+// A cache of the visibility of "environmental" lights (lights at
+// infinity, such as EnvmapLight and FarLight) from surface points.
+//
+// Space is divided into a grid of cubical cells, and each cell is
+// further divided by the direction of the surface normal, so that
+// opposite sides of a thin object don't share the same entry.  Each
+// entry holds a "directional bitmask" over the whole sphere of
+// directions (using an octahedral mapping, so bins are roughly equal in
+// size), where each bin records how many shadow rays in that direction
+// were found to be occluded and unoccluded.
+//
+// Once enough rays in a bin have been traced, and all of them had the
+// same result, that result is used for further rays in that bin
+// without tracing them.  Bins which have seen both results (for
+// instance, at a shadow boundary), or partial occlusion, are never
+// used, so the cache only skips "obviously" occluded or unoccluded
+// directions.  The error introduced is controlled by the cell spacing,
+// and by the number of consistent probes required before a bin is
+// used.
+//
+// The cache is filled lazily, by recording the results of shadow rays
+// that are actually traced.  It is not thread-safe, so each
+// RenderContext has its own.
+//
+// The cache is controlled by the following render parameters:
+//
+//   "env-vis-cache"		-- true to enable the cache (default false)
+//   "env-vis-cache-spacing"	-- cell spacing, in scene units (default
+//				   1/2000 of the scene size, which is too
+//				   coarse for scenes with a huge ground
+//				   object)
+//   "env-vis-cache-probes"	-- number of consistent rays required
+//				   before a bin is used (default 8, max 15)
+//
+class EnvVisCache
+{
+public:
+
+  // Visibility in some direction, as known by the cache.
+  //
+  enum Vis { UNKNOWN, VISIBLE, OCCLUDED };
+
+  // Make a cache for rendering SCENE, using parameters from PARAMS.
+  //
+  EnvVisCache (const Scene &scene, const ValTable &params);
+
+  // Return a reference to the bin holding visibility information for
+  // the direction DIR from the point POS, on a surface with normal
+  // NORMAL (all in world coordinates).  The result may be passed to
+  // EnvVisCache::vis and EnvVisCache::record.
+  //
+  // If the cache entry for POS and NORMAL doesn't exist, it's created,
+  // replacing any other entry that hashed to the same location.
+  //
+  unsigned char &bin (const Pos &pos, const Vec &normal, const Vec &dir);
+
+  // Return the visibility recorded in BIN.
+  //
+  Vis vis (unsigned char bin) const
+  {
+    unsigned num_vis = bin & 0xF, num_occ = bin >> 4;
+    if (num_occ == 0 && num_vis >= min_probes)
+      return VISIBLE;
+    else if (num_vis == 0 && num_occ >= min_probes)
+      return OCCLUDED;
+    else
+      return UNKNOWN;
+  }
+
+  // Record the result of tracing a shadow ray in BIN's direction:
+  // OCCLUDED is true if it was completely occluded, and PARTIAL is true
+  // if it wasn't, but its transmittance was less than one.
+  //
+  static void record (unsigned char &bin, bool occluded, bool partial)
+  {
+    unsigned num_vis = bin & 0xF, num_occ = bin >> 4;
+
+    if (partial)
+      {
+	// Mark BIN as permanently unusable.
+	//
+	num_vis = num_occ = 1;
+      }
+    else if (occluded)
+      num_occ = (num_occ < 15) ? num_occ + 1 : 15;
+    else
+      num_vis = (num_vis < 15) ? num_vis + 1 : 15;
+
+    bin = (num_occ << 4) | num_vis;
+  }
+
+private:
+
+  // Direction resolution.  The octahedral direction map is
+  // DIR_RES x DIR_RES bins.
+  //
+  static const unsigned DIR_RES = 16;
+  static const unsigned NUM_DIR_BINS = DIR_RES * DIR_RES;
+
+  // Surface-normal resolution used for entry keys.
+  //
+  static const unsigned NORMAL_RES = 4;
+
+  // Number of entries in the cache.
+  //
+  static const unsigned TABLE_SIZE = 16384;
+
+  // Return the index of the octahedral-map bin containing direction
+  // DIR, in a map with RES x RES bins.
+  //
+  static unsigned dir_bin (const Vec &dir, unsigned res);
+
+  struct Entry
+  {
+    Entry () : normal_bin (~0u) { }
+
+    // Key for this entry: the cell coordinates and normal bin.
+    // NORMAL_BIN is ~0 for unused entries.
+    //
+    int x, y, z;
+    unsigned normal_bin;
+
+    // Direction bins.  The low four bits of each are the number of
+    // unoccluded rays, and the high four bits the number of occluded
+    // rays.
+    //
+    unsigned char dir_bins[NUM_DIR_BINS];
+  };
+
+  // Origin and cell size of the grid.
+  //
+  Pos grid_origin;
+  dist_t inv_cell_size;
+
+  // The number of consistent rays required before a bin is used.
+  //
+  unsigned min_probes;
+
+  std::vector<Entry> entries;
+};
+
+
+}
+
+#endif // __ENV_VIS_CACHE_H__
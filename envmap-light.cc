@@ -10,6 +10,8 @@
 // Written by Miles Bader <miles@gnu.org>
 //
 
+#include "snogmath.h"
+#include "intersect.h"
 #include "scene.h"
 #include "light-map.h"
 #include "spheremap.h"
@@ -23,10 +25,20 @@ using namespace snogray;
 
 
 EnvmapLight::EnvmapLight (const Ref<Envmap> &_envmap, const Frame &_frame)
-  : envmap (_envmap), frame (_frame),
-    intensity_dist (envmap_histogram (_envmap)),
-    scene_radius (0)
+  : envmap (_envmap), frame (_frame), scene_radius (0)
 {
+  init_dists (envmap_histogram (envmap));
+}
+
+EnvmapLight::~EnvmapLight ()
+{
+  for (std::vector<Hist2dAliasDist *>::iterator di
+	 = normal_cell_dists.begin ();
+       di != normal_cell_dists.end (); ++di)
+    delete *di;
+  for (std::vector<Hist2dAliasDist *>::iterator di = cell_dists.begin ();
+       di != cell_dists.end (); ++di)
+    delete *di;
 }
 
 // Return a 2d histogram containing the intensity of ENVMAP, with the
@@ -62,6 +74,219 @@ EnvmapLight::envmap_histogram (const Ref<Envmap> &envmap)
   return hist;
 }
 
+
+// Return the direction of the center of the rectangle from U0, V0 to
+// U1, V1 in lat-long map coordinates, and in RADIUS, the largest angle
+// between the center and any direction in the rectangle.
+//
+static Vec
+latlong_rect_center (float u0, float v0, float u1, float v1, float &radius)
+{
+  Vec center = LatLongMapping::map (UV ((u0 + u1) / 2, (v0 + v1) / 2));
+
+  // The furthest point from the center of a lat-long rectangle is
+  // always one of the corners.
+  //
+  radius = 0;
+  for (unsigned corner = 0; corner < 4; corner++)
+    {
+      Vec dir = LatLongMapping::map (UV ((corner & 1) ? u1 : u0,
+					 (corner & 2) ? v1 : v0));
+      float angle = acos (clamp (float (dot (center, dir)), -1.f, 1.f));
+      radius = max (radius, angle);
+    }
+
+  // Leave a little room for rounding errors.
+  //
+  radius += 0.001f;
+
+  return center;
+}
+
+// Set up the sampling distributions for the light-map histogram HIST.
+//
+void
+EnvmapLight::init_dists (const Hist2d &hist)
+{
+  map_width = hist.width;
+  map_height = hist.height;
+  cell_cols = min (CELL_COLS, map_width);
+  cell_rows = min (CELL_ROWS, map_height);
+
+  // Make the distribution within each cell, and find the total
+  // intensity of the cell, and its center and angular radius.
+  //
+  Hist2d cell_intens (cell_cols, cell_rows);
+  std::vector<Vec> cell_centers;
+  std::vector<float> cell_radii;
+
+  for (unsigned cell_row = 0; cell_row < cell_rows; cell_row++)
+    for (unsigned cell_col = 0; cell_col < cell_cols; cell_col++)
+      {
+	unsigned x0, y0, x1, y1;
+	cell_bounds (cell_col, cell_row, x0, y0, x1, y1);
+
+	Hist2d cell_hist (x1 - x0, y1 - y0);
+	for (unsigned y = y0; y < y1; y++)
+	  for (unsigned x = x0; x < x1; x++)
+	    {
+	      float intens = hist (x, y);
+	      cell_hist (x - x0, y - y0) = intens;
+	      cell_intens.add (cell_col, cell_row, intens);
+	    }
+
+	cell_dists.push_back (new Hist2dAliasDist (cell_hist));
+
+	float radius;
+	cell_centers.push_back (
+	  latlong_rect_center (float (x0) / map_width,
+			       float (y0) / map_height,
+			       float (x1) / map_width,
+			       float (y1) / map_height,
+			       radius));
+	cell_radii.push_back (radius);
+      }
+
+  cell_dist.reset (new Hist2dAliasDist (cell_intens));
+
+  // Make a cell distribution for each normal cluster.
+  //
+  Hist2d weighted_intens (cell_cols, cell_rows);
+  for (unsigned norm_row = 0; norm_row < NORMAL_ROWS; norm_row++)
+    for (unsigned norm_col = 0; norm_col < NORMAL_COLS; norm_col++)
+      {
+	float norm_radius;
+	Vec norm_center
+	  = latlong_rect_center (float (norm_col) / NORMAL_COLS,
+				 float (norm_row) / NORMAL_ROWS,
+				 float (norm_col + 1) / NORMAL_COLS,
+				 float (norm_row + 1) / NORMAL_ROWS,
+				 norm_radius);
+
+	for (unsigned cell = 0; cell < cell_intens.size; cell++)
+	  {
+	    // The smallest possible angle between a normal in this
+	    // cluster and a direction in the cell.  The cosine of that
+	    // angle is an upper bound for the cosine term of any sample
+	    // in the cell, and if it's more than 90 degrees, the cell is
+	    // always below the surface.
+	    //
+	    float dir_cos
+	      = clamp (float (dot (norm_center, cell_centers[cell])), -1.f, 1.f);
+	    float min_angle
+	      = acos (dir_cos) - norm_radius - cell_radii[cell];
+
+	    float cos_bound;
+	    if (min_angle <= 0)
+	      cos_bound = 1;
+	    else if (min_angle < PIf / 2)
+	      cos_bound = cos (min_angle);
+	    else
+	      cos_bound = 0;
+
+	    weighted_intens.bins[cell] = cell_intens.bins[cell] * cos_bound;
+	  }
+
+	normal_cell_dists.push_back (new Hist2dAliasDist (weighted_intens));
+      }
+}
+
+
+// Return a light-map position chosen using CELL_DIST to choose a
+// cell, and then that cell's entry in CELL_DISTS to choose a position
+// within it, based on the parameter PARAM.  The PDF of the position in
+// the light map is returned in PDF (or zero, if nothing can be
+// sampled).
+//
+UV
+EnvmapLight::sample_map (const Hist2dAliasDist &cell_dist, const UV &param,
+			 float &pdf) const
+{
+  float cell_pdf;
+  UV cell_pos = cell_dist.sample (param, cell_pdf);
+
+  if (cell_pdf == 0)
+    {
+      pdf = 0;
+      return UV (0, 0);
+    }
+
+  unsigned cell_col = min (unsigned (cell_pos.u * cell_cols), cell_cols - 1);
+  unsigned cell_row = min (unsigned (cell_pos.v * cell_rows), cell_rows - 1);
+
+  // The position within the chosen cell's grid square is used as the
+  // parameter for choosing a position within the cell.
+  //
+  UV in_cell_param (cell_pos.u * cell_cols - cell_col,
+		    cell_pos.v * cell_rows - cell_row);
+
+  float in_cell_pdf;
+  UV in_cell_pos
+    = cell_dists[cell_row * cell_cols + cell_col]->sample (in_cell_param,
+							    in_cell_pdf);
+
+  unsigned x0, y0, x1, y1;
+  cell_bounds (cell_col, cell_row, x0, y0, x1, y1);
+
+  // CELL_PDF is relative to the cell grid, and IN_CELL_PDF relative to
+  // the cell, so convert their product to be relative to the light map
+  // (cells don't all have exactly the same size).
+  //
+  pdf = cell_pdf * in_cell_pdf
+    * (float (map_width) / (cell_cols * (x1 - x0)))
+    * (float (map_height) / (cell_rows * (y1 - y0)));
+
+  return UV ((x0 + in_cell_pos.u * (x1 - x0)) / map_width,
+	     (y0 + in_cell_pos.v * (y1 - y0)) / map_height);
+}
+
+// Return the PDF of MAP_POS when sampled using EnvmapLight::sample_map
+// with CELL_DIST.
+//
+float
+EnvmapLight::map_pdf (const Hist2dAliasDist &cell_dist, const UV &map_pos)
+  const
+{
+  unsigned x = clamp (int (map_pos.u * map_width), 0, int (map_width) - 1);
+  unsigned y = clamp (int (map_pos.v * map_height), 0, int (map_height) - 1);
+
+  // The cell containing X, Y (the inverse of EnvmapLight::cell_bounds).
+  //
+  unsigned cell_col = ((x + 1) * cell_cols - 1) / map_width;
+  unsigned cell_row = ((y + 1) * cell_rows - 1) / map_height;
+
+  unsigned x0, y0, x1, y1;
+  cell_bounds (cell_col, cell_row, x0, y0, x1, y1);
+
+  float cell_pdf
+    = cell_dist.pdf (UV ((cell_col + 0.5f) / cell_cols,
+			 (cell_row + 0.5f) / cell_rows));
+  float in_cell_pdf
+    = cell_dists[cell_row * cell_cols + cell_col]->pdf (
+	UV ((x - x0 + 0.5f) / (x1 - x0), (y - y0 + 0.5f) / (y1 - y0)));
+
+  return cell_pdf * in_cell_pdf
+    * (float (map_width) / (cell_cols * (x1 - x0)))
+    * (float (map_height) / (cell_rows * (y1 - y0)));
+}
+
+// Return the cell distribution to use for sampling from the viewpoint
+// of ISEC.
+//
+const Hist2dAliasDist &
+EnvmapLight::isec_cell_dist (const Intersect &isec) const
+{
+  // The normal in the light's frame of reference, in lat-long
+  // coordinates.
+  //
+  UV pos = LatLongMapping::map (frame.to (isec.normal_frame.z));
+
+  unsigned col = clamp (int (pos.u * NORMAL_COLS), 0, int (NORMAL_COLS) - 1);
+  unsigned row = clamp (int (pos.v * NORMAL_ROWS), 0, int (NORMAL_ROWS) - 1);
+
+  return *normal_cell_dists[row * NORMAL_COLS + col];
+}
+
 
 // EnvmapLight::sample
 
@@ -76,10 +301,14 @@ EnvmapLight::sample (const Intersect &isec, const UV &param) const
   //
   float pdf;
 
-  // Map U,V to a direction (which may be anywhere in the
-  // sphere) based on the light's intensity distribution.
+  // Map U,V to a direction based on the light's intensity
+  // distribution, conditioned on ISEC's normal (this almost always
+  // gives a direction in the hemisphere above the surface).
   //
-  UV map_pos = intensity_dist.sample (param, pdf);
+  UV map_pos = sample_map (isec_cell_dist (isec), param, pdf);
+
+  if (pdf == 0)
+    return Sample ();
 
   // The direction of this sample in our frame.
   //
@@ -98,8 +327,8 @@ EnvmapLight::sample (const Intersect &isec, const UV &param) const
   if (isec.cos_n (dir) < 0 || isec.cos_geom_n (dir) < 0)
     return Sample ();
 
-  // The intensity distribution covers the entire sphere, so adjust
-  // the pdf to reflect that.
+  // The intensity distribution is over the light map, which covers
+  // the entire sphere, so adjust the pdf to reflect that.
   //
   pdf *= 0.25f * INV_PIf;
 
@@ -119,7 +348,7 @@ EnvmapLight::sample (const UV &param, const UV &dir_param) const
 
   // Sample using intensity distribution
   //
-  UV map_pos = intensity_dist.sample (dir_param, pdf);
+  UV map_pos = sample_map (*cell_dist, dir_param, pdf);
 
   // Direction (in world coordinates) of the sample.
   //
@@ -175,7 +404,7 @@ EnvmapLight::eval (const Intersect &isec, const Vec &dir) const
   // Look up the intensity and PDF at that point.
   //
   Color intens = envmap->map (light_dir);
-  float pdf = intensity_dist.pdf (map_pos);
+  float pdf = map_pdf (isec_cell_dist (isec), map_pos);
 
   // The intensity distribution covers the entire sphere, so adjust
   // the pdf to reflect that.
@@ -185,6 +414,26 @@ EnvmapLight::eval (const Intersect &isec, const Vec &dir) const
   return Value (intens, pdf, 0);
 }
 
+
+// EnvmapLight::free_sample_pdf
+
+// Return the pdf which the free-sampling variant of Light::sample
+// would have for a sample that reaches VIEWPOINT from direction DIR
+// (in world coordinates, pointing from VIEWPOINT towards the light).
+//
+float
+EnvmapLight::free_sample_pdf (const Pos &, const Vec &dir) const
+{
+  // As in the free-sampling variant of EnvmapLight::sample, use the
+  // unconditioned intensity distribution, adjusted for the whole
+  // sphere, and for sampling the position on a disk covering the
+  // scene.
+  //
+  UV map_pos = LatLongMapping::map (frame.to (dir));
+  float pdf = map_pdf (*cell_dist, map_pos) * 0.25f * INV_PIf;
+  return pdf / (PIf * scene_radius * scene_radius);
+}
+
 
 
 // Do any scene-related setup for this light.  This is is called once
@@ -14,11 +14,14 @@
 #define __ENVMAP_LIGHT_H__
 
 
+#include <vector>
+
+#include "unique-ptr.h"
 #include "light.h"
 #include "envmap.h"
 #include "frame.h"
 #include "hist-2d.h"
-#include "hist-2d-dist.h"
+#include "hist-2d-alias-dist.h"
 
 
 namespace snogray {
@@ -29,6 +32,7 @@ class EnvmapLight : public Light
 public:
 
   EnvmapLight (const Ref<Envmap> &_envmap, const Frame &_frame = Frame ());
+  ~EnvmapLight ();
 
   // Return a sample of this light from the viewpoint of ISEC (using a
   // surface-normal coordinate system, where the surface normal is
@@ -46,6 +50,12 @@ public:
   //
   virtual Value eval (const Intersect &isec, const Vec &dir) const;
 
+  // Return the pdf which the free-sampling variant of Light::sample
+  // would have for a sample that reaches VIEWPOINT from direction DIR
+  // (in world coordinates, pointing from VIEWPOINT towards the light).
+  //
+  virtual float free_sample_pdf (const Pos &viewpoint, const Vec &dir) const;
+
   // Return true if this is an "environmental" light, not associated
   // with any surface.
   //
@@ -71,15 +81,91 @@ private:
   //
   Hist2d envmap_histogram (const Ref<Envmap> &envmap);
 
+  // Sampling uses a two-level distribution:  the light map is divided
+  // into a coarse grid of "cells", and a sample first chooses a cell,
+  // and then a position within that cell.
+  //
+  // When sampling from the viewpoint of a surface, the cell is chosen
+  // using a distribution conditioned on the surface normal.  Normals
+  // are grouped into "normal clusters" (a coarse lat-long grid of
+  // directions), and the distribution for each cluster weights each
+  // cell's intensity by an upper bound on the cosine between any
+  // normal in the cluster and any direction in the cell.  Cells which
+  // are below the horizon for every normal in the cluster get no
+  // weight, so few samples are wasted below the surface, but every
+  // direction which might be visible still has a non-zero PDF.
+
+  // Maximum size of the cell grid, and size of the grid of normal
+  // clusters.
+  //
+  static const unsigned CELL_COLS = 64, CELL_ROWS = 32;
+  static const unsigned NORMAL_COLS = 16, NORMAL_ROWS = 8;
+
+  // Set up the sampling distributions for the light-map histogram
+  // HIST.
+  //
+  void init_dists (const Hist2d &hist);
+
+  // Return the light-map bounds of the cell at CELL_COL, CELL_ROW in
+  // X0, Y0 (inclusive) and X1, Y1 (exclusive).
+  //
+  void cell_bounds (unsigned cell_col, unsigned cell_row,
+		    unsigned &x0, unsigned &y0, unsigned &x1, unsigned &y1)
+    const
+  {
+    x0 = cell_col * map_width / cell_cols;
+    x1 = (cell_col + 1) * map_width / cell_cols;
+    y0 = cell_row * map_height / cell_rows;
+    y1 = (cell_row + 1) * map_height / cell_rows;
+  }
+
+  // Return a light-map position chosen using CELL_DIST to choose a
+  // cell, and then that cell's entry in CELL_DISTS to choose a
+  // position within it, based on the parameter PARAM.  The PDF of the
+  // position in the light map is returned in PDF (or zero, if nothing
+  // can be sampled).
+  //
+  UV sample_map (const Hist2dAliasDist &cell_dist, const UV &param,
+		 float &pdf) const;
+
+  // Return the PDF of MAP_POS when sampled using
+  // EnvmapLight::sample_map with CELL_DIST.
+  //
+  float map_pdf (const Hist2dAliasDist &cell_dist, const UV &map_pos) const;
+
+  // Return the cell distribution to use for sampling from the
+  // viewpoint of ISEC.
+  //
+  const Hist2dAliasDist &isec_cell_dist (const Intersect &isec) const;
+
   Ref<Envmap> envmap;
 
   // Frame of reference for the environment map.
   //
   Frame frame;
 
-  // Distribution for sampling the intensity of ENVMAP.
+  // Size of ENVMAP's light map, and of the cell grid.
+  //
+  unsigned map_width, map_height;
+  unsigned cell_cols, cell_rows;
+
+  // Distribution for choosing a cell, using only the intensity of
+  // ENVMAP.  This is used for free samples.
+  //
+  UniquePtr<Hist2dAliasDist> cell_dist;
+
+  // For each normal cluster, a distribution for choosing a cell which
+  // also takes the cluster's normals into account.
+  //
+  std::vector<Hist2dAliasDist *> normal_cell_dists;
+
+  // For each cell, a distribution for choosing a position within it,
+  // based on the intensity of ENVMAP.
+  //
+  // These are alias-table distributions, as the binary searches done
+  // by Hist2dDist are expensive for large environment maps.
   //
-  Hist2dDist intensity_dist;
+  std::vector<Hist2dAliasDist *> cell_dists;
 
   // Center and radius of a bounding sphere for the engire scene.
   //
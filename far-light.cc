@@ -87,6 +87,29 @@ FarLight::eval (const Intersect &isec, const Vec &dir) const
   return Value ();
 }
 
+
+// FarLight::free_sample_pdf
+
+// Return the pdf which the free-sampling variant of Light::sample
+// would have for a sample that reaches VIEWPOINT from direction DIR
+// (in world coordinates, pointing from VIEWPOINT towards the light).
+//
+float
+FarLight::free_sample_pdf (const Pos &, const Vec &dir) const
+{
+  // As in FarLight::sample, the pdf is the directional pdf adjusted
+  // for sampling the position on a disk covering the scene.
+  //
+  float disk_pdf = 1 / (PIf * scene_radius * scene_radius);
+
+  if (cos_half_angle == 1)
+    return disk_pdf;
+  else if (dot (dir, frame.z) >= cos_half_angle)
+    return cone_sample_pdf (cos_half_angle) * disk_pdf;
+  else
+    return 0;
+}
+
 
 
 // Evaluate this environmental light in direction DIR (in world-coordinates).
@@ -15,6 +15,7 @@
 #include "triv-space.h"
 #include "grid.h"
 #include "direct-integ.h"
+#include "bdpt-integ.h"
 #include "path-integ.h"
 #include "photon-integ.h"
 #include "filter-volume-integ.h"
@@ -60,7 +61,7 @@ GlobalRenderState::make_space_builder_factory (const ValTable &params)
 {
   std::string accel = params.get_string ("accel", "octree");
   if (accel == "octree")
-    return new Octree::BuilderFactory;
+    return new Octree::BuilderFactory (params);
   else if (accel == "trivial" || accel == "list")
     return new TrivSpace::BuilderFactory;
   else
@@ -81,6 +82,8 @@ GlobalRenderState::make_surface_integ_global_state (const ValTable &params)
     return new PathInteg::GlobalState (*this, sint_params);
   else if (sint == "photon")
     return new PhotonInteg::GlobalState (*this, sint_params);
+  else if (sint == "bdpt")
+    return new BdptInteg::GlobalState (*this, sint_params);
   else
     throw std::runtime_error ("Unknown surface-integrator \"" + sint + "\"");
 }
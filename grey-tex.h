@@ -35,6 +35,31 @@ public:
     return val.eval (tex_coords);
   }
 
+  // Evaluate this texture at each of the NUM coordinates in TEX_COORDS,
+  // storing the results into RESULTS.
+  //
+  virtual void eval_batch (const TexCoords *tex_coords, Color *results,
+			   unsigned num)
+    const
+  {
+    float vals[BATCH_CHUNK];
+
+    while (num > 0)
+      {
+	unsigned chunk = num;
+	if (chunk > BATCH_CHUNK)
+	  chunk = BATCH_CHUNK;
+
+	val.eval_batch (tex_coords, vals, chunk);
+	for (unsigned i = 0; i < chunk; i++)
+	  results[i] = vals[i];
+
+	tex_coords += chunk;
+	results += chunk;
+	num -= chunk;
+      }
+  }
+
   TexVal<float> val;
 };
 
@@ -89,7 +89,10 @@ Grid::gen_float_samples (Random &random,
   float offs = 0;
 
   for (unsigned i = 0; i < num; i++)
-    table[i] = clamp01 (offs + random () * n_step);
+    {
+      table[i] = clamp01 (offs + random () * n_step);
+      offs += n_step;
+    }
 }
 
 
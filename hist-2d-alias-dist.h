@@ -0,0 +1,309 @@
+// hist-2d-alias-dist.h -- Constant-time sampling distribution based on a 2d histogram
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef __HIST_2D_ALIAS_DIST_H__
+#define __HIST_2D_ALIAS_DIST_H__
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include "compiler.h"
+
+#include "hist-2d.h"
+
+
+namespace snogray {
+
+
+// A sampling distribution based on a 2d histogram, with the same
+// interface as Hist2dDist, but which uses "alias tables" (Walker's
+// alias method, constructed using Vose's algorithm) instead of
+// cumulative sums, so that sampling takes constant time instead of
+// requiring two binary searches.  The PDF is also stored for every
+// bin, so Hist2dAliasDist::pdf is a single table lookup.
+//
+// Sampling chooses a row using an alias table for the whole-row
+// probabilities and PARAM.v, and then a column within that row using
+// the row's alias table and PARAM.u.  The part of each random
+// variable not used to choose a bin is used for the position within
+// the bin, so nearby parameter values usually map to nearby positions,
+// though not as consistently as with Hist2dDist.
+//
+class Hist2dAliasDist
+{
+public:
+
+  // This constructor allocates the necessary memory, but won't be
+  // usable until a histogram has been specified using
+  // Hist2dAliasDist::calc.
+  //
+  Hist2dAliasDist (unsigned w, unsigned h)
+    : width (w), height (h), size (w*h),
+      column_width (1.f / width), row_height (1.f / height),
+      row_table (height), column_tables (size), bin_pdfs (size),
+      empty (true)
+  { }
+
+  // This constructor automatically copies the size from HIST, and
+  // calculates the PDF.  No references to HIST is kept.
+  //
+  Hist2dAliasDist (const Hist2d &hist)
+    : width (hist.width), height (hist.height), size (height * width),
+      column_width (1.f / width), row_height (1.f / height),
+      row_table (height), column_tables (size), bin_pdfs (size),
+      empty (true)
+  { calc (hist); }
+
+  // Calculate the PDF based from the histogram HIST.  HIST's size must
+  // be the same as the size this object was created with.  No reference
+  // to HIST is kept.
+  //
+  void calc (const Hist2d &hist)
+  {
+    // As in Hist2dDist, sums are calculated using double-precision
+    // floats, as HDR images can cause precision problems otherwise;
+    // only the final tables use single-precision.
+
+    std::vector<double> row_sums (height);
+    double bin_sum = 0;
+
+    unsigned row_offs = 0;
+    for (unsigned row = 0; row < height; row++)
+      {
+	double row_sum = 0;
+	for (unsigned col = 0; col < width; col++)
+	  row_sum += hist.bins[row_offs + col];
+	row_sums[row] = row_sum;
+	bin_sum += row_sum;
+	row_offs += width;
+      }
+
+    empty = (bin_sum == 0);
+
+    // Scratch space used by make_alias_table.
+    //
+    std::vector<double> probs (std::max (width, height));
+    std::vector<unsigned> small, large;
+
+    // Whole-row probabilities.
+    //
+    double inv_bin_sum = empty ? 0 : 1 / bin_sum;
+    for (unsigned row = 0; row < height; row++)
+      probs[row] = row_sums[row] * inv_bin_sum;
+    make_alias_table (probs, height, &row_table[0], small, large);
+
+    // Column probabilities within each row, and the PDF of each bin.
+    //
+    // PDF = probability of choosing a bin / bin area.  Since we
+    // consider the "total area" to be 1, then the bin area is just
+    // 1 / the number of bins (which is SIZE).
+    //
+    row_offs = 0;
+    for (unsigned row = 0; row < height; row++)
+      {
+	double inv_row_sum = (row_sums[row] == 0) ? 0 : 1 / row_sums[row];
+	for (unsigned col = 0; col < width; col++)
+	  {
+	    double bin = hist.bins[row_offs + col];
+	    probs[col] = bin * inv_row_sum;
+	    bin_pdfs[row_offs + col] = bin * inv_bin_sum * size;
+	  }
+
+	make_alias_table (probs, width, &column_tables[row_offs], small, large);
+
+	row_offs += width;
+      }
+  }
+
+  // Return a sample of this distribution based on the random
+  // variables in PARAM.  The PDF at the sample location is returned
+  // in _PDF.
+  //
+  // The returned UV coordinates should have roughly the same
+  // distribution as the input data (limited by the granularity of
+  // the histogram).
+  //
+  UV sample (const UV &param, float &_pdf) const
+  {
+    if (unlikely (empty))
+      {
+	_pdf = 0;
+	return UV (0, 0);
+      }
+
+    float col_frac, row_frac;
+    unsigned row = table_sample (&row_table[0], height, param.v, row_frac);
+    unsigned row_offs = row * width;
+    unsigned col
+      = table_sample (&column_tables[row_offs], width, param.u, col_frac);
+
+    _pdf = bin_pdfs[row_offs + col];
+
+    return UV ((col + col_frac) * column_width,
+	       (row + row_frac) * row_height);
+  }
+
+  // Return a sample of this distribution based on the random
+  // variables in PARAM.
+  //
+  // The returned UV coordinates should have roughly the same
+  // distribution as the input data (limited by the granularity of the
+  // histogram).
+  //
+  UV sample (const UV &param) const
+  {
+    float pdf;
+    return sample (param, pdf);
+  }
+
+  // Return the PDF of this distribution at location POS.
+  //
+  float pdf (const UV &pos) const
+  {
+    unsigned col = clamp (int (pos.u * width), 0, int (width) - 1);
+    unsigned row = clamp (int (pos.v * height), 0, int (height) - 1);
+
+    return bin_pdfs[row * width + col];
+  }
+
+  const unsigned width, height, size;
+  const float column_width, row_height;
+
+private:
+
+  // An entry in an alias table.  An entry is chosen uniformly, and
+  // then, with probability THRESHOLD, the entry's own index is the
+  // result; otherwise ALIAS is.
+  //
+  struct AliasEntry
+  {
+    AliasEntry (float _threshold = 1, unsigned _alias = 0)
+      : threshold (_threshold), alias (_alias)
+    { }
+
+    float threshold;
+    unsigned alias;
+  };
+
+  // Fill in the NUM entries of the alias table TABLE, for choosing
+  // indices with the probabilities in PROBS (which should sum to 1, or
+  // else all be zero, in which case TABLE is uniform).  SMALL and LARGE
+  // are used as scratch space.
+  //
+  static void make_alias_table (std::vector<double> &probs, unsigned num,
+				AliasEntry *table,
+				std::vector<unsigned> &small,
+				std::vector<unsigned> &large)
+  {
+    small.clear ();
+    large.clear ();
+
+    // Scale PROBS so that the average entry is 1, and divide the
+    // entries into those which need extra probability from an alias
+    // (SMALL), and those which can supply it (LARGE).
+    //
+    for (unsigned i = 0; i < num; i++)
+      {
+	probs[i] *= num;
+	if (probs[i] < 1)
+	  small.push_back (i);
+	else
+	  large.push_back (i);
+      }
+
+    while (!small.empty () && !large.empty ())
+      {
+	unsigned s = small.back (), l = large.back ();
+	small.pop_back ();
+
+	table[s].threshold = probs[s];
+	table[s].alias = l;
+
+	// L gives up enough of its probability to fill S's entry.
+	//
+	probs[l] -= 1 - probs[s];
+	if (probs[l] < 1)
+	  {
+	    large.pop_back ();
+	    small.push_back (l);
+	  }
+      }
+
+    // Anything left over should have a probability of (almost exactly)
+    // 1, so just gets its own entry.  If all probabilities were zero,
+    // everything ends up here, making a uniform table.
+    //
+    for (std::vector<unsigned>::iterator i = small.begin ();
+	 i != small.end (); ++i)
+      table[*i] = AliasEntry (1, *i);
+    for (std::vector<unsigned>::iterator i = large.begin ();
+	 i != large.end (); ++i)
+      table[*i] = AliasEntry (1, *i);
+  }
+
+  // Return an index chosen from the alias table TABLE with NUM
+  // entries, using the random variable PARAM.  The remaining part of
+  // PARAM, after choosing an index, is rescaled to the range 0-1 and
+  // returned in FRAC.
+  //
+  static unsigned table_sample (const AliasEntry *table, unsigned num,
+				float param, float &frac)
+  {
+    float scaled = clamp (param, 0.f, 1.f) * num;
+    unsigned index = min (unsigned (scaled), num - 1);
+    float rem = min (scaled - index, 1.f);
+
+    const AliasEntry &entry = table[index];
+    if (rem < entry.threshold)
+      {
+	frac = rem / entry.threshold;
+      }
+    else
+      {
+	frac = (entry.threshold < 1)
+	  ? (rem - entry.threshold) / (1 - entry.threshold)
+	  : 0;
+	index = entry.alias;
+      }
+
+    // Keep FRAC strictly less than 1 (rounding can make it exactly 1),
+    // so it doesn't refer to the beginning of the next bin.
+    //
+    frac = min (frac, 1 - std::numeric_limits<float>::epsilon () / 2);
+
+    return index;
+  }
+
+  // Alias table for choosing a row.
+  //
+  std::vector<AliasEntry> row_table;
+
+  // Alias tables for choosing a column within each row, one row after
+  // another.  Alias indices are relative to the beginning of the row.
+  //
+  std::vector<AliasEntry> column_tables;
+
+  // The PDF of each bin.
+  //
+  std::vector<float> bin_pdfs;
+
+  // True if all bins in the histogram were zero, making sampling
+  // impossible.
+  //
+  bool empty;
+};
+
+
+}
+
+#endif // __HIST_2D_ALIAS_DIST_H__
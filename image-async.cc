@@ -0,0 +1,291 @@
+// image-async.cc -- Image output using a separate writer thread
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include "config.h"
+
+#if USE_THREADS
+
+#include <stdexcept>
+#include <iostream>
+
+#include "thread.h"
+
+#include "image-async.h"
+
+
+using namespace snogray;
+
+
+// Make an AsyncImageSink which writes to SINK, which becomes owned by
+// the new object.  At most MAX_QUEUED rows are queued for the writer
+// thread at once.
+//
+AsyncImageSink::AsyncImageSink (ImageSink *_sink, unsigned _max_queued)
+  : ImageSink (_sink->filename, _sink->width, _sink->height, ValTable::NONE),
+    sink (_sink), max_queued (_max_queued ? _max_queued : 1),
+    shutting_down (false), err_reported (false),
+    thread (new Thread (&AsyncImageSink::run_writer, this))
+{
+}
+
+AsyncImageSink::~AsyncImageSink ()
+{
+  stop_writer ();
+
+  // We can't throw an exception from a destructor, so just complain
+  // about any error which the caller never saw.
+  //
+  if (!err_msg.empty () && !err_reported)
+    std::cerr << err_msg << std::endl;
+
+  for (std::deque<Entry>::iterator qi = queue.begin ();
+       qi != queue.end (); ++qi)
+    {
+      delete qi->row;
+      delete qi->tile;
+    }
+  for (std::vector<ImageRow *>::iterator ri = spare_rows.begin ();
+       ri != spare_rows.end (); ++ri)
+    delete *ri;
+  for (std::vector<ImageTile *>::iterator ti = spare_tiles.begin ();
+       ti != spare_tiles.end (); ++ti)
+    delete *ti;
+}
+
+
+// Wait until there's room in the queue for another entry.  If an
+// error has occurred in the writer thread which hasn't been reported
+// yet, it is thrown; if an error has already been reported, false is
+// returned (and whatever the caller wanted to write should be
+// discarded).  LOCK should hold MUTEX.
+//
+bool
+AsyncImageSink::wait_for_room (UniqueLock &lock)
+{
+  while (queue.size () >= max_queued && err_msg.empty ())
+    nonfull_cond.wait (lock);
+
+  throw_pending_error ();
+
+  return err_msg.empty ();
+}
+
+
+// Queue ROW to be written by the writer thread.
+//
+void
+AsyncImageSink::write_row (const ImageRow &row)
+{
+  UniqueLock lock (mutex);
+
+  if (! wait_for_room (lock))
+    return;			// discard rows after an error
+
+  ImageRow *copy;
+  if (spare_rows.empty ())
+    copy = new ImageRow (row);
+  else
+    {
+      copy = spare_rows.back ();
+      spare_rows.pop_back ();
+      *copy = row;
+    }
+
+  queue.push_back (Entry (copy));
+
+  nonempty_cond.notify_one ();
+}
+
+
+// Queue TILE to be written by the writer thread.
+//
+void
+AsyncImageSink::write_tile (const ImageTile &tile)
+{
+  UniqueLock lock (mutex);
+
+  if (! wait_for_room (lock))
+    return;			// discard tiles after an error
+
+  ImageTile *copy;
+  if (spare_tiles.empty ())
+    copy = new ImageTile (tile);
+  else
+    {
+      copy = spare_tiles.back ();
+      spare_tiles.pop_back ();
+      *copy = tile;
+    }
+
+  queue.push_back (Entry (0, copy));
+
+  nonempty_cond.notify_one ();
+}
+
+
+// Arrange for the underlying sink to be flushed once the writer
+// thread has written all rows queued so far.  This does not wait for
+// the flush to happen.
+//
+void
+AsyncImageSink::flush ()
+{
+  LockGuard guard (mutex);
+
+  throw_pending_error ();
+
+  if (err_msg.empty () && thread)
+    {
+      queue.push_back (Entry ());
+      nonempty_cond.notify_one ();
+    }
+}
+
+
+// Wait for all queued rows to be written, stop the writer thread, and
+// close the underlying sink.  If any error occurred while writing or
+// closing, it is thrown.  No more rows may be written afterwards.
+//
+void
+AsyncImageSink::close ()
+{
+  stop_writer ();
+
+  LockGuard guard (mutex);
+
+  throw_pending_error ();
+
+  // If writing failed, the underlying sink is in an unknown state, so
+  // leave it to be cleaned up by its destructor.
+  //
+  if (err_msg.empty ())
+    try
+      {
+	sink->close ();
+      }
+    catch (std::runtime_error &err)
+      {
+	err_msg = err.what ();
+	err_reported = true;
+	throw;
+      }
+    catch (std::exception &err)
+      {
+	err_msg = err.what ();
+	err_reported = true;
+	throw std::runtime_error (err_msg);
+      }
+}
+
+
+// If an error has occurred in the writer thread which hasn't been
+// reported yet, throw it.  MUTEX must be locked by the caller.
+//
+void
+AsyncImageSink::throw_pending_error ()
+{
+  if (!err_msg.empty () && !err_reported)
+    {
+      err_reported = true;
+      throw std::runtime_error (err_msg);
+    }
+}
+
+
+// Tell the writer thread to exit after writing any queued rows, and
+// wait until it does so.
+//
+void
+AsyncImageSink::stop_writer ()
+{
+  if (! thread)
+    return;
+
+  {
+    LockGuard guard (mutex);
+    shutting_down = true;
+    nonempty_cond.notify_one ();
+  }
+
+  thread->join ();
+
+  delete thread;
+  thread = 0;
+}
+
+
+// Main loop for the writer thread.
+//
+void
+AsyncImageSink::run_writer ()
+{
+  UniqueLock lock (mutex);
+
+  for (;;)
+    {
+      while (queue.empty () && !shutting_down)
+	nonempty_cond.wait (lock);
+
+      if (queue.empty ())
+	break;
+
+      Entry entry = queue.front ();
+
+      // Do the actual writing without holding the lock, so that the
+      // caller can continue to queue rows.  ENTRY stays at the front of
+      // the queue meanwhile, so the caller can't get too far ahead.
+      //
+      lock.unlock ();
+
+      std::string row_err;
+      if (err_msg.empty ())	// only we set ERR_MSG, so no need to lock
+	try
+	  {
+	    if (entry.row)
+	      sink->write_row (*entry.row);
+	    else if (entry.tile)
+	      sink->write_tile (*entry.tile);
+	    else
+	      sink->flush ();
+	  }
+	catch (std::exception &err)
+	  {
+	    row_err = err.what ();
+	  }
+	catch (...)
+	  {
+	    // An exception escaping from this thread would kill the whole
+	    // program, so catch everything.
+	    //
+	    row_err = sink->filename + ": unknown error writing image";
+	  }
+
+      lock.lock ();
+
+      if (! row_err.empty ())
+	err_msg = row_err;
+
+      queue.pop_front ();
+      if (entry.row)
+	spare_rows.push_back (entry.row);
+      if (entry.tile)
+	spare_tiles.push_back (entry.tile);
+
+      // Wake up the caller if it's waiting for room in the queue (or
+      // for an error).
+      //
+      nonfull_cond.notify_one ();
+    }
+}
+
+
+#endif // USE_THREADS
@@ -0,0 +1,184 @@
+// image-async.h -- Image output using a separate writer thread
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef __IMAGE_ASYNC_H__
+#define __IMAGE_ASYNC_H__
+
+#include "config.h"
+
+#if USE_THREADS
+
+#include <deque>
+#include <vector>
+#include <string>
+
+#include "unique-ptr.h"
+#include "mutex.h"
+#include "cond-var.h"
+#include "image-io.h"
+
+
+namespace snogray {
+
+
+class Thread;
+
+
+// An ImageSink which passes rows to another ImageSink, which does the
+// real work, in a separate writer thread.
+//
+// Encoding and compressing image data (e.g. for PNG or EXR output) can
+// take a significant amount of time, and doing it in the writer thread
+// lets the caller get back to work immediately.  Rows are copied into a
+// queue of limited length; if the queue is full, AsyncImageSink::write_row
+// waits until the writer thread has made room.
+//
+// Tiles (see ImageSink::write_tile) are handled the same way as rows.
+//
+// If the underlying sink signals an error, the error is reported (by
+// throwing a std::runtime_error) from the next call to
+// AsyncImageSink::write_row, AsyncImageSink::write_tile,
+// AsyncImageSink::flush, or AsyncImageSink::close; any rows or tiles
+// written after that are discarded.
+//
+class AsyncImageSink : public ImageSink
+{
+public:
+
+  // Make an AsyncImageSink which writes to SINK, which becomes owned by
+  // the new object.  At most MAX_QUEUED rows are queued for the writer
+  // thread at once.
+  //
+  AsyncImageSink (ImageSink *sink, unsigned max_queued);
+  ~AsyncImageSink ();
+
+  // Queue ROW to be written by the writer thread.
+  //
+  virtual void write_row (const ImageRow &row);
+
+  // Queue TILE to be written by the writer thread.
+  //
+  virtual void write_tile (const ImageTile &tile);
+
+  // Arrange for the underlying sink to be flushed once the writer
+  // thread has written all rows queued so far.  This does not wait for
+  // the flush to happen.
+  //
+  virtual void flush ();
+
+  // Wait for all queued rows to be written, stop the writer thread, and
+  // close the underlying sink.  If any error occurred while writing or
+  // closing, it is thrown.  No more rows may be written afterwards.
+  //
+  virtual void close ();
+
+  // Add an extra layer to the underlying sink.  This must be called
+  // before any rows are written.
+  //
+  virtual bool add_layer (const std::string &name,
+			  const std::string &components)
+  {
+    return sink->add_layer (name, components);
+  }
+
+  virtual unsigned tile_size () const { return sink->tile_size (); }
+  virtual bool has_alpha_channel () const { return sink->has_alpha_channel (); }
+  virtual RowOrder row_order () const { return sink->row_order (); }
+  virtual float max_intens () const { return sink->max_intens (); }
+
+private:
+
+  // An entry in the queue of things for the writer thread to write:
+  // either a row or a tile, or if both are zero, a request to flush
+  // SINK.
+  //
+  struct Entry
+  {
+    Entry (ImageRow *_row = 0, ImageTile *_tile = 0)
+      : row (_row), tile (_tile)
+    { }
+
+    ImageRow *row;
+    ImageTile *tile;
+  };
+
+  // Wait until there's room in the queue for another entry.  If an
+  // error has occurred in the writer thread which hasn't been reported
+  // yet, it is thrown; if an error has already been reported, false is
+  // returned (and whatever the caller wanted to write should be
+  // discarded).  LOCK should hold MUTEX.
+  //
+  bool wait_for_room (UniqueLock &lock);
+
+  // Main loop for the writer thread.
+  //
+  void run_writer ();
+
+  // Tell the writer thread to exit after writing any queued rows, and
+  // wait until it does so.
+  //
+  void stop_writer ();
+
+  // If an error has occurred in the writer thread which hasn't been
+  // reported yet, throw it.  MUTEX must be locked by the caller.
+  //
+  void throw_pending_error ();
+
+  // The sink which actually writes the image.
+  //
+  UniquePtr<ImageSink> sink;
+
+  // Rows and tiles waiting to be written, in order.
+  //
+  std::deque<Entry> queue;
+
+  // The maximum number of entries in QUEUE.
+  //
+  unsigned max_queued;
+
+  // Rows and tiles which have been written, kept for re-use to avoid
+  // allocating a new one every time.
+  //
+  std::vector<ImageRow *> spare_rows;
+  std::vector<ImageTile *> spare_tiles;
+
+  // If true, the writer thread should exit when QUEUE is empty.
+  //
+  bool shutting_down;
+
+  // The error message from the first error which occurred in the writer
+  // thread, and whether it has been reported to the caller yet.  Once
+  // an error has occurred, further rows are discarded.
+  //
+  std::string err_msg;
+  bool err_reported;
+
+  // Protects all of the above (except SINK, which is only used by the
+  // writer thread).
+  //
+  Mutex mutex;
+
+  // Condition variables used to signal that QUEUE has become non-empty
+  // (or the writer should exit), and that it has become non-full,
+  // respectively.
+  //
+  CondVar nonempty_cond, nonfull_cond;
+
+  Thread *thread;
+};
+
+
+}
+
+#endif // USE_THREADS
+
+#endif // __IMAGE_ASYNC_H__
@@ -131,6 +131,50 @@ ByteVecImageSink::ByteVecImageSink (const std::string &filename,
     gamma_correction (1 / target_gamma),
     output_row (width * num_channels * bytes_per_component)
 {
+  init_gamma_tables ();
+}
+
+// Initialize GAMMA_THRESHOLDS and GAMMA_INDEX.
+//
+void
+ByteVecImageSink::init_gamma_tables ()
+{
+  unsigned num_vals = unsigned (max_component) + 1;
+
+  gamma_thresholds.resize (num_vals);
+  gamma_thresholds[0] = 0;
+
+  // Start with an approximate threshold for each value, and then nudge
+  // it so that it's exactly the point at which
+  // slow_color_component_to_int changes, so that color_component_to_int
+  // gives exactly the same results.
+  //
+  for (unsigned val = 1; val < num_vals; val++)
+    {
+      Color::component_t thresh = val / component_scale;
+      if (gamma_correction != 0)
+	thresh = pow (thresh, 1 / gamma_correction);
+
+      while (thresh < 1 && slow_color_component_to_int (thresh) < val)
+	thresh = nextafterf (thresh, 2);
+      while (thresh > 0
+	     && slow_color_component_to_int (nextafterf (thresh, 0)) >= val)
+	thresh = nextafterf (thresh, 0);
+
+      gamma_thresholds[val] = thresh;
+    }
+
+  // A few index entries per integer value keeps the search in
+  // color_component_to_int short.  There's one extra entry, as
+  // multiplying a value just below 1 by GAMMA_INDEX_SCALE may round up.
+  //
+  unsigned index_size = num_vals * 4;
+  gamma_index_scale = index_size;
+
+  gamma_index.resize (index_size + 1);
+  for (unsigned i = 0; i <= index_size; i++)
+    gamma_index[i]
+      = slow_color_component_to_int (min (i / gamma_index_scale, 1.f));
 }
 
 void
@@ -195,7 +239,7 @@ ByteVecImageSource::ByteVecImageSource (const std::string &filename,
   : ImageSource (filename, params), ByteVecIo (params),
     component_scale (
       1 / Color::component_t ((1 << (bytes_per_component * 8)) - 1)),
-    input_row (0)
+    gamma_table_gamma (0), input_row (0)
 { }
 
 void
@@ -215,15 +259,35 @@ ByteVecImageSource::set_specs (unsigned _width, unsigned _height,
 
   component_scale = 1 / Color::component_t ((1 << bits_per_component) - 1);
 
+  gamma_table.clear ();		// force re-initialization
+
   if (width)
     input_row.resize (width * num_channels * bytes_per_component);
 }
 
+// Initialize GAMMA_TABLE for the current values of TARGET_GAMMA and
+// COMPONENT_SCALE.
+//
+void
+ByteVecImageSource::init_gamma_table ()
+{
+  unsigned num_vals = 1 << (bytes_per_component * 8);
+
+  gamma_table.resize (num_vals);
+  for (unsigned val = 0; val < num_vals; val++)
+    gamma_table[val] = pow (val * component_scale, target_gamma);
+
+  gamma_table_gamma = target_gamma;
+}
+
 void
 ByteVecImageSource::read_row (ImageRow &row)
 {
   read_row (input_row);
 
+  if (gamma_table.empty () || gamma_table_gamma != target_gamma)
+    init_gamma_table ();
+
   bool rgb = (pixel_format_base (pixel_format) == PIXEL_FORMAT_RGB);
   bool alpha_channel = (pixel_format_has_alpha_channel (pixel_format));
 
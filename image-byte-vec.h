@@ -154,9 +154,33 @@ public:
 protected:
 
   // Floating-point to integer and range conversion for color
-  // components.
+  // components, including gamma correction.
+  //
+  // This gives exactly the same result as
+  // ByteVecImageSink::slow_color_component_to_int, but instead of
+  // calling pow, it uses GAMMA_INDEX to find an integer value which is
+  // not greater than the correct result, and then increments it until
+  // COM is below the threshold for the next integer value.
   //
   unsigned color_component_to_int (Color::component_t com) const
+  {
+    if (! (com > 0))
+      return 0;
+    if (com >= 1)
+      return unsigned (max_component);
+
+    unsigned val = gamma_index[unsigned (com * gamma_index_scale)];
+    while (val < max_component && com >= gamma_thresholds[val + 1])
+      val++;
+
+    return val;
+  }
+
+  // Floating-point to integer and range conversion for color
+  // components, calculating the gamma correction directly.  This is
+  // only used to initialize the tables used by color_component_to_int.
+  //
+  unsigned slow_color_component_to_int (Color::component_t com) const
   {
     com = max (com, 0.f);
 
@@ -225,6 +249,23 @@ protected:
 
 private:
 
+  // Initialize GAMMA_THRESHOLDS and GAMMA_INDEX.
+  //
+  void init_gamma_tables ();
+
+  // For each integer component value, the smallest floating-point
+  // component value which color_component_to_int will convert to it.
+  //
+  std::vector<Color::component_t> gamma_thresholds;
+
+  // A table giving the integer component value for the floating-point
+  // values 0, 1 / GAMMA_INDEX_SCALE, 2 / GAMMA_INDEX_SCALE, ..., 1,
+  // used by color_component_to_int as a starting point for searching
+  // GAMMA_THRESHOLDS.
+  //
+  std::vector<unsigned short> gamma_index;
+  Color::component_t gamma_index_scale;
+
   // A single row of bytes we use as temporary storage during output
   //
   ByteVec output_row;
@@ -267,11 +308,13 @@ protected:
 		  unsigned bytes_per_component = 1,
 		  unsigned bits_per_component = 0 /* 0: use default */);
 
+  // Integer to floating-point conversion for color components,
+  // undoing gamma correction.  This uses a table lookup, so
+  // init_gamma_table must be called first.
+  //
   Color::component_t int_to_color_component (unsigned int_cc) const
   {
-    Color::component_t com = int_cc * component_scale;
-    com = pow (com, target_gamma); // undo gamma correction
-    return com;
+    return gamma_table[int_cc];
   }
   Color::component_t int_to_alpha_component (unsigned int_alpha) const
   {
@@ -313,6 +356,19 @@ private:
   //
   Color::component_t component_scale;
 
+  // Initialize GAMMA_TABLE for the current values of TARGET_GAMMA and
+  // COMPONENT_SCALE.
+  //
+  void init_gamma_table ();
+
+  // The linear color component for every possible integer component
+  // value, and the value of TARGET_GAMMA used to calculate it (the
+  // gamma may be changed after the image header is read, so the table
+  // is initialized lazily).
+  //
+  std::vector<Color::component_t> gamma_table;
+  float gamma_table_gamma;
+
   // A single row of bytes we use as temporary storage during input
   //
   ByteVec input_row;
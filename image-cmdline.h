@@ -58,7 +58,11 @@
                                  \"gamma\"   -- target gamma correction\n\
                                  \"quality\" -- image compression quality (0-100)\n\
                                  \"filter\"  -- output filter\n\
-                                 \"exposure\"-- output exposure"
+                                 \"exposure\"-- output exposure\n\
+                                 \"write-queue\" -- rows buffered for the\n\
+                                   background writer (0 = write directly)\n\
+                                 \"stream-tiles\" -- render and write the\n\
+                                   image tile by tile (tiled EXR only)"
 
 #define IMAGE_OUTPUT_SHORT_OPTIONS "s:e:F:O:"
 
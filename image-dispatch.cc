@@ -59,6 +59,21 @@ ImageIo::find_format (const ValTable &params, const std::string &filename)
   return fmt;
 }
 
+// Set the number of threads which image formats that can do their
+// own encoding or decoding in multiple threads (currently only EXR)
+// should use to NUM_THREADS.  This is a global setting, so it should
+// be called once by the program, before any images are opened.
+//
+void
+ImageIo::set_num_threads (unsigned num_threads)
+{
+#ifdef HAVE_LIBEXR
+  set_exr_num_threads (num_threads);
+#else
+  (void)num_threads;
+#endif
+}
+
 // Return true if FILENAME has a recogized image format we can read.
 //
 bool
@@ -10,55 +10,397 @@
 // Written by Miles Bader <miles@gnu.org>
 //
 
+#include <algorithm>
+
+#include <ImfChannelList.h>
+#include <ImfTileDescription.h>
+#include <ImfCompression.h>
+#include <ImfThreading.h>
+
 #include "image-exr.h"
 
 
 using namespace snogray;
 
-
+
+// Set the number of threads OpenEXR uses for compressing and
+// decompressing images to NUM_THREADS.
+//
+void
+snogray::set_exr_num_threads (unsigned num_threads)
+{
+  if (Imf::globalThreadCount () != int (num_threads))
+    Imf::setGlobalThreadCount (num_threads);
+}
+
+
 // output
 
+// The number of rows buffered before writing a scanline file.  This is
+// enough rows for several compression blocks, so that OpenEXR's
+// threads have something to do in parallel.
+//
+#define SCANLINE_BUF_ROWS 64
+
+// Return the EXR compression method named NAME, or signal an error if
+// it's not a known method.
+//
+static Imf::Compression
+compression_method (const std::string &name, ExrImageSink &sink)
+{
+  if (name == "zip")
+    return Imf::ZIP_COMPRESSION;
+  else if (name == "zips")
+    return Imf::ZIPS_COMPRESSION;
+  else if (name == "piz")
+    return Imf::PIZ_COMPRESSION;
+  else if (name == "rle")
+    return Imf::RLE_COMPRESSION;
+  else if (name == "pxr24")
+    return Imf::PXR24_COMPRESSION;
+  else if (name == "b44")
+    return Imf::B44_COMPRESSION;
+  else if (name == "none")
+    return Imf::NO_COMPRESSION;
+  else
+    sink.open_err ("unknown compression method \"" + name + "\"");
+}
+
 ExrImageSink::ExrImageSink (const std::string &filename,
 			    unsigned width, unsigned height,
 			    const ValTable &params)
   : ImageSink (filename, width, height, params),
-    outf (filename.c_str(), width, height,
-	  (params.get_bool ("alpha-channel,alpha")
-	   ? Imf::WRITE_RGBA
-	   : Imf::WRITE_RGB)),
-    row_buf (width), cur_y (0)
+    alpha (params.get_bool ("alpha-channel,alpha")),
+    num_color_chans (alpha ? 4 : 3),
+    tile_dim (params.get_uint ("tile-size", 64)),
+    stream (filename.c_str ()),
+    header (width, height),
+    buf_y (0), num_buf_rows (0),
+    max_buf_rows (tile_dim ? tile_dim : SCANLINE_BUF_ROWS),
+    closed (false)
 {
   if (params.contains ("gamma"))
     open_err ("OpenEXR format does not use gamma correction");
+
+  header.compression ()
+    = compression_method (params.get_string ("compression", "zip"), *this);
+
+  Imf::ChannelList &chans = header.channels ();
+  chans.insert ("R", Imf::Channel (Imf::HALF));
+  chans.insert ("G", Imf::Channel (Imf::HALF));
+  chans.insert ("B", Imf::Channel (Imf::HALF));
+  if (alpha)
+    chans.insert ("A", Imf::Channel (Imf::HALF));
+
+  if (tile_dim)
+    header.setTileDescription (
+	     Imf::TileDescription (tile_dim, tile_dim, Imf::ONE_LEVEL));
+}
+
+ExrImageSink::~ExrImageSink ()
+{
+  // If ExrImageSink::close wasn't called, try to finish the file
+  // anyway; as there's no way to report errors from here, they are
+  // ignored.
+  //
+  if (! closed)
+    try
+      {
+	finish_file ();
+      }
+    catch (...)
+      {
+      }
+}
+
+
+// Finish writing previously written rows; no more rows may be written
+// afterwards.  Any error is signaled by throwing an exception.
+//
+void
+ExrImageSink::close ()
+{
+  if (closed)
+    return;
+
+  closed = true;
+
+  finish_file ();
+}
+
+// Throw EXC, an exception thrown by OpenEXR (which uses its own
+// exception types), as our usual form of error.
+//
+void
+ExrImageSink::exr_err (const std::exception &exc)
+{
+  err (exc.what ());
+}
+
+// Write any buffered rows, and finish the output file.  A valid header
+// is always written, even if the image is incomplete.
+//
+void
+ExrImageSink::finish_file ()
+{
+  if (!tiled_file && !scanline_file)
+    start_file ();
+
+  if (num_buf_rows != 0)
+    write_buffered_rows ();
+
+  // Destroying the file objects makes OpenEXR write its final
+  // bookkeeping data.
+  //
+  tiled_file.reset ();
+  scanline_file.reset ();
+}
+
+
+// Add an extra layer, which will be written in addition to the
+// normal color and alpha channels.  See ImageSink::add_layer for
+// details.
+//
+bool
+ExrImageSink::add_layer (const std::string &name,
+			 const std::string &components)
+{
+  if (tiled_file || scanline_file)
+    err ("layers must be added before writing any rows");
+
+  std::vector<std::string> names;
+  if (components.empty ())
+    names.push_back (name);
+  else
+    for (unsigned i = 0; i < components.length (); i++)
+      names.push_back (name + "." + components[i]);
+
+  for (std::vector<std::string>::iterator ni = names.begin ();
+       ni != names.end (); ++ni)
+    {
+      header.channels ().insert (ni->c_str (), Imf::Channel (Imf::FLOAT));
+      layer_chans.push_back (*ni);
+    }
+
+  return true;
+}
+
+
+// Write the file header, and get ready to write rows.  If
+// RANDOM_TILE_ORDER is true, the file is set up to have tiles written
+// in any order.
+//
+void
+ExrImageSink::start_file (bool random_tile_order)
+{
+  // With the default line order, OpenEXR would keep out-of-order tiles
+  // in memory until it could write them in increasing-Y order.
+  //
+  if (random_tile_order)
+    header.lineOrder () = Imf::RANDOM_Y;
+
+  try
+    {
+      if (tile_dim)
+	tiled_file.reset (new Imf::TiledOutputFile (stream, header));
+      else
+	scanline_file.reset (new Imf::OutputFile (stream, header));
+    }
+  catch (std::exception &exc)
+    {
+      exr_err (exc);
+    }
+
+  // The row buffers are only needed if we're writing rows.
+  //
+  if (! random_tile_order)
+    {
+      row_buf.resize (max_buf_rows * width * num_color_chans);
+      layer_buf.resize (max_buf_rows * width * layer_chans.size ());
+    }
 }
 
+
 void
 ExrImageSink::write_row (const ImageRow &row)
 {
-  for (unsigned x = 0; x < row.width; x++)
+  if (!tiled_file && !scanline_file)
+    start_file ();
+
+  unsigned num_lchans = layer_chans.size ();
+
+  store_pixels (row, width,
+		&row_buf[num_buf_rows * width * num_color_chans],
+		num_lchans ? &layer_buf[num_buf_rows * width * num_lchans] : 0);
+
+  num_buf_rows++;
+
+  if (num_buf_rows == max_buf_rows || buf_y + num_buf_rows == height)
+    write_buffered_rows ();
+}
+
+
+// Write TILE, which must be one of the tiles in the file.  See
+// ImageSink::write_tile for details.
+//
+void
+ExrImageSink::write_tile (const ImageTile &tile)
+{
+  if (!tiled_file && !scanline_file)
+    start_file (true);
+
+  if (! tiled_file)
+    err ("tiles can only be written to a tiled file");
+
+  unsigned num_pixels = tile.width * tile.height;
+  unsigned num_lchans = layer_chans.size ();
+
+  tile_buf.resize (num_pixels * num_color_chans);
+  tile_layer_buf.resize (num_pixels * num_lchans);
+
+  half *color_vals = &tile_buf[0];
+  float *layer_vals = num_lchans ? &tile_layer_buf[0] : 0;
+
+  store_pixels (tile.pixels, num_pixels, color_vals, layer_vals);
+
+  try
+    {
+      tiled_file->setFrameBuffer (
+		    frame_buffer (color_vals, layer_vals,
+				  tile.x, tile.y, tile.width));
+      tiled_file->writeTile (tile.x / tile_dim, tile.y / tile_dim);
+    }
+  catch (std::exception &exc)
+    {
+      exr_err (exc);
+    }
+}
+
+
+// Store the color (and alpha) channels of the NUM pixels in PIXELS
+// into COLOR_VALS, and any extra layer channels into LAYER_VALS.
+//
+void
+ExrImageSink::store_pixels (const ImageRow &pixels, unsigned num,
+			    half *color_vals, float *layer_vals)
+{
+  for (unsigned i = 0; i < num; i++)
     {
-      const Tint &tint = row[x];
+      const Tint &tint = pixels[i];
       const Color &col = tint.alpha_scaled_color ();
 
       // Note that EXR files use pre-multiplied alpha like we do.
       //
-      Imf::Rgba rgba (col.r(), col.g(), col.b(), tint.alpha);
+      *color_vals++ = col.r ();
+      *color_vals++ = col.g ();
+      *color_vals++ = col.b ();
+      if (alpha)
+	*color_vals++ = tint.alpha;
+    }
 
-      row_buf[x] = rgba;
+  unsigned num_lchans = layer_chans.size ();
+  if (num_lchans != 0)
+    {
+      if (pixels.layer_vals.size () == num * num_lchans)
+	std::copy (pixels.layer_vals.begin (), pixels.layer_vals.end (),
+		   layer_vals);
+      else
+	std::fill (layer_vals, layer_vals + num * num_lchans, 0.f);
     }
+}
 
-  outf.setFrameBuffer (&row_buf[0] - cur_y * row.width, 1, row.width);
-  outf.writePixels ();
 
-  cur_y++;
+// Return a frame-buffer describing the pixels in COLOR_VALS and
+// LAYER_VALS, which hold rows of BUF_WIDTH pixels, with the first
+// pixel corresponding to position X, Y in the image.
+//
+Imf::FrameBuffer
+ExrImageSink::frame_buffer (half *color_vals, float *layer_vals,
+			    unsigned x, unsigned y, unsigned buf_width)
+{
+  Imf::FrameBuffer fb;
+
+  // OpenEXR addresses pixels using absolute image coordinates, so the
+  // base pointers we give it are offset to make the first buffered
+  // pixel correspond to position X, Y.
+
+  size_t color_xstride = num_color_chans * sizeof (half);
+  size_t color_ystride = buf_width * color_xstride;
+  char *color_base
+    = (reinterpret_cast<char *> (color_vals)
+       - y * color_ystride - x * color_xstride);
+
+  const char *color_names[] = { "R", "G", "B", "A" };
+  for (unsigned c = 0; c < num_color_chans; c++)
+    fb.insert (color_names[c],
+	       Imf::Slice (Imf::HALF, color_base + c * sizeof (half),
+			   color_xstride, color_ystride));
+
+  unsigned num_lchans = layer_chans.size ();
+  if (num_lchans != 0)
+    {
+      size_t layer_xstride = num_lchans * sizeof (float);
+      size_t layer_ystride = buf_width * layer_xstride;
+      char *layer_base
+	= (reinterpret_cast<char *> (layer_vals)
+	   - y * layer_ystride - x * layer_xstride);
+
+      for (unsigned c = 0; c < num_lchans; c++)
+	fb.insert (layer_chans[c].c_str (),
+		   Imf::Slice (Imf::FLOAT, layer_base + c * sizeof (float),
+			       layer_xstride, layer_ystride));
+    }
+
+  return fb;
 }
 
-
+
+// Write out the rows in ROW_BUF and LAYER_BUF, and empty them.
+//
+void
+ExrImageSink::write_buffered_rows ()
+{
+  Imf::FrameBuffer fb
+    = frame_buffer (&row_buf[0],
+		    layer_chans.empty () ? 0 : &layer_buf[0],
+		    0, buf_y, width);
+
+  try
+    {
+      if (tiled_file)
+	{
+	  // The buffered rows are always exactly one row of tiles
+	  // (except that the last row of tiles may be partial).
+	  //
+	  int tile_row = buf_y / tile_dim;
+
+	  tiled_file->setFrameBuffer (fb);
+	  tiled_file->writeTiles (0, tiled_file->numXTiles () - 1,
+				  tile_row, tile_row);
+	}
+      else
+	{
+	  scanline_file->setFrameBuffer (fb);
+	  scanline_file->writePixels (num_buf_rows);
+	}
+    }
+  catch (std::exception &exc)
+    {
+      exr_err (exc);
+    }
+
+  buf_y += num_buf_rows;
+  num_buf_rows = 0;
+}
+
+
 // input
 
 ExrImageSource::ExrImageSource (const std::string &filename,
 				const ValTable &params)
-  : ImageSource (filename, params), inf (filename.c_str()), cur_y (0)
+  : ImageSource (filename, params), inf (filename.c_str()),
+    max_buf_rows (params.get_uint ("read-rows", 64)),
+    buf_y (0), num_buf_rows (0), cur_y (0)
 {
   const Imf::Header &hdr = inf.header ();
   const Imath::Box2i &data_window = hdr.dataWindow ();
@@ -66,19 +408,34 @@ ExrImageSource::ExrImageSource (const std::string &filename,
   width = data_window.max.x - data_window.min.x + 1;
   height = data_window.max.y - data_window.min.y + 1;
 
-  row_buf.resize (width);
+  if (max_buf_rows == 0)
+    max_buf_rows = 1;
+
+  row_buf.resize (max_buf_rows * width);
 }
 
 
 void
 ExrImageSource::read_row (ImageRow &row)
 {
-  inf.setFrameBuffer (&row_buf[0] - cur_y * row.width, 1, row.width);
-  inf.readPixels (cur_y);
+  // Rows are read from the file in bands of MAX_BUF_ROWS rows; reading
+  // many rows at once lets the EXR library decompress them in parallel
+  // using its thread pool.
+  //
+  if (cur_y >= buf_y + num_buf_rows)
+    {
+      buf_y = cur_y;
+      num_buf_rows = min (max_buf_rows, height - cur_y);
+
+      inf.setFrameBuffer (&row_buf[0] - buf_y * row.width, 1, row.width);
+      inf.readPixels (buf_y, buf_y + num_buf_rows - 1);
+    }
+
+  const Imf::Rgba *buf_row = &row_buf[(cur_y - buf_y) * row.width];
 
   for (unsigned x = 0; x < row.width; x++)
     {
-      const Imf::Rgba &rgba = row_buf[x];
+      const Imf::Rgba &rgba = buf_row[x];
 
       // Note that EXR files use pre-multiplied alpha like we do.
       //
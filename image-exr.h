@@ -13,36 +13,165 @@
 #ifndef __IMAGE_EXR_H__
 #define __IMAGE_EXR_H__
 
+#include <vector>
+#include <string>
+
 #include <ImfRgbaFile.h>
+#include <ImfHeader.h>
+#include <ImfStdIO.h>
+#include <ImfOutputFile.h>
+#include <ImfTiledOutputFile.h>
+#include <ImfFrameBuffer.h>
 
+#include "unique-ptr.h"
 #include "image-io.h"
 
 
 namespace snogray {
 
+// EXR output.
+//
+// By default, the output file is tiled, with square tiles of
+// TILE_DIM pixels (set by the "tile-size" parameter, where 0 means to
+// write a scanline file instead).  Rows are buffered until a complete
+// row of tiles is available, and then the whole row of tiles is
+// written at once, which lets OpenEXR compress the tiles in parallel
+// using its own thread pool (the size of which is set by
+// ImageIo::set_num_threads).
+//
+// A tiled file may also be written tile by tile, in any order, using
+// ExrImageSink::write_tile; the tiles are then stored in the file in
+// the order they are written.
+//
+// Besides the usual R, G, B, and (optional) A channels, which are
+// stored as half-floats, any number of extra layers may be added with
+// ExrImageSink::add_layer; these are stored as full floats.  As EXR
+// files require all channels to be declared in the file header, the
+// file header isn't written until the first row is written.
+//
 class ExrImageSink : public ImageSink
 {  
 public:
 
   ExrImageSink (const std::string &filename, unsigned width, unsigned height,
 		const ValTable &params = ValTable::NONE);
+  ~ExrImageSink ();
 
   // Return true if output has an alpha (opacity) channel.
   //
-  virtual bool has_alpha_channel () const
-  {
-    return outf.channels() & Imf::WRITE_A;
-  }
+  virtual bool has_alpha_channel () const { return alpha; }
+
+  // Add an extra layer, which will be written in addition to the
+  // normal color and alpha channels.  See ImageSink::add_layer for
+  // details.
+  //
+  virtual bool add_layer (const std::string &name,
+			  const std::string &components);
 
   virtual void write_row (const ImageRow &row);
 
+  // If we're writing a tiled file, return the tile size, otherwise
+  // zero.
+  //
+  virtual unsigned tile_size () const { return tile_dim; }
+
+  // Write TILE, which must be one of the tiles in the file.  See
+  // ImageSink::write_tile for details.
+  //
+  virtual void write_tile (const ImageTile &tile);
+
+  // Finish writing previously written rows; no more rows may be
+  // written afterwards.  Any error is signaled by throwing an
+  // exception.
+  //
+  virtual void close ();
+
 private:
 
-  Imf::RgbaOutputFile outf;
+  // Write the file header, and get ready to write rows.  If
+  // RANDOM_TILE_ORDER is true, the file is set up to have tiles
+  // written in any order.
+  //
+  void start_file (bool random_tile_order = false);
 
-  std::vector<Imf::Rgba> row_buf;
+  // Store the color (and alpha) channels of the NUM pixels in PIXELS
+  // into COLOR_VALS, and any extra layer channels into LAYER_VALS.
+  //
+  void store_pixels (const ImageRow &pixels, unsigned num,
+		     half *color_vals, float *layer_vals);
 
-  unsigned cur_y;
+  // Write out the rows in ROW_BUF and LAYER_BUF, and empty them.
+  //
+  void write_buffered_rows ();
+
+  // Throw EXC, an exception thrown by OpenEXR (which uses its own
+  // exception types), as our usual form of error.
+  //
+  void exr_err (const std::exception &exc) __attribute__ ((noreturn));
+
+  // Write any buffered rows, and finish the output file.  A valid
+  // header is always written, even if the image is incomplete.
+  //
+  void finish_file ();
+
+  // Return a frame-buffer describing the pixels in COLOR_VALS and
+  // LAYER_VALS, which hold rows of BUF_WIDTH pixels, with the first
+  // pixel corresponding to position X, Y in the image.
+  //
+  Imf::FrameBuffer frame_buffer (half *color_vals, float *layer_vals,
+				 unsigned x, unsigned y, unsigned buf_width);
+
+  // True if we write an alpha channel.
+  //
+  bool alpha;
+
+  // The number of color channels (3 or 4, depending on ALPHA).
+  //
+  unsigned num_color_chans;
+
+  // The names of the channels in any extra layers, in the order their
+  // values occur in ImageRow::layer_vals.
+  //
+  std::vector<std::string> layer_chans;
+
+  // Size of each tile, or zero if we're writing a scanline file.
+  //
+  unsigned tile_dim;
+
+  // The output stream, which is opened immediately (so that errors are
+  // reported early), and the file header, which is filled in as
+  // layers are added.
+  //
+  Imf::StdOFStream stream;
+  Imf::Header header;
+
+  // The output file; one of these is created by
+  // ExrImageSink::start_file, depending on whether we're writing a
+  // tiled file.
+  //
+  UniquePtr<Imf::TiledOutputFile> tiled_file;
+  UniquePtr<Imf::OutputFile> scanline_file;
+
+  // Rows which have been buffered to be written together.  ROW_BUF
+  // holds color (and alpha) channels, and LAYER_BUF holds extra layer
+  // channels, in both cases with all channels of each pixel together.
+  // The first buffered row is row BUF_Y of the image, and there are
+  // NUM_BUF_ROWS rows buffered; we write them when there are
+  // MAX_BUF_ROWS.
+  //
+  std::vector<half> row_buf;
+  std::vector<float> layer_buf;
+  unsigned buf_y, num_buf_rows, max_buf_rows;
+
+  // Buffers used by ExrImageSink::write_tile, holding the color (and
+  // alpha) channels, and extra layer channels, of a single tile.
+  //
+  std::vector<half> tile_buf;
+  std::vector<float> tile_layer_buf;
+
+  // True if ExrImageSink::close has been called.
+  //
+  bool closed;
 };
 
 class ExrImageSource : public ImageSource
@@ -65,11 +194,24 @@ private:
 
   Imf::RgbaInputFile inf;
 
+  // A buffer holding up to MAX_BUF_ROWS rows read from the file.
+  // NUM_BUF_ROWS rows, starting at row BUF_Y, are currently valid.
+  //
   std::vector<Imf::Rgba> row_buf;
+  unsigned max_buf_rows;
+  unsigned buf_y, num_buf_rows;
 
+  // The next row to return from ExrImageSource::read_row.
+  //
   unsigned cur_y;
 };
 
+
+// Set the number of threads OpenEXR uses for compressing and
+// decompressing images to NUM_THREADS.
+//
+extern void set_exr_num_threads (unsigned num_threads);
+
 }
 
 #endif /* __IMAGE_EXR_H__ */
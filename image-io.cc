@@ -86,6 +86,12 @@ ImageSink::flush ()
   // do nothing
 }
 
+void
+ImageSink::write_tile (const ImageTile &)
+{
+  err ("tiled output not supported");
+}
+
 float
 ImageSink::max_intens () const
 {
@@ -65,6 +65,32 @@ public:
   using std::vector<Tint>::at;
 
   unsigned width;
+
+  // Values of any extra layers (see ImageSink::add_layer), stored pixel
+  // by pixel, with all the channels of all layers for each pixel
+  // together.  This is empty if there are no extra layers.
+  //
+  std::vector<float> layer_vals;
+};
+
+
+// A rectangular block of pixels in an image, for writing images in
+// tiles (see ImageSink::write_tile).  The tile's upper-left corner is
+// at X, Y in the image.  PIXELS holds the tile's pixels in row-major
+// order, so the pixel at (X + i, Y + j) is PIXELS[j * WIDTH + i], and
+// PIXELS.layer_vals holds any extra layer values in the same order.
+//
+struct ImageTile
+{
+  ImageTile (unsigned _x = 0, unsigned _y = 0,
+	     unsigned _width = 0, unsigned _height = 0)
+    : x (_x), y (_y), width (_width), height (_height),
+      pixels (_width * _height)
+  { }
+
+  unsigned x, y, width, height;
+
+  ImageRow pixels;
 };
 
 
@@ -108,6 +134,13 @@ public:
   static std::string find_format (const ValTable &params,
 				  const std::string &filename);
 
+  // Set the number of threads which image formats that can do their
+  // own encoding or decoding in multiple threads (currently only EXR)
+  // should use to NUM_THREADS.  This is a global setting, so it should
+  // be called once by the program, before any images are opened.
+  //
+  static void set_num_threads (unsigned num_threads);
+
 
   ImageIo (const std::string &_filename, unsigned _width, unsigned _height)
     : filename (_filename), width (_width), height (_height)
@@ -230,8 +263,38 @@ public:
 
   virtual ~ImageSink () = 0;
 
+  // Add an extra layer, which will be written in addition to the
+  // normal color and alpha channels.  If COMPONENTS is empty, the layer
+  // has a single channel called NAME; otherwise it has one channel for
+  // each character in COMPONENTS, called NAME.C (where C is the
+  // character), e.g., "N.X", "N.Y", and "N.Z".  The values for each
+  // row are taken from ImageRow::layer_vals.
+  //
+  // This must be called before any rows are written.  If this image
+  // format doesn't support extra layers, false is returned.
+  //
+  virtual bool add_layer (const std::string &/*name*/,
+			  const std::string &/*components*/)
+  {
+    return false;
+  }
+
   virtual void write_row (const ImageRow &row) = 0;
 
+  // If this sink can write the image as separate tiles, in any order,
+  // return the size of the tiles (which are square); otherwise return
+  // zero.
+  //
+  virtual unsigned tile_size () const { return 0; }
+
+  // Write TILE, which must be one of the tiles in the grid of tiles
+  // whose size is returned by ImageSink::tile_size (tiles at the right
+  // and bottom edges of the image may be smaller).  This may only be
+  // used if ImageSink::tile_size returns non-zero, and rows and tiles
+  // may not both be written to the same sink.
+  //
+  virtual void write_tile (const ImageTile &tile);
+
   // Write previously written rows to disk, if possible.  This may flush
   // I/O buffers etc., but will not in any way change the output (so for
   // instance, it will _not_ flush the compression state of a PNG output
@@ -239,6 +302,13 @@ public:
   //
   virtual void flush ();
 
+  // Finish writing previously written rows; no more rows may be written
+  // afterwards.  Any error is signaled by throwing an exception.  The
+  // default does nothing, as most sinks finish writing the image file
+  // when they are destroyed.
+  //
+  virtual void close () { }
+
   virtual float max_intens () const;
 
   void open_err (const char *msg = "", bool use_errno = false)
@@ -11,6 +11,10 @@
 //
 
 #include <string>
+#include <algorithm>
+#include <iostream>
+
+#include "config.h"
 
 #include "snogmath.h"
 #include "snogassert.h"
@@ -19,6 +23,9 @@
 #include "mitchell-filt.h"
 #include "gauss-filt.h"
 #include "box-filt.h"
+#if USE_THREADS
+# include "image-async.h"
+#endif
 
 #include "image-output.h"
 
@@ -27,6 +34,95 @@ using namespace snogray;
 
 
 
+// The default number of rows which may be waiting to be written by an
+// AsyncImageSink writer thread.
+//
+#define DEFAULT_WRITE_QUEUE 64
+
+
+// Return an ImageSink for writing to FILENAME.  Unless disabled by the
+// "write-queue" parameter in PARAMS, the sink does the actual writing
+// in a separate thread, so that image encoding and I/O don't hold up
+// rendering.
+//
+static ImageSink *
+open_sink (const std::string &filename, unsigned width, unsigned height,
+	   const ValTable &params)
+{
+  ImageSink *sink = ImageSink::open (filename, width, height, params);
+
+#if USE_THREADS
+  unsigned write_queue = params.get_uint ("write-queue", DEFAULT_WRITE_QUEUE);
+  if (write_queue != 0)
+    sink = new AsyncImageSink (sink, write_queue);
+#endif
+
+  return sink;
+}
+
+
+// Raw row I/O, used for checkpointing
+
+// Write the floats in VALS to OUT, in native binary form.
+//
+static void
+write_raw_floats (std::ostream &out, const std::vector<float> &vals)
+{
+  if (! vals.empty ())
+    out.write (reinterpret_cast<const char *> (&vals[0]),
+	       vals.size () * sizeof (float));
+}
+
+// Read VALS.size() floats from IN, in native binary form, into VALS.
+// If IN ends prematurely, an exception is thrown.
+//
+static void
+read_raw_floats (std::istream &in, std::vector<float> &vals)
+{
+  if (! vals.empty ())
+    in.read (reinterpret_cast<char *> (&vals[0]),
+	     vals.size () * sizeof (float));
+  if (! in)
+    throw std::runtime_error ("premature end of checkpoint data");
+}
+
+// Write the pixels and layer values in ROW to OUT, in raw form.
+//
+static void
+write_raw_row (std::ostream &out, const ImageRow &row)
+{
+  std::vector<float> vals (row.width * 4);
+  for (unsigned x = 0; x < row.width; x++)
+    {
+      const Color &col = row[x].alpha_scaled_color ();
+      vals[x * 4] = col.r ();
+      vals[x * 4 + 1] = col.g ();
+      vals[x * 4 + 2] = col.b ();
+      vals[x * 4 + 3] = row[x].alpha;
+    }
+
+  write_raw_floats (out, vals);
+  write_raw_floats (out, row.layer_vals);
+}
+
+// Read the pixels and layer values in ROW, which should have
+// NUM_LAYER_CHANNELS layer channels, from IN, in the form written by
+// write_raw_row.
+//
+static void
+read_raw_row (std::istream &in, ImageRow &row, unsigned num_layer_channels)
+{
+  std::vector<float> vals (row.width * 4);
+  read_raw_floats (in, vals);
+  for (unsigned x = 0; x < row.width; x++)
+    row[x].set_scaled_rgba (vals[x * 4], vals[x * 4 + 1], vals[x * 4 + 2],
+			    vals[x * 4 + 3]);
+
+  row.layer_vals.resize (row.width * num_layer_channels);
+  read_raw_floats (in, row.layer_vals);
+}
+
+
 // Create an ImageOutput object for writing to FILENAME, with a size of
 // WIDTH, HEIGHT.  PARAMS holds any additional optional parameters.
 //
@@ -39,9 +135,65 @@ ImageOutput::ImageOutput (const std::string &filename,
     min_y (0),
     sample_base_x (params.get_float ("sample-base-x", 0)),
     sample_base_y (params.get_float ("sample-base-y", 0)),
-    sink (ImageSink::open (filename, _width, _height, params)),
-    filter_conv (params)
+    sink (open_sink (filename, _width, _height, params)),
+    filter_conv (params),
+    stream_tile_size (params.get_bool ("stream-tiles") ? sink->tile_size () : 0),
+    tile_filter_conv (params), row_log (0), closed (false)
 {
+  if (params.get_bool ("stream-tiles") && stream_tile_size == 0)
+    throw std::runtime_error (filename + ": output format does not support"
+			      " streaming tiles");
+}
+
+// Convert the accumulated samples in R to final pixel values (in
+// R.pixels), applying any intensity modifiers.
+//
+void
+ImageOutput::finish_pixels (SampleRow &r)
+{
+  unsigned num_pixels = r.pixels.width;
+
+  for (unsigned x = 0; x < num_pixels; x++)
+    {
+      Tint pixel = r.pixels[x];
+      Color col = pixel.alpha_scaled_color ();
+      Tint::alpha_t alpha = pixel.alpha;
+
+      float weight = r.weights[x];
+      if (weight > 0)
+	{
+	  col *= 1 / weight;
+	  alpha *= 1 / weight;
+	}
+
+      if (intensity_scale != 1)
+	col *= intensity_scale;
+      if (intensity_power != 1)
+	col = pow (max (col, 0.f), intensity_power);
+
+      r.pixels[x] = Tint (col, alpha);
+    }
+
+  // Extra layers are just averaged (or summed) within each pixel.
+  //
+  unsigned num_lchans = num_layer_channels ();
+  if (num_lchans != 0)
+    {
+      r.pixels.layer_vals.resize (num_pixels * num_lchans);
+
+      for (unsigned x = 0; x < num_pixels; x++)
+	{
+	  float weight = r.layer_weights[x];
+	  float inv_weight = weight > 0 ? 1 / weight : 0;
+
+	  for (unsigned c = 0; c < num_lchans; c++)
+	    {
+	      float sum = r.layer_sums[x * num_lchans + c];
+	      r.pixels.layer_vals[x * num_lchans + c]
+		= summed_layer_channels[c] ? sum : sum * inv_weight;
+	    }
+	}
+    }
 }
 
 void
@@ -66,29 +218,13 @@ ImageOutput::set_raw_min_y (int new_min_y)
       rows.pop_front ();
       min_y++;
 
-      for (unsigned x = 0; x < width; x++)
-	{
-	  Tint pixel = r->pixels[x];
-	  Color col = pixel.alpha_scaled_color ();
-	  Tint::alpha_t alpha = pixel.alpha;
-
-	  float weight = r->weights[x];
-	  if (weight > 0)
-	    {
-	      col *= 1 / weight;
-	      alpha *= 1 / weight;
-	    }
-
-	  if (intensity_scale != 1)
-	    col *= intensity_scale;
-	  if (intensity_power != 1)
-	    col = pow (max (col, 0.f), intensity_power);
-
-	  r->pixels[x] = Tint (col, alpha);
-	}
+      finish_pixels (*r);
 
       sink->write_row (r->pixels);
 
+      if (row_log)
+	write_raw_row (*row_log, r->pixels);
+
       delete r;
     }
 
@@ -97,13 +233,123 @@ ImageOutput::set_raw_min_y (int new_min_y)
 
 ImageOutput::~ImageOutput ()
 {
-  // Write as-yet unwritten rows
-  //
-  set_raw_min_y (height);
-  flush ();
+  if (! closed)
+    {
+      // Write as-yet unwritten rows
+      //
+      write_remaining ();
+      flush ();
+    }
+}
+
+// Write all pixels which haven't been written yet to the output image.
+//
+void
+ImageOutput::write_remaining ()
+{
+  if (stream_tile_size)
+    {
+      // Only tiles which have received samples are written; tiles
+      // which were never started would be empty anyway.
+      //
+      while (! tiles.empty ())
+	finish_tile (tiles.begin()->first);
+    }
+  else
+    set_raw_min_y (height);
+}
+
+// Write all remaining rows, and finish writing the output image.  Any
+// error is signaled by throwing an exception (errors which occur when
+// an ImageOutput object is destroyed without calling
+// ImageOutput::close can't be reported that way).  No more samples
+// may be added afterwards.
+//
+void
+ImageOutput::close ()
+{
+  if (! closed)
+    {
+      closed = true;
+      write_remaining ();
+      sink->close ();
+    }
 }
 
 
+// Checkpointing
+
+// Write the raw state of all rows which haven't been written to the
+// output image yet -- the accumulated sample values and weights,
+// before normalization -- to OUT.
+//
+void
+ImageOutput::save_state (std::ostream &out) const
+{
+  int hdr[2] = { min_y, int (rows.size ()) };
+  out.write (reinterpret_cast<const char *> (hdr), sizeof hdr);
+
+  for (std::deque<SampleRow *>::const_iterator ri = rows.begin ();
+       ri != rows.end (); ++ri)
+    {
+      const SampleRow &r = **ri;
+
+      write_raw_row (out, r.pixels);
+      write_raw_floats (out, r.weights);
+      write_raw_floats (out, r.layer_sums);
+      write_raw_floats (out, r.layer_weights);
+    }
+}
+
+// Restore the state saved by ImageOutput::save_state from STATE.  Any
+// rows which had already been written to the output image when the
+// state was saved are read from ROW_LOG, which should contain the
+// contents written to the row log (see ImageOutput::set_row_log), and
+// written to the output image again.  This must be called before any
+// samples are added.  If STATE or ROW_LOG is incomplete, an exception
+// is thrown.
+//
+void
+ImageOutput::restore_state (std::istream &state, std::istream &row_log)
+{
+  ASSERT (rows.empty () && min_y == 0);
+
+  int hdr[2];
+  state.read (reinterpret_cast<char *> (hdr), sizeof hdr);
+  if (! state)
+    throw std::runtime_error ("premature end of checkpoint data");
+
+  int saved_min_y = hdr[0], num_rows = hdr[1];
+  if (saved_min_y < 0 || saved_min_y > int (height)
+      || num_rows < 0 || saved_min_y + num_rows > int (height))
+    throw std::runtime_error ("invalid checkpoint data");
+
+  // Rows which were already written out are just copied to the sink
+  // again; they already have intensity-scaling, etc, applied.
+  //
+  ImageRow row (width);
+  for ( ; min_y < saved_min_y; min_y++)
+    {
+      read_raw_row (row_log, row, num_layer_channels ());
+      sink->write_row (row);
+    }
+
+  for (int i = 0; i < num_rows; i++)
+    {
+      SampleRow *r = new SampleRow (width, num_layer_channels ());
+      rows.push_back (r);
+
+      // Layer values are kept separately in unwritten rows.
+      //
+      read_raw_row (state, r->pixels, 0);
+
+      read_raw_floats (state, r->weights);
+      read_raw_floats (state, r->layer_sums);
+      read_raw_floats (state, r->layer_weights);
+    }
+}
+
+
 // Low-level row handling
 
 // Returns a row at absolute position Y.  Rows cannot be addressed
@@ -119,12 +365,57 @@ ImageOutput::_row (int y)
   // Add new rows as necessary
   //
   while (y >= min_y + int (rows.size ()))
-    rows.push_back (new SampleRow (width));
+    rows.push_back (new SampleRow (width, num_layer_channels ()));
 
   return *rows[y - min_y];
 }
 
 
+// Tiles
+
+// Return tile number TILE, creating it if necessary.
+//
+ImageOutput::SampleTile &
+ImageOutput::_sample_tile (unsigned tile)
+{
+  unsigned num_x_tiles = (width + stream_tile_size - 1) / stream_tile_size;
+  unsigned x = (tile % num_x_tiles) * stream_tile_size;
+  unsigned y = (tile / num_x_tiles) * stream_tile_size;
+
+  ASSERT (x < width && y < height);
+
+  SampleTile *t
+    = new SampleTile (x, y,
+		      min (stream_tile_size, width - x),
+		      min (stream_tile_size, height - y),
+		      num_layer_channels ());
+  tiles[tile] = t;
+
+  return *t;
+}
+
+// Write tile number TILE to the output image.  This should be called
+// when all pixels in TILE, and in a margin of
+// ImageOutput::filter_radius pixels around it, have been rendered;
+// no more samples may be added to it afterwards.
+//
+void
+ImageOutput::finish_tile (unsigned tile)
+{
+  SampleTile &t = sample_tile (tile);
+
+  finish_pixels (t);
+
+  ImageTile out (t.x, t.y, t.width, t.height);
+  std::swap (out.pixels, t.pixels);
+
+  tiles.erase (tile);
+  delete &t;
+
+  sink->write_tile (out);
+}
+
+
 // ImageOutput::add_sample
 
 // Add a sample with value TINT at floating point position SX, SY.
@@ -141,4 +432,76 @@ void ImageOutput::add_sample (float sx, float sy, const Tint &tint)
 }
 
 
+// Extra layers
+
+// Add an extra output layer, which will be written in addition to the
+// normal color and alpha channels; see ImageSink::add_layer for the
+// meaning of NAME and COMPONENTS.  Unlike color values, layer values
+// are not filtered; each sample only affects the pixel containing it.
+// The final value of each pixel is the average of the samples in it,
+// or their sum if SUM is true.  This must be called before any
+// samples are added.  If the output image format doesn't support
+// extra layers, an exception is thrown.
+//
+void
+ImageOutput::add_layer (const std::string &name, const std::string &components,
+			bool sum)
+{
+  ASSERT (rows.empty () && tiles.empty () && min_y == 0);
+
+  if (! sink->add_layer (name, components))
+    throw std::runtime_error (sink->filename + ": output format does not"
+			      " support extra layers (\"" + name + "\")");
+
+  unsigned num_chans = components.empty () ? 1 : components.length ();
+  summed_layer_channels.insert (summed_layer_channels.end (), num_chans, sum);
+}
+
+// Add a sample for all extra layers at floating point position SX, SY.
+// VALS points to ImageOutput::num_layer_channels values, in the order
+// the layers were added.
+//
+void
+ImageOutput::add_layer_sample (float sx, float sy, const float *vals)
+{
+  int px = int (floor (sx - sample_base_x));
+  int py = int (floor (sy - sample_base_y));
+
+  if (valid_x (px) && valid_y (py))
+    {
+      SampleRow &r = row (py);
+      unsigned num_lchans = num_layer_channels ();
+
+      for (unsigned c = 0; c < num_lchans; c++)
+	r.layer_sums[px * num_lchans + c] += vals[c];
+      r.layer_weights[px] += 1;
+    }
+}
+
+// Add a sample for all extra layers at floating point position SX,
+// SY to tile number TILE.  This is like the normal
+// ImageOutput::add_layer_sample method, except that only pixels in
+// TILE are affected.
+//
+void
+ImageOutput::add_layer_sample (unsigned tile, float sx, float sy,
+			       const float *vals)
+{
+  int px = int (floor (sx - sample_base_x));
+  int py = int (floor (sy - sample_base_y));
+
+  SampleTile &t = sample_tile (tile);
+
+  if (t.valid_x (px) && t.valid_y (py))
+    {
+      unsigned offs = (py - t.y) * t.width + (px - t.x);
+      unsigned num_lchans = num_layer_channels ();
+
+      for (unsigned c = 0; c < num_lchans; c++)
+	t.layer_sums[offs * num_lchans + c] += vals[c];
+      t.layer_weights[offs] += 1;
+    }
+}
+
+
 // arch-tag: b4e1bbd7-c070-4ac9-9075-b9abcaefc30a
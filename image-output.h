@@ -16,6 +16,8 @@
 #include <string>
 #include <vector>
 #include <deque>
+#include <map>
+#include <iosfwd>
 
 #include "unique-ptr.h"
 #include "filter-conv.h"
@@ -24,6 +26,23 @@
 
 namespace snogray {
 
+// High-level image output, which accumulates (filtered) samples into
+// pixels, and writes the pixels to an image file.
+//
+// Normally the image is written in rows, and the rows around the
+// current rendering position are buffered in memory until they can't
+// receive any more samples.
+//
+// Alternatively, if the "stream-tiles" parameter is true, and the
+// output image format supports it, the image is written in tiles, and
+// only tiles which are being rendered are kept in memory.  Each tile
+// receives samples only from its own pixels and a margin of
+// ImageOutput::filter_radius pixels around it (see RenderPattern),
+// so once those have been rendered, the tile is finished, and can be
+// written to the output image (see ImageOutput::finish_tile).  This
+// keeps memory use small regardless of the image's width, at the cost
+// of rendering the margins of adjacent tiles twice.
+//
 class ImageOutput
 {
 public:
@@ -32,16 +51,55 @@ public:
   //
   struct SampleRow
   {
-    SampleRow (unsigned width) : pixels (width), weights (width) { }
+    SampleRow (unsigned width, unsigned num_layer_channels = 0)
+      : pixels (width), weights (width),
+	layer_sums (width * num_layer_channels),
+	layer_weights (num_layer_channels ? width : 0)
+    { }
 
     void clear ()
     {
       pixels.clear ();
       weights.assign (weights.size(), 0);
+      layer_sums.assign (layer_sums.size(), 0);
+      layer_weights.assign (layer_weights.size(), 0);
     }
 
     ImageRow pixels;
     std::vector<float> weights;
+
+    // Sums of extra-layer samples for each pixel (all channels of all
+    // layers for each pixel together), and the number of such samples
+    // in each pixel.
+    //
+    std::vector<float> layer_sums;
+    std::vector<float> layer_weights;
+  };
+
+  // A tile being accumulated.  This is just a SampleRow holding all
+  // the tile's pixels, in row-major order, plus the tile's location.
+  //
+  struct SampleTile : SampleRow
+  {
+    SampleTile (int _x, int _y, unsigned _width, unsigned _height,
+		unsigned num_layer_channels)
+      : SampleRow (_width * _height, num_layer_channels),
+	x (_x), y (_y), width (_width), height (_height)
+    { }
+
+    // [These methods are callbacks used by FilterConv<SampleTile>.]
+    //
+    bool valid_x (int px) { return px >= x && px < x + int (width); }
+    bool valid_y (int py) { return py >= y && py < y + int (height); }
+    void add_sample (int px, int py, const Tint &tint, float weight)
+    {
+      unsigned offs = (py - y) * width + (px - x);
+      pixels[offs] += tint;
+      weights[offs] += weight;
+    }
+
+    int x, y;
+    unsigned width, height;
   };
 
   // Create an ImageOutput object for writing to FILENAME, with a size
@@ -60,6 +118,62 @@ public:
   //
   void add_sample (float sx, float sy, const Tint &tint);
 
+  // Add an extra output layer, which will be written in addition to the
+  // normal color and alpha channels; see ImageSink::add_layer for the
+  // meaning of NAME and COMPONENTS.  Unlike color values, layer values
+  // are not filtered; each sample only affects the pixel containing it.
+  // The final value of each pixel is the average of the samples in it,
+  // or their sum if SUM is true.  This must be called before any
+  // samples are added.  If the output image format doesn't support
+  // extra layers, an exception is thrown.
+  //
+  void add_layer (const std::string &name, const std::string &components,
+		  bool sum = false);
+
+  // Return the total number of channels in all extra layers.
+  //
+  unsigned num_layer_channels () const { return summed_layer_channels.size (); }
+
+  // Add a sample for all extra layers at floating point position SX, SY.
+  // VALS points to ImageOutput::num_layer_channels values, in the order
+  // the layers were added.
+  //
+  void add_layer_sample (float sx, float sy, const float *vals);
+
+  // Tile-streaming support.
+
+  // If the output is being written as tiles, return the size of each
+  // tile (which are square), otherwise return zero.  Tiles are numbered
+  // in scanline order.
+  //
+  unsigned tile_size () const { return stream_tile_size; }
+
+  // Add a sample with value TINT at floating point position SX, SY to
+  // tile number TILE.  This is like the normal ImageOutput::add_sample
+  // method, except that only pixels in TILE are affected.
+  //
+  void add_sample (unsigned tile, float sx, float sy, const Tint &tint)
+  {
+    sx -= sample_base_x;
+    sy -= sample_base_y;
+    tile_filter_conv.add_sample (sx, sy, tint, sample_tile (tile));
+  }
+
+  // Add a sample for all extra layers at floating point position SX,
+  // SY to tile number TILE.  This is like the normal
+  // ImageOutput::add_layer_sample method, except that only pixels in
+  // TILE are affected.
+  //
+  void add_layer_sample (unsigned tile, float sx, float sy,
+			 const float *vals);
+
+  // Write tile number TILE to the output image.  This should be called
+  // when all pixels in TILE, and in a margin of
+  // ImageOutput::filter_radius pixels around it, have been rendered;
+  // no more samples may be added to it afterwards.
+  //
+  void finish_tile (unsigned tile);
+
   // Write the completed portion of the output image to disk, if possible.
   // This may flush I/O buffers etc., but will not in any way change the
   // output (so for instance, it will _not_ flush the compression state of
@@ -67,6 +181,14 @@ public:
   //
   void flush () { sink->flush (); }
 
+  // Write all remaining rows, and finish writing the output image.  Any
+  // error is signaled by throwing an exception (errors which occur when
+  // an ImageOutput object is destroyed without calling
+  // ImageOutput::close can't be reported that way).  No more samples
+  // may be added afterwards.
+  //
+  void close ();
+
   // Return true if the output has an alpha (opacity) channel.
   //
   bool has_alpha_channel () const { return sink->has_alpha_channel (); }
@@ -77,6 +199,11 @@ public:
   //
   void set_min_sample_y (int new_min_y)
   {
+    // When writing tiles, rows aren't used at all.
+    //
+    if (stream_tile_size)
+      return;
+
     // Set the raw min_y leaving some room for the filter support,
     // and converting between the sample coordinate-system and the
     // output-image coordinate-system.
@@ -124,6 +251,36 @@ public:
   bool valid_x (int px) { return px >= 0 && px < int (width); }
   bool valid_y (int py) { return py >= min_y && py < int (height); }
 
+  // Checkpointing support.  These methods are used to save the state of
+  // a partially written image, so that it can be restored exactly later.
+
+  // If LOG is non-zero, each row subsequently written to the output
+  // image is also written to LOG, in raw binary form, so that it can
+  // later be restored by ImageOutput::restore_state.
+  //
+  void set_row_log (std::ostream *log) { row_log = log; }
+
+  // Write the raw state of all rows which haven't been written to the
+  // output image yet -- the accumulated sample values and weights,
+  // before normalization -- to OUT.
+  //
+  void save_state (std::ostream &out) const;
+
+  // Restore the state saved by ImageOutput::save_state from STATE.  Any
+  // rows which had already been written to the output image when the
+  // state was saved are read from ROW_LOG, which should contain the
+  // contents written to the row log (see ImageOutput::set_row_log), and
+  // written to the output image again.  This must be called before any
+  // samples are added.  If STATE or ROW_LOG is incomplete, an exception
+  // is thrown.
+  //
+  void restore_state (std::istream &state, std::istream &row_log);
+
+  // Return the number of rows which have been written to the output
+  // image so far.
+  //
+  unsigned num_rows_written () const { return min_y; }
+
   // Returns a row at absolute position Y.  Rows cannot be addressed
   // completely randomly, as only rows above ImageOutput::min_y are
   // buffered in memory; if a row less than ImageOutput::min_y is
@@ -171,6 +328,31 @@ private:
   //
   SampleRow &_row (int y);
 
+  // Return tile number TILE, creating it if necessary.
+  //
+  SampleTile &sample_tile (unsigned tile)
+  {
+    std::map<unsigned, SampleTile *>::iterator ti = tiles.find (tile);
+    if (ti != tiles.end ())
+      return *ti->second;
+    else
+      return _sample_tile (tile);
+  }
+
+  // Internal version of the ImageOutput::sample_tile() method which
+  // handles tiles not in ImageOutput::tiles.
+  //
+  SampleTile &_sample_tile (unsigned tile);
+
+  // Convert the accumulated samples in R to final pixel values (in
+  // R.pixels), applying any intensity modifiers.
+  //
+  void finish_pixels (SampleRow &r);
+
+  // Write all pixels which haven't been written yet to the output image.
+  //
+  void write_remaining ();
+
   // Where the output goes.
   //
   UniquePtr<ImageSink> sink;
@@ -181,6 +363,33 @@ private:
   // ImageOutput::min_y.
   //
   std::deque<SampleRow *> rows;
+
+  // If non-zero, the output is being written as tiles of this size,
+  // instead of as rows.
+  //
+  unsigned stream_tile_size;
+
+  // Tiles currently being accumulated, indexed by tile number.
+  //
+  std::map<unsigned, SampleTile *> tiles;
+
+  // Filter convolver used to add samples to tiles.
+  //
+  FilterConv<SampleTile, Tint> tile_filter_conv;
+
+  // For each channel in all extra layers, true if its values should be
+  // summed instead of averaged.
+  //
+  std::vector<bool> summed_layer_channels;
+
+  // If non-zero, each row written to the output image is also written
+  // here, in raw form.
+  //
+  std::ostream *row_log;
+
+  // True if ImageOutput::close has been called.
+  //
+  bool closed;
 };
 
 }
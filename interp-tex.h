@@ -41,8 +41,35 @@ public:
     return linterp (c, v1, v2);
   }
 
+  virtual void eval_batch (const TexCoords *tex_coords, T *results,
+			   unsigned num)
+    const
+  {
+    float cs[Tex<T>::BATCH_CHUNK];
+    T vals2[Tex<T>::BATCH_CHUNK];
+
+    while (num > 0)
+      {
+	unsigned chunk = num;
+	if (chunk > Tex<T>::BATCH_CHUNK)
+	  chunk = Tex<T>::BATCH_CHUNK;
+
+	control.eval_batch (tex_coords, cs, chunk);
+	val1.eval_batch (tex_coords, results, chunk);
+	val2.eval_batch (tex_coords, vals2, chunk);
+	for (unsigned i = 0; i < chunk; i++)
+	  results[i] = linterp (cs[i], results[i], vals2[i]);
+
+	tex_coords += chunk;
+	results += chunk;
+	num -= chunk;
+      }
+  }
+
 private:
 
+  friend class TexCompiler;
+
   const TexVal<float> control;
   const TexVal<T> val1, val2;
 };
@@ -68,8 +95,35 @@ public:
     return sinterp (c, v1, v2);
   }
 
+  virtual void eval_batch (const TexCoords *tex_coords, T *results,
+			   unsigned num)
+    const
+  {
+    float cs[Tex<T>::BATCH_CHUNK];
+    T vals2[Tex<T>::BATCH_CHUNK];
+
+    while (num > 0)
+      {
+	unsigned chunk = num;
+	if (chunk > Tex<T>::BATCH_CHUNK)
+	  chunk = Tex<T>::BATCH_CHUNK;
+
+	control.eval_batch (tex_coords, cs, chunk);
+	val1.eval_batch (tex_coords, results, chunk);
+	val2.eval_batch (tex_coords, vals2, chunk);
+	for (unsigned i = 0; i < chunk; i++)
+	  results[i] = sinterp (cs[i], results[i], vals2[i]);
+
+	tex_coords += chunk;
+	results += chunk;
+	num -= chunk;
+      }
+  }
+
 private:
 
+  friend class TexCompiler;
+
   const TexVal<float> control;
   const TexVal<T> val1, val2;
 };
@@ -33,23 +33,24 @@ bump_map (Frame &normal_frame, const Ref<const Tex<float> > &tex,
   //
   dist_t ds = 0.001f, dt = 0.001f;
       
-  // Non-perturbed bump-map value.
+  // Coordinates at which to evaluate the bump-map:  the original
+  // location, and locations slightly offset in the s and t directions.
   //
-  float origin_depth = tex->eval (tex_coords);
-
-  // Evaluate bump-map in s direction.
+  TexCoords coords[3] = {
+    tex_coords,
+    TexCoords (tex_coords.pos + normal_frame.x * ds, tex_coords.uv + dTds * ds,
+	       tex_coords.pos_width, tex_coords.uv_width),
+    TexCoords (tex_coords.pos + normal_frame.y * dt, tex_coords.uv + dTdt * dt,
+	       tex_coords.pos_width, tex_coords.uv_width)
+  };
+
+  // Evaluate all three at once.
   //
-  Pos ds_pos = tex_coords.pos + normal_frame.x * ds;
-  UV ds_uv = tex_coords.uv + dTds * ds;
-  TexCoords ds_tex_coords (ds_pos, ds_uv);
-  float ds_delta = tex->eval (ds_tex_coords) - origin_depth;
+  float depths[3];
+  tex->eval_batch (coords, depths, 3);
 
-  // Evaluate bump-map in t direction.
-  //
-  Pos dt_pos = tex_coords.pos + normal_frame.y * dt;
-  UV dt_uv = tex_coords.uv + dTdt * dt;
-  TexCoords dt_tex_coords (dt_pos, dt_uv);
-  float dt_delta = tex->eval (dt_tex_coords) - origin_depth;
+  float ds_delta = depths[1] - depths[0];
+  float dt_delta = depths[2] - depths[0];
 
   if (ds_delta != 0 || dt_delta != 0)
     {
@@ -84,6 +85,37 @@ bump_map (Frame &normal_frame, const Ref<const Tex<float> > &tex,
 void
 Intersect::finish_init (const Ray &ray, const UV &dTds, const UV &dTdt)
 {
+  // If RAY is an eye-ray, estimate the size of the area around this
+  // intersection which it represents, for use in texture filtering.
+  // Only the first intersection of an eye-ray uses its spread, so it's
+  // reset afterwards.
+  //
+  if (context.eye_ray_spread != 0)
+    {
+      // Width of the ray's footprint perpendicular to the ray, at the
+      // point of intersection.
+      //
+      dist_t ray_len = ray.dir.length ();
+      dist_t width = context.eye_ray_spread * ray.t1 * ray_len;
+
+      // The footprint is stretched when the surface is seen at a
+      // glancing angle; the limit keeps it from becoming enormous.
+      //
+      float cos_v = abs (dot (geom_frame.z, ray.dir)) / ray_len;
+      width /= sqrt (max (cos_v, 0.01f));
+
+      // Scale to texture-coordinate units using the rate of change of
+      // the texture coordinates along the surface.
+      //
+      float dT = sqrt (max (dTds.u * dTds.u + dTds.v * dTds.v,
+			    dTdt.u * dTdt.u + dTdt.v * dTdt.v));
+
+      tex_coords.pos_width = width;
+      tex_coords.uv_width = width * dT;
+
+      context.eye_ray_spread = 0;
+    }
+
   if (material.bump_map)
     bump_map (normal_frame, material.bump_map, tex_coords, dTds, dTdt);
 
@@ -0,0 +1,175 @@
+// isec-mailbox.h -- Exact per-search mailboxing for intersection testing
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef __ISEC_MAILBOX_H__
+#define __ISEC_MAILBOX_H__
+
+
+namespace snogray {
+
+
+class Surface;
+
+
+// An alternative to IsecCache which remembers _every_ surface added
+// during a search, instead of using a fixed-size direct-mapped table.
+//
+// It is an open-addressed hash set, which is grown whenever it becomes
+// half full, so entries are never lost to collisions.  The table
+// persists across searches (clearing it just increments a generation
+// counter), so after a few searches it will be large enough for the
+// typical number of surfaces a search touches.
+//
+// This has the same interface as IsecCache, so either can be used by
+// a space-search.
+//
+class IsecMailbox
+{
+public:
+
+  IsecMailbox ()
+    : gen (1), table_size (INITIAL_TABLE_SIZE), num_entries (0),
+      mboxes (new Mbox[INITIAL_TABLE_SIZE])
+  {
+    for (unsigned i = 0; i < table_size; i++)
+      mboxes[i].gen = 0;
+  }
+  ~IsecMailbox () { delete[] mboxes; }
+
+  // Mark all entries as out-of-date.  This is very fast.
+  //
+  void clear ()
+  {
+    num_entries = 0;
+
+    // If the generation counter wraps around, old entries might appear
+    // to be up-to-date, so really clear the table in that case.
+    //
+    if (++gen == 0)
+      {
+	for (unsigned i = 0; i < table_size; i++)
+	  mboxes[i].gen = 0;
+	gen = 1;
+      }
+  }
+
+  // Return true if there's an up-to-date entry for SURF.
+  //
+  bool contains (const Surface *surf) const
+  {
+    unsigned mask = table_size - 1;
+    for (unsigned i = hash (surf) & mask; ; i = (i + 1) & mask)
+      {
+	const Mbox &mbox = mboxes[i];
+	if (mbox.gen != gen)
+	  return false;
+	if (mbox.surf == surf)
+	  return true;
+      }
+  }
+
+  // Add an up-to-date entry for SURF, which should not already be
+  // present.  Return true if a collision occurred (the new entry
+  // removed an old one), which for this class is never the case.
+  //
+  bool add (const Surface *surf)
+  {
+    if ((num_entries + 1) * 2 > table_size)
+      grow ();
+
+    insert (surf);
+    num_entries++;
+
+    return false;
+  }
+
+  // Pool object protocol methods.
+  //
+  void acquire () { clear (); }
+  void release () { }
+
+private:
+
+  typedef unsigned hash_t;
+  typedef unsigned gen_t;
+
+  // Initial size of the hash table; this must be a power of two.
+  //
+  static const unsigned INITIAL_TABLE_SIZE = 64;
+
+  struct Mbox
+  {
+    gen_t gen;
+    const Surface *surf;
+  };
+
+  IsecMailbox (const IsecMailbox &);		// not defined
+  void operator= (const IsecMailbox &);		// not defined
+
+  hash_t hash (const Surface *surf) const
+  {
+    // Surfaces are usually allocated close together, so mix the
+    // pointer bits up a bit; the low bits are always zero.
+    //
+    hash_t h = hash_t (((unsigned long)surf) >> 3);
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h;
+  }
+
+  // Store SURF in the first free slot of its probe sequence.
+  //
+  void insert (const Surface *surf)
+  {
+    unsigned mask = table_size - 1;
+    unsigned i = hash (surf) & mask;
+    while (mboxes[i].gen == gen)
+      i = (i + 1) & mask;
+    mboxes[i].surf = surf;
+    mboxes[i].gen = gen;
+  }
+
+  // Double the size of the table, keeping all up-to-date entries.
+  //
+  void grow ()
+  {
+    Mbox *old_mboxes = mboxes;
+    unsigned old_table_size = table_size;
+
+    table_size *= 2;
+    mboxes = new Mbox[table_size];
+    for (unsigned i = 0; i < table_size; i++)
+      mboxes[i].gen = 0;
+
+    for (unsigned i = 0; i < old_table_size; i++)
+      if (old_mboxes[i].gen == gen)
+	insert (old_mboxes[i].surf);
+
+    delete[] old_mboxes;
+  }
+
+  gen_t gen;
+
+  // Number of slots in MBOXES (always a power of two), and the number
+  // of them which are up-to-date.
+  //
+  unsigned table_size, num_entries;
+
+  Mbox *mboxes;
+};
+
+
+}
+
+
+#endif // __ISEC_MAILBOX_H__
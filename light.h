@@ -112,7 +112,7 @@ public:
     dist_t dist;
   };
 
-  Light () { }
+  Light () : num (0) { }
   virtual ~Light () { }
 
   // Return a sample of this light from the viewpoint of ISEC (using a
@@ -131,6 +131,17 @@ public:
   //
   virtual Value eval (const Intersect &isec, const Vec &dir) const = 0;
 
+  // Return the pdf which the free-sampling variant of Light::sample
+  // would have for a sample that reaches VIEWPOINT from direction DIR
+  // (in world coordinates, pointing from VIEWPOINT towards the light),
+  // in the same terms as Light::FreeSample::pdf.  If no free sample
+  // could reach VIEWPOINT from DIR, zero is returned.
+  //
+  // For point lights, only the direction of emission is considered.
+  //
+  virtual float free_sample_pdf (const Pos &viewpoint, const Vec &dir)
+    const = 0;
+
   // Return true if this is a point light.
   //
   virtual bool is_point_light () const { return false; }
@@ -148,6 +159,11 @@ public:
   // after the entire scene has been loaded.
   //
   virtual void scene_setup (const Scene &/*scene*/) { }
+
+  // The index of this light in the scene's list of lights (set by
+  // Scene::add).  This can be used to index per-light data.
+  //
+  unsigned num;
 };
 
 
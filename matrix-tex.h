@@ -19,6 +19,7 @@
 #include "tex.h"
 #include "tuple-matrix.h"
 #include "matrix-linterp.h"
+#include "tex-cache.h"
 
 
 namespace snogray {
@@ -31,6 +32,10 @@ class MatrixTex : public Tex<T>
 {
 public:
 
+  // If the global texture cache (TEX_CACHE) is enabled, texels are
+  // fetched through it instead of loading the whole image into memory;
+  // in that case, MatrixTex::matrix is zero.
+  //
   MatrixTex (const std::string &filename,
 	     const ValTable &params = ValTable::NONE);
 
@@ -48,6 +53,12 @@ public:
   //
   virtual T eval (const TexCoords &tex_coords) const;
 
+  // Evaluate this texture at each of the NUM coordinates in TEX_COORDS,
+  // storing the results into RESULTS.
+  //
+  virtual void eval_batch (const TexCoords *tex_coords, T *results,
+			   unsigned num)
+    const;
 
 private:
 
@@ -106,12 +117,24 @@ public:
 
   const_iterator end () const {return const_iterator(*this, 0, matrix->height);}
 
-  // Matrix holding data for this texture.
+  // Matrix holding data for this texture.  This is zero if the texture
+  // is fetched through the texture cache.
   //
   Ref<TupleMatrix<T, DT> > matrix;
 
 private:
 
+  typedef TupleAdaptor<T, DT> TA;
+
+  // Return true if an image loaded with PARAMS should be fetched
+  // through the texture cache.
+  //
+  static bool use_tex_cache (const ValTable &params);
+
+  // If non-zero, the texture-cache image this texture fetches from.
+  //
+  Ref<TexCache::Image> cached_image;
+
   const MatrixLinterp interp;
 };
 
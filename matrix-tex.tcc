@@ -25,10 +25,21 @@
 namespace snogray {
 
 
+// If the global texture cache (TEX_CACHE) is enabled, texels are
+// fetched through it instead of loading the whole image into memory; in
+// that case, MatrixTex::matrix is zero.
+//
 template<typename T, typename DT>
 MatrixTex<T,DT>::MatrixTex (const std::string &filename, const ValTable &params)
-  : matrix (new TupleMatrix<T,DT> (filename, params)),
-    interp (matrix->width, matrix->height)
+  : matrix (use_tex_cache (params)
+	    ? 0
+	    : new TupleMatrix<T,DT> (filename, params)),
+    cached_image (use_tex_cache (params)
+		  ? new TexCache::Image (tex_cache, filename, TA::TUPLE_LEN,
+					 params)
+		  : 0),
+    interp (matrix ? matrix->width : cached_image->width,
+	    matrix ? matrix->height : cached_image->height)
 { }
 
 template<typename T, typename DT>
@@ -44,12 +55,42 @@ MatrixTex<T,DT>::MatrixTex (const TupleMatrix<T,DT> &base,
     interp (matrix->width, matrix->height)
 { }
 
+// Return true if an image loaded with PARAMS should be fetched through
+// the texture cache.
+//
+template<typename T, typename DT>
+bool
+MatrixTex<T,DT>::use_tex_cache (const ValTable &params)
+{
+  // The texture cache doesn't support image borders or row reversal.
+  //
+  return (tex_cache.enabled ()
+	  && !params.contains ("border")
+	  && !params.contains ("reverse-rows"));
+}
+
 // Evaluate this texture at TEX_COORDS.
 //
 template<typename T, typename DT>
 T
 MatrixTex<T,DT>::eval (const TexCoords &tex_coords) const
 {
+  if (cached_image)
+    {
+      // Choose a MIP level where one texel is about the size of the
+      // lookup's footprint.
+      //
+      float level = 0;
+      float footprint
+	= tex_coords.uv_width * max (cached_image->width, cached_image->height);
+      if (footprint > 1)
+	level = log (footprint) * 1.442695f; // log2 (footprint)
+
+      float texel[TexCache::Image::MAX_TUPLE_LEN];
+      cached_image->lookup (tex_coords.uv, level, texel);
+      return TupleAdaptor<T, const float> (texel);
+    }
+
   unsigned xi_lo, yi_lo, xi_hi, yi_hi;
   float x_lo_fr, y_lo_fr, x_hi_fr, y_hi_fr;
   interp.calc_params (tex_coords.uv, xi_lo, yi_lo, xi_hi, yi_hi,
@@ -66,6 +107,19 @@ MatrixTex<T,DT>::eval (const TexCoords &tex_coords) const
     + x_hi_fr * y_hi_fr * (*matrix) (xi_hi, yi_hi);
 }
 
+// Evaluate this texture at each of the NUM coordinates in TEX_COORDS,
+// storing the results into RESULTS.
+//
+template<typename T, typename DT>
+void
+MatrixTex<T,DT>::eval_batch (const TexCoords *tex_coords, T *results,
+			     unsigned num)
+  const
+{
+  for (unsigned i = 0; i < num; i++)
+    results[i] = MatrixTex::eval (tex_coords[i]);
+}
+
 
 // If possible, suppress instantiation of classes which we will define
 // out-of-line.
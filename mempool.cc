@@ -30,10 +30,29 @@ Mempool::_get (size_t size)
 {
   if (size > large_size)
     {
-      // A very large allocation; allocate an individual block from the system.
+      // A very large allocation; use a dedicated block.  Large blocks
+      // are rounded up to a power-of-two size-class, so that they can be
+      // reused for other allocations after the pool is reset.
 
-      large_blocks = new Block (new char [size], large_blocks);
-      return large_blocks->mem;
+      unsigned sc = size_class (size);
+      Block *block = free_large_blocks[sc];
+
+      if (block)
+	free_large_blocks[sc] = block->next;
+      else
+	{
+	  // No free block of the right size-class, get one from the system.
+
+	  block = new Block (new char [size_t (1) << sc], 0, sc);
+	  _num_large_allocs++;
+	}
+
+      block->next = large_blocks;
+      large_blocks = block;
+
+      large_bytes += size_t (1) << sc;
+
+      return block->mem;
     }
   else
     {
@@ -56,8 +75,12 @@ Mempool::_get (size_t size)
 	  blocks = new Block (new char [block_size], blocks);
 	  beg = blocks->mem;
 	  end = beg + block_size;
+
+	  _num_block_refills++;
 	}
 
+      num_used_blocks++;
+
       // Finally, allocate from the small-allocation arena, now guaranteed
       // to be useable.
       //
@@ -67,7 +90,7 @@ Mempool::_get (size_t size)
     }
 }
 
-
+
 
 // Return all blocks in BLOCK_LIST to the system, and set BLOCK_LIST to
 // zero.
@@ -91,12 +114,35 @@ Mempool::free_blocks (Block *&block_list)
 // Return all memory allocate from this pool to the pool.  This is the
 // only way to reclaim memory allocated with Mempool::get.
 //
+// Memory is not returned to the system, but retained for use by
+// subsequent allocations, so a pool which is repeatedly used for
+// similar allocation patterns and then reset will quickly stop
+// allocating memory from the system at all.
+//
 void
 Mempool::reset ()
 {
+  // Update the peak-usage statistic.  The remaining space in the current
+  // small-allocation block isn't counted.
+  //
+  size_t used_bytes = num_used_blocks * block_size - (end - beg) + large_bytes;
+  if (used_bytes > _peak_bytes)
+    _peak_bytes = used_bytes;
+
+  // Move large blocks to the free-lists for their size-class.
+  //
+  while (large_blocks)
+    {
+      Block *block = large_blocks;
+      large_blocks = block->next;
+      block->next = free_large_blocks[block->size_class];
+      free_large_blocks[block->size_class] = block;
+    }
+
   avail = blocks;
   beg = end = 0;
-  free_blocks (large_blocks);
+  num_used_blocks = 0;
+  large_bytes = 0;
 }
 
 // Return all allocated and available memory to the system.
@@ -106,6 +152,8 @@ Mempool::clear ()
 {
   reset ();
   free_blocks (blocks);
+  for (unsigned i = 0; i < NUM_SIZE_CLASSES; i++)
+    free_blocks (free_large_blocks[i]);
 }
 
 
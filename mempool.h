@@ -32,11 +32,21 @@ public:
   static const size_t DEFAULT_BLOCK_SIZE = 16384;
   static const size_t DEFAULT_LARGE_SIZE = 8192;
 
+  // The number of size-classes used for retaining large blocks.  Size
+  // class N holds blocks of size 2^N.
+  //
+  static const unsigned NUM_SIZE_CLASSES = sizeof (size_t) * 8;
+
   Mempool (size_t _block_size = DEFAULT_BLOCK_SIZE,
 	   size_t _large_size = DEFAULT_LARGE_SIZE)
     : beg (0), end (0), blocks (0), avail (0), large_blocks (0),
-      block_size (_block_size), large_size (_large_size)
-  { }
+      num_used_blocks (0), large_bytes (0),
+      block_size (_block_size), large_size (_large_size),
+      _peak_bytes (0), _num_block_refills (0), _num_large_allocs (0)
+  {
+    for (unsigned i = 0; i < NUM_SIZE_CLASSES; i++)
+      free_large_blocks[i] = 0;
+  }
   ~Mempool () { clear (); }
 
   // Allocate a block of memory from this pool.
@@ -63,23 +73,62 @@ public:
   // Return all memory allocate from this pool to the pool.  This is the
   // only way to reclaim memory allocated with Mempool::get.
   //
+  // Memory is not returned to the system, but retained for use by
+  // subsequent allocations, so a pool which is repeatedly used for
+  // similar allocation patterns and then reset will quickly stop
+  // allocating memory from the system at all.
+  //
   void reset ();
 
   // Return all allocated and available memory to the system.
   //
   void clear ();
 
+  // Return the largest number of bytes that has been allocated from
+  // this pool between resets.  This is only updated when the pool is
+  // reset.
+  //
+  size_t peak_bytes () const { return _peak_bytes; }
+
+  // Return the number of times a new block for small allocations had to
+  // be allocated from the system.
+  //
+  unsigned long long num_block_refills () const { return _num_block_refills; }
+
+  // Return the number of times a large allocation could not be satisfied
+  // using a previously allocated large block, and so had to be allocated
+  // from the system.
+  //
+  unsigned long long num_large_allocs () const { return _num_large_allocs; }
+
 private:
 
   // A chunk of memory allocated from the OS.
   //
   struct Block
   {
-    Block (char *_mem, Block *_next) : mem (_mem), next (_next) { }
+    Block (char *_mem, Block *_next, unsigned _size_class = 0)
+      : mem (_mem), next (_next), size_class (_size_class)
+    { }
     char *mem;
     Block *next;
+
+    // For large blocks, the size-class of this block; the block's
+    // size is 2^SIZE_CLASS.
+    //
+    unsigned size_class;
   };
 
+  // Return the smallest size-class whose blocks can hold SIZE bytes.
+  //
+  static unsigned size_class (size_t size)
+  {
+    unsigned sc = 0;
+    while ((size_t (1) << sc) < size)
+      sc++;
+    return sc;
+  }
+
 
   // Allocate a block of memory from this pool.  Unlike the Mempool::get
   // method, this method knows how to allocate large blocks or refill the
@@ -111,11 +160,22 @@ private:
   Block *avail;
 
   // Blocks too large to be allocated using the default mechanism, each
-  // dedicated to a single user allocation.  These are returned the system
-  // when reseting.
+  // dedicated to a single user allocation.  When the pool is reset,
+  // these are moved to the appropriate FREE_LARGE_BLOCKS list.
   //
   Block *large_blocks;
 
+  // Lists of unused large blocks, indexed by size-class.
+  //
+  Block *free_large_blocks[NUM_SIZE_CLASSES];
+
+  // The number of small-allocation blocks used since the last reset,
+  // and the number of bytes in large blocks used since the last reset.
+  // These are only used for statistics.
+  //
+  unsigned num_used_blocks;
+  size_t large_bytes;
+
   // The size of the blocks used for normal allocations.
   //
   size_t block_size;
@@ -124,6 +184,12 @@ private:
   // LARGE_BLOCKS list.
   //
   size_t large_size;
+
+  // Statistics.
+  //
+  size_t _peak_bytes;
+  unsigned long long _num_block_refills;
+  unsigned long long _num_large_allocs;
 };
 
 
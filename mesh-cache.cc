@@ -0,0 +1,463 @@
+// mesh-cache.cc -- Cache of binary mesh snapshots
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "config.h"
+
+extern "C"
+{
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#if HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+}
+
+#include "mesh.h"
+#include "mutex.h"
+#include "string-funs.h"
+
+#include "mesh-cache.h"
+
+
+using namespace snogray;
+
+
+// Directory in which mesh snapshots are stored.  If empty (the
+// default), no caching is done.
+//
+std::string snogray::mesh_cache_dir;
+
+
+// Snapshot file format.  All values are in native byte order, as
+// snapshots are only intended to be read back by the same program on the
+// same machine.
+//
+//   "SNOGMESH"			magic number (8 bytes)
+//   uint32			key length
+//   bytes			key
+//   uint64			source-file size
+//   int64			source-file modification time
+//   uint32			1 if left-handed, 0 otherwise
+//   3 x double			mesh axis
+//   uint32 x 4			number of vertices, triangles,
+//				vertex normals, and vertex UVs
+//   3 x scoord_t per vertex
+//   3 x sdist_t per vertex normal
+//   2 x float per vertex UV
+//   3 x uint32 per triangle	triangle vertex indices
+//
+// Any change to the format must be reflected in SNAPSHOT_VERSION, which
+// is part of the key.
+
+#define SNAPSHOT_MAGIC "SNOGMESH"
+#define SNAPSHOT_MAGIC_LEN 8
+#define SNAPSHOT_VERSION 2
+
+
+
+// Snapshot reading/writing helpers
+
+// Write the raw bytes of VAL to STREAM.
+//
+template<typename T>
+static void
+write_raw (std::ostream &stream, const T &val)
+{
+  stream.write (reinterpret_cast<const char *> (&val), sizeof val);
+}
+
+// A simple cursor for reading values from a memory buffer.
+//
+class SnapshotReader
+{
+public:
+
+  SnapshotReader (const char *_beg, const char *_end)
+    : pos (_beg), end (_end)
+  { }
+
+  // Read a single value of type T into VAL, returning false if there's
+  // not enough data.
+  //
+  template<typename T>
+  bool read (T &val)
+  {
+    if (size_t (end - pos) < sizeof val)
+      return false;
+    memcpy (&val, pos, sizeof val);
+    pos += sizeof val;
+    return true;
+  }
+
+  // Return a pointer to the next LEN bytes of data, and advance past
+  // them; if there's not enough data, return zero.
+  //
+  const char *skip (size_t len)
+  {
+    if (size_t (end - pos) < len)
+      return 0;
+    const char *data = pos;
+    pos += len;
+    return data;
+  }
+
+  bool at_end () const { return pos == end; }
+
+  // Return the current position, and the number of bytes remaining.
+  //
+  const char *position () const { return pos; }
+  size_t remaining () const { return end - pos; }
+
+private:
+
+  const char *pos, *end;
+};
+
+
+// Mesh snapshot methods
+
+// Write a binary snapshot of this mesh's contents (excluding material) to
+// STREAM.
+//
+void
+Mesh::write_snapshot (std::ostream &stream) const
+{
+  uint32_t num_verts = vertices.size ();
+  uint32_t num_tris = triangles.size ();
+  uint32_t num_norms = vertex_normals.size ();
+  uint32_t num_uvs = vertex_uvs.size ();
+
+  write_raw (stream, uint32_t (left_handed));
+  write_raw (stream, double (axis.x));
+  write_raw (stream, double (axis.y));
+  write_raw (stream, double (axis.z));
+
+  write_raw (stream, num_verts);
+  write_raw (stream, num_tris);
+  write_raw (stream, num_norms);
+  write_raw (stream, num_uvs);
+
+  for (uint32_t v = 0; v < num_verts; v++)
+    {
+      write_raw (stream, vertices[v].x);
+      write_raw (stream, vertices[v].y);
+      write_raw (stream, vertices[v].z);
+    }
+  for (uint32_t n = 0; n < num_norms; n++)
+    {
+      write_raw (stream, vertex_normals[n].x);
+      write_raw (stream, vertex_normals[n].y);
+      write_raw (stream, vertex_normals[n].z);
+    }
+  for (uint32_t u = 0; u < num_uvs; u++)
+    {
+      write_raw (stream, vertex_uvs[u].u);
+      write_raw (stream, vertex_uvs[u].v);
+    }
+  for (uint32_t t = 0; t < num_tris; t++)
+    for (unsigned num = 0; num < 3; num++)
+      write_raw (stream, uint32_t (triangles[t].vi[num]));
+}
+
+// Replace the contents of this mesh with a snapshot previously written
+// by Mesh::write_snapshot, contained in the SIZE bytes at DATA.  Returns
+// false if the data is not a valid snapshot.
+//
+bool
+Mesh::read_snapshot (const char *data, size_t size)
+{
+  SnapshotReader reader (data, data + size);
+
+  uint32_t lh;
+  double ax, ay, az;
+  uint32_t num_verts, num_tris, num_norms, num_uvs;
+
+  if (! (reader.read (lh) && reader.read (ax) && reader.read (ay)
+	 && reader.read (az) && reader.read (num_verts)
+	 && reader.read (num_tris) && reader.read (num_norms)
+	 && reader.read (num_uvs)))
+    return false;
+
+  // Sanity-check the counts before allocating anything, so a truncated
+  // file can't cause a huge allocation.
+  //
+  const char *verts_data = reader.skip (num_verts * 3 * sizeof (scoord_t));
+  const char *norms_data = reader.skip (num_norms * 3 * sizeof (sdist_t));
+  const char *uvs_data = reader.skip (num_uvs * 2 * sizeof (float));
+  const char *tris_data = reader.skip (num_tris * 3 * sizeof (uint32_t));
+  if (!verts_data || !norms_data || !uvs_data || !tris_data
+      || !reader.at_end ()
+      || (num_norms != 0 && num_norms != num_verts)
+      || (num_uvs != 0 && num_uvs != num_verts))
+    return false;
+
+  SnapshotReader verts_reader (verts_data, norms_data);
+  SnapshotReader norms_reader (norms_data, uvs_data);
+  SnapshotReader uvs_reader (uvs_data, tris_data);
+  SnapshotReader tris_reader (tris_data,
+			      tris_data + num_tris * 3 * sizeof (uint32_t));
+
+  vertices.resize (num_verts);
+  for (uint32_t v = 0; v < num_verts; v++)
+    {
+      verts_reader.read (vertices[v].x);
+      verts_reader.read (vertices[v].y);
+      verts_reader.read (vertices[v].z);
+    }
+
+  vertex_normals.resize (num_norms);
+  for (uint32_t n = 0; n < num_norms; n++)
+    {
+      norms_reader.read (vertex_normals[n].x);
+      norms_reader.read (vertex_normals[n].y);
+      norms_reader.read (vertex_normals[n].z);
+    }
+
+  vertex_uvs.resize (num_uvs);
+  for (uint32_t u = 0; u < num_uvs; u++)
+    {
+      uvs_reader.read (vertex_uvs[u].u);
+      uvs_reader.read (vertex_uvs[u].v);
+    }
+
+  triangles.clear ();
+  triangles.reserve (num_tris);
+  for (uint32_t t = 0; t < num_tris; t++)
+    {
+      uint32_t vi[3] = { 0, 0, 0 };
+      for (unsigned num = 0; num < 3; num++)
+	{
+	  tris_reader.read (vi[num]);
+	  if (vi[num] >= num_verts)
+	    {
+	      vertices.clear ();
+	      vertex_normals.clear ();
+	      vertex_uvs.clear ();
+	      triangles.clear ();
+	      return false;
+	    }
+	}
+      add_triangle (vi[0], vi[1], vi[2]);
+    }
+
+  left_handed = lh;
+  axis = Vec (ax, ay, az);
+
+  recalc_bbox ();
+
+  return true;
+}
+
+
+
+// MeshCacheEntry
+
+// Return a 64-bit FNV-1a hash of STR, as a hexadecimal string.
+//
+static std::string
+hash_string (const std::string &str)
+{
+  unsigned long long hash = 14695981039346656037ULL;
+
+  for (std::string::const_iterator i = str.begin (); i != str.end (); ++i)
+    {
+      hash ^= static_cast<unsigned char> (*i);
+      hash *= 1099511628211ULL;
+    }
+
+  char buf[17];
+  snprintf (buf, sizeof buf, "%016llx", hash);
+  return buf;
+}
+
+
+// Find the cache entry for FILE_NAME, loaded with vertex-normal
+// smoothing if SMOOTH is true.
+//
+MeshCacheEntry::MeshCacheEntry (const std::string &file_name, bool smooth)
+  : source_size (0), source_mtime (0)
+{
+#if HAVE_UNISTD_H && HAVE_SYS_MMAN_H && HAVE_SYS_STAT_H
+
+  if (mesh_cache_dir.empty ())
+    return;
+
+  struct stat statb;
+  if (stat (file_name.c_str (), &statb) != 0)
+    return;
+
+  // Use an absolute filename if possible, so that the same file
+  // referred to from different directories gets the same entry.
+  //
+  std::string abs_name = file_name;
+  if (char *real = realpath (file_name.c_str (), 0))
+    {
+      abs_name = real;
+      free (real);
+    }
+
+  // The size and modification time are kept at full width, so that
+  // files larger than 4GB, or timestamps past 2106, can't alias.
+  //
+  source_size = statb.st_size;
+  source_mtime = statb.st_mtime;
+
+  char stat_buf[48];
+  snprintf (stat_buf, sizeof stat_buf, ":%llu:%lld",
+	    static_cast<unsigned long long> (source_size),
+	    static_cast<long long> (source_mtime));
+
+  key = abs_name;
+  key += stat_buf;
+  key += ":" + stringify (SNAPSHOT_VERSION);
+  key += ":" + stringify (unsigned (sizeof (scoord_t)));
+  key += smooth ? ":smooth" : ":raw";
+
+  cache_file = mesh_cache_dir + "/" + hash_string (key) + ".snogmesh";
+
+#endif // HAVE_UNISTD_H && HAVE_SYS_MMAN_H && HAVE_SYS_STAT_H
+}
+
+
+// If a snapshot for this entry exists, load it into MESH and return
+// true, otherwise return false.  MESH should be empty.
+//
+bool
+MeshCacheEntry::load (Mesh &mesh) const
+{
+  bool loaded = false;
+
+#if HAVE_UNISTD_H && HAVE_SYS_MMAN_H && HAVE_SYS_STAT_H
+
+  if (! valid ())
+    return false;
+
+  int fd = open (cache_file.c_str (), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat statb;
+  if (fstat (fd, &statb) == 0 && statb.st_size > 0)
+    {
+      size_t size = statb.st_size;
+      void *contents = mmap (0, size, PROT_READ, MAP_SHARED, fd, 0);
+
+      if (contents != MAP_FAILED)
+	{
+	  const char *data
+	    = static_cast<const char *> (const_cast<const void *> (contents));
+
+#ifdef MADV_SEQUENTIAL
+	  madvise (contents, size, MADV_SEQUENTIAL);
+#endif
+
+	  SnapshotReader reader (data, data + size);
+
+	  const char *magic = reader.skip (SNAPSHOT_MAGIC_LEN);
+	  uint32_t key_len;
+
+	  if (magic && memcmp (magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) == 0
+	      && reader.read (key_len) && key_len == key.length ())
+	    {
+	      const char *file_key = reader.skip (key_len);
+
+	      uint64_t file_size;
+	      int64_t file_mtime;
+
+	      // The key check guards against hash collisions.
+	      //
+	      if (file_key && memcmp (file_key, key.data (), key_len) == 0
+		  && reader.read (file_size) && file_size == source_size
+		  && reader.read (file_mtime) && file_mtime == source_mtime)
+		loaded = mesh.read_snapshot (reader.position (),
+					     reader.remaining ());
+	    }
+
+	  munmap (contents, size);
+	}
+    }
+
+  close (fd);
+
+#endif // HAVE_UNISTD_H && HAVE_SYS_MMAN_H && HAVE_SYS_STAT_H
+
+  return loaded;
+}
+
+
+// Write a snapshot of MESH to the cache for this entry.  Failure to
+// write the snapshot is not considered an error (the cache is merely
+// not updated).
+//
+void
+MeshCacheEntry::save (const Mesh &mesh) const
+{
+#if HAVE_UNISTD_H && HAVE_SYS_MMAN_H && HAVE_SYS_STAT_H
+
+  if (! valid ())
+    return;
+
+  // We write to a temporary file and then rename it into place, so
+  // that a reader (perhaps in another process) never sees a partially
+  // written snapshot.  The temporary name must be unique even if the
+  // same mesh is being saved by multiple threads.
+  //
+  static unsigned tmp_counter = 0;
+  static Mutex tmp_counter_lock;
+
+  tmp_counter_lock.lock ();
+  unsigned tmp_num = tmp_counter++;
+  tmp_counter_lock.unlock ();
+
+  std::string tmp_file
+    = cache_file + ".tmp" + stringify (unsigned (getpid ()))
+    + "." + stringify (tmp_num);
+
+  {
+    std::ofstream stream (tmp_file.c_str (), std::ios::binary);
+    if (! stream)
+      return;
+
+    stream.write (SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN);
+    write_raw (stream, uint32_t (key.length ()));
+    stream.write (key.data (), key.length ());
+    write_raw (stream, source_size);
+    write_raw (stream, source_mtime);
+
+    mesh.write_snapshot (stream);
+
+    if (! stream)
+      {
+	stream.close ();
+	unlink (tmp_file.c_str ());
+	return;
+      }
+  }
+
+  if (rename (tmp_file.c_str (), cache_file.c_str ()) != 0)
+    unlink (tmp_file.c_str ());
+
+#endif // HAVE_UNISTD_H && HAVE_SYS_MMAN_H && HAVE_SYS_STAT_H
+}
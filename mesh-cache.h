@@ -0,0 +1,94 @@
+// mesh-cache.h -- Cache of binary mesh snapshots
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef __MESH_CACHE_H__
+#define __MESH_CACHE_H__
+
+#include <string>
+
+#include <stdint.h>
+
+
+namespace snogray {
+
+
+class Mesh;
+
+
+// Directory in which mesh snapshots are stored.  If empty (the
+// default), no caching is done.
+//
+extern std::string mesh_cache_dir;
+
+
+// An entry in the mesh snapshot cache.
+//
+// Loading a large mesh file (parsing it and computing vertex normals)
+// can take much longer than simply reading back the resulting
+// vertex/triangle arrays, so after a mesh is loaded, a binary snapshot
+// of the result is written to MESH_CACHE_DIR, and subsequent loads of
+// the same file use the snapshot instead.  Only the mesh itself is
+// cached; the acceleration structure (octree) built from the scene's
+// meshes is still rebuilt every time a scene is rendered.
+//
+// Snapshots are keyed by the source file's name, size, and modification
+// time, the loading parameters, and the snapshot format version, so
+// any change to the source file results in a cache miss.
+//
+class MeshCacheEntry
+{
+public:
+
+  // Find the cache entry for FILE_NAME, loaded with vertex-normal
+  // smoothing if SMOOTH is true.
+  //
+  MeshCacheEntry (const std::string &file_name, bool smooth);
+
+  // Return true if this entry can be used (caching is enabled, and
+  // FILE_NAME exists).
+  //
+  bool valid () const { return ! cache_file.empty (); }
+
+  // If a snapshot for this entry exists, load it into MESH and return
+  // true, otherwise return false.  MESH should be empty.
+  //
+  bool load (Mesh &mesh) const;
+
+  // Write a snapshot of MESH to the cache for this entry.  Failure to
+  // write the snapshot is not considered an error (the cache is merely
+  // not updated).
+  //
+  void save (const Mesh &mesh) const;
+
+private:
+
+  // A string which uniquely describes the source and parameters of
+  // this entry.
+  //
+  std::string key;
+
+  // The size and modification time of the source file when this entry
+  // was created.  These are part of KEY too, but are also stored
+  // separately in the snapshot header so they can be checked directly.
+  //
+  uint64_t source_size;
+  int64_t source_mtime;
+
+  // The name of the snapshot file corresponding to KEY.
+  //
+  std::string cache_file;
+};
+
+
+}
+
+#endif // __MESH_CACHE_H__
@@ -0,0 +1,245 @@
+// mesh-load-queue.cc -- Concurrent loading of mesh files
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include <stdexcept>
+
+#include "config.h"
+
+#include "mesh.h"
+#include "scene.h"
+#include "num-cores.h"
+#if USE_THREADS
+#include "thread.h"
+#endif
+
+#include "mesh-load-queue.h"
+
+
+using namespace snogray;
+
+
+MeshLoadQueue::MeshLoadQueue (unsigned _num_threads)
+#if USE_THREADS
+  : num_outstanding (0),
+    num_threads (_num_threads ? _num_threads : num_cores (1)),
+    shutting_down (false)
+#endif
+{
+}
+
+MeshLoadQueue::~MeshLoadQueue ()
+{
+#if USE_THREADS
+  stop_workers ();
+#endif
+}
+
+
+// Do the actual loading.  Any error results in an exception.
+//
+void
+MeshLoadQueue::Job::run () const
+{
+  mesh->load (file_name, smooth);
+
+  if (! xform.is_identity ())
+    mesh->transform (xform);
+}
+
+
+// Arrange for FILE_NAME to be loaded into MESH.  If SMOOTH is true,
+// vertex normals are computed after loading, and then the mesh is
+// transformed by XFORM.
+//
+// This normally returns immediately, with the actual loading done by
+// a worker thread; MESH must not be used by the caller until
+// MeshLoadQueue::finish has returned.
+//
+void
+MeshLoadQueue::load (Mesh &mesh, const std::string &file_name, bool smooth,
+		     const Xform &xform)
+{
+  Job job (mesh, file_name, smooth, xform);
+
+#if USE_THREADS
+  if (num_threads > 1 && Mesh::load_is_thread_safe (file_name))
+    {
+      LockGuard guard (mutex);
+
+      if (threads.empty ())
+	for (unsigned i = 0; i < num_threads; i++)
+	  threads.push_back (new Thread (&MeshLoadQueue::run_worker, this));
+
+      jobs.push_back (job);
+      num_outstanding++;
+
+      job_cond.notify_one ();
+
+      return;
+    }
+#endif // USE_THREADS
+
+  // Either we can't use threads, or this is a format which must be
+  // loaded in the main thread, so just load it immediately.  Errors
+  // are propagated directly.
+  //
+  job.run ();
+}
+
+
+// Add SURFACE to SCENE.  If any loads are still outstanding, the
+// addition is deferred until MeshLoadQueue::finish is called (the
+// scene needs the surface's final bounding box, which isn't known
+// until loading is complete).
+//
+// Deferred additions are done in the order they were requested, so
+// while loads are pending, _all_ surfaces should be added using this
+// method, not just meshes being loaded; otherwise the order in which
+// surfaces are added to the scene may change.
+//
+void
+MeshLoadQueue::add (Scene &scene, const Surface *surface)
+{
+#if USE_THREADS
+  {
+    LockGuard guard (mutex);
+
+    if (num_outstanding != 0 || !additions.empty ())
+      {
+	additions.push_back (Addition (scene, surface));
+	return;
+      }
+  }
+#endif // USE_THREADS
+
+  scene.add (surface);
+}
+
+// Add LIGHT to SCENE.  Lights don't depend on loading, and their
+// order relative to surfaces doesn't matter, so this is done
+// immediately; it's provided so that callers can route all scene
+// additions through the queue.
+//
+void
+MeshLoadQueue::add (Scene &scene, Light *light)
+{
+  scene.add (light);
+}
+
+
+// Wait for all outstanding loads to complete, and then perform any
+// deferred scene additions.  If any load failed, a runtime_error
+// describing the first failure is thrown.
+//
+void
+MeshLoadQueue::finish ()
+{
+#if USE_THREADS
+  {
+    UniqueLock lock (mutex);
+
+    while (num_outstanding != 0)
+      done_cond.wait (lock);
+  }
+#endif // USE_THREADS
+
+  // Scene additions are done even if there was an error, as the scene
+  // owns the added surfaces, and will take care of freeing them.
+  //
+  for (std::vector<Addition>::iterator ai = additions.begin ();
+       ai != additions.end (); ++ai)
+    ai->scene->add (ai->surface);
+  additions.clear ();
+
+  if (! err_msg.empty ())
+    {
+      std::string msg = err_msg;
+      err_msg.clear ();
+      throw std::runtime_error (msg);
+    }
+}
+
+
+
+#if USE_THREADS
+
+// Main loop for worker threads.
+//
+void
+MeshLoadQueue::run_worker ()
+{
+  UniqueLock lock (mutex);
+
+  for (;;)
+    {
+      while (jobs.empty () && !shutting_down)
+	job_cond.wait (lock);
+
+      if (jobs.empty ())
+	break;
+
+      Job job = jobs.front ();
+      jobs.pop_front ();
+
+      // Do the actual loading without holding the lock, so that other
+      // workers can proceed.
+      //
+      lock.unlock ();
+
+      // Any exception escaping a thread would terminate the program,
+      // so catch everything, and report it from MeshLoadQueue::finish.
+      //
+      std::string job_err;
+      try
+	{
+	  job.run ();
+	}
+      catch (std::exception &err)
+	{
+	  job_err = err.what ();
+	}
+      catch (...)
+	{
+	  job_err = "unknown error loading mesh";
+	}
+
+      lock.lock ();
+
+      if (!job_err.empty () && err_msg.empty ())
+	err_msg = job_err;
+
+      if (--num_outstanding == 0)
+	done_cond.notify_all ();
+    }
+}
+
+// Tell worker threads to exit, and wait until they do so.
+//
+void
+MeshLoadQueue::stop_workers ()
+{
+  {
+    LockGuard guard (mutex);
+    shutting_down = true;
+    job_cond.notify_all ();
+  }
+
+  while (! threads.empty ())
+    {
+      Thread *th = threads.back ();
+      threads.pop_back ();
+      th->join ();
+      delete th;
+    }
+}
+
+#endif // USE_THREADS
@@ -0,0 +1,182 @@
+// mesh-load-queue.h -- Concurrent loading of mesh files
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef __MESH_LOAD_QUEUE_H__
+#define __MESH_LOAD_QUEUE_H__
+
+#include <string>
+#include <deque>
+#include <vector>
+
+#include "config.h"
+
+#include "mutex.h"
+#include "cond-var.h"
+#include "xform.h"
+
+
+namespace snogray {
+
+
+class Mesh;
+class Surface;
+class Light;
+class Scene;
+class Thread;
+
+
+// A pool of worker threads used to load independent mesh files
+// concurrently.
+//
+// Loading a mesh file (parsing it, computing vertex normals, and
+// transforming it) only touches the mesh being loaded, so many meshes
+// can be loaded in parallel.  Adding the resulting surfaces to a scene
+// is _not_ thread-safe, so that is deferred until MeshLoadQueue::finish
+// is called, and done in the calling thread, in the order requested.
+//
+// Mesh formats which are loaded using global state (e.g., those loaded
+// by Lua code) are loaded synchronously by MeshLoadQueue::load instead.
+//
+class MeshLoadQueue
+{
+public:
+
+  // Make a queue that uses NUM_THREADS worker threads; if NUM_THREADS
+  // is zero, one thread per CPU core is used.  Threads are only
+  // started when the first load is requested.
+  //
+  MeshLoadQueue (unsigned num_threads = 0);
+  ~MeshLoadQueue ();
+
+  // Arrange for FILE_NAME to be loaded into MESH.  If SMOOTH is true,
+  // vertex normals are computed after loading, and then the mesh is
+  // transformed by XFORM.
+  //
+  // This normally returns immediately, with the actual loading done by
+  // a worker thread; MESH must not be used by the caller until
+  // MeshLoadQueue::finish has returned.
+  //
+  void load (Mesh &mesh, const std::string &file_name, bool smooth = true,
+	     const Xform &xform = Xform ());
+
+  // Add SURFACE to SCENE.  If any loads are still outstanding, the
+  // addition is deferred until MeshLoadQueue::finish is called (the
+  // scene needs the surface's final bounding box, which isn't known
+  // until loading is complete).
+  //
+  // Deferred additions are done in the order they were requested, so
+  // while loads are pending, _all_ surfaces should be added using this
+  // method, not just meshes being loaded; otherwise the order in which
+  // surfaces are added to the scene may change.
+  //
+  void add (Scene &scene, const Surface *surface);
+
+  // Add LIGHT to SCENE.  Lights don't depend on loading, and their
+  // order relative to surfaces doesn't matter, so this is done
+  // immediately; it's provided so that callers can route all scene
+  // additions through the queue.
+  //
+  void add (Scene &scene, Light *light);
+
+  // Wait for all outstanding loads to complete, and then perform any
+  // deferred scene additions.  If any load failed, a runtime_error
+  // describing the first failure is thrown.
+  //
+  void finish ();
+
+private:
+
+  // A single pending load.
+  //
+  struct Job
+  {
+    Job (Mesh &_mesh, const std::string &_file_name, bool _smooth,
+	 const Xform &_xform)
+      : mesh (&_mesh), file_name (_file_name), smooth (_smooth),
+	xform (_xform)
+    { }
+
+    // Do the actual loading.  Any error results in an exception.
+    //
+    void run () const;
+
+    Mesh *mesh;
+    std::string file_name;
+    bool smooth;
+    Xform xform;
+  };
+
+  // A deferred scene addition.
+  //
+  struct Addition
+  {
+    Addition (Scene &_scene, const Surface *_surface)
+      : scene (&_scene), surface (_surface)
+    { }
+
+    Scene *scene;
+    const Surface *surface;
+  };
+
+#if USE_THREADS
+
+  // Main loop for worker threads.
+  //
+  void run_worker ();
+
+  // Tell worker threads to exit, and wait until they do so.
+  //
+  void stop_workers ();
+
+  // Jobs waiting for a worker thread.
+  //
+  std::deque<Job> jobs;
+
+  // The number of jobs which have been queued but not yet completed.
+  //
+  unsigned num_outstanding;
+
+  // The number of worker threads we will use, and the threads themselves
+  // (which are only started when needed).
+  //
+  unsigned num_threads;
+  std::vector<Thread *> threads;
+
+  // If true, worker threads should exit when there are no more jobs.
+  //
+  bool shutting_down;
+
+  // Mutex protecting all of the above state (and ERR_MSG).
+  //
+  Mutex mutex;
+
+  // Condition variables used to signal the arrival of new jobs, and the
+  // completion of all outstanding jobs, respectively.
+  //
+  CondVar job_cond, done_cond;
+
+#endif // USE_THREADS
+
+  // Scene additions waiting for outstanding loads to complete.
+  //
+  std::vector<Addition> additions;
+
+  // The error message from the first failed load, or an empty string if
+  // there have been no errors.
+  //
+  std::string err_msg;
+};
+
+
+}
+
+#endif // __MESH_LOAD_QUEUE_H__
@@ -26,6 +26,8 @@
 # include "load-lua.h"
 #endif
 
+#include "mesh-cache.h"
+
 #include "mesh.h"
 
 using namespace snogray;
@@ -68,5 +70,50 @@ Mesh::load (const string &file_name)
     }
 }
 
+// Load mesh from FILE_NAME, and if SMOOTH is true, compute vertex
+// normals.  If the mesh snapshot cache is enabled (see mesh-cache.h), a
+// snapshot of the result is used if available, and otherwise one is
+// created.
+//
+void
+Mesh::load (const string &file_name, bool smooth)
+{
+  // Snapshots replace the entire contents of a mesh, so only use the
+  // cache if this mesh is currently empty.
+  //
+  MeshCacheEntry cache_entry (file_name, smooth);
+  bool use_cache = cache_entry.valid () && num_vertices () == 0;
+
+  if (use_cache && cache_entry.load (*this))
+    {
+      std::cout << "* loading mesh: " << file_name << " (cached)"
+		<< std::endl;
+      return;
+    }
+
+  load (file_name);
+
+  if (smooth)
+    compute_vertex_normals ();
+
+  if (use_cache)
+    cache_entry.save (*this);
+}
+
+// Return true if Mesh::load can load FILE_NAME without using any
+// global state (such as the Lua interpreter), so that it can be safely
+// be loaded in a thread other than the main thread.
+//
+bool
+Mesh::load_is_thread_safe (const string &file_name)
+{
+  string ext = filename_ext (file_name);
+
+  // Only formats loaded directly by C++ code qualify.  3ds files are
+  // excluded, as lib3ds hasn't been checked for thread-safety.
+  //
+  return (ext == "ply" || ext == "msh" || ext == "mesh");
+}
+
 
 // arch-tag: 50a45108-0f51-4377-9246-7b0bcedf4135
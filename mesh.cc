@@ -354,20 +354,50 @@ Mesh::add_triangles (const std::vector<vert_index_t> &tri_vert_indices,
 //
 const Surface::IsecInfo *
 Mesh::Triangle::intersect (Ray &ray, RenderContext &context) const
+{
+  IsecParams isec_params;
+  if (find_intersection (ray, isec_params, context))
+    return make_isec_info (ray, isec_params, context);
+  else
+    return 0;
+}
+
+// "Two-phase" version of Surface::intersect:  If this surface
+// intersects RAY, change RAY's maximum bound (Ray::t1) to reflect the
+// point of intersection, store the intersection's parameters in
+// ISEC_PARAMS, and return true; otherwise return false.
+//
+bool
+Mesh::Triangle::find_intersection (Ray &ray, IsecParams &isec_params,
+				   RenderContext &)
+  const
 {
   // We have to convert the types to match that of RAY first.
   //
   Pos corner = v(0);
   Vec edge1 = v(1) - corner, edge2 = v(2) - corner;
 
-  dist_t t, u, v;
-  if (triangle_intersects (corner, edge1, edge2, ray, t, u, v))
+  dist_t t;
+  if (triangle_intersects (corner, edge1, edge2, ray,
+			   t, isec_params.u, isec_params.v))
     {
       ray.t1 = t;
-      return new (context) IsecInfo (ray, *this, u, v);
+      return true;
     }
 
-  return 0;
+  return false;
+}
+
+// Return a Surface::IsecInfo object describing the intersection of
+// this surface with RAY, found by a previous call to
+// Mesh::Triangle::find_intersection which returned ISEC_PARAMS.
+//
+const Surface::IsecInfo *
+Mesh::Triangle::make_isec_info (const Ray &ray, const IsecParams &isec_params,
+				RenderContext &context)
+  const
+{
+  return new (context) IsecInfo (ray, *this, isec_params.u, isec_params.v);
 }
 
 // Return a normal frame FRAME at ORIGIN, with basis vectors calculated
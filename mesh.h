@@ -16,6 +16,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <iosfwd>
 
 #include "primitive.h"
 #include "pos.h"
@@ -54,9 +55,7 @@ public:
 	const std::string &file_name, bool smooth = true)
     : Primitive (mat), axis (Vec (0, 0, 1)), left_handed (true)
   {
-    load (file_name);
-    if (smooth)
-      compute_vertex_normals ();
+    load (file_name, smooth);
   }
 
 
@@ -150,6 +149,30 @@ public:
   //
   void load (const std::string &file_name);
 
+  // Return true if Mesh::load can load FILE_NAME without using any
+  // global state (such as the Lua interpreter), so that it can be safely
+  // be loaded in a thread other than the main thread.
+  //
+  static bool load_is_thread_safe (const std::string &file_name);
+
+  // Load mesh from FILE_NAME, and if SMOOTH is true, compute vertex
+  // normals.  If the mesh snapshot cache is enabled (see mesh-cache.h),
+  // a snapshot of the result is used if available, and otherwise one
+  // is created.
+  //
+  void load (const std::string &file_name, bool smooth);
+
+  // Write a binary snapshot of this mesh's contents (excluding material)
+  // to STREAM.
+  //
+  void write_snapshot (std::ostream &stream) const;
+
+  // Replace the contents of this mesh with a snapshot previously written
+  // by Mesh::write_snapshot, contained in the SIZE bytes at DATA.
+  // Returns false if the data is not a valid snapshot.
+  //
+  bool read_snapshot (const char *data, size_t size);
+
   // Add this (or some other) surfaces to the space being built by
   // SPACE_BUILDER.
   //
@@ -296,6 +319,18 @@ public:
   //
   virtual const IsecInfo *intersect (Ray &ray, RenderContext &context) const;
 
+  // "Two-phase" version of Surface::intersect, used when searching for
+  // the closest intersection.  See Surface::find_intersection and
+  // Surface::make_isec_info.
+  //
+  virtual bool find_intersection (Ray &ray, IsecParams &isec_params,
+				  RenderContext &context)
+    const;
+  virtual const IsecInfo *make_isec_info (const Ray &ray,
+					  const IsecParams &isec_params,
+					  RenderContext &context)
+    const;
+
   // Return true if this surface intersects RAY.
   //
   virtual bool intersects (const Ray &ray, RenderContext &context)
@@ -42,7 +42,7 @@ namespace snogray {
 // samples), and it's cheaper to calculate here than separately
 // dividing by the number of samples afterwards.
 //
-static float
+static inline float
 mis_sample_weight (float pdf, float num_samples,
 		   float other_pdf, float num_other_samples)
 {
@@ -76,6 +76,22 @@ mis_sample_weight (float pdf, float num_samples,
   return (term * pdf) / (term_2 + other_term_2);
 }
 
+// Return a power-heuristic weight for one sample in multiple
+// importance sampling with any number of sampling strategies, each of
+// which takes a single sample.  PDF is the pdf for the strategy which
+// generated the sample being weighted, and PDF_SQ_SUM is the sum of
+// the squared pdfs of all strategies (including that one).
+//
+// As only the ratios of the pdfs matter, they may all be relative to
+// some common value, which can be useful to avoid floating-point
+// overflow.
+//
+static inline float
+mis_sample_weight (double pdf, double pdf_sq_sum)
+{
+  return (pdf_sq_sum > 0) ? float (pdf * pdf / pdf_sq_sum) : 0;
+}
+
 
 }
 
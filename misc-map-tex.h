@@ -32,7 +32,21 @@ public:
 
   virtual T eval (const TexCoords &coords) const
   {
-    return tex->eval (TexCoords (coords.pos, UV (coords.pos.x, coords.pos.y)));
+    return tex->eval (map (coords));
+  }
+
+  virtual void eval_batch (const TexCoords *coords, T *results, unsigned num)
+    const
+  {
+    eval_mapped_batch (*tex, *this, coords, results, num);
+  }
+
+  // Return COORDS with its 2d coordinates replaced by the mapping.
+  //
+  TexCoords map (const TexCoords &coords) const
+  {
+    return TexCoords (coords.pos, UV (coords.pos.x, coords.pos.y),
+		      coords.pos_width, coords.pos_width);
   }
 
   const Ref<Tex<T> > tex;
@@ -49,10 +63,23 @@ public:
   CylinderMapTex (const Ref<Tex<T> > &_tex) : tex (_tex) { }
 
   virtual T eval (const TexCoords &coords) const
+  {
+    return tex->eval (map (coords));
+  }
+
+  virtual void eval_batch (const TexCoords *coords, T *results, unsigned num)
+    const
+  {
+    eval_mapped_batch (*tex, *this, coords, results, num);
+  }
+
+  // Return COORDS with its 2d coordinates replaced by the mapping.
+  //
+  TexCoords map (const TexCoords &coords) const
   {
     const Pos &pos = coords.pos;
     UV uv (atan2 (pos.x, pos.y) * INV_PI * 0.5f + 0.5f, pos.z);
-    return tex->eval (TexCoords (pos, uv));
+    return TexCoords (pos, uv);
   }
 
   const Ref<Tex<T> > tex;
@@ -70,12 +97,25 @@ public:
   LatLongMapTex (const Ref<Tex<T> > &_tex) : tex (_tex) { }
 
   virtual T eval (const TexCoords &coords) const
+  {
+    return tex->eval (map (coords));
+  }
+
+  virtual void eval_batch (const TexCoords *coords, T *results, unsigned num)
+    const
+  {
+    eval_mapped_batch (*tex, *this, coords, results, num);
+  }
+
+  // Return COORDS with its 2d coordinates replaced by the mapping.
+  //
+  TexCoords map (const TexCoords &coords) const
   {
     const Pos &pos = coords.pos;
     float x = pos.x, y = pos.y, z = pos.z;
     UV uv (atan2 (x, y) * INV_PI * 0.5f + 0.5f,
 	   atan2 (z, sqrt (x*x + y*y)) * INV_PI + 0.5f);
-    return tex->eval (TexCoords (pos, uv));
+    return TexCoords (pos, uv);
   }
 
   const Ref<Tex<T> > tex;
@@ -0,0 +1,233 @@
+// mlt-renderer.cc -- Metropolis light transport rendering driver
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include <limits>
+
+#include "snogmath.h"
+#include "camera.h"
+#include "media.h"
+
+#include "mlt-renderer.h"
+
+
+using namespace snogray;
+
+
+// Make a Markov chain for rendering the area of the virtual screen
+// (which is WIDTH x HEIGHT pixels) starting at LIMIT_X, LIMIT_Y and
+// extending LIMIT_WIDTH x LIMIT_HEIGHT pixels.
+//
+MltRenderer::MltRenderer (const GlobalRenderState &global_state,
+			  const Camera &_camera,
+			  unsigned _width, unsigned _height,
+			  int _limit_x, int _limit_y,
+			  unsigned _limit_width, unsigned _limit_height)
+  : camera (_camera), width (_width), height (_height),
+    limit_x (_limit_x), limit_y (_limit_y),
+    limit_width (_limit_width), limit_height (_limit_height),
+    large_step_prob (
+      clamp01 (global_state.params.get_float ("mlt-large-step", 0.3f))),
+    context (global_state, 1, &sample_gen),
+    film_samples (context.samples.add_channel<UV> ()),
+    focus_samples (context.samples.add_channel<UV> ()),
+    brightness (0), cur_importance (0),
+    pixels (_limit_width * _limit_height, Color (0)),
+    num_mutations (0)
+{
+}
+
+
+// Generate a new set of samples, and trace the eye-ray they describe,
+// returning its position in our image in POS, and the light arriving
+// along it in VAL.  The "importance" of the result (which determines
+// how often the chain visits it) is returned.
+//
+float
+MltRenderer::eval (UV &pos, Color &val)
+{
+  SampleSet &samples = context.samples;
+
+  samples.generate ();
+
+  SampleSet::Sample sample (samples, 0);
+
+  UV film_samp = sample.get (film_samples);
+  UV focus_samp = sample.get (focus_samples);
+
+  pos = UV (film_samp.u * limit_width, film_samp.v * limit_height);
+
+  // The X/Y coordinates of the sample on the virtual screen, and its
+  // location on the film-plane (we flip the vertical coordinate
+  // because the output image has zero at the top, whereas rendering
+  // coordinates use zero at the bottom).
+  //
+  UV coords (limit_x + pos.u, limit_y + pos.v);
+  UV film_loc (coords.u / width, (height - coords.v) / height);
+
+  Ray camera_ray = camera.eye_ray (film_loc, focus_samp);
+
+  // Tell the first intersection how big an area the ray covers; on
+  // average, each pixel receives as many eye-rays as it would with
+  // normal rendering.
+  //
+  float samp_scale = 1 / sqrt (float (context.global_state.num_samples));
+  UV film_delta (samp_scale / width, samp_scale / height);
+  context.eye_ray_spread = camera.eye_ray_spread (film_loc, film_delta);
+
+  Media media (context.default_medium);
+  Tint tint = context.surface_integ->Li (camera_ray, media, sample);
+
+  context.mempool.reset ();
+
+  val = tint.alpha_scaled_color ();
+
+  // Results which are infinite or NaN would ruin the chain, so just
+  // ignore them.
+  //
+  float importance = val.intensity ();
+  if (! (importance > 0 && importance <= std::numeric_limits<float>::max ()))
+    {
+      val = 0;
+      importance = 0;
+    }
+
+  return importance;
+}
+
+// Add VAL, scaled by WEIGHT, to the pixel containing POS in our image.
+//
+void
+MltRenderer::splat (const UV &pos, const Color &val, float weight)
+{
+  unsigned px = min (unsigned (pos.u), unsigned (limit_width) - 1);
+  unsigned py = min (unsigned (pos.v), unsigned (limit_height) - 1);
+  pixels[py * unsigned (limit_width) + px] += val * weight;
+}
+
+
+// Estimate the average intensity of the image using NUM_SAMPLES
+// independent samples, and choose one of them, in proportion to its
+// intensity, as the starting state of the chain.  This must be
+// called before MltRenderer::run.
+//
+void
+MltRenderer::bootstrap (unsigned num_samples)
+{
+  double importance_sum = 0;
+
+  for (unsigned i = 0; i < num_samples; i++)
+    {
+      sample_gen.start_iteration (true);
+
+      UV pos;
+      Color val;
+      float importance = eval (pos, val);
+
+      importance_sum += importance;
+
+      // Replace the current state with this sample with a probability
+      // of its share of the total importance so far, which means that
+      // each sample ends up chosen in proportion to its importance.
+      //
+      if (importance > 0 && context.random () * importance_sum < importance)
+	{
+	  sample_gen.accept ();
+
+	  cur_pos = pos;
+	  cur_val = val;
+	  cur_importance = importance;
+	}
+      else
+	sample_gen.reject ();
+    }
+
+  context.stats.mlt.bootstrap_samples += num_samples;
+
+  brightness = num_samples == 0 ? 0 : importance_sum / num_samples;
+}
+
+
+// Run the chain for NUM_MUTATIONS mutations, adding the results to
+// our image.  This may be called repeatedly.
+//
+void
+MltRenderer::run (unsigned long long _num_mutations)
+{
+  RenderStats::MltStats &stats = context.stats.mlt;
+
+  num_mutations += _num_mutations;
+
+  // If bootstrapping found no light at all, the image is black.
+  //
+  if (cur_importance == 0)
+    return;
+
+  for (unsigned long long i = 0; i < _num_mutations; i++)
+    {
+      bool large_step = context.random () < large_step_prob;
+
+      sample_gen.start_iteration (large_step);
+
+      UV pos;
+      Color val;
+      float importance = eval (pos, val);
+
+      float accept_prob = min (importance / cur_importance, 1.f);
+
+      // Rather than only adding the state the chain ends up in, add
+      // both the current and the proposed state, weighted by the
+      // probability of each being chosen; this is unbiased, and
+      // greatly reduces noise.  Each state is scaled by the inverse of
+      // its importance, so the image converges to the true image
+      // (divided by the number of mutations per pixel).
+      //
+      if (accept_prob > 0)
+	splat (pos, val, accept_prob * brightness / importance);
+      if (accept_prob < 1)
+	splat (cur_pos, cur_val,
+	       (1 - accept_prob) * brightness / cur_importance);
+
+      stats.mutations++;
+      if (large_step)
+	stats.large_steps++;
+
+      if (context.random () < accept_prob)
+	{
+	  sample_gen.accept ();
+
+	  cur_pos = pos;
+	  cur_val = val;
+	  cur_importance = importance;
+
+	  stats.accepted++;
+	  if (large_step)
+	    stats.large_accepted++;
+	}
+      else
+	sample_gen.reject ();
+    }
+}
+
+
+// Return rendering statistics for this renderer.
+//
+RenderStats
+MltRenderer::stats () const
+{
+  RenderStats stats = context.stats;
+
+  stats.mempool.peak_bytes = context.mempool.peak_bytes ();
+  stats.mempool.block_refills = context.mempool.num_block_refills ();
+  stats.mempool.large_allocs = context.mempool.num_large_allocs ();
+
+  return stats;
+}
@@ -0,0 +1,154 @@
+// mlt-renderer.h -- Metropolis light transport rendering driver
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef __MLT_RENDERER_H__
+#define __MLT_RENDERER_H__
+
+#include <vector>
+
+#include "color.h"
+#include "mlt-sample-gen.h"
+#include "render-context.h"
+#include "render-stats.h"
+#include "sample-set.h"
+
+
+namespace snogray {
+
+class Camera;
+
+
+// A single Markov chain for "primary sample space" Metropolis light
+// transport (Kelemen et al.).
+//
+// Each state of the chain is the set of sample coordinates used to
+// render one eye-ray -- including its position on the image -- as
+// generated by an MltSampleGen, and states are visited in proportion
+// to the intensity of the light the eye-ray returns.  Each visited
+// state adds its light to the pixel it falls in, scaled so that the
+// accumulated image (after MltRenderer::image_scale is applied) is an
+// estimate of the true image.
+//
+// The normal surface integrator is used to calculate the light for each
+// state, so any surface integrator may be used, although the Metropolis
+// algorithm is most effective when combined with a good one (such as
+// "bdpt").
+//
+class MltRenderer
+{
+public:
+
+  // Make a Markov chain for rendering the area of the virtual screen
+  // (which is WIDTH x HEIGHT pixels) starting at LIMIT_X, LIMIT_Y and
+  // extending LIMIT_WIDTH x LIMIT_HEIGHT pixels.
+  //
+  MltRenderer (const GlobalRenderState &global_state,
+	       const Camera &_camera, unsigned _width, unsigned _height,
+	       int _limit_x, int _limit_y,
+	       unsigned _limit_width, unsigned _limit_height);
+
+  // Estimate the average intensity of the image using NUM_SAMPLES
+  // independent samples, and choose one of them, in proportion to its
+  // intensity, as the starting state of the chain.  This must be
+  // called before MltRenderer::run.
+  //
+  void bootstrap (unsigned num_samples);
+
+  // Run the chain for NUM_MUTATIONS mutations, adding the results to
+  // our image.  This may be called repeatedly.
+  //
+  void run (unsigned long long num_mutations);
+
+  // Return the image accumulated so far, which has LIMIT_WIDTH x
+  // LIMIT_HEIGHT pixels in row-major order.  Each pixel must be
+  // multiplied by MltRenderer::image_scale to get the final result.
+  //
+  const std::vector<Color> &image () const { return pixels; }
+
+  // Return the factor by which pixels in MltRenderer::image must be
+  // multiplied to get the final result.
+  //
+  float image_scale () const
+  {
+    return (num_mutations == 0
+	    ? 0
+	    : float (pixels.size ()) / float (num_mutations));
+  }
+
+  // Return rendering statistics for this renderer.
+  //
+  RenderStats stats () const;
+
+private:
+
+  // Generate a new set of samples, and trace the eye-ray they describe,
+  // returning its position in our image in POS, and the light arriving
+  // along it in VAL.  The "importance" of the result (which determines
+  // how often the chain visits it) is returned.
+  //
+  float eval (UV &pos, Color &val);
+
+  // Add VAL, scaled by WEIGHT, to the pixel containing POS in our image.
+  //
+  void splat (const UV &pos, const Color &val, float weight);
+
+  // The camera being used.
+  //
+  const Camera &camera;
+
+  // Size of the virtual screen, and the area of it we're rendering.
+  // These are floats because they are always used as such.
+  //
+  float width, height;
+  float limit_x, limit_y, limit_width, limit_height;
+
+  // Probability of each mutation being a "large step".
+  //
+  float large_step_prob;
+
+  // Source of samples.  This must be declared before CONTEXT, which
+  // refers to it.
+  //
+  MltSampleGen sample_gen;
+
+  // Thread-local global R/W rendering state.
+  //
+  RenderContext context;
+
+  // Sample channels for the eye-ray's position in our image, and
+  // camera-focus samples.
+  //
+  SampleSet::Channel<UV> film_samples;
+  SampleSet::Channel<UV> focus_samples;
+
+  // Average importance of the image, as estimated by
+  // MltRenderer::bootstrap.
+  //
+  float brightness;
+
+  // The current state of the chain:  its position, value, and
+  // importance.
+  //
+  UV cur_pos;
+  Color cur_val;
+  float cur_importance;
+
+  // Accumulated results, and the number of mutations they represent.
+  //
+  std::vector<Color> pixels;
+  unsigned long long num_mutations;
+};
+
+
+}
+
+#endif // __MLT_RENDERER_H__
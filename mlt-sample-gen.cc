@@ -0,0 +1,118 @@
+// mlt-sample-gen.cc -- Sample generator for Metropolis light transport
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include "snogmath.h"
+#include "random.h"
+
+#include "mlt-sample-gen.h"
+
+
+using namespace snogray;
+
+
+// The range of sizes of small-step perturbations.  Perturbation sizes
+// are distributed exponentially between these limits, as suggested by
+// Kelemen et al.
+//
+static const float MIN_PERTURB = 1.f / 1024;
+static const float MAX_PERTURB = 1.f / 64;
+
+
+MltSampleGen::MltSampleGen () : next_index (0), large_step (true) { }
+
+
+// Start a new mutation.  If LARGE_STEP is true, all coordinates are
+// replaced by new uniformly distributed values; otherwise, each is
+// perturbed by a small amount.
+//
+void
+MltSampleGen::start_iteration (bool _large_step)
+{
+  old_coords = coords;
+  next_index = 0;
+  large_step = _large_step;
+}
+
+
+// Return the next coordinate for the current iteration, using
+// RANDOM as a source of randomness.
+//
+float
+MltSampleGen::next_coord (Random &random) const
+{
+  unsigned index = next_index++;
+
+  // Coordinates which have never been used before are independent of
+  // everything else, so just start them off with a uniform value.
+  //
+  if (index >= coords.size ())
+    {
+      coords.push_back (random ());
+      return coords.back ();
+    }
+
+  float &coord = coords[index];
+
+  if (large_step)
+    coord = random ();
+  else
+    {
+      // Perturb COORD up or down with equal probability, wrapping
+      // around at the edges of [0, 1), so the mutation is symmetric.
+      //
+      static const float log_ratio = log (MAX_PERTURB / MIN_PERTURB);
+      float delta = MAX_PERTURB * exp (-log_ratio * random ());
+
+      if (random () < 0.5f)
+	delta = -delta;
+
+      coord += delta;
+      coord -= floor (coord);
+
+      // Rounding can make the wrapped value exactly 1.
+      //
+      if (coord >= 1)
+	coord = 0;
+    }
+
+  return coord;
+}
+
+
+// The actual sample generating methods.  Using RANDOM as a source of
+// randomness, add NUM samples to TABLE through TABLE+NUM.
+
+void
+MltSampleGen::gen_float_samples (Random &random,
+				 const std::vector<float>::iterator &table,
+				 unsigned num)
+  const
+{
+  std::vector<float>::iterator samp = table;
+  for (unsigned i = 0; i < num; i++)
+    *samp++ = next_coord (random);
+}
+
+void
+MltSampleGen::gen_uv_samples (Random &random,
+			      const std::vector<UV>::iterator &table,
+			      unsigned num)
+  const
+{
+  std::vector<UV>::iterator samp = table;
+  for (unsigned i = 0; i < num; i++)
+    {
+      float u = next_coord (random);
+      float v = next_coord (random);
+      *samp++ = UV (u, v);
+    }
+}
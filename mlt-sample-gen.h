@@ -0,0 +1,113 @@
+// mlt-sample-gen.h -- Sample generator for Metropolis light transport
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef __MLT_SAMPLE_GEN_H__
+#define __MLT_SAMPLE_GEN_H__
+
+#include <vector>
+
+#include "sample-gen.h"
+
+
+namespace snogray {
+
+
+// A sample generator for "primary sample space" Metropolis light
+// transport (as described by Kelemen et al.).  Instead of generating
+// well-distributed samples, it keeps the "current" value of every
+// sample coordinate, and each time samples are generated, returns
+// mutated versions of them.
+//
+// Every call to MltSampleGen::start_iteration must be followed by a
+// single call to SampleSet::generate on a SampleSet using this
+// generator (coordinates are assigned in the order SampleSet::generate
+// asks for them, which is the same every time), and then by a call to
+// either MltSampleGen::accept, to make the mutated coordinates the
+// current ones, or MltSampleGen::reject, to return to the previous
+// ones.
+//
+// Because the generated samples depend on internal state, a single
+// MltSampleGen object may only be used by one SampleSet.
+//
+class MltSampleGen : public SampleGen
+{
+public:
+
+  MltSampleGen ();
+
+  // Start a new mutation.  If LARGE_STEP is true, all coordinates are
+  // replaced by new uniformly distributed values; otherwise, each is
+  // perturbed by a small amount.
+  //
+  void start_iteration (bool large_step);
+
+  // Make the coordinates generated since the last call to
+  // MltSampleGen::start_iteration the current ones.
+  //
+  void accept () { }
+
+  // Restore the coordinates which were current before the last call to
+  // MltSampleGen::start_iteration.
+  //
+  void reject () { coords.swap (old_coords); }
+
+  // Return false, as shuffling the samples generated in a channel
+  // would move each coordinate to a different place in the channel on
+  // every iteration, instead of just perturbing it.
+  //
+  virtual bool shuffle_samples () const { return false; }
+
+protected:
+
+  // The actual sample generating methods.  Using RANDOM as a source of
+  // randomness, add NUM samples to TABLE through TABLE+NUM.
+  //
+  virtual void gen_float_samples (Random &random,
+				  const std::vector<float>::iterator &table,
+				  unsigned num)
+    const;
+  virtual void gen_uv_samples (Random &random,
+			       const std::vector<UV>::iterator &table,
+			       unsigned num)
+    const;
+
+private:
+
+  // Return the next coordinate for the current iteration, using
+  // RANDOM as a source of randomness.
+  //
+  float next_coord (Random &random) const;
+
+  // The coordinates generated by the current iteration, and the
+  // coordinates which were current before it started.  COORDS can grow
+  // during an iteration, if more coordinates are asked for than were
+  // used before.
+  //
+  // These are mutable because the SampleGen interface only allows
+  // generating samples using const methods.
+  //
+  mutable std::vector<float> coords;
+  std::vector<float> old_coords;
+
+  // The index in COORDS of the next coordinate to be generated.
+  //
+  mutable unsigned next_index;
+
+  // True if the current iteration is a "large step".
+  //
+  bool large_step;
+};
+
+
+}
+
+#endif // __MLT_SAMPLE_GEN_H__
@@ -65,6 +65,9 @@ public:
   RealUniqueLock () { }
   explicit RealUniqueLock (RealMutex &) { }
   template<typename A> RealUniqueLock (RealMutex &, const A &) { }
+
+  void lock () { }
+  void unlock () { }
 };
 
 #endif // !USE_STD_THREAD && !USE_BOOST_THREAD
@@ -135,6 +138,13 @@ public:
     : RealUniqueLock (mutex.real_mutex (), arg)
   { }
 
+  // Temporarily release, and later re-acquire, the mutex.  Unlike
+  // calling Mutex::unlock directly, these keep track of whether the
+  // lock is held, so the destructor does the right thing.
+  //
+  using RealUniqueLock::lock;
+  using RealUniqueLock::unlock;
+
   // Return the underlying type.
   //
   RealUniqueLock &real_unique_lock () { return *this; }
@@ -10,8 +10,13 @@
 // Written by Miles Bader <miles@gnu.org>
 //
 
+#include <stdexcept>
+
 #include "bbox.h"
 #include "grab.h"
+#include "isec-cache.h"
+#include "isec-mailbox.h"
+#include "val-table.h"
 
 #include "octree.h"
 
@@ -24,6 +29,21 @@ Octree::~Octree ()
   delete root;
 }
 
+// Make a factory using options from PARAMS.  Currently the only
+// option is "isec-cache", which may be "hash" (the default) or
+// "mailbox".
+//
+Octree::BuilderFactory::BuilderFactory (const ValTable &params)
+  : isec_cache_kind (ISEC_CACHE_HASH)
+{
+  std::string kind = params.get_string ("isec-cache", "hash");
+  if (kind == "mailbox")
+    isec_cache_kind = ISEC_CACHE_MAILBOX;
+  else if (kind != "hash")
+    throw std::runtime_error ("Unknown octree isec-cache type \""
+			      + kind + "\"");
+}
+
 
 // Ray intersection testing (Octree::for_each_possible_intersector)
 
@@ -38,6 +58,22 @@ Octree::for_each_possible_intersector (const Ray &ray,
 				       RenderContext &context,
 				       RenderStats::IsecStats &isec_stats)
   const
+{
+  if (isec_cache_kind == ISEC_CACHE_MAILBOX)
+    search (ray, callback, context.isec_mailbox_pool, isec_stats);
+  else
+    search (ray, callback, context.isec_cache_pool, isec_stats);
+}
+
+// Do the work of Octree::for_each_possible_intersector, using a
+// negative-intersection cache of type NEG_CACHE from CACHE_POOL.
+//
+template<class NegCache>
+void
+Octree::search (const Ray &ray, IntersectCallback &callback,
+		Pool<NegCache> &cache_pool,
+		RenderStats::IsecStats &isec_stats)
+  const
 {
   if (root)
     {
@@ -94,11 +130,11 @@ Octree::for_each_possible_intersector (const Ray &ray,
 				ray.origin.y + ray.dir.y * z_max_scale,
 				z_max);
 
-	  // Get an IsecCache object.
+	  // Get a negative-intersection cache object.
 	  //
-	  Grab<IsecCache> isec_cache_grab (context.isec_cache_pool);
+	  Grab<NegCache> isec_cache_grab (cache_pool);
 
-	  SearchState ss (callback, *isec_cache_grab);
+	  SearchState<NegCache> ss (callback, *isec_cache_grab);
 
 	  root->for_each_possible_intersector (ray, ss,
 					       x_min_isec, x_max_isec,
@@ -122,9 +158,10 @@ Octree::for_each_possible_intersector (const Ray &ray,
 // This method is critical for speed, and so we try to avoid doing any
 // calculation at all.
 //
+template<class NegCache>
 void
 Octree::Node::for_each_possible_intersector (const Ray &ray,
-					     SearchState &ss,
+					     SearchState<NegCache> &ss,
 					     const Pos &x_min_isec,
 					     const Pos &x_max_isec,
 					     const Pos &y_min_isec,
@@ -17,11 +17,15 @@
 
 #include "pos.h"
 #include "space.h"
+#include "pool.h"
 
 
 namespace snogray {
 
 
+class ValTable;
+
+
 class Octree : public Space
 {
 public:
@@ -35,7 +39,24 @@ public:
   class BuilderFactory;
 
 
-  Octree () : root (0), num_real_surfaces (0) { }
+  // Kinds of cache used to avoid testing the same surface more than
+  // once during a single search.
+  //
+  enum IsecCacheKind
+  {
+    // Fixed-size direct-mapped table (IsecCache); very cheap, but
+    // entries may be lost due to collisions.
+    //
+    ISEC_CACHE_HASH,
+
+    // Growable per-search set (IsecMailbox), which never loses entries.
+    //
+    ISEC_CACHE_MAILBOX
+  };
+
+  Octree (IsecCacheKind _isec_cache_kind = ISEC_CACHE_HASH)
+    : root (0), num_real_surfaces (0), isec_cache_kind (_isec_cache_kind)
+  { }
   ~Octree ();
 
 
@@ -88,6 +109,7 @@ public:
 
 private:  
 
+  template<class NegCache>
   struct SearchState;
 
   // A octree node is one level of the tree, containing a cubic volume
@@ -103,6 +125,15 @@ private:
   //
   void grow_to_include (const Surface *surface, const BBox &surface_bbox);
 
+  // Do the work of Octree::for_each_possible_intersector, using a
+  // negative-intersection cache of type NEG_CACHE from CACHE_POOL.
+  //
+  template<class NegCache>
+  void search (const Ray &ray, IntersectCallback &callback,
+	       Pool<NegCache> &cache_pool,
+	       RenderStats::IsecStats &isec_stats)
+    const;
+
   // The root of the tree
   //
   Node *root;
@@ -110,6 +141,10 @@ private:
   // The number of "real" surfaces added to the octree.
   //
   unsigned long num_real_surfaces;
+
+  // What kind of negative-intersection cache searches use.
+  //
+  IsecCacheKind isec_cache_kind;
 };
 
 
@@ -122,7 +157,9 @@ class Octree::Builder : public SpaceBuilder
 {
 public:
 
-  Builder () : octree (new Octree) { }
+  Builder (IsecCacheKind isec_cache_kind = ISEC_CACHE_HASH)
+    : octree (new Octree (isec_cache_kind))
+  { }
 
   // Add SURFACE to the space being built.
   //
@@ -149,12 +186,26 @@ class Octree::BuilderFactory : public SpaceBuilderFactory
 {
 public:
 
+  BuilderFactory (IsecCacheKind _isec_cache_kind = ISEC_CACHE_HASH)
+    : isec_cache_kind (_isec_cache_kind)
+  { }
+
+  // Make a factory using options from PARAMS.  Currently the only
+  // option is "isec-cache", which may be "hash" (the default) or
+  // "mailbox".
+  //
+  BuilderFactory (const ValTable &params);
+
   // Return a new SpaceBuilder object.
   //
   virtual SpaceBuilder *make_space_builder () const
   {
-    return new Octree::Builder ();
+    return new Octree::Builder (isec_cache_kind);
   }
+
+private:
+
+  IsecCacheKind isec_cache_kind;
 };
 
 
@@ -183,8 +234,9 @@ struct Octree::Node
   // planes bounding this node's volume (we don't actually need the
   // ray itself).
   //
+  template<class NegCache>
   void for_each_possible_intersector (const Ray &ray,
-				      SearchState &ss,
+				      SearchState<NegCache> &ss,
 				      const Pos &x_min_isec,
 				      const Pos &x_max_isec,
 				      const Pos &y_min_isec,
@@ -241,9 +293,10 @@ struct Octree::Node
 
 // Octree::SearchState
 
+template<class NegCache>
 struct Octree::SearchState : Space::SearchState
 {
-  SearchState (IntersectCallback &_callback, IsecCache &_negative_isec_cache)
+  SearchState (IntersectCallback &_callback, NegCache &_negative_isec_cache)
     : Space::SearchState (_callback),
       negative_isec_cache (_negative_isec_cache),
       neg_cache_hits (0), neg_cache_collisions (0)
@@ -261,9 +314,10 @@ struct Octree::SearchState : Space::SearchState
   }
     
   // Cache of negative surface intersection test results, so we can
-  // avoid testing the same object twice.
+  // avoid testing the same object twice.  This is either an IsecCache
+  // or an IsecMailbox object.
   //
-  IsecCache &negative_isec_cache;
+  NegCache &negative_isec_cache;
 
   // Keep track of some statics for the negative intersection cache.
   //
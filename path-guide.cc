@@ -0,0 +1,269 @@
+// path-guide.cc -- Learned directional distributions for guiding paths
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include "val-table.h"
+
+#include "path-guide.h"
+
+
+using namespace snogray;
+
+
+// Directional resolution of the histograms in each octree leaf.
+//
+static const unsigned DIR_RES_U = 16, DIR_RES_V = 16;
+
+// A leaf must have at least this many records before a sampling
+// distribution is made for it.
+//
+static const unsigned MIN_DIST_RECORDS = 64;
+
+// Fraction of each leaf's histogram which is spread uniformly over all
+// directions, so that no direction has zero probability.
+//
+static const float UNIFORM_FRACTION = 0.05f;
+
+// Leaves at this depth are never split.
+//
+static const unsigned MAX_DEPTH = 20;
+
+
+// Make a path guide covering BOUNDS, using parameters from PARAMS.
+//
+PathGuide::PathGuide (const BBox &bounds, const ValTable &params)
+  : nodes (1, Node (0)),
+    leaf_hists (1, new DirHist (DIR_RES_U, DIR_RES_V)),
+    leaf_counts (1, 0), leaf_depths (1, 0),
+    iter_records (0),
+    iter_target (max (params.get_uint ("guide-train", 32768), 1u)),
+    iters_left (params.get_uint ("guide-iterations", 6)),
+    split_threshold (max (params.get_uint ("guide-split", 4000), 8u)),
+    cur_snapshot (0)
+{
+  // Use a cube (so that leaves stay roughly cubical), slightly larger
+  // than BOUNDS to avoid problems with points exactly on the boundary.
+  //
+  dist_t size = bounds.max_size ();
+  if (size > 0)
+    {
+      center = midpoint (bounds.min, bounds.max);
+      size *= 0.5f * 1.01f;
+    }
+  else
+    {
+      center = Pos (0, 0, 0);
+      size = 1;
+    }
+  half_size = Vec (size, size, size);
+}
+
+PathGuide::~PathGuide ()
+{
+  for (std::vector<DirHist *>::iterator i = leaf_hists.begin ();
+       i != leaf_hists.end (); ++i)
+    delete *i;
+  for (std::vector<const Snapshot *>::iterator i = snapshots.begin ();
+       i != snapshots.end (); ++i)
+    delete *i;
+}
+
+PathGuide::Snapshot::~Snapshot ()
+{
+  for (std::vector<const DirHistDist *>::iterator i = leaf_dists.begin ();
+       i != leaf_dists.end (); ++i)
+    delete *i;
+}
+
+
+// Return the index of the octant of the box with center CENTER which
+// contains POS, and update CENTER and HALF_SIZE to describe that
+// octant.
+//
+unsigned
+PathGuide::octant (const Pos &pos, Pos &center, Vec &half_size)
+{
+  half_size *= 0.5f;
+
+  unsigned index = 0;
+
+  if (pos.x >= center.x)
+    {
+      index |= 1;
+      center.x += half_size.x;
+    }
+  else
+    center.x -= half_size.x;
+
+  if (pos.y >= center.y)
+    {
+      index |= 2;
+      center.y += half_size.y;
+    }
+  else
+    center.y -= half_size.y;
+
+  if (pos.z >= center.z)
+    {
+      index |= 4;
+      center.z += half_size.z;
+    }
+  else
+    center.z -= half_size.z;
+
+  return index;
+}
+
+// Return the index of the leaf in the octree NODES (covering the
+// box with center CENTER and half-size HALF_SIZE) containing POS.
+//
+unsigned
+PathGuide::find_leaf (const std::vector<Node> &nodes, const Pos &pos,
+		      Pos center, Vec half_size)
+{
+  unsigned node = 0;
+  while (nodes[node].children)
+    node = nodes[node].children + octant (pos, center, half_size);
+  return nodes[node].leaf;
+}
+
+
+// Add the training records in RECORDS, and clear RECORDS.  If enough
+// records have been added for the current training iteration, a new
+// snapshot is made.
+//
+void
+PathGuide::add_records (std::vector<Record> &records)
+{
+  LockGuard guard (mutex);
+
+  if (iters_left.load () > 0)
+    {
+      for (std::vector<Record>::iterator r = records.begin ();
+	   r != records.end (); ++r)
+	{
+	  unsigned leaf = find_leaf (nodes, r->pos, center, half_size);
+	  leaf_hists[leaf]->add (r->dir, r->val);
+	  leaf_counts[leaf]++;
+	}
+
+      iter_records += records.size ();
+
+      if (iter_records >= iter_target)
+	{
+	  update ();
+
+	  iter_records = 0;
+	  iter_target *= 2;
+	  --iters_left;
+	}
+    }
+
+  records.clear ();
+}
+
+
+// Make a new snapshot from the training data, and split any leaves
+// which have received enough records.  MUTEX should be locked.
+//
+void
+PathGuide::update ()
+{
+  Snapshot *snap = new Snapshot;
+  snap->center = center;
+  snap->half_size = half_size;
+  snap->nodes = nodes;
+
+  unsigned num_leaves = leaf_hists.size ();
+
+  snap->leaf_dists.resize (num_leaves, 0);
+
+  for (unsigned leaf = 0; leaf < num_leaves; leaf++)
+    if (leaf_counts[leaf] >= MIN_DIST_RECORDS)
+      {
+	DirHist hist (*leaf_hists[leaf]);
+
+	float sum = 0;
+	for (unsigned i = 0; i < hist.size; i++)
+	  sum += hist.bins[i];
+
+	if (sum > 0)
+	  {
+	    // Add a uniform floor, so every direction can still be
+	    // sampled (the histogram is only an estimate, and a
+	    // direction which hasn't been seen yet may still matter).
+	    //
+	    float floor = sum * UNIFORM_FRACTION / hist.size;
+	    for (unsigned i = 0; i < hist.size; i++)
+	      hist.bins[i] += floor;
+
+	    DirHistDist *dist = new DirHistDist (DIR_RES_U, DIR_RES_V);
+	    dist->calc (hist);
+	    snap->leaf_dists[leaf] = dist;
+	  }
+      }
+
+  snapshots.push_back (snap);
+  cur_snapshot.store (snap);
+
+  // Split any leaves which have received enough records.  The new
+  // children start out with a share of the parent's training data, so
+  // they aren't left without a distribution in the next snapshot.
+  //
+  unsigned num_nodes = nodes.size ();
+  for (unsigned node = 0; node < num_nodes; node++)
+    if (nodes[node].children == 0)
+      {
+	unsigned leaf = nodes[node].leaf;
+
+	if (leaf_counts[leaf] < split_threshold
+	    || leaf_depths[leaf] >= MAX_DEPTH)
+	  continue;
+
+	DirHist *parent_hist = leaf_hists[leaf];
+	for (unsigned i = 0; i < parent_hist->size; i++)
+	  parent_hist->bins[i] *= 0.125f;
+
+	unsigned child_count = leaf_counts[leaf] / 8;
+	unsigned child_depth = leaf_depths[leaf] + 1;
+
+	// Note that NODES may be reallocated by push_back, so we only
+	// refer to nodes by index here.
+	//
+	unsigned children = nodes.size ();
+
+	for (unsigned oct = 0; oct < 8; oct++)
+	  {
+	    unsigned child_leaf;
+
+	    if (oct == 0)
+	      {
+		// The first child reuses the parent's leaf data.
+		//
+		child_leaf = leaf;
+	      }
+	    else
+	      {
+		child_leaf = leaf_hists.size ();
+		leaf_hists.push_back (new DirHist (*parent_hist));
+		leaf_counts.push_back (0);
+		leaf_depths.push_back (0);
+	      }
+
+	    leaf_counts[child_leaf] = child_count;
+	    leaf_depths[child_leaf] = child_depth;
+
+	    nodes.push_back (Node (child_leaf));
+	  }
+
+	nodes[node].children = children;
+      }
+}
@@ -0,0 +1,228 @@
+// path-guide.h -- Learned directional distributions for guiding paths
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef __PATH_GUIDE_H__
+#define __PATH_GUIDE_H__
+
+#include <vector>
+
+#include "bbox.h"
+#include "mutex.h"
+#include "atomic.h"
+#include "dir-hist.h"
+#include "dir-hist-dist.h"
+
+
+namespace snogray {
+
+
+class ValTable;
+
+
+// A "path guide" learns, while rendering, how much light arrives at
+// points in the scene from each direction, so that a path tracer can
+// sample directions in proportion to incoming light as well as the
+// BSDF (which helps enormously with indirect light that arrives
+// through narrow openings).
+//
+// Space is divided by an octree whose leaves each hold a directional
+// histogram (DirHist) of incoming radiance.  Render threads add
+// "training records" -- a position, a direction, and an estimate of
+// the radiance arriving from that direction divided by the pdf with
+// which the direction was chosen -- and once enough records have been
+// added, a new read-only "snapshot" is made, containing a sampling
+// distribution (DirHistDist) for each leaf with enough data, and any
+// leaf which has received many records is split.
+//
+// Training happens in a fixed number of iterations, each of which
+// needs twice as many records as the one before; after the final
+// iteration, PathGuide::training returns false, and no more records
+// should be added.
+//
+// All public methods may be called concurrently from multiple threads.
+// Snapshots are never modified after being made, and remain valid
+// until the PathGuide object is destroyed, so a thread may keep using
+// a snapshot even after a newer one has been made.
+//
+// Parameters (from the PARAMS argument to the constructor):
+//
+//   "guide-train"	-- number of records in the first training
+//			   iteration (default 32768)
+//   "guide-iterations"	-- number of training iterations (default 6)
+//   "guide-split"	-- number of records after which an octree leaf
+//			   is split (default 4000)
+//
+class PathGuide
+{
+public:
+
+  // A training record.
+  //
+  struct Record
+  {
+    Record (const Pos &_pos, const Vec &_dir, float _val)
+      : pos (_pos), dir (_dir), val (_val)
+    { }
+
+    // The position of the record, and the direction (in world
+    // coordinates) from which light arrives.
+    //
+    Pos pos;
+    Vec dir;
+
+    // The intensity of the incoming light, divided by the pdf of
+    // choosing DIR.
+    //
+    float val;
+  };
+
+  class Snapshot;
+
+  // Make a path guide covering BOUNDS, using parameters from PARAMS.
+  //
+  PathGuide (const BBox &bounds, const ValTable &params);
+  ~PathGuide ();
+
+  // Return the most recent snapshot, or zero if none has been made yet.
+  // This doesn't lock anything, so it's cheap enough to call for every
+  // path.
+  //
+  const Snapshot *snapshot () const
+  {
+    return cur_snapshot.load ();
+  }
+
+  // Return true if more training records are wanted.  Like
+  // PathGuide::snapshot, this doesn't lock anything.
+  //
+  bool training () const
+  {
+    return iters_left.load () > 0;
+  }
+
+  // Add the training records in RECORDS, and clear RECORDS.  If enough
+  // records have been added for the current training iteration, a new
+  // snapshot is made.
+  //
+  void add_records (std::vector<Record> &records);
+
+private:
+
+  // A node in an octree.  If CHILDREN is zero, the node is a leaf, and
+  // LEAF is the index of its data; otherwise the node's children are
+  // the eight nodes starting at CHILDREN.  The child containing a
+  // given point is found using the bits of PathGuide::octant.
+  //
+  struct Node
+  {
+    Node (unsigned _leaf = 0) : children (0), leaf (_leaf) { }
+
+    unsigned children;
+    unsigned leaf;
+  };
+
+  // Return the index of the octant of the box with center CENTER which
+  // contains POS, and update CENTER and HALF_SIZE to describe that
+  // octant.
+  //
+  static unsigned octant (const Pos &pos, Pos &center, Vec &half_size);
+
+  // Return the index of the leaf in the octree NODES (covering the
+  // box with center CENTER and half-size HALF_SIZE) containing POS.
+  //
+  static unsigned find_leaf (const std::vector<Node> &nodes, const Pos &pos,
+			     Pos center, Vec half_size);
+
+  // Make a new snapshot from the training data, and split any leaves
+  // which have received enough records.  MUTEX should be locked.
+  //
+  void update ();
+
+  // Bounds of the octree.
+  //
+  Pos center;
+  Vec half_size;
+
+  // The training octree, and per-leaf training data:  a directional
+  // histogram, the number of records added to it, and the leaf's depth
+  // in the octree.
+  //
+  std::vector<Node> nodes;
+  std::vector<DirHist *> leaf_hists;
+  std::vector<unsigned> leaf_counts;
+  std::vector<unsigned> leaf_depths;
+
+  // Number of records in the current training iteration so far, and the
+  // number needed to finish it.
+  //
+  unsigned long iter_records, iter_target;
+
+  // Number of training iterations remaining.  This is only changed
+  // with MUTEX locked, but is atomic so that PathGuide::training can
+  // read it without locking.
+  //
+  Atomic<unsigned> iters_left;
+
+  // Number of records after which a leaf is split.
+  //
+  unsigned split_threshold;
+
+  // The most recent snapshot, and all older snapshots (which are only
+  // kept so they can be deleted).  CUR_SNAPSHOT is only changed with
+  // MUTEX locked, but is atomic so that PathGuide::snapshot can read it
+  // without locking.
+  //
+  Atomic<const Snapshot *> cur_snapshot;
+  std::vector<const Snapshot *> snapshots;
+
+  // Protects all of the above (except for reads of ITERS_LEFT and
+  // CUR_SNAPSHOT).
+  //
+  mutable Mutex mutex;
+};
+
+
+// A read-only snapshot of the sampling distributions in a PathGuide.
+//
+class PathGuide::Snapshot
+{
+public:
+
+  ~Snapshot ();
+
+  // Return the sampling distribution for incoming light at POS, or zero
+  // if there isn't enough information to make one there.
+  //
+  const DirHistDist *dist (const Pos &pos) const
+  {
+    unsigned leaf = find_leaf (nodes, pos, center, half_size);
+    return leaf_dists[leaf];
+  }
+
+private:
+
+  friend class PathGuide;
+
+  Pos center;
+  Vec half_size;
+
+  std::vector<Node> nodes;
+
+  // Sampling distribution for each leaf, or zero.
+  //
+  std::vector<const DirHistDist *> leaf_dists;
+};
+
+
+}
+
+#endif // __PATH_GUIDE_H__
@@ -10,6 +10,8 @@
 // Written by Miles Bader <miles@gnu.org>
 //
 
+#include <limits>
+
 #include "bsdf.h"
 #include "scene.h"
 #include "media.h"
@@ -61,15 +63,22 @@ PathInteg::GlobalState::GlobalState (const GlobalRenderState &rstate,
 				     const ValTable &params)
   : SurfaceInteg::GlobalState (rstate),
     min_path_len (params.get_uint ("min-len", 3)),
-    max_path_len (params.get_uint ("max-len", 25)),
+    max_path_len (params.get_uint ("max-len", 100)),
+    russian_roulette (params, min_path_len),
     direct_illum (
+      rstate, params,
       params.get_uint ("direct-samples,dir-samples,dir-samps",
 		       rstate.params.get_uint ("light-samples", 1))),
     photon_eval (
       params.get_uint ("render-photons", 50),
       params.get_float ("photon-radius,radius", 5),
-      params.get_float ("marker-radius", 0))
+      params.get_float ("marker-radius", 0)),
+    guide_fraction (clamp (params.get_float ("guide-fraction", 0.5f),
+			   0.f, 1.f))
 {
+  if (params.get_bool ("guide", false))
+    guide.reset (new PathGuide (rstate.scene.surfaces.bbox (), params));
+
   // Shoot photons if the user has enabled "photon-diffuse" mode.
   //
   // [It's disabled by default, because there are some annoying
@@ -119,6 +128,62 @@ PathInteg::GlobalState::make_integrator (RenderContext &context)
 }
 
 
+// PathInteg::guided_sample
+
+// Return a sample for continuing a path from ISEC, chosen from either
+// the BSDF or the path-guide distribution GUIDE_DIST (with
+// PathInteg::GlobalState::guide_fraction being the probability of
+// using the latter), using the random variables in PARAM.  The
+// returned pdf is the combined pdf of both strategies.
+//
+// This is "one-sample" multiple importance sampling using the balance
+// heuristic:  whichever strategy is chosen, dividing by the combined
+// pdf gives an unbiased estimate as long as either strategy can
+// generate every direction the BSDF reflects light into (which is
+// always true, as the BSDF can).
+//
+Bsdf::Sample
+PathInteg::guided_sample (const Intersect &isec, const DirHistDist &guide_dist,
+			  const UV &param) const
+{
+  float guide_frac = global.guide_fraction;
+
+  if (param.u < guide_frac)
+    {
+      // Sample the guide distribution, which is in world coordinates.
+      //
+      float guide_pdf;
+      Vec world_dir
+	= guide_dist.sample (UV (param.u / guide_frac, param.v), guide_pdf);
+      Vec dir = isec.normal_frame.to (world_dir);
+
+      Bsdf::Value bsdf_val = isec.bsdf->eval (dir);
+
+      float pdf = guide_frac * guide_pdf + (1 - guide_frac) * bsdf_val.pdf;
+
+      unsigned flags
+	= (isec.cos_geom_n (dir) < 0) ? Bsdf::TRANSMISSIVE : Bsdf::REFLECTIVE;
+
+      return Bsdf::Sample (bsdf_val.val, pdf, dir, flags);
+    }
+  else
+    {
+      UV bsdf_param ((param.u - guide_frac) / (1 - guide_frac), param.v);
+
+      Bsdf::Sample samp = isec.bsdf->sample (bsdf_param);
+
+      if (samp.pdf != 0)
+	{
+	  float guide_pdf
+	    = guide_dist.pdf (isec.normal_frame.from (samp.dir));
+	  samp.pdf = guide_frac * guide_pdf + (1 - guide_frac) * samp.pdf;
+	}
+
+      return samp;
+    }
+}
+
+
 // PathInteg::Li
 
 // Return the light arriving at RAY's origin from the direction it
@@ -169,6 +234,33 @@ PathInteg::Li (const Ray &ray, const Media &orig_media,
   //
   float alpha = 1;
 
+  // If we're using a path guide, the snapshot we use for sampling (zero
+  // if none has been made yet), and whether we should record path
+  // vertices for training it.
+  //
+  const PathGuide::Snapshot *guide_snapshot = 0;
+  bool guide_training = false;
+  if (global.guide)
+    {
+      guide_snapshot = global.guide->snapshot ();
+      guide_training = global.guide->training ();
+
+      // Once training has finished, any records we haven't added yet
+      // are no longer wanted, so free them (unless a caller of this
+      // method is still using GUIDE_VERTICES).
+      //
+      if (!guide_training && guide_vertices.empty ()
+	  && guide_records.capacity () != 0)
+	{
+	  std::vector<GuideVertex> ().swap (guide_vertices);
+	  std::vector<PathGuide::Record> ().swap (guide_records);
+	}
+    }
+
+  // Index of the first entry in GUIDE_VERTICES belonging to this call.
+  //
+  unsigned guide_vertex_base = guide_vertices.size ();
+
   // Grow the path, one vertex at a time.  At each vertex, the lighting
   // contribution will be added for that vertex, and then a new sample
   // direction is chosen to use for the path's next vertex.  This will
@@ -311,10 +403,25 @@ PathInteg::Li (const Ray &ray, const Media &orig_media,
 	 ? sample.get (bsdf_sample_channels[path_len])
 	 : UV (context.random (), context.random ()));
 
-      // Now sample the BSDF to get a new ray for the next path vertex.
+      // If the path guide has a distribution for this location, use it
+      // as well as the BSDF for choosing a direction.  We don't do so
+      // for BSDFs with specular components, as those can't be
+      // evaluated in arbitrary directions, or when some BSDF layers
+      // are being handled by the photon-map.
+      //
+      const DirHistDist *guide_dist = 0;
+      if (guide_snapshot
+	  && non_photon_flags == Bsdf::ALL
+	  && !(isec.bsdf->supports () & Bsdf::SPECULAR))
+	guide_dist = guide_snapshot->dist (isec.normal_frame.origin);
+
+      // Now sample the BSDF (and maybe the path guide) to get a new
+      // ray for the next path vertex.
       //
       Bsdf::Sample bsdf_samp
-	= isec.bsdf->sample (bsdf_samp_param, non_photon_flags);
+	= (guide_dist
+	   ? guided_sample (isec, *guide_dist, bsdf_samp_param)
+	   : isec.bsdf->sample (bsdf_samp_param, non_photon_flags));
 
       // If the BSDF couldn't give us a sample, this path is done.
       // It's essentially perfect  black.
@@ -330,36 +437,20 @@ PathInteg::Li (const Ray &ray, const Media &orig_media,
       // If this path is getting long, use russian roulette to randomly
       // terminate it.
       //
-      if (path_len > global.min_path_len)
+      if (global.russian_roulette.applies (path_len)
+	  && global.russian_roulette.terminate (context.random (),
+						path_transmittance))
 	{
-	  // RR_CONTINUE_PROB is the probability that we'll continue
-	  // this path.
+	  // Terminated!
 	  //
-	  // We make it proportional to the current path transmittance
-	  // so that paths with high-transmittance, which have a
-	  // bigger effect on the final result, will be explored
-	  // farther.
-	  //
-	  float rr_continue_prob = min (1.f, path_transmittance.intensity ());
-	  float russian_roulette = context.random ();
-	  
-	  if (russian_roulette > rr_continue_prob)
-	    //
-	    // Terminated!
-	    break;
-	  else
-	    // Don't terminate.  Adjust PATH_TRANSMITTANCE to reflect
-	    // the fact that we tried.
-	    //
-	    // By dividing by the probability of continuation, which is
-	    // less than 1, we boost the intensity of paths that survive
-	    // russian-roulette, which will exactly compensate for the
-	    // zero value of paths that are terminated by it.
-	    //
-	    path_transmittance /= rr_continue_prob;
+	  context.stats.path.rr_terminations++;
+	  break;
 	}
       if (path_len == global.max_path_len)
-	break;
+	{
+	  context.stats.path.max_len_terminations++;
+	  break;
+	}
 
       // Update ISEC_RAY to point from ISEC's position in the direction
       // of the BSDF sample.  
@@ -368,6 +459,17 @@ PathInteg::Li (const Ray &ray, const Media &orig_media,
 		      isec.normal_frame.from (bsdf_samp.dir),
 		      min_dist, scene.horizon);
 
+      // Remember this vertex for training the path guide, so that once
+      // the path is done, we can tell how much light arrived from
+      // the direction we chose.  Specular samples are useless for
+      // training, as they're never guided.
+      //
+      if (guide_training && !(bsdf_samp.flags & Bsdf::SPECULAR))
+	guide_vertices.push_back (
+			 GuideVertex (isec_ray.origin, isec_ray.dir,
+				      path_transmittance, radiance,
+				      bsdf_samp.pdf));
+
       // Remember whether we followed a specular sample, because such
       // samples are normally not accounted for in the direct-lighting
       // term, and so if the sample hits an emitter, the emitter
@@ -394,5 +496,36 @@ PathInteg::Li (const Ray &ray, const Media &orig_media,
       path_len++;
     }
 
+  context.stats.path.add_path (path_len);
+
+  // Turn the path vertices we recorded into training records for the
+  // path guide.  The radiance added after each vertex, divided by the
+  // path transmittance up to that point, is an estimate of the
+  // radiance arriving at the vertex from the direction chosen.
+  //
+  if (guide_vertices.size () > guide_vertex_base)
+    {
+      for (std::vector<GuideVertex>::iterator v
+	     = guide_vertices.begin () + guide_vertex_base;
+	   v != guide_vertices.end (); ++v)
+	{
+	  float trans = v->transmittance.intensity ();
+	  if (trans > 0)
+	    {
+	      float val
+		= (radiance - v->radiance).intensity () / trans / v->pdf;
+	      if (val >= 0 && val < std::numeric_limits<float>::infinity ())
+		guide_records.push_back (
+				   PathGuide::Record (v->pos, v->dir, val));
+	    }
+	}
+
+      guide_vertices.erase (guide_vertices.begin () + guide_vertex_base,
+			    guide_vertices.end ());
+
+      if (guide_vertex_base == 0 && guide_records.size () >= 1024)
+	global.guide->add_records (guide_records);
+    }
+
   return Tint (radiance, alpha);
 }
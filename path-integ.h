@@ -13,10 +13,15 @@
 #ifndef __PATH_INTEG_H__
 #define __PATH_INTEG_H__
 
+#include <vector>
+
 #include "surface-integ.h"
 #include "direct-illum.h"
 #include "photon-map.h"
 #include "photon-eval.h"
+#include "path-guide.h"
+#include "russian-roulette.h"
+#include "unique-ptr.h"
 
 
 namespace snogray {
@@ -52,10 +57,16 @@ public:
     //
     unsigned min_path_len;
 
-    // Path-length at which we just give up and return 0.
+    // Path-length at which we just give up and return 0.  Russian
+    // roulette normally terminates paths long before this, so it can
+    // be fairly large.
     //
     unsigned max_path_len;
 
+    // Russian-roulette termination of paths over MIN_PATH_LEN.
+    //
+    RussianRoulette russian_roulette;
+
     // Global state for DirectIllum objects.
     //
     DirectIllum::GlobalState direct_illum;
@@ -71,6 +82,16 @@ public:
     // Amount by which we scale photons during rendering.
     //
     float photon_scale;
+
+    // If non-zero, a path guide used to choose the directions in which
+    // paths are extended, trained using the paths we trace.
+    //
+    UniquePtr<PathGuide> guide;
+
+    // The fraction of samples at each path vertex which are taken from
+    // GUIDE instead of the BSDF (once GUIDE has a distribution there).
+    //
+    float guide_fraction;
   };
 
   // Return the light arriving at RAY's origin from the direction it
@@ -89,10 +110,47 @@ private:
 
   class Shooter;		// for generating photons
 
+  // A path vertex recorded for training the path guide.
+  //
+  struct GuideVertex
+  {
+    GuideVertex (const Pos &_pos, const Vec &_dir,
+		 const Color &_transmittance, const Color &_radiance,
+		 float _pdf)
+      : pos (_pos), dir (_dir), transmittance (_transmittance),
+	radiance (_radiance), pdf (_pdf)
+    { }
+
+    // The position of the vertex, and the direction (in world
+    // coordinates) in which the path continued.
+    //
+    Pos pos;
+    Vec dir;
+
+    // The path transmittance after continuing in direction DIR, and the
+    // radiance accumulated before doing so.
+    //
+    Color transmittance, radiance;
+
+    // The pdf with which DIR was chosen.
+    //
+    float pdf;
+  };
+
   // Integrator state for rendering a group of related samples.
   //
   PathInteg (RenderContext &context, GlobalState &global_state);
 
+  // Return a sample for continuing a path from ISEC, chosen from either
+  // the BSDF or the path-guide distribution GUIDE_DIST (with
+  // PathInteg::GlobalState::guide_fraction being the probability of
+  // using the latter), using the random variables in PARAM.  The
+  // returned pdf is the combined pdf of both strategies.
+  //
+  Bsdf::Sample guided_sample (const Intersect &isec,
+			      const DirHistDist &guide_dist,
+			      const UV &param) const;
+
   // Pointer to our global state info.
   //
   const GlobalState &global;
@@ -136,6 +194,15 @@ private:
   // The photon-map evaluator.
   //
   PhotonEval photon_eval;
+
+  // Path vertices recorded by PathInteg::Li for training the path guide,
+  // and training records waiting to be added to the path guide.  Like
+  // RANDOM_SAMPLE_SET, these are only fields to avoid allocation in
+  // PathInteg::Li; for reentrancy, PathInteg::Li only uses vertices
+  // after those present when it was called.
+  //
+  std::vector<GuideVertex> guide_vertices;
+  std::vector<PathGuide::Record> guide_records;
 };
 
 
@@ -30,6 +30,14 @@ public:
     return perlin.noise (coords.pos);
   }
 
+  virtual void eval_batch (const TexCoords *coords, float *results,
+			   unsigned num)
+    const
+  {
+    for (unsigned i = 0; i < num; i++)
+      results[i] = perlin.noise (coords[i].pos);
+  }
+
 private:
 
   Perlin perlin;
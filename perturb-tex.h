@@ -33,11 +33,14 @@ public:
   virtual T eval (const TexCoords &coords) const
   {
     Vec offs (x.eval (coords), y.eval (coords), z.eval (coords));
-    return source.eval (TexCoords (coords.pos + offs, coords.uv));
+    return source.eval (TexCoords (coords.pos + offs, coords.uv,
+					coords.pos_width, coords.uv_width));
   }
 
 private:
 
+  friend class TexCompiler;
+
   TexVal<T> source;
 
   TexVal<float> x, y, z;
@@ -57,11 +60,14 @@ public:
   virtual T eval (const TexCoords &coords) const
   {
     UV offs (u.eval (coords), v.eval (coords));
-    return source.eval (TexCoords (coords.pos, coords.uv + offs));
+    return source.eval (TexCoords (coords.pos, coords.uv + offs,
+					coords.pos_width, coords.uv_width));
   }
 
 private:
 
+  friend class TexCompiler;
+
   TexVal<T> source;
 
   TexVal<float> u, v;
@@ -43,6 +43,7 @@ PhotonInteg::GlobalState::GlobalState (const GlobalRenderState &rstate,
       params.get_float ("radius", 0.1),
       params.get_float ("marker-radius", 0)),
     direct_illum (
+      rstate, params,
       params.get_uint ("direct-samples,dir-samples,dir-samps",
 		       rstate.params.get_uint ("light-samples", 16))),
     use_direct_illum (params.get_bool ("direct-illum,dir-illum", true)),
@@ -80,5 +80,19 @@ PointLight::eval (const Intersect &, const Vec &) const
   return Value ();  // DIR will always fail to point exactly to th
 }
 
+// Return the pdf which the free-sampling variant of Light::sample
+// would have for a sample that reaches VIEWPOINT from direction DIR
+// (in world coordinates, pointing from VIEWPOINT towards the light).
+//
+// As this is a point light, DIR is ignored, and only the direction
+// from the light to VIEWPOINT matters.
+//
+float
+PointLight::free_sample_pdf (const Pos &viewpoint, const Vec &) const
+{
+  float cos_dir = dot ((viewpoint - frame.origin).unit (), frame.z);
+  return (cos_dir >= cos_half_angle) ? cone_sample_pdf (cos_half_angle) : 0;
+}
+
 
 // arch-tag: 1ef7bd92-c1c5-4053-b4fb-f8a6bee1a1de
@@ -62,6 +62,12 @@ public:
   //
   virtual Value eval (const Intersect &isec, const Vec &dir) const;
 
+  // Return the pdf which the free-sampling variant of Light::sample
+  // would have for a sample that reaches VIEWPOINT from direction DIR
+  // (in world coordinates, pointing from VIEWPOINT towards the light).
+  //
+  virtual float free_sample_pdf (const Pos &viewpoint, const Vec &dir) const;
+
   // Return true if this is a point light.
   //
   virtual bool is_point_light () const { return true; }
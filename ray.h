@@ -59,6 +59,15 @@ public:
   {
   }
 
+  TRay &operator= (const TRay &ray)
+  {
+    origin = ray.origin;
+    dir = ray.dir;
+    t0 = ray.t0;
+    t1 = ray.t1;
+    return *this;
+  }
+
   // Returns the location of this ray with parameter T.
   //
   TPos<T> operator() (T t) const { return origin + dir * t; }
@@ -0,0 +1,258 @@
+// render-checkpoint.cc -- Periodic saving of render state
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+
+#include <unistd.h>
+
+#include "timeval.h"
+#include "file-funs.h"
+#include "image-output.h"
+
+#include "render-checkpoint.h"
+
+
+using namespace snogray;
+
+
+// The first line of every checkpoint file.
+//
+#define CHECKPOINT_MAGIC "snogray checkpoint 1\n"
+
+// Indices of the header fields in a checkpoint file, which follow
+// CHECKPOINT_MAGIC.
+//
+enum {
+  HDR_WIDTH, HDR_HEIGHT, HDR_NUM_LAYER_CHANNELS, HDR_PATTERN_SIZE,
+  HDR_POSITION, HDR_RESUMES, HDR_SKIPPED_ROWS,
+  NUM_HDR_FIELDS
+};
+
+
+// Make a checkpoint object using the checkpoint file FILE_NAME, which
+// saves a new checkpoint every INTERVAL seconds.
+//
+RenderCheckpoint::RenderCheckpoint (const std::string &_file_name,
+				    float _interval)
+  : file_name (_file_name), row_log_name (_file_name + "-rows"),
+    interval (_interval), next_time (0),
+    resume_pos (0), resume_pattern_size (0), resumes (0), skipped (0)
+{
+}
+
+
+// Return true if there's a checkpoint file which can be resumed from.
+//
+bool
+RenderCheckpoint::exists () const
+{
+  return file_exists (file_name) && file_exists (row_log_name);
+}
+
+
+// Start checkpointing the rendering of OUTPUT from the beginning.
+//
+void
+RenderCheckpoint::start (ImageOutput &output)
+{
+  check_output (output);
+
+  row_log.open (row_log_name.c_str (),
+		std::ios::out | std::ios::binary | std::ios::trunc);
+  if (! row_log)
+    throw std::runtime_error (row_log_name + ": " + strerror (errno));
+
+  output.set_row_log (&row_log);
+
+  reset_timer ();
+}
+
+
+// Restore the state of OUTPUT from the checkpoint, and continue
+// checkpointing it.  If there's a problem with the checkpoint, an
+// exception is thrown.
+//
+void
+RenderCheckpoint::resume (ImageOutput &output)
+{
+  check_output (output);
+
+  std::ifstream state (file_name.c_str (), std::ios::in | std::ios::binary);
+  if (! state)
+    throw std::runtime_error (file_name + ": " + strerror (errno));
+
+  char magic[sizeof CHECKPOINT_MAGIC - 1];
+  unsigned hdr[NUM_HDR_FIELDS];
+  state.read (magic, sizeof magic);
+  state.read (reinterpret_cast<char *> (hdr), sizeof hdr);
+
+  if (!state || memcmp (magic, CHECKPOINT_MAGIC, sizeof magic) != 0)
+    throw std::runtime_error (file_name + ": Not a checkpoint file");
+
+  if (hdr[HDR_WIDTH] != output.width || hdr[HDR_HEIGHT] != output.height
+      || hdr[HDR_NUM_LAYER_CHANNELS] != output.num_layer_channels ()
+      || hdr[HDR_SKIPPED_ROWS] > output.height)
+    throw std::runtime_error (file_name + ": Checkpoint is for a different"
+			      " output image size or layers");
+
+  resume_pattern_size = hdr[HDR_PATTERN_SIZE];
+  resume_pos = hdr[HDR_POSITION];
+  resumes = hdr[HDR_RESUMES] + 1;
+  skipped = hdr[HDR_SKIPPED_ROWS];
+
+  {
+    std::ifstream in_log (row_log_name.c_str (),
+			  std::ios::in | std::ios::binary);
+    if (! in_log)
+      throw std::runtime_error (row_log_name + ": " + strerror (errno));
+
+    try
+      {
+	output.restore_state (state, in_log);
+      }
+    catch (std::runtime_error &err)
+      {
+	throw std::runtime_error (file_name + ": " + err.what ());
+      }
+  }
+
+  // Discard anything in the row log after the rows we restored (they
+  // were written after the checkpoint was saved), and continue
+  // appending to it.
+  //
+  off_t row_size
+    = output.width * (4 + output.num_layer_channels ()) * sizeof (float);
+  if (truncate (row_log_name.c_str (),
+		off_t (output.num_rows_written ()) * row_size)
+      != 0)
+    throw std::runtime_error (row_log_name + ": " + strerror (errno));
+
+  row_log.open (row_log_name.c_str (),
+		std::ios::out | std::ios::binary | std::ios::app);
+  if (! row_log)
+    throw std::runtime_error (row_log_name + ": " + strerror (errno));
+
+  output.set_row_log (&row_log);
+
+  reset_timer ();
+}
+
+
+// Throw an exception if OUTPUT can't be checkpointed.
+//
+void
+RenderCheckpoint::check_output (const ImageOutput &output) const
+{
+  // Checkpoints only hold rows, not tiles.
+  //
+  if (output.tile_size ())
+    throw std::runtime_error (file_name + ": Checkpointing is not supported"
+			      " when streaming output tiles");
+}
+
+
+// Return an iterator for PATTERN at which rendering should start
+// (normally PATTERN.begin(), but when resuming, the position at which
+// the checkpoint was saved).  If PATTERN doesn't match the pattern
+// used to save a resumed checkpoint, an exception is thrown.
+//
+RenderPattern::iterator
+RenderCheckpoint::start_position (const RenderPattern &pattern) const
+{
+  if (resumes == 0)
+    return pattern.begin ();
+
+  if (pattern.position (pattern.end ()) != resume_pattern_size
+      || resume_pos > resume_pattern_size)
+    throw std::runtime_error (file_name + ": Checkpoint is for a different"
+			      " render area");
+
+  return pattern.at_position (resume_pos);
+}
+
+
+// Return true if it's time to save a new checkpoint.
+//
+bool
+RenderCheckpoint::due () const
+{
+  return double (Timeval (Timeval::TIME_OF_DAY)) >= next_time;
+}
+
+// Schedule the next checkpoint for INTERVAL seconds from now.
+//
+void
+RenderCheckpoint::reset_timer ()
+{
+  next_time = double (Timeval (Timeval::TIME_OF_DAY)) + interval;
+}
+
+
+// Save a checkpoint of OUTPUT, where PAT_IT is the position in
+// PATTERN of the first pixel whose samples haven't been added to
+// OUTPUT yet.  If there's an error, an exception is thrown.
+//
+void
+RenderCheckpoint::save (const ImageOutput &output,
+			const RenderPattern &pattern,
+			const RenderPattern::iterator &pat_it)
+{
+  // The checkpoint refers to rows in the row log, so make sure they're
+  // written first.
+  //
+  row_log.flush ();
+  if (! row_log)
+    throw std::runtime_error (row_log_name + ": Error writing row log");
+
+  std::string tmp_name = file_name + ".tmp";
+  std::ofstream out (tmp_name.c_str (),
+		     std::ios::out | std::ios::binary | std::ios::trunc);
+
+  unsigned hdr[NUM_HDR_FIELDS];
+  hdr[HDR_WIDTH] = output.width;
+  hdr[HDR_HEIGHT] = output.height;
+  hdr[HDR_NUM_LAYER_CHANNELS] = output.num_layer_channels ();
+  hdr[HDR_PATTERN_SIZE] = pattern.position (pattern.end ());
+  hdr[HDR_POSITION] = pattern.position (pat_it);
+  hdr[HDR_RESUMES] = resumes;
+  hdr[HDR_SKIPPED_ROWS] = skipped;
+
+  out.write (CHECKPOINT_MAGIC, sizeof CHECKPOINT_MAGIC - 1);
+  out.write (reinterpret_cast<const char *> (hdr), sizeof hdr);
+
+  output.save_state (out);
+
+  out.close ();
+  if (! out)
+    throw std::runtime_error (tmp_name + ": Error writing checkpoint");
+
+  if (rename (tmp_name.c_str (), file_name.c_str ()) != 0)
+    throw std::runtime_error (file_name + ": " + strerror (errno));
+
+  reset_timer ();
+}
+
+
+// Delete the checkpoint files; this should be called after rendering
+// is successfully finished.
+//
+void
+RenderCheckpoint::remove ()
+{
+  row_log.close ();
+
+  unlink (file_name.c_str ());
+  unlink (row_log_name.c_str ());
+}
@@ -0,0 +1,160 @@
+// render-checkpoint.h -- Periodic saving of render state
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef __RENDER_CHECKPOINT_H__
+#define __RENDER_CHECKPOINT_H__
+
+#include <string>
+#include <fstream>
+
+#include "render-pattern.h"
+
+
+namespace snogray {
+
+
+class ImageOutput;
+
+
+// Periodically saves enough rendering state that a render which is
+// interrupted can later be resumed exactly where it stopped.
+//
+// There are two files:  the checkpoint file proper, which holds the
+// position in the render pattern at which to resume, and the raw
+// (un-normalized) contents of any output rows which haven't been
+// written to the output image yet; and a "row log" (the checkpoint
+// file name with "-rows" appended), to which every row written to
+// the output image is also appended.  Because the output image is
+// recreated from the row log when resuming, it doesn't matter if the
+// output image itself is incomplete or corrupted.
+//
+// The checkpoint file is replaced atomically, by writing a temporary
+// file and renaming it.  The row log may contain rows written after
+// the latest checkpoint was saved; these are discarded when resuming,
+// as the renderer will produce them again.
+//
+// Sample-generator state is _not_ saved, as with multiple rendering
+// threads which pixels get which random samples isn't deterministic
+// anyway.  Instead, RenderCheckpoint::num_resumes can be used to give
+// the resumed render different random seeds, so that the samples
+// don't simply repeat the sequence used at the beginning of the
+// original render.
+//
+class RenderCheckpoint
+{
+public:
+
+  // Make a checkpoint object using the checkpoint file FILE_NAME, which
+  // saves a new checkpoint every INTERVAL seconds.
+  //
+  RenderCheckpoint (const std::string &file_name, float interval);
+
+  // Return true if there's a checkpoint file which can be resumed from.
+  //
+  bool exists () const;
+
+  // Start checkpointing the rendering of OUTPUT from the beginning.
+  //
+  void start (ImageOutput &output);
+
+  // Restore the state of OUTPUT from the checkpoint, and continue
+  // checkpointing it.  If there's a problem with the checkpoint, an
+  // exception is thrown.
+  //
+  void resume (ImageOutput &output);
+
+  // Record that the first NUM_ROWS rows of the output image were
+  // recovered from a previous render, and so aren't part of the render
+  // pattern.  This is saved in checkpoints, so that a resumed render
+  // can leave them out of its pattern too.
+  //
+  void set_skipped_rows (unsigned num_rows) { skipped = num_rows; }
+
+  // Return the number of rows at the top of the output image which
+  // aren't part of the render pattern (see
+  // RenderCheckpoint::set_skipped_rows).  When resuming, this is the
+  // value stored in the checkpoint.
+  //
+  unsigned skipped_rows () const { return skipped; }
+
+  // Return an iterator for PATTERN at which rendering should start
+  // (normally PATTERN.begin(), but when resuming, the position at which
+  // the checkpoint was saved).  If PATTERN doesn't match the pattern
+  // used to save a resumed checkpoint, an exception is thrown.
+  //
+  RenderPattern::iterator start_position (const RenderPattern &pattern)
+    const;
+
+  // Return the number of times the render being checkpointed has been
+  // resumed.
+  //
+  unsigned num_resumes () const { return resumes; }
+
+  // Return true if it's time to save a new checkpoint.
+  //
+  bool due () const;
+
+  // Save a checkpoint of OUTPUT, where PAT_IT is the position in
+  // PATTERN of the first pixel whose samples haven't been added to
+  // OUTPUT yet.  If there's an error, an exception is thrown.
+  //
+  void save (const ImageOutput &output,
+	     const RenderPattern &pattern, const RenderPattern::iterator &pat_it);
+
+  // Delete the checkpoint files; this should be called after rendering
+  // is successfully finished.
+  //
+  void remove ();
+
+private:
+
+  // Throw an exception if OUTPUT can't be checkpointed.
+  //
+  void check_output (const ImageOutput &output) const;
+
+  // Schedule the next checkpoint for INTERVAL seconds from now.
+  //
+  void reset_timer ();
+
+  // Name of the checkpoint file, and of the row log.
+  //
+  std::string file_name, row_log_name;
+
+  // The row log (see ImageOutput::set_row_log).
+  //
+  std::ofstream row_log;
+
+  // Time between checkpoints, in seconds, and the time (in seconds
+  // since the epoch) at which the next one should be saved.
+  //
+  float interval;
+  double next_time;
+
+  // If resuming, the pattern position and pattern size stored in the
+  // checkpoint; otherwise both are zero.
+  //
+  unsigned resume_pos, resume_pattern_size;
+
+  // The number of times the render has been resumed.
+  //
+  unsigned resumes;
+
+  // The number of rows at the top of the output image which aren't
+  // part of the render pattern.
+  //
+  unsigned skipped;
+};
+
+
+}
+
+#endif // __RENDER_CHECKPOINT_H__
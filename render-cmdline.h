@@ -22,13 +22,21 @@
                                Options include:\n\
                                  \"direct\"     -- direct-lighting\n\
                                  \"path\"       -- path-tracing\n\
+                                 \"bdpt\"       -- bidirectional path-tracing\n\
                                  \"photon\"     -- photon-mapping\n\
 \n\
   -A, --background-alpha=ALPHA Use ALPHA as the opacity of the background\n\
 \n\
   -R, --render-options=OPTS  Set output-image options; OPTS has the format\n\
                                OPT1=VAL1[,...]; current options include:\n\
-                                 \"min-trace\"  -- minimum trace ray length"
+                                 \"min-trace\"  -- minimum trace ray length\n\
+                                 \"env-vis-cache\" -- cache environment-light\n\
+                                                 visibility (faster, less exact)\n\
+                                 \"isec-cache\" -- octree search cache, either\n\
+                                                 \"hash\" (default) or \"mailbox\"\n\
+                                 \"aov\"        -- extra outputs, e.g. \"depth+normal\"\n\
+                                                 (\"depth\", \"normal\", \"albedo\",\n\
+                                                 \"samples\"; EXR output only)"
 
 #if 0
 "\n						\
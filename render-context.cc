@@ -11,6 +11,7 @@
 //
 
 #include "mutex.h"
+#include "scene.h"
 
 #include "render-context.h"
 
@@ -19,10 +20,12 @@ using namespace snogray;
 
 
 // Return an integer which can be used to seed a new random-number
-// generator in the current thread.
+// generator in the current thread.  BASE_SEED is added to the result,
+// so that different values can be used to get different random
+// sequences (for instance when resuming an interrupted render).
 //
 static unsigned
-make_rng_seed ()
+make_rng_seed (unsigned base_seed)
 {
   // No attempt is made to generate a great seed; the main intent is to
   // avoid every thread using the _same_ seed.
@@ -34,16 +37,31 @@ make_rng_seed ()
   unsigned global_count = global_seed_counter++;
   global_seed_counter_lock.unlock ();
 
-  return 578987 + global_count * 1023717;
+  return 578987 + global_count * 1023717 + base_seed * 2654435761u;
 }
 
 
-RenderContext::RenderContext (const GlobalRenderState &_global_state)
+// If NUM_SAMPLES is non-zero, or SAMPLE_GEN is non-null, they are
+// used for RenderContext::samples instead of the number of samples
+// and the sample generator in GLOBAL_STATE.
+//
+RenderContext::RenderContext (const GlobalRenderState &_global_state,
+			      unsigned num_samples,
+			      const SampleGen *sample_gen)
   : scene (_global_state.scene),
-    samples (_global_state.num_samples, *_global_state.sample_gen, random),
-    random (make_rng_seed ()),
+    samples (num_samples ? num_samples : _global_state.num_samples,
+	     sample_gen ? *sample_gen : *_global_state.sample_gen,
+	     random),
+    random (make_rng_seed (
+	      _global_state.params.get_uint ("random-seed", 0))),
     global_state (_global_state),
     params (_global_state.params),
+    eye_ray_spread (0),
+    env_vis_cache (
+      _global_state.params.get_bool ("env-vis-cache", false)
+      ? new EnvVisCache (scene, _global_state.params)
+      : 0),
+    shadow_occluders (scene.num_lights (), 0),
     surface_integ (
       _global_state.surface_integ_global_state
       ? _global_state.surface_integ_global_state->make_integrator (*this)
@@ -13,6 +13,8 @@
 #ifndef __RENDER_CONTEXT_H__
 #define __RENDER_CONTEXT_H__
 
+#include <vector>
+
 #include "global-render-state.h"
 #include "render-stats.h"
 #include "render-params.h"
@@ -23,6 +25,8 @@
 #include "sample-set.h"
 #include "surface-integ.h"
 #include "isec-cache.h"
+#include "isec-mailbox.h"
+#include "env-vis-cache.h"
 #include "unique-ptr.h"
 
 
@@ -36,7 +40,13 @@ class RenderContext
 {
 public:
 
-  RenderContext (const GlobalRenderState &global_state);
+  // If NUM_SAMPLES is non-zero, or SAMPLE_GEN is non-null, they are
+  // used for RenderContext::samples instead of the number of samples
+  // and the sample generator in GLOBAL_STATE.
+  //
+  RenderContext (const GlobalRenderState &global_state,
+		 unsigned num_samples = 0, const SampleGen *sample_gen = 0);
+
   ~RenderContext ();
 
   // Scene being rendered.
@@ -70,6 +80,11 @@ public:
   //
   Pool<IsecCache> isec_cache_pool;
 
+  // Pool of exact intersection mailboxes, used instead of
+  // ISEC_CACHE_POOL by spaces configured to use them.
+  //
+  Pool<IsecMailbox> isec_mailbox_pool;
+
   RenderStats stats;
 
   // Random number generator.  This is a callable object.
@@ -84,6 +99,28 @@ public:
   //
   const RenderParams params;
 
+  // The angular spread, in radians, of the eye-ray currently being
+  // traced, used to estimate the size of the area around its first
+  // intersection that it represents (for texture filtering).  This is
+  // set by the renderer before tracing each eye-ray, and reset to zero
+  // once used, so secondary rays see zero, meaning "point sample".
+  //
+  float eye_ray_spread;
+
+  // Cache of environment-light visibility, used for shadow-testing
+  // environmental lights, or zero if the "env-vis-cache" render
+  // parameter isn't enabled.
+  //
+  UniquePtr<EnvVisCache> env_vis_cache;
+
+  // For each light in the scene (indexed by Light::num), the surface
+  // which most recently blocked a shadow ray towards it, or zero.
+  // This is passed to Scene::occludes as a "shadow cache", as
+  // neighboring shadow rays towards the same light are often blocked
+  // by the same surface.
+  //
+  std::vector<const Surface *> shadow_occluders;
+
   // Surface integrator.  This should be one of the last fields, so it
   // will be initialized after other fields -- the integrator creation
   // method is passed a reference to the RenderContext object, so we
@@ -11,13 +11,17 @@
 //
 
 #include <list>
+#include <stdexcept>
+#include <vector>
 #include <map>
 
 #include "snogmath.h"
 #include "snogassert.h"
 #include "progress.h"
 #include "renderer.h"
+#include "mlt-renderer.h"
 #include "render-packet.h"
+#include "render-checkpoint.h"
 #if USE_THREADS
 #include "render-thread.h"
 #include "render-queue.h"
@@ -33,7 +37,7 @@ RenderMgr::RenderMgr (const GlobalRenderState &_global_state,
 		      const Camera &_camera,
 		      unsigned _width, unsigned _height)
   : global_state (_global_state), camera (_camera),
-    width (_width), height (_height)
+    width (_width), height (_height), first_unfilled_tile (0)
 {
 }
 
@@ -44,17 +48,26 @@ RenderMgr::RenderMgr (const GlobalRenderState &_global_state,
 // iterating through PATTERN.  STATS will be updated with rendering
 // statistics.
 //
+// If CHECKPOINT is non-zero, rendering starts at the position it
+// specifies, and it is used to periodically save the rendering
+// state.
+//
 void
 RenderMgr::render (unsigned num_threads,
 		   RenderPattern &pattern, ImageOutput &output,
-		   Progress &prog, RenderStats &stats)
+		   Progress &prog, RenderStats &stats,
+		   RenderCheckpoint *checkpoint)
 {
+  tile_packets.clear ();
+  first_unfilled_tile = 0;
+
 #if USE_THREADS
   if (num_threads != 1)
-    render_multi_threaded (num_threads, pattern, output, prog, stats);
+    render_multi_threaded (num_threads, pattern, output, prog, stats,
+			   checkpoint);
   else
 #endif // USE_THREADS
-    render_single_threaded (pattern, output, prog, stats);
+    render_single_threaded (pattern, output, prog, stats, checkpoint);
 }
 
 
@@ -67,10 +80,12 @@ RenderMgr::render (unsigned num_threads,
 //
 void
 RenderMgr::render_single_threaded (RenderPattern &pattern, ImageOutput &output,
-				   Progress &prog, RenderStats &stats)
+				   Progress &prog, RenderStats &stats,
+				   RenderCheckpoint *checkpoint)
 {
   Renderer renderer (global_state, camera, width, height);
-  RenderPattern::iterator pat_it = pattern.begin ();
+  RenderPattern::iterator pat_it
+    = checkpoint ? checkpoint->start_position (pattern) : pattern.begin ();
   RenderPattern::iterator limit = pattern.end ();
   RenderPacket packet;
 
@@ -87,6 +102,12 @@ RenderMgr::render_single_threaded (RenderPattern &pattern, ImageOutput &output,
 
       output_packet (packet, output);
 
+      // All pixels before PAT_IT have now been added to OUTPUT, so this
+      // is a consistent point at which to save a checkpoint.
+      //
+      if (checkpoint && checkpoint->due ())
+	checkpoint->save (output, pattern, pat_it);
+
       prog.update (pattern.position (pat_it));
     }
 
@@ -108,9 +129,11 @@ RenderMgr::render_single_threaded (RenderPattern &pattern, ImageOutput &output,
 void
 RenderMgr::render_multi_threaded (unsigned num_threads,
 				  RenderPattern &pattern, ImageOutput &output,
-				  Progress &prog, RenderStats &stats)
+				  Progress &prog, RenderStats &stats,
+				  RenderCheckpoint *checkpoint)
 {
-  RenderPattern::iterator pat_it = pattern.begin ();
+  RenderPattern::iterator pat_it
+    = checkpoint ? checkpoint->start_position (pattern) : pattern.begin ();
   RenderPattern::iterator limit = pattern.end ();
 
   // RenderPacket queues for communicating with rendering threads.
@@ -151,6 +174,33 @@ RenderMgr::render_multi_threaded (unsigned num_threads,
       //
       output_packet (*packet, output);
 
+      // Saving a checkpoint requires that all pixels before PAT_IT have
+      // been added to OUTPUT, so first wait for all the other packets
+      // to come back and output their results, and then send them out
+      // again after saving.
+      //
+      if (checkpoint && checkpoint->due ())
+	{
+	  std::vector<RenderPacket *> returned;
+	  for (unsigned i = 1; i < num_packets; i++)
+	    {
+	      RenderPacket *other = done_q.get ();
+	      output_packet (*other, output);
+	      returned.push_back (other);
+	    }
+
+	  checkpoint->save (output, pattern, pat_it);
+
+	  for (std::vector<RenderPacket *>::iterator pi = returned.begin ();
+	       pi != returned.end (); ++pi)
+	    {
+	      packet_min_y[*pi]
+		= clamp (pattern.min_y (pat_it), 0, int (height) - 1);
+	      fill_packet (pat_it, limit, **pi);
+	      pending_q.put (*pi);
+	    }
+	}
+
       // Update PACKET's min_y value to reflect the pixels it will be
       // filled with.
       //
@@ -215,9 +265,142 @@ RenderMgr::render_multi_threaded (unsigned num_threads,
 #endif // USE_THREADS
 
 
+// Metropolis light transport rendering
+
+// Add the image accumulated by CHAIN to IMAGE, scaled by SCALE (in
+// addition to the chain's own scale factor).
+//
+static void
+add_chain_image (const MltRenderer &chain, float scale,
+		 std::vector<Color> &image)
+{
+  const std::vector<Color> &chain_image = chain.image ();
+  scale *= chain.image_scale ();
+
+  for (unsigned i = 0; i < image.size (); i++)
+    image[i] += chain_image[i] * scale;
+}
+
+// Render the area of the virtual screen starting at LIMIT_X, LIMIT_Y
+// and extending LIMIT_WIDTH x LIMIT_HEIGHT pixels to OUTPUT, using
+// Metropolis light transport, with one independent Markov chain in
+// each of NUM_THREADS threads.  PROG will be periodically updated
+// with the number of pixels' worth of work done so far (so its range
+// should be LIMIT_WIDTH * LIMIT_HEIGHT).  STATS will be updated with
+// rendering statistics.
+//
+void
+RenderMgr::render_mlt (unsigned num_threads,
+		       int limit_x, int limit_y,
+		       unsigned limit_width, unsigned limit_height,
+		       ImageOutput &output, Progress &prog, RenderStats &stats)
+{
+  if (output.tile_size () != 0)
+    throw std::runtime_error
+      ("Metropolis light transport cannot write a tiled output image");
+  if (! Renderer::selected_aovs (global_state.params).empty ())
+    throw std::runtime_error
+      ("Metropolis light transport cannot render AOVs");
+
+  // Pixels are only visited in proportion to their brightness, so
+  // there's no estimate of their alpha values (the output image is
+  // always opaque).
+  //
+  if (global_state.bg_alpha != 1)
+    throw std::runtime_error
+      ("Metropolis light transport cannot render background alpha");
+
+#if USE_THREADS
+  unsigned num_chains = max (num_threads, 1u);
+#else
+  unsigned num_chains = 1;
+#endif
+
+  // The total number of mutations is chosen so that each pixel gets,
+  // on average, as many eye-rays as it would with normal rendering;
+  // the total is divided evenly between chains, as are the bootstrap
+  // samples.
+  //
+  unsigned num_pixels = limit_width * limit_height;
+  unsigned long long num_mutations
+    = (unsigned long long)global_state.num_samples * num_pixels;
+  unsigned long long chain_mutations
+    = (num_mutations + num_chains - 1) / num_chains;
+  unsigned num_bootstrap
+    = global_state.params.get_uint ("mlt-bootstrap", 100000);
+  unsigned chain_bootstrap
+    = max ((num_bootstrap + num_chains - 1) / num_chains, 1u);
+
+  prog.start ();
+
+#if USE_THREADS
+  // Start threads for all chains but the first.
+  //
+  std::list<MltThread *> threads;
+  for (unsigned i = 1; i < num_chains; i++)
+    threads.push_back (new MltThread (global_state, camera, width, height,
+				      limit_x, limit_y,
+				      limit_width, limit_height,
+				      chain_bootstrap, chain_mutations));
+#endif // USE_THREADS
+
+  // Run the first chain in this thread, a row's worth of mutations at a
+  // time, so that we can update PROG.  All chains run at about the same
+  // speed, so the progress of the first is a good estimate of the
+  // total.
+  //
+  MltRenderer chain (global_state, camera, width, height,
+		     limit_x, limit_y, limit_width, limit_height);
+
+  chain.bootstrap (chain_bootstrap);
+
+  unsigned long long step
+    = (unsigned long long)global_state.num_samples * limit_width;
+  unsigned long long done = 0;
+  while (done < chain_mutations)
+    {
+      unsigned long long num = chain_mutations - done;
+      if (num > step)
+	num = step;
+      chain.run (num);
+      done += num;
+      prog.update (int (done * num_pixels / chain_mutations));
+    }
+
+  // The final image is the average of all the chains' images.
+  //
+  std::vector<Color> image (num_pixels, Color (0));
+
+  add_chain_image (chain, 1 / float (num_chains), image);
+  stats += chain.stats ();
+
+#if USE_THREADS
+  // Join and destroy all rendering threads, adding their results.
+  //
+  while (! threads.empty ())
+    {
+      MltThread *th = threads.back ();
+      threads.pop_back ();
+      th->join ();
+      add_chain_image (th->chain (), 1 / float (num_chains), image);
+      stats += th->stats ();
+      delete th;
+    }
+#endif // USE_THREADS
+
+  prog.end ();
+
+  for (unsigned y = 0; y < limit_height; y++)
+    for (unsigned x = 0; x < limit_width; x++)
+      output.add_sample (int (x), int (y), Tint (image[y * limit_width + x]),
+			 1.f);
+}
+
+
 // packet utility methods
 
-// Fill PACKET with pixels yielded from PAT_IT.
+// Fill PACKET with pixels yielded from PAT_IT, stopping at the end
+// of the current tile.
 //
 void
 RenderMgr::fill_packet (RenderPattern::iterator &pat_it,
@@ -226,6 +409,9 @@ RenderMgr::fill_packet (RenderPattern::iterator &pat_it,
 {
   packet.pixels.clear ();
   packet.results.clear ();
+  packet.aov_vals.clear ();
+
+  packet.tile = pat_it.tile ();
 
   // Calculate the number of input pixels which will yield the desired
   // number of output results.
@@ -233,16 +419,63 @@ RenderMgr::fill_packet (RenderPattern::iterator &pat_it,
   unsigned num_samps = global_state.num_samples;
   unsigned num_pix = (PACKET_SIZE + num_samps - 1) / num_samps;
 
-  for (unsigned i = 0; i < num_pix && pat_it != limit; i++)
+  for (unsigned i = 0;
+       i < num_pix && pat_it != limit && pat_it.tile () == packet.tile;
+       i++)
     packet.pixels.push_back (*pat_it++);
+
+  if (! packet.pixels.empty ())
+    tile_packets[packet.tile]++;
+
+  first_unfilled_tile = pat_it.tile ();
 }
 
-// Output results from PACKET to OUTPUT.
+// Output results from PACKET to OUTPUT.  If OUTPUT is being written
+// as tiles, and PACKET was the last packet outstanding for its tile,
+// the tile is finished.
 //
 void
 RenderMgr::output_packet (RenderPacket &packet, ImageOutput &output)
 {
+  bool tiled = output.tile_size () != 0;
+
   for (std::vector<RenderPacket::Result>::iterator ri = packet.results.begin ();
        ri != packet.results.end (); ++ri)
-    output.add_sample (ri->coords.u, ri->coords.v, ri->val);
+    if (tiled)
+      output.add_sample (packet.tile, ri->coords.u, ri->coords.v, ri->val);
+    else
+      output.add_sample (ri->coords.u, ri->coords.v, ri->val);
+
+  // AOV values go into the output image's extra layers.
+  //
+  if (! packet.aov_vals.empty () && output.num_layer_channels () != 0)
+    {
+      unsigned num_chans = output.num_layer_channels ();
+      const float *vals = &packet.aov_vals[0];
+
+      for (std::vector<RenderPacket::Result>::iterator ri
+	     = packet.results.begin ();
+	   ri != packet.results.end (); ++ri)
+	{
+	  if (tiled)
+	    output.add_layer_sample (packet.tile,
+				     ri->coords.u, ri->coords.v, vals);
+	  else
+	    output.add_layer_sample (ri->coords.u, ri->coords.v, vals);
+	  vals += num_chans;
+	}
+    }
+
+  // If this was the last packet for a tile which has been completely
+  // put into packets, the tile is done.
+  //
+  if (! packet.pixels.empty ()
+      && --tile_packets[packet.tile] == 0
+      && packet.tile < first_unfilled_tile)
+    {
+      tile_packets.erase (packet.tile);
+
+      if (tiled)
+	output.finish_tile (packet.tile);
+    }
 }
@@ -13,6 +13,8 @@
 #ifndef __RENDER_MGR_H__
 #define __RENDER_MGR_H__
 
+#include <map>
+
 #include "config.h"
 #include "image-output.h"
 #include "render-pattern.h"
@@ -26,6 +28,7 @@ class Progress;
 class RenderPacket;
 struct RenderStats;
 class GlobalRenderState;
+class RenderCheckpoint;
 
 
 class RenderMgr
@@ -44,9 +47,31 @@ public:
   // RenderPattern::position on an iterator iterating through PATTERN.
   // STATS will be updated with rendering statistics.
   //
+  // If CHECKPOINT is non-zero, rendering starts at the position it
+  // specifies, and it is used to periodically save the rendering
+  // state.
+  //
   void render (unsigned num_threads,
 	       RenderPattern &pattern, ImageOutput &output,
-	       Progress &prog, RenderStats &stats);
+	       Progress &prog, RenderStats &stats,
+	       RenderCheckpoint *checkpoint = 0);
+
+  // Render the area of the virtual screen starting at LIMIT_X, LIMIT_Y
+  // and extending LIMIT_WIDTH x LIMIT_HEIGHT pixels to OUTPUT, using
+  // Metropolis light transport, with one independent Markov chain in
+  // each of NUM_THREADS threads.  PROG will be periodically updated
+  // with the number of pixels' worth of work done so far (so its range
+  // should be LIMIT_WIDTH * LIMIT_HEIGHT).  STATS will be updated with
+  // rendering statistics.
+  //
+  // As Metropolis light transport adds samples to arbitrary pixels,
+  // OUTPUT is only written after all rendering is done, and cannot be
+  // written as tiles.
+  //
+  void render_mlt (unsigned num_threads,
+		   int limit_x, int limit_y,
+		   unsigned limit_width, unsigned limit_height,
+		   ImageOutput &output, Progress &prog, RenderStats &stats);
 
 private:
 
@@ -56,7 +81,8 @@ private:
   // STATS will be updated with rendering statistics.
   //
   void render_single_threaded (RenderPattern &pattern, ImageOutput &output,
-			       Progress &prog, RenderStats &stats);
+			       Progress &prog, RenderStats &stats,
+			       RenderCheckpoint *checkpoint);
 
 #if USE_THREADS
   // Render the pixels in PATTERN to OUTPUT, using NUM_THREADS threads.
@@ -66,16 +92,20 @@ private:
   //
   void render_multi_threaded (unsigned num_threads,
 			      RenderPattern &pattern, ImageOutput &output,
-			      Progress &prog, RenderStats &stats);
+			      Progress &prog, RenderStats &stats,
+			      RenderCheckpoint *checkpoint);
 #endif // USE_THREADS
 
-  // Fill PACKET with pixels yielded from PAT_IT.
+  // Fill PACKET with pixels yielded from PAT_IT, stopping at the end
+  // of the current tile.
   //
   void fill_packet (RenderPattern::iterator &pat_it,
 		    const RenderPattern::iterator &limit,
 		    RenderPacket &packet);
 
-  // Output results from PACKET to OUTPUT.
+  // Output results from PACKET to OUTPUT.  If OUTPUT is being written
+  // as tiles, and PACKET was the last packet outstanding for its tile,
+  // the tile is finished.
   //
   void output_packet (RenderPacket &packet, ImageOutput &output);
 
@@ -90,6 +120,14 @@ private:
   // they are always used as such.
   //
   float width, height;
+
+  // The number of packets containing pixels from each tile which have
+  // been filled but not yet output, and the number of the first tile
+  // whose pixels haven't all been put into packets yet.  These are
+  // used to tell when a tile is finished.
+  //
+  std::map<unsigned, unsigned> tile_packets;
+  unsigned first_unfilled_tile;
 };
 
 
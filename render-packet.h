@@ -26,6 +26,8 @@ class RenderPacket
 {
 public:
 
+  RenderPacket () : tile (0) { }
+
   // The result of rendering a single sample inside a pixel.
   //
   struct Result
@@ -42,10 +44,20 @@ public:
   //
   std::vector<UV> pixels;
 
+  // The tile (see RenderPattern::tile) which all of PIXELS belong to.
+  //
+  unsigned tile;
+
   // Render results.  Multiple samples are rendered within each pixel,
   // so there are usually many more output results than input pixels.
   //
   std::vector<Result> results;
+
+  // Values of any AOVs (see Renderer::Aov) for each result, with the
+  // values for all AOVs of a given result together.  This is empty if
+  // no AOVs are being rendered.
+  //
+  std::vector<float> aov_vals;
 };
 
 
@@ -13,6 +13,7 @@
 #ifndef __RENDER_PATTERN_H__
 #define __RENDER_PATTERN_H__
 
+#include "snogmath.h"
 #include "uv.h"
 #include "tint.h"
 
@@ -22,8 +23,17 @@ namespace snogray {
 
 // A generator object, which yields pixel coordinates to be rendered.
 //
-// Currently this is hardwired to just scan from the upper-left in
-// scanline order.
+// The pixels rendered are those in a rectangle, plus a margin around
+// it (so that output filtering near the edges of the rectangle has
+// enough samples).  Normally they are yielded in scanline order,
+// starting at the upper-left.
+//
+// Alternatively, the rectangle may be divided into square tiles.  The
+// tiles are yielded in scanline order, and the pixels in each tile in
+// scanline order, each tile getting its own margin.  Pixels in a
+// tile's margin which also belong to adjacent tiles (or to their
+// margins) are yielded again for each tile, so that each tile can be
+// rendered independently of the others.
 //
 class RenderPattern
 {
@@ -35,17 +45,31 @@ public:
   {
   public:
 
-    iterator (int _x, int _y, const RenderPattern &_pat)
-      : x (_x), y (_y), pat (_pat)
-    { }
+    // Return an iterator positioned OFFSET pixels after the first pixel
+    // of tile number TILE in PAT.  If TILE is the number of tiles in
+    // PAT, the iterator is PAT's end iterator.
+    //
+    iterator (unsigned _tile, unsigned offset, const RenderPattern &_pat)
+      : pat (_pat)
+    {
+      set_tile (_tile);
+
+      if (x_end != x_beg)
+	{
+	  x += offset % (x_end - x_beg);
+	  y += offset / (x_end - x_beg);
+	}
+    }
 
     iterator (const iterator &it)
-      : x (it.x), y (it.y), pat (it.pat)
+      : x (it.x), y (it.y), cur_tile (it.cur_tile),
+	x_beg (it.x_beg), y_beg (it.y_beg), x_end (it.x_end), y_end (it.y_end),
+	pat (it.pat)
     { }
 
     bool operator== (const iterator &it) const
     {
-      return x == it.x && y == it.y;
+      return x == it.x && y == it.y && cur_tile == it.cur_tile;
     }
     bool operator!= (const iterator &it) const
     {
@@ -56,46 +80,81 @@ public:
 
     iterator &operator++ ()
     {
-      if (++x == pat.x_end)
+      if (++x == x_end)
 	{
-	  x = pat.x_beg;
-	  ++y;
+	  x = x_beg;
+	  if (++y == y_end)
+	    set_tile (cur_tile + 1);
 	}
       return *this;
     }
     iterator operator++ (int)
     {
       iterator result = *this;
-      if (++x == pat.x_end)
-	{
-	  x = pat.x_beg;
-	  ++y;
-	}
+      ++*this;
       return result;
     }
 
-    int min_y () const { return y; }
+    // When yielding tiles, every tile in a row of tiles starts at the
+    // same y-value, so only the top of the current tile is safe.
+    //
+    int min_y () const { return pat.tile_size ? y_beg : y; }
 
     unsigned position () const
     {
-      unsigned per_row = (pat.x_end - pat.x_beg);
-      return per_row * (y - pat.y_beg) + (x - pat.x_beg);
+      return (pat.tile_position (cur_tile)
+	      + (y - y_beg) * (x_end - x_beg) + (x - x_beg));
     }
 
+    unsigned tile () const { return cur_tile; }
+
   private:
 
+    // Position this iterator at the first pixel of tile number TILE.
+    //
+    void set_tile (unsigned tile)
+    {
+      cur_tile = tile;
+
+      if (tile < pat.num_tiles ())
+	pat.tile_bounds (tile, x_beg, y_beg, x_end, y_end);
+      else
+	x_beg = y_beg = x_end = y_end = 0;
+
+      x = x_beg;
+      y = y_beg;
+    }
+
     int x, y;
 
+    // The tile this iterator is in, and its bounds (including its
+    // margin).  When not yielding tiles, the whole pattern is a single
+    // tile.
+    //
+    unsigned cur_tile;
+    int x_beg, y_beg, x_end, y_end;
+
     const RenderPattern &pat;
   };
 
-  RenderPattern (int _left_x, int _top_y, int _width, int _height)
+  // A pattern yielding the pixels in the rectangle from LEFT_X, TOP_Y
+  // of size WIDTH x HEIGHT, plus MARGIN pixels on each side.  If
+  // TILE_SIZE is non-zero, the rectangle is divided into tiles of that
+  // size, and MARGIN is added around each tile.
+  //
+  RenderPattern (int _left_x, int _top_y, int _width, int _height,
+		 unsigned _margin = 0, unsigned _tile_size = 0)
     : x_beg (_left_x), y_beg (_top_y),
-      x_end (_left_x + _width), y_end (_top_y + _height)
+      x_end (_left_x + _width), y_end (_top_y + _height),
+      margin (_margin), tile_size (_tile_size),
+      tile_width (_tile_size ? _tile_size : _width > 0 ? _width : 1),
+      tile_height (_tile_size ? _tile_size : _height > 0 ? _height : 1),
+      num_x_tiles ((_width + tile_width - 1) / tile_width),
+      num_y_tiles ((_height + tile_height - 1) / tile_height)
   { }
 
-  iterator begin () const { return iterator (x_beg, y_beg, *this); }
-  iterator end () const { return iterator (x_beg, y_end, *this); }
+  iterator begin () const { return iterator (0, 0, *this); }
+  iterator end () const { return iterator (num_tiles (), 0, *this); }
 
   // Return the minimum y-value will ever be returned from the iterator
   // PAT_IT in the future.
@@ -114,9 +173,99 @@ public:
     return pat_it.position ();
   }
 
+  // Return an iterator whose position (as returned by
+  // RenderPattern::position) is POS.
+  //
+  iterator at_position (unsigned pos) const
+  {
+    if (pos >= tile_position (num_tiles ()))
+      return end ();
+
+    // All rows of tiles except the last are the same size, as are all
+    // tiles in a row except the last.
+    //
+    unsigned tile_row_size = (tile_height + 2 * margin) * tile_row_width ();
+    unsigned ty = min (pos / tile_row_size, num_y_tiles - 1);
+    pos -= ty * tile_row_size;
+
+    int tx_beg, ty_beg, tx_end, ty_end;
+    tile_bounds (ty * num_x_tiles, tx_beg, ty_beg, tx_end, ty_end);
+
+    unsigned tile_area = (tile_width + 2 * margin) * (ty_end - ty_beg);
+    unsigned tx = min (pos / tile_area, num_x_tiles - 1);
+    pos -= tx * tile_area;
+
+    return iterator (ty * num_x_tiles + tx, pos, *this);
+  }
+
+  // Return the number of the tile containing PAT_IT.  When not yielding
+  // tiles, this is always zero, except for the end iterator, whose tile
+  // number is RenderPattern::num_tiles.  Tiles are numbered in
+  // scanline order.
+  //
+  unsigned tile (const iterator &pat_it) const { return pat_it.tile (); }
+
+  // Return the number of tiles in this pattern.
+  //
+  unsigned num_tiles () const { return num_x_tiles * num_y_tiles; }
+
 private:
 
+  // Return the width of an entire row of tiles, including the margin
+  // around each tile.
+  //
+  unsigned tile_row_width () const
+  {
+    return (x_end - x_beg) + 2 * margin * num_x_tiles;
+  }
+
+  // Return the position of the first pixel in tile number TILE (or if
+  // TILE is the number of tiles, the position of the end of the
+  // pattern).
+  //
+  unsigned tile_position (unsigned tile) const
+  {
+    if (tile >= num_tiles ())
+      return (y_end - y_beg + 2 * margin * num_y_tiles) * tile_row_width ();
+
+    unsigned tx = tile % num_x_tiles, ty = tile / num_x_tiles;
+    int tx_beg, ty_beg, tx_end, ty_end;
+    tile_bounds (tile, tx_beg, ty_beg, tx_end, ty_end);
+
+    return (ty * (tile_height + 2 * margin) * tile_row_width ()
+	    + tx * (tile_width + 2 * margin) * (ty_end - ty_beg));
+  }
+
+  // Return in TX_BEG, TY_BEG, TX_END, TY_END the bounds of tile number
+  // TILE, including its margin.
+  //
+  void tile_bounds (unsigned tile,
+		    int &tx_beg, int &ty_beg, int &tx_end, int &ty_end)
+    const
+  {
+    tx_beg = x_beg + int (tile % num_x_tiles) * tile_width;
+    ty_beg = y_beg + int (tile / num_x_tiles) * tile_height;
+    tx_end = min (tx_beg + tile_width, x_end) + int (margin);
+    ty_end = min (ty_beg + tile_height, y_end) + int (margin);
+    tx_beg -= int (margin);
+    ty_beg -= int (margin);
+  }
+
   int x_beg, y_beg, x_end, y_end;
+
+  // Size of margin around the rectangle, or around each tile.
+  //
+  unsigned margin;
+
+  // Size of each tile, or zero if we're not yielding tiles.
+  //
+  unsigned tile_size;
+
+  // Size of each tile (when not yielding tiles, the whole rectangle is
+  // a single tile), and the number of tiles in each direction.
+  //
+  int tile_width, tile_height;
+  unsigned num_x_tiles, num_y_tiles;
 };
 
 
@@ -89,6 +89,28 @@ RenderStats::print (ostream &os)
 	   << "%)"
 	   << endl;
       }
+
+      long long oct = shadow.occluder_cache_tests;
+
+      if (oct != 0)
+	{
+	  long long och = shadow.occluder_cache_hits;
+
+	  // Each hit avoided a search of the scene, so estimate the
+	  // number of tree node tests saved using the average cost of
+	  // the searches which did happen.
+	  //
+	  long long searches = sst - och;
+	  long long tnt_saved
+	    = searches == 0 ? 0 : (long long)(double (tnt) / searches * och);
+
+	  os << "     occluder cache:  " << setw (16) << commify (oct)
+	     << " (hit = " << setw(2) << percent (och, oct)
+	     << "%, searches avoided = " << setw(2) << percent (och, sst)
+	     << "%)" << endl;
+	  os << "     est. node tests saved: " << setw (10)
+	     << commify (tnt_saved) << endl;
+	}
     }
 
   long long ic = illum_calls;
@@ -102,6 +124,89 @@ RenderStats::print (ostream &os)
 	os << "     average shadow rays:   " << setw (10)
 	   << setprecision(3) << fraction (sst, ic) << endl;
     }
+
+  long long evl = env_vis_cache_lookups;
+
+  if (evl != 0)
+    {
+      long long evh = env_vis_cache_hits;
+
+      os << "  env vis cache:" << endl;
+      os << "     lookups:         " << setw (16) << commify (evl) << endl;
+      os << "     hits:            " << setw (16) << commify (evh)
+	 << " (" << setw(2) << percent (evh, evl) << "%)" << endl;
+    }
+
+  long long paths = path.paths;
+
+  if (paths != 0)
+    {
+      os << "  paths:" << endl;
+      os << "     paths:           " << setw (16) << commify (paths) << endl;
+      os << "     average bounces: " << setw (16)
+	 << setprecision(3) << fraction (path.bounces, paths) << endl;
+      os << "     rr terminated:   " << setw (16)
+	 << commify (path.rr_terminations)
+	 << " (" << setw(2) << percent (path.rr_terminations, paths) << "%)"
+	 << endl;
+      os << "     len terminated:  " << setw (16)
+	 << commify (path.max_len_terminations)
+	 << " (" << setw(2) << percent (path.max_len_terminations, paths)
+	 << "%)" << endl;
+
+      for (unsigned len = 0; len < PathStats::MAX_LEN; len++)
+	if (path.len_counts[len] != 0)
+	  {
+	    bool last = (len == PathStats::MAX_LEN - 1);
+	    os << "     bounces " << setw (2) << len << (last ? "+" : " ")
+	       << ":     " << setw (16) << commify (path.len_counts[len])
+	       << " (" << setw(2) << percent (path.len_counts[len], paths)
+	       << "%)" << endl;
+	  }
+    }
+
+  long long mutations = mlt.mutations;
+
+  if (mutations != 0)
+    {
+      long long small_steps = mutations - mlt.large_steps;
+
+      os << "  mlt:" << endl;
+      os << "     bootstrap samps: " << setw (16)
+	 << commify (mlt.bootstrap_samples) << endl;
+      os << "     mutations:       " << setw (16)
+	 << commify (mutations) << endl;
+      os << "     accepted:        " << setw (16)
+	 << commify (mlt.accepted)
+	 << " (" << setw(2) << percent (mlt.accepted, mutations) << "%)"
+	 << endl;
+      os << "     large steps:     " << setw (16)
+	 << commify (mlt.large_steps)
+	 << " (" << setw(2) << percent (mlt.large_steps, mutations) << "%)"
+	 << endl;
+      if (mlt.large_steps != 0)
+	os << "     large accepted:  " << setw (16)
+	   << commify (mlt.large_accepted)
+	   << " (" << setw(2) << percent (mlt.large_accepted, mlt.large_steps)
+	   << "%)" << endl;
+      if (small_steps != 0)
+	os << "     small accepted:  " << setw (16)
+	   << commify (mlt.accepted - mlt.large_accepted)
+	   << " (" << setw(2)
+	   << percent (mlt.accepted - mlt.large_accepted, small_steps)
+	   << "%)" << endl;
+    }
+
+  if (mempool.peak_bytes != 0)
+    {
+      os << "  mempool:" << endl;
+      os << "     peak bytes:      " << setw (16)
+	 << commify (mempool.peak_bytes) << endl;
+      os << "     block refills:   " << setw (16)
+	 << commify (mempool.block_refills) << endl;
+      os << "     large allocs:    " << setw (16)
+	 << commify (mempool.large_allocs) << endl;
+    }
 }
 
 // arch-tag: b884b170-54ff-4f69-a847-0997e0b0f347
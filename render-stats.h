@@ -24,7 +24,8 @@ class Scene;
 struct RenderStats
 {
   RenderStats ()
-    : scene_intersect_calls (0), scene_shadow_tests (0), illum_calls (0)
+    : scene_intersect_calls (0), scene_shadow_tests (0), illum_calls (0),
+      env_vis_cache_lookups (0), env_vis_cache_hits (0)
   { }
 
   struct IsecStats
@@ -32,7 +33,8 @@ struct RenderStats
     IsecStats ()
       : surface_intersects_tests (0), surface_intersects_hits (0),
 	neg_cache_hits (0), neg_cache_collisions (0),
-	space_node_intersect_calls (0)
+	space_node_intersect_calls (0),
+	occluder_cache_tests (0), occluder_cache_hits (0)
     { }
 
     void operator+= (const IsecStats &is)
@@ -42,6 +44,8 @@ struct RenderStats
       neg_cache_hits += is.neg_cache_hits;
       neg_cache_collisions += is.neg_cache_collisions;
       space_node_intersect_calls += is.space_node_intersect_calls;
+      occluder_cache_tests += is.occluder_cache_tests;
+      occluder_cache_hits += is.occluder_cache_hits;
     }
 
     unsigned long long surface_intersects_tests;
@@ -49,6 +53,123 @@ struct RenderStats
     unsigned long long neg_cache_hits;
     unsigned long long neg_cache_collisions;
     unsigned long long space_node_intersect_calls;
+
+    // Number of times a cached occluder was tested before searching
+    // the scene (see Scene::occludes), and the number of times it
+    // occluded the ray, so no search was necessary.
+    //
+    unsigned long long occluder_cache_tests;
+    unsigned long long occluder_cache_hits;
+  };
+
+  // Statistics for paths traced by path-tracing integrators.
+  //
+  struct PathStats
+  {
+    // Path lengths of at least this many bounces are all counted in the
+    // last entry of PathStats::len_counts.
+    //
+    static const unsigned MAX_LEN = 32;
+
+    PathStats () : paths (0), bounces (0), rr_terminations (0),
+		   max_len_terminations (0)
+    {
+      for (unsigned i = 0; i < MAX_LEN; i++)
+	len_counts[i] = 0;
+    }
+
+    void operator+= (const PathStats &ps)
+    {
+      paths += ps.paths;
+      bounces += ps.bounces;
+      rr_terminations += ps.rr_terminations;
+      max_len_terminations += ps.max_len_terminations;
+      for (unsigned i = 0; i < MAX_LEN; i++)
+	len_counts[i] += ps.len_counts[i];
+    }
+
+    // Record the end of a path after LEN bounces.
+    //
+    void add_path (unsigned len)
+    {
+      paths++;
+      bounces += len;
+      len_counts[len < MAX_LEN ? len : MAX_LEN - 1]++;
+    }
+
+    // Total number of paths, and the total number of bounces in them.
+    //
+    unsigned long long paths;
+    unsigned long long bounces;
+
+    // Number of paths terminated by russian-roulette, and by reaching
+    // the maximum path length.
+    //
+    unsigned long long rr_terminations;
+    unsigned long long max_len_terminations;
+
+    // Number of paths which ended after each number of bounces.
+    //
+    unsigned long long len_counts[MAX_LEN];
+  };
+
+  // Statistics for Metropolis light transport Markov chains.
+  //
+  struct MltStats
+  {
+    MltStats ()
+      : bootstrap_samples (0), mutations (0), accepted (0),
+	large_steps (0), large_accepted (0)
+    { }
+
+    void operator+= (const MltStats &ms)
+    {
+      bootstrap_samples += ms.bootstrap_samples;
+      mutations += ms.mutations;
+      accepted += ms.accepted;
+      large_steps += ms.large_steps;
+      large_accepted += ms.large_accepted;
+    }
+
+    // Number of independent samples used to start chains.
+    //
+    unsigned long long bootstrap_samples;
+
+    // Number of proposed mutations, and the number of those accepted.
+    //
+    unsigned long long mutations;
+    unsigned long long accepted;
+
+    // Number of proposed mutations which were "large steps" (completely
+    // new samples), and the number of those accepted.
+    //
+    unsigned long long large_steps;
+    unsigned long long large_accepted;
+  };
+
+  // Statistics for the per-thread temporary-storage mempool.
+  //
+  struct MempoolStats
+  {
+    MempoolStats () : peak_bytes (0), block_refills (0), large_allocs (0) { }
+
+    void operator+= (const MempoolStats &ms)
+    {
+      if (ms.peak_bytes > peak_bytes)
+	peak_bytes = ms.peak_bytes;
+      block_refills += ms.block_refills;
+      large_allocs += ms.large_allocs;
+    }
+
+    // The maximum number of bytes used by a single mempool (between
+    // resets).
+    //
+    unsigned long long peak_bytes;
+
+    // The number of times memory had to be allocated from the system.
+    //
+    unsigned long long block_refills;
+    unsigned long long large_allocs;
   };
 
   void operator+= (const RenderStats &is)
@@ -56,17 +177,39 @@ struct RenderStats
     scene_intersect_calls += is.scene_intersect_calls;
     scene_shadow_tests += is.scene_shadow_tests;
     illum_calls += is.illum_calls;
+    env_vis_cache_lookups += is.env_vis_cache_lookups;
+    env_vis_cache_hits += is.env_vis_cache_hits;
 
     intersect += is.intersect;
     shadow += is.shadow;
+
+    path += is.path;
+
+    mlt += is.mlt;
+
+    mempool += is.mempool;
   }
 
   unsigned long long scene_intersect_calls;
   unsigned long long scene_shadow_tests;
   unsigned long long illum_calls;
-  
+
+  // Number of shadow tests for environmental lights which consulted
+  // the environment-visibility cache (see EnvVisCache), and the number
+  // of those for which the cached result was used instead of tracing a
+  // shadow ray.
+  //
+  unsigned long long env_vis_cache_lookups;
+  unsigned long long env_vis_cache_hits;
+
   IsecStats intersect, shadow;
 
+  PathStats path;
+
+  MltStats mlt;
+
+  MempoolStats mempool;
+
   void print (std::ostream &os);
 };
 
@@ -27,3 +27,10 @@ RenderWorker::run ()
       out_q.put (packet);
     }
 }
+
+void
+MltWorker::run ()
+{
+  renderer.bootstrap (num_bootstrap);
+  renderer.run (num_mutations);
+}
@@ -16,6 +16,7 @@
 #include "thread.h"
 
 #include "renderer.h"
+#include "mlt-renderer.h"
 
 
 namespace snogray {
@@ -73,6 +74,64 @@ public:
 };
 
 
+// The guts of a thread running a single Metropolis light transport
+// Markov chain.
+//
+class MltWorker
+{
+public:
+
+  MltWorker (const GlobalRenderState &global_state,
+	     const Camera &camera, unsigned width, unsigned height,
+	     int limit_x, int limit_y,
+	     unsigned limit_width, unsigned limit_height,
+	     unsigned _num_bootstrap, unsigned long long _num_mutations)
+    : renderer (global_state, camera, width, height,
+		limit_x, limit_y, limit_width, limit_height),
+      num_bootstrap (_num_bootstrap), num_mutations (_num_mutations)
+  { }
+
+  // Return the chain's rendering state, which holds its results.
+  //
+  const MltRenderer &chain () const { return renderer; }
+
+  // Return rendering statistics from this thread.
+  //
+  RenderStats stats () const { return renderer.stats (); }
+
+  void run ();
+
+private:
+
+  // Per-thread rendering state.
+  //
+  MltRenderer renderer;
+
+  // Number of bootstrap samples and mutations to use for the chain.
+  //
+  unsigned num_bootstrap;
+  unsigned long long num_mutations;
+};
+
+// Thread that runs an MltWorker.
+//
+class MltThread : public MltWorker, public Thread
+{
+public:
+
+  MltThread (const GlobalRenderState &global_state,
+	     const Camera &camera, unsigned width, unsigned height,
+	     int limit_x, int limit_y,
+	     unsigned limit_width, unsigned limit_height,
+	     unsigned num_bootstrap, unsigned long long num_mutations)
+    : MltWorker (global_state, camera, width, height,
+		 limit_x, limit_y, limit_width, limit_height,
+		 num_bootstrap, num_mutations),
+      Thread (&MltThread::run, this)
+  { }
+};
+
+
 }
 
 #endif // __RENDER_THREAD_H__
@@ -10,7 +10,14 @@
 // Written by Miles Bader <miles@gnu.org>
 //
 
+#include <stdexcept>
+
 #include "camera.h"
+#include "scene.h"
+#include "intersect.h"
+#include "bsdf.h"
+#include "string-funs.h"
+#include "image-output.h"
 #include "media.h"
 #include "sample-set.h"
 #include "render-packet.h"
@@ -26,10 +33,130 @@ Renderer::Renderer (const GlobalRenderState &_global_state,
   : camera (_camera), width (_width), height (_height),
     context (_global_state),
     camera_samples (context.samples.add_channel<UV> ()),
-    focus_samples (context.samples.add_channel<UV> ())
+    focus_samples (context.samples.add_channel<UV> ()),
+    aovs (selected_aovs (_global_state.params))
 {
 }
 
+
+// AOVs
+
+// Return the AOVs selected by PARAMS.  An unknown AOV name causes an
+// exception to be thrown.
+//
+std::vector<Renderer::Aov>
+Renderer::selected_aovs (const ValTable &params)
+{
+  std::vector<Aov> aovs;
+
+  std::string spec = params.get_string ("aov");
+  while (! spec.empty ())
+    {
+      std::string name = strip_prefix (spec, "+,");
+      if (name.empty ())
+	{
+	  name = spec;
+	  spec = "";
+	}
+
+      name = downcase (name);
+
+      if (name == "depth" || name == "z")
+	aovs.push_back (AOV_DEPTH);
+      else if (name == "normal" || name == "n")
+	aovs.push_back (AOV_NORMAL);
+      else if (name == "albedo")
+	aovs.push_back (AOV_ALBEDO);
+      else if (name == "samples")
+	aovs.push_back (AOV_SAMPLES);
+      else
+	throw std::runtime_error ("Unknown AOV \"" + name + "\"");
+    }
+
+  return aovs;
+}
+
+// Add extra output layers to OUTPUT for the AOVs selected by PARAMS.
+//
+void
+Renderer::add_aov_layers (const ValTable &params, ImageOutput &output)
+{
+  std::vector<Aov> aovs = selected_aovs (params);
+
+  for (std::vector<Aov>::iterator ai = aovs.begin (); ai != aovs.end (); ++ai)
+    switch (*ai)
+      {
+      case AOV_DEPTH:	output.add_layer ("Z", ""); break;
+      case AOV_NORMAL:	output.add_layer ("N", "XYZ"); break;
+      case AOV_ALBEDO:	output.add_layer ("albedo", "RGB"); break;
+      case AOV_SAMPLES:	output.add_layer ("samples", "", true); break;
+      }
+}
+
+// Append the values of our AOVs for an eye-ray EYE_RAY, whose
+// starting medium is MEDIA, to VALS.
+//
+void
+Renderer::add_aov_vals (const Ray &eye_ray, const Media &media,
+			std::vector<float> &vals)
+{
+  const Scene &scene = context.scene;
+
+  // AOVs only depend on the first surface hit, so we just trace
+  // EYE_RAY again, rather than complicating the surface integrators.
+  //
+  Ray isec_ray (eye_ray, context.params.min_trace, scene.horizon);
+  const Surface::IsecInfo *isec_info = scene.intersect (isec_ray, context);
+
+  Vec normal (0, 0, 0);
+  Color albedo = 0;
+
+  if (isec_info)
+    {
+      Intersect isec = isec_info->make_intersect (media, context);
+
+      normal = isec.normal_frame.z;
+
+      // Estimate the albedo using a single BSDF sample; averaging the
+      // samples in each pixel gives a reasonable estimate.
+      //
+      if (isec.bsdf)
+	{
+	  UV param (context.random (), context.random ());
+	  Bsdf::Sample samp = isec.bsdf->sample (param, Bsdf::ALL);
+
+	  if (samp.flags & Bsdf::SPECULAR)
+	    albedo = samp.val * abs (isec.cos_n (samp.dir));
+	  else if (samp.pdf > 0)
+	    albedo = samp.val * abs (isec.cos_n (samp.dir)) / samp.pdf;
+	}
+    }
+
+  for (std::vector<Aov>::iterator ai = aovs.begin (); ai != aovs.end (); ++ai)
+    switch (*ai)
+      {
+      case AOV_DEPTH:
+	vals.push_back (isec_ray.t1);
+	break;
+
+      case AOV_NORMAL:
+	vals.push_back (normal.x);
+	vals.push_back (normal.y);
+	vals.push_back (normal.z);
+	break;
+
+      case AOV_ALBEDO:
+	vals.push_back (albedo.r ());
+	vals.push_back (albedo.g ());
+	vals.push_back (albedo.b ());
+	break;
+
+      case AOV_SAMPLES:
+	vals.push_back (1);
+	break;
+      }
+}
+
 
 
 // Render a single packet.
@@ -43,6 +170,14 @@ Renderer::render_packet (RenderPacket &packet)
   Media media (context.default_medium);
 
   packet.results.clear ();
+  packet.aov_vals.clear ();
+
+  // The size of the area on the film plane represented by each
+  // eye-ray; with multiple samples per pixel, each represents only a
+  // fraction of the pixel.
+  //
+  float samp_scale = 1 / sqrt (float (samples.num_samples));
+  UV film_delta (samp_scale / width, samp_scale / height);
 
   for (std::vector<UV>::const_iterator pi = packet.pixels.begin ();
        pi != packet.pixels.end (); ++pi)
@@ -73,16 +208,37 @@ Renderer::render_packet (RenderPacket &packet)
 	  //
 	  Ray camera_ray = camera.eye_ray (film_loc, focus_samp);
 
+	  // Tell the first intersection how big an area the ray covers.
+	  //
+	  context.eye_ray_spread = camera.eye_ray_spread (film_loc, film_delta);
+
 	  // .. calculate what light arrives via that ray.
 	  //
 	  Tint tint = surface_integ.Li (camera_ray, media, sample);
 
 	  packet.results.push_back (RenderPacket::Result (coords, tint));
 
+	  if (! aovs.empty ())
+	    add_aov_vals (camera_ray, media, packet.aov_vals);
+
 	  context.mempool.reset ();
 	}
     }
 }
 
+// Return rendering statistics for this renderer.
+//
+RenderStats
+Renderer::stats () const
+{
+  RenderStats stats = context.stats;
+
+  stats.mempool.peak_bytes = context.mempool.peak_bytes ();
+  stats.mempool.block_refills = context.mempool.num_block_refills ();
+  stats.mempool.large_allocs = context.mempool.num_large_allocs ();
+
+  return stats;
+}
+
 
 // arch-tag: 4c2c754d-4caa-487d-acd2-04bf97d849d3
@@ -13,6 +13,8 @@
 #ifndef __RENDERER_H__
 #define __RENDERER_H__
 
+#include <vector>
+
 #include "render-context.h"
 #include "render-stats.h"
 #include "sample-set.h"
@@ -23,6 +25,8 @@ namespace snogray {
 class Camera;
 class SampleGen;
 class RenderPacket;
+class ImageOutput;
+class Media;
 
 
 // Low-level rendering driver
@@ -31,10 +35,30 @@ class Renderer
 {
 public:
 
+  // Kinds of extra per-sample output ("arbitrary output variables")
+  // which may be rendered in addition to the normal rendering result.
+  // They are selected by the "aov" render parameter, which is a list
+  // of AOV names separated by "+" (or commas).
+  //
+  enum Aov {
+    AOV_DEPTH,			// "depth": distance to the first surface hit
+    AOV_NORMAL,			// "normal": its shading normal
+    AOV_ALBEDO,			// "albedo": an estimate of its reflectance
+    AOV_SAMPLES			// "samples": the number of samples per pixel
+  };
+
   Renderer (const GlobalRenderState &global_state,
 	    const Camera &_camera,
 	    unsigned _width, unsigned _height);
 
+  // Return the AOVs selected by PARAMS.  An unknown AOV name causes an
+  // exception to be thrown.
+  //
+  static std::vector<Aov> selected_aovs (const ValTable &params);
+
+  // Add extra output layers to OUTPUT for the AOVs selected by PARAMS.
+  //
+  static void add_aov_layers (const ValTable &params, ImageOutput &output);
   
   // Render a single packet.
   //
@@ -42,10 +66,16 @@ public:
 
   // Return rendering statistics for this renderer.
   //
-  RenderStats stats () const { return context.stats; }
+  RenderStats stats () const;
 
 private:
 
+  // Append the values of our AOVs for an eye-ray EYE_RAY, whose
+  // starting medium is MEDIA, to VALS.
+  //
+  void add_aov_vals (const Ray &eye_ray, const Media &media,
+		     std::vector<float> &vals);
+
   // The camera being used.
   //
   const Camera &camera;
@@ -63,6 +93,10 @@ private:
   //
   SampleSet::Channel<UV> camera_samples;
   SampleSet::Channel<UV> focus_samples;
+
+  // AOVs to render for each sample, in addition to the normal result.
+  //
+  std::vector<Aov> aovs;
 };
 
 
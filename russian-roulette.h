@@ -0,0 +1,120 @@
+// russian-roulette.h -- Russian-roulette path termination
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef __RUSSIAN_ROULETTE_H__
+#define __RUSSIAN_ROULETTE_H__
+
+#include <stdexcept>
+
+#include "color.h"
+#include "val-table.h"
+#include "snogmath.h"
+
+
+namespace snogray {
+
+
+// Russian-roulette termination of paths, as used by path-tracing
+// integrators.
+//
+// Paths with more than MIN_PATH_LEN vertices whose transmittance is
+// below THRESHOLD are continued with a probability proportional to
+// their transmittance, but never less than MIN_PROB.  Paths which
+// survive have their transmittance boosted to compensate.
+//
+class RussianRoulette
+{
+public:
+
+  // Initialize from the "rr-threshold" and "rr-min-prob" parameters in
+  // PARAMS.  Russian roulette is only applied to paths with more than
+  // MIN_PATH_LEN vertices.
+  //
+  RussianRoulette (const ValTable &params, unsigned _min_path_len)
+    : min_path_len (_min_path_len),
+      threshold (params.get_float ("rr-threshold", 1)),
+      min_prob (clamp (params.get_float ("rr-min-prob", 0.05f), 0.f, 1.f))
+  {
+    if (threshold <= 0)
+      throw std::runtime_error ("rr-threshold must be positive");
+  }
+
+  // Return true if russian roulette should be used for a path which
+  // currently has PATH_LEN vertices.
+  //
+  bool applies (unsigned path_len) const { return path_len > min_path_len; }
+
+  // Return the probability with which a path with transmittance
+  // TRANSMITTANCE should be continued.  REF_INTENS is the intensity
+  // which TRANSMITTANCE is measured relative to (e.g., for light
+  // paths, the intensity of the light sample they started with).
+  //
+  // The probability is proportional to the current path transmittance,
+  // so that paths with high-transmittance, which have a bigger effect
+  // on the final result, will be explored farther.  Paths that survive
+  // then all have a transmittance of about THRESHOLD, so no single
+  // surviving path is boosted much more than the others.  This is a
+  // simple heuristic based only on throughput; it doesn't try to
+  // estimate the light the path will actually find.
+  //
+  // We use the maximum color component rather than the intensity, so
+  // that strongly colored paths aren't terminated too eagerly (which
+  // causes colored "fireflies").  The minimum probability MIN_PROB
+  // limits how much a surviving path can be boosted.
+  //
+  float continue_prob (const Color &transmittance, float ref_intens = 1)
+    const
+  {
+    return clamp (transmittance.max_component () / (ref_intens * threshold),
+		  min_prob, 1.f);
+  }
+
+  // Use the random number RANDOM, in the range [0, 1), to decide
+  // whether to terminate a path with transmittance TRANSMITTANCE
+  // (see RussianRoulette::continue_prob for the meaning of
+  // REF_INTENS).  Return true if the path should be terminated;
+  // otherwise, TRANSMITTANCE is adjusted to reflect the fact that we
+  // tried, and false is returned.
+  //
+  bool terminate (float random, Color &transmittance, float ref_intens = 1)
+    const
+  {
+    float prob = continue_prob (transmittance, ref_intens);
+
+    if (random > prob)
+      return true;
+
+    // By dividing by the probability of continuation, which is less
+    // than 1, we boost the intensity of paths that survive russian
+    // roulette, which will exactly compensate for the zero value of
+    // paths that are terminated by it.
+    //
+    transmittance /= prob;
+
+    return false;
+  }
+
+  // Paths must have more than this many vertices before russian
+  // roulette is used.
+  //
+  unsigned min_path_len;
+
+  // Continuation parameters, as described above.
+  //
+  float threshold;
+  float min_prob;
+};
+
+
+}
+
+#endif // __RUSSIAN_ROULETTE_H__
@@ -47,6 +47,12 @@ public:
   template<typename T>
   unsigned adjust_sample_count (unsigned num) const;
 
+  // Return true if the samples in each channel of a SampleSet should be
+  // shuffled after being generated (so that samples in different
+  // channels aren't correlated).  By default, true is returned.
+  //
+  virtual bool shuffle_samples () const { return true; }
+
 protected:
 
   // The actual sample generating methods, defined by subclasses.
@@ -36,13 +36,16 @@ SampleSet::clear ()
 void
 SampleSet::generate ()
 {
+  bool shuffle = gen.shuffle_samples ();
+
   for (std::vector<Channel<float> >::iterator i = float_channels.begin();
        i != float_channels.end (); ++i)
     if (i->num_total_samples != 0)
       {
 	std::vector<float>::iterator base = sample<float> (i->base_offset);
 	gen.gen_samples<float> (random, base, i->num_total_samples);
-	random_shuffle (base, base + i->num_total_samples, random);
+	if (shuffle)
+	  random_shuffle (base, base + i->num_total_samples, random);
       }
 
   for (std::vector<Channel<UV> >::iterator i = uv_channels.begin();
@@ -51,7 +54,8 @@ SampleSet::generate ()
       {
 	std::vector<UV>::iterator base = sample<UV> (i->base_offset);
 	gen.gen_samples<UV> (random, base, i->num_total_samples);
-	random_shuffle (base, base + i->num_total_samples, random);
+	if (shuffle)
+	  random_shuffle (base, base + i->num_total_samples, random);
       }
 }
 
@@ -20,6 +20,8 @@
 #include "string-funs.h"
 #include "cmdlineparser.h"
 #include "load.h"
+#include "mesh-cache.h"
+#include "tex-cache.h"
 #if USE_LUA
 # include "load-lua.h"
 #endif
@@ -93,6 +95,17 @@ SceneDef::load (Scene &scene, Camera &camera)
       scene.add (bg_light);
     }	  
 
+  // If the user specified a mesh cache directory, use it for any meshes
+  // loaded by the scene.
+  //
+  mesh_cache_dir = params.get_string ("mesh-cache");
+
+  // Likewise the size limit (in megabytes) of the image-texture
+  // cache; zero means image textures are loaded entirely into memory.
+  //
+  unsigned long tex_cache_mb = params.get_uint ("tex-cache-size");
+  tex_cache.set_max_size (tex_cache_mb * 1024 * 1024);
+
   // Read in scene file
   //
   for (vector<Spec>::iterator spec = specs.begin();
@@ -27,7 +27,12 @@
                                OPT1=VAL1[,...]; current options include:\n\
                                  \"format\"    -- scene file type\n\
                                  \"background\"-- scene background\n\
-                                 \"gamma\"     -- implied scene gamma correction"
+                                 \"gamma\"     -- implied scene gamma correction\n\
+                                 \"load-threads\" -- threads for loading meshes\n\
+                                 \"mesh-cache\" -- directory for caching\n\
+                                                   loaded meshes\n\
+                                 \"tex-cache-size\" -- memory limit (MB) for\n\
+                                                   image textures"
                                
 //
 #define SCENE_DEF_SHORT_OPTIONS		"b:A:l:I:c:"
@@ -62,12 +62,51 @@ Scene::add (const Surface *surface)
 void
 Scene::add (Light *light)
 {
+  light->num = lights.size ();
+
   lights.push_back (light);
 
   if (light->is_environ_light ())
     environ_lights.push_back (light);
 }
 
+// A variant of Scene::occludes which uses OCCLUDER as a "shadow
+// cache":  if OCCLUDER is non-zero, it is tested first, and if it
+// completely occludes RAY, true is returned without searching the
+// rest of the scene.  Otherwise the scene is searched as usual, and
+// OCCLUDER is set to the surface which completely occluded RAY, or
+// zero if none did.
+//
+bool
+Scene::occludes (const Ray &ray, const Medium &medium,
+		 Color &total_transmittance, const Surface *&occluder,
+		 RenderContext &context)
+  const
+{
+  context.stats.scene_shadow_tests++;
+
+  if (occluder)
+    {
+      RenderStats::IsecStats &shadow_stats = context.stats.shadow;
+
+      shadow_stats.occluder_cache_tests++;
+
+      // OCCLUDER's transmittance only matters if it _doesn't_
+      // completely occlude RAY, in which case it will be encountered
+      // again when searching the scene, so use a scratch value instead
+      // of TOTAL_TRANSMITTANCE to avoid counting it twice.
+      //
+      Color scratch_transmittance = 1;
+      if (occluder->occludes (ray, medium, scratch_transmittance, context))
+	{
+	  shadow_stats.occluder_cache_hits++;
+	  return true;
+	}
+    }
+
+  return space->occludes (ray, medium, total_transmittance, occluder, context);
+}
+
 // Construct the search accelerator for this scene.
 // SPACE_BUILDER_FACTORY says how to do it.
 //
@@ -84,6 +84,18 @@ public:
     return space->occludes (ray, medium, total_transmittance, context);
   }
 
+  // A variant of Scene::occludes which uses OCCLUDER as a "shadow
+  // cache":  if OCCLUDER is non-zero, it is tested first, and if it
+  // completely occludes RAY, true is returned without searching the
+  // rest of the scene.  Otherwise the scene is searched as usual, and
+  // OCCLUDER is set to the surface which completely occluded RAY, or
+  // zero if none did.
+  //
+  bool occludes (const Ray &ray, const Medium &medium,
+		 Color &total_transmittance, const Surface *&occluder,
+		 RenderContext &context)
+    const;
+
 
   //
   // Add various items to a scene.  All of the following "give" the
@@ -10,19 +10,360 @@
 // Written by Miles Bader <miles@gnu.org>
 //
 
+#include "config.h"
+
 #include <iostream>
 #include <cstring>
 
+#if USE_THREADS
+# include <vector>
+# include <deque>
+# include <map>
+#endif
+
 #include "cmdlineparser.h"
 #include "image-input.h"
 #include "image-output.h"
 #include "image-cmdline.h"
 #include "string-funs.h"
 #include "unique-ptr.h"
+#include "num-cores.h"
+
+#if USE_THREADS
+# include "filter-conv.h"
+# include "thread.h"
+# include "mutex.h"
+# include "cond-var.h"
+#endif
 
 using namespace snogray;
 using namespace std;
 
+
+#if USE_THREADS
+
+// Converts bands of source-image rows to output-image samples using
+// multiple threads.
+//
+// The main thread reads the source image, and passes it in bands of
+// rows to BandConverter::add_band.  Worker threads filter each band into
+// a separate block of output rows, which the main thread then adds to
+// the output image, in order; rows which no later band can affect are
+// written out as soon as possible.
+//
+class BandConverter
+{
+public:
+
+  // A band of source rows, and the output samples they produce.
+  //
+  struct Band
+  {
+    Band (unsigned _src_y, unsigned _num_rows, unsigned width)
+      : src_y (_src_y), num_rows (_num_rows),
+	rows (_num_rows, ImageRow (width)), out (0), seq (0)
+    { }
+    ~Band () { delete out; }
+
+    // The position of the band in the source image, and its rows.  The
+    // rows are freed once they've been converted.
+    //
+    unsigned src_y, num_rows;
+    std::vector<ImageRow> rows;
+
+    // Output samples produced from ROWS.
+    //
+    ImageOutput::SampleTile *out;
+
+    // Order in which this band was added.
+    //
+    unsigned seq;
+  };
+
+  // Make a BandConverter which adds samples to DST, using NUM_THREADS
+  // worker threads.  Source pixel coordinates are multiplied by X_SCALE
+  // and Y_SCALE to get output-image coordinates, and DST_PARAMS
+  // specifies the filter to use.
+  //
+  BandConverter (ImageOutput &dst, const ValTable &dst_params,
+		 float x_scale, float y_scale, unsigned num_threads);
+  ~BandConverter ();
+
+  // Queue BAND for conversion, and add any bands which have finished
+  // conversion to the output image.  BAND becomes owned by the
+  // BandConverter.  If too many bands are waiting, this waits for some
+  // to finish.
+  //
+  void add_band (Band *band);
+
+  // Wait for all queued bands to be converted, and add them to the
+  // output image.
+  //
+  void finish ();
+
+private:
+
+  // Main loop for worker threads.
+  //
+  void run_worker ();
+
+  // Filter the source rows in BAND into BAND->out.
+  //
+  void convert (Band &band);
+
+  // Add the output samples from BAND to the output image, and write any
+  // output rows which later bands can't affect.
+  //
+  void merge (Band &band);
+
+  // Add converted bands to the output image, in order, until at most
+  // MAX_UNMERGED bands remain unmerged.  LOCK should hold MUTEX.
+  //
+  void merge_done_bands (UniqueLock &lock, unsigned max_unmerged);
+
+  // Tell worker threads to exit, and wait until they do so.
+  //
+  void stop_workers ();
+
+  ImageOutput &dst;
+
+  float x_scale, y_scale;
+
+  // Filter used to convert samples.  This is shared by all worker
+  // threads (FilterConv::add_sample doesn't modify it).
+  //
+  FilterConv<ImageOutput::SampleTile, Tint> filter_conv;
+
+  // Bands waiting for a worker thread.
+  //
+  std::deque<Band *> pending;
+
+  // Converted bands which haven't been merged yet, indexed by sequence
+  // number.
+  //
+  std::map<unsigned, Band *> done;
+
+  // The sequence number of the next band to be added, and of the next
+  // band to be merged.
+  //
+  unsigned next_seq, next_merge_seq;
+
+  // The maximum number of bands which may be in memory at once.
+  //
+  unsigned max_bands;
+
+  // If true, worker threads should exit when PENDING is empty.
+  //
+  bool shutting_down;
+
+  // Protects all of the above (except DST, which is only used by the
+  // main thread).
+  //
+  Mutex mutex;
+
+  // Condition variables used to signal that PENDING has become
+  // non-empty (or workers should exit), and that a band has been added
+  // to DONE, respectively.
+  //
+  CondVar pending_cond, done_cond;
+
+  std::vector<Thread *> threads;
+};
+
+
+// Make a BandConverter which adds samples to DST, using NUM_THREADS
+// worker threads.  Source pixel coordinates are multiplied by X_SCALE
+// and Y_SCALE to get output-image coordinates, and DST_PARAMS
+// specifies the filter to use.
+//
+BandConverter::BandConverter (ImageOutput &_dst, const ValTable &dst_params,
+			      float _x_scale, float _y_scale,
+			      unsigned num_threads)
+  : dst (_dst), x_scale (_x_scale), y_scale (_y_scale),
+    filter_conv (dst_params), next_seq (0), next_merge_seq (0),
+    max_bands (num_threads * 2), shutting_down (false)
+{
+  for (unsigned i = 0; i < num_threads; i++)
+    threads.push_back (new Thread (&BandConverter::run_worker, this));
+}
+
+BandConverter::~BandConverter ()
+{
+  stop_workers ();
+
+  for (std::deque<Band *>::iterator pi = pending.begin ();
+       pi != pending.end (); ++pi)
+    delete *pi;
+  for (std::map<unsigned, Band *>::iterator di = done.begin ();
+       di != done.end (); ++di)
+    delete di->second;
+}
+
+
+// Queue BAND for conversion, and add any bands which have finished
+// conversion to the output image.  BAND becomes owned by the
+// BandConverter.  If too many bands are waiting, this waits for some
+// to finish.
+//
+void
+BandConverter::add_band (Band *band)
+{
+  UniqueLock lock (mutex);
+
+  band->seq = next_seq++;
+  pending.push_back (band);
+  pending_cond.notify_one ();
+
+  merge_done_bands (lock, max_bands);
+}
+
+// Wait for all queued bands to be converted, and add them to the
+// output image.
+//
+void
+BandConverter::finish ()
+{
+  UniqueLock lock (mutex);
+  merge_done_bands (lock, 0);
+}
+
+
+// Add converted bands to the output image, in order, until at most
+// MAX_UNMERGED bands remain unmerged.  LOCK should hold MUTEX.
+//
+void
+BandConverter::merge_done_bands (UniqueLock &lock, unsigned max_unmerged)
+{
+  for (;;)
+    {
+      std::map<unsigned, Band *>::iterator di = done.find (next_merge_seq);
+
+      if (di != done.end ())
+	{
+	  Band *band = di->second;
+	  done.erase (di);
+	  next_merge_seq++;
+
+	  // Do the merging without holding the lock, so that worker
+	  // threads can continue to finish bands meanwhile.
+	  //
+	  lock.unlock ();
+	  merge (*band);
+	  delete band;
+	  lock.lock ();
+	}
+      else if (next_seq - next_merge_seq > max_unmerged)
+	done_cond.wait (lock);
+      else
+	break;
+    }
+}
+
+
+// Main loop for worker threads.
+//
+void
+BandConverter::run_worker ()
+{
+  UniqueLock lock (mutex);
+
+  for (;;)
+    {
+      while (pending.empty () && !shutting_down)
+	pending_cond.wait (lock);
+
+      if (pending.empty ())
+	break;
+
+      Band *band = pending.front ();
+      pending.pop_front ();
+
+      lock.unlock ();
+      convert (*band);
+      lock.lock ();
+
+      done[band->seq] = band;
+      done_cond.notify_one ();
+    }
+}
+
+// Tell worker threads to exit, and wait until they do so.
+//
+void
+BandConverter::stop_workers ()
+{
+  {
+    LockGuard guard (mutex);
+    shutting_down = true;
+    pending_cond.notify_all ();
+  }
+
+  for (std::vector<Thread *>::iterator ti = threads.begin ();
+       ti != threads.end (); ++ti)
+    {
+      (*ti)->join ();
+      delete *ti;
+    }
+  threads.clear ();
+}
+
+
+// Filter the source rows in BAND into BAND->out.
+//
+void
+BandConverter::convert (Band &band)
+{
+  // The range of output rows which samples from BAND can affect.
+  //
+  int radius = filter_conv.filter_radius;
+  int first_row = int ((band.src_y + 0.5f) * y_scale) - radius;
+  int last_row
+    = int ((band.src_y + band.num_rows - 0.5f) * y_scale) + radius;
+  first_row = max (first_row, 0);
+  last_row = min (last_row, int (dst.height) - 1);
+
+  band.out = new ImageOutput::SampleTile (0, first_row, dst.width,
+					  max (last_row + 1 - first_row, 0),
+					  0);
+
+  for (unsigned y = 0; y < band.num_rows; y++)
+    {
+      const ImageRow &src_row = band.rows[y];
+      float sy = (band.src_y + y + 0.5f) * y_scale;
+
+      for (unsigned x = 0; x < src_row.width; x++)
+	filter_conv.add_sample ((x + 0.5f) * x_scale, sy, src_row[x],
+				*band.out);
+    }
+
+  band.rows.clear ();
+}
+
+// Add the output samples from BAND to the output image, and write any
+// output rows which later bands can't affect.
+//
+void
+BandConverter::merge (Band &band)
+{
+  const ImageOutput::SampleTile &out = *band.out;
+
+  for (unsigned y = 0; y < out.height; y++)
+    {
+      ImageOutput::SampleRow &row = dst.row (out.y + y);
+      unsigned offs = y * out.width;
+
+      for (unsigned x = 0; x < out.width; x++, offs++)
+	{
+	  row.pixels[x] += out.pixels[offs];
+	  row.weights[x] += out.weights[offs];
+	}
+    }
+
+  dst.set_min_sample_y (int ((band.src_y + band.num_rows + 0.5f) * y_scale));
+}
+
+#endif // USE_THREADS
+
 
 
 static void
@@ -52,6 +393,10 @@ s "      --underlay=UND_IMAGE   Use pixels from UND_IMAGE when they are brighter
 s "                               than the corresponding pixel in SOURCE_IMAGE"
 s "                               (UND_IMAGE must be the same size as SOURCE_IMAGE)"
 n
+#if USE_THREADS
+s "  -j, --threads=NUM          Use NUM threads for conversion (default all cores)"
+n
+#endif
 s IMAGE_INPUT_OPTIONS_HELP
 n
 s IMAGE_OUTPUT_OPTIONS_HELP
@@ -77,6 +422,9 @@ int main (int argc, char *const *argv)
   static struct option long_options[] = {
     { "pad-bottom",	required_argument, 0, 'p' },
     { "underlay",	required_argument, 0, OPT_UNDERLAY },
+#if USE_THREADS
+    { "threads",	required_argument, 0, 'j' },
+#endif
     IMAGE_INPUT_LONG_OPTIONS,
     IMAGE_OUTPUT_LONG_OPTIONS,
     CMDLINEPARSER_GENERAL_LONG_OPTIONS,
@@ -84,6 +432,9 @@ int main (int argc, char *const *argv)
   };
   char short_options[] =
     "p:"
+#if USE_THREADS
+    "j:"
+#endif
     IMAGE_OUTPUT_SHORT_OPTIONS
     IMAGE_INPUT_SHORT_OPTIONS
     CMDLINEPARSER_GENERAL_SHORT_OPTIONS;
@@ -95,6 +446,7 @@ int main (int argc, char *const *argv)
   unsigned dst_width = 0, dst_height = 0; // zero means copy from source image
   unsigned pad_bottom = 0;		  // rows of padding to add to src img
   string underlay_image;		  // image file to use as underlay
+  unsigned num_threads = 0;		  // 0 means use all cores
   ValTable src_params, dst_params;
 
   // Parse command-line options
@@ -111,6 +463,12 @@ int main (int argc, char *const *argv)
 	underlay_image = clp.opt_arg ();
 	break;
 
+#if USE_THREADS
+      case 'j':
+	num_threads = clp.unsigned_opt_arg ();
+	break;
+#endif
+
 	IMAGE_OUTPUT_OPTION_CASES (clp, dst_params);
 	IMAGE_INPUT_OPTION_CASES (clp, src_params);
 	CMDLINEPARSER_GENERAL_OPTION_CASES (clp);
@@ -124,6 +482,14 @@ int main (int argc, char *const *argv)
       exit (10);
     }
 
+  if (num_threads == 0)
+    num_threads = num_cores (1);
+
+  // Image formats which can do their own encoding or decoding in
+  // multiple threads (e.g. EXR) should use the same number.
+  //
+  ImageIo::set_num_threads (num_threads);
+
   // Open the input image
   //
   ImageInput src (clp.get_arg(), src_params);
@@ -184,15 +550,41 @@ int main (int argc, char *const *argv)
   float x_scale = float (dst_width) / float (src.width);
   float y_scale = float (dst_height) / float (padded_src_height);
 
+#if USE_THREADS
+  // When using multiple threads, source rows are read in bands of
+  // BAND_ROWS rows, and converted by a BandConverter.
+  //
+  const unsigned BAND_ROWS = 32;
+  UniquePtr<BandConverter> band_converter;
+  if (num_threads > 1)
+    band_converter.reset (
+      new BandConverter (dst, dst_params, x_scale, y_scale, num_threads));
+  BandConverter::Band *band = 0;
+#endif
+
   // Copy input image to output image, doing any processing
   //
   ImageRow src_row (src.width);
   ImageRow underlay_row (src.width);
   for (unsigned y = 0; y < src.height; y++)
     {
+      ImageRow *row = &src_row;
+
+#if USE_THREADS
+      // If using a BandConverter, read directly into the current band.
+      //
+      if (band_converter)
+	{
+	  if (! band)
+	    band = new BandConverter::Band (y, min (BAND_ROWS, src.height - y),
+					    src.width);
+	  row = &band->rows[y - band->src_y];
+	}
+#endif
+
       // Read one row of the source image.
       //
-      src.read_row (src_row);
+      src.read_row (*row);
 
       // If there's an underlay, we essentially take the maximum of it and
       // the source image.  This is useful for HDR light-maps which only
@@ -206,16 +598,42 @@ int main (int argc, char *const *argv)
 	  underlay->read_row (underlay_row);
 
 	  for (unsigned x = 0; x < src.width; x++)
-	    src_row[x] = max (src_row[x], underlay_row[x]);
+	    (*row)[x] = max ((*row)[x], underlay_row[x]);
 	}
 
+#if USE_THREADS
+      if (band_converter)
+	{
+	  if (y + 1 == band->src_y + band->num_rows)
+	    {
+	      band_converter->add_band (band);
+	      band = 0;
+	    }
+	  continue;
+	}
+#endif
+
       // Write to the output image, scaling as necessary.
       //
       for (unsigned x = 0; x < src.width; x++)
 	dst.add_sample ((x + 0.5f) * x_scale, (y + 0.5f) * y_scale, src_row[x]);
+
+      // Let the output image write any rows which later source rows
+      // can't affect.
+      //
+      dst.set_min_sample_y (int ((y + 1.5f) * y_scale));
     }
 
+#if USE_THREADS
+  if (band_converter)
+    band_converter->finish ();
+#endif
+
   delete underlay;
+
+  // Finish writing the output image, reporting any error.
+  //
+  CMDLINEPARSER_CATCH (clp, dst.close ());
 }
 
 // arch-tag: 9852837a-ecf5-4400-9b79-f0cca96a6736
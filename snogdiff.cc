@@ -10,17 +10,497 @@
 // Written by Miles Bader <miles@gnu.org>
 //
 
+#include "config.h"
+
 #include <iostream>
+#include <vector>
+#include <stdexcept>
 
 #include "snogmath.h"
 #include "cmdlineparser.h"
+#include "num-cores.h"
 #include "image-input.h"
 #include "image-output.h"
 #include "image-cmdline.h"
+#include "unique-ptr.h"
+
+#if USE_THREADS
+# include "thread.h"
+# include "mutex.h"
+#endif
 
 using namespace snogray;
 using namespace std;
 
+
+// Error metrics
+
+// Error statistics for a tile, or a whole image.  The second image
+// being compared is treated as the reference.
+//
+struct ErrStats
+{
+  ErrStats ()
+    : num_pixels (0), sq_err_sum (0), rel_sq_err_sum (0),
+      ssim_sum (0), num_ssim_windows (0), delta_e_sum (0), max_delta_e (0)
+  { }
+
+  void operator+= (const ErrStats &stats)
+  {
+    num_pixels += stats.num_pixels;
+    sq_err_sum += stats.sq_err_sum;
+    rel_sq_err_sum += stats.rel_sq_err_sum;
+    ssim_sum += stats.ssim_sum;
+    num_ssim_windows += stats.num_ssim_windows;
+    delta_e_sum += stats.delta_e_sum;
+    max_delta_e = max (max_delta_e, stats.max_delta_e);
+  }
+
+  // Mean squared error, per color channel.
+  //
+  double mse () const { return sq_err_sum / (3 * num_pixels); }
+
+  // Root mean squared error.
+  //
+  double rmse () const { return sqrt (mse ()); }
+
+  // Peak signal-to-noise ratio in decibels, using a peak value of 1.
+  // This is infinite (returned as zero) if the images are identical.
+  //
+  double psnr () const
+  {
+    double err = mse ();
+    return err == 0 ? 0 : -10 * log10 (err);
+  }
+
+  // Mean squared error, relative to the squared reference value.
+  //
+  double rel_mse () const { return rel_sq_err_sum / (3 * num_pixels); }
+
+  // Mean structural similarity of the image luminance.
+  //
+  double ssim () const { return ssim_sum / num_ssim_windows; }
+
+  // Mean CIE76 color difference, in L*a*b* space.
+  //
+  double delta_e () const { return delta_e_sum / num_pixels; }
+
+  unsigned num_pixels;
+
+  // Sum of squared errors in every color channel, and the same with
+  // each error divided by the squared reference value.
+  //
+  double sq_err_sum, rel_sq_err_sum;
+
+  // Sum of SSIM values for each window of SSIM_WINDOW x SSIM_WINDOW
+  // pixels, and the number of windows.
+  //
+  double ssim_sum;
+  unsigned num_ssim_windows;
+
+  // Sum and maximum of per-pixel CIE76 color differences.
+  //
+  double delta_e_sum;
+  float max_delta_e;
+};
+
+
+// Compares two images tile-by-tile, possibly using multiple threads,
+// and calculates error statistics for each tile.
+//
+class ImageComparer
+{
+public:
+
+  // The size of windows used for calculating SSIM.
+  //
+  static const unsigned SSIM_WINDOW = 8;
+
+  // Added to the squared reference value when calculating relative
+  // MSE, to avoid dividing by zero in black regions.
+  //
+  static float rel_mse_eps () { return 0.01f; }
+
+  // Make a comparer for images with size WIDTH x HEIGHT, whose pixels
+  // are in PIXELS1 and PIXELS2 (three floats, red, green, and blue, per
+  // pixel, in row-major order), using tiles of TILE_SIZE x TILE_SIZE
+  // pixels.
+  //
+  ImageComparer (const std::vector<float> &pixels1,
+		 const std::vector<float> &pixels2,
+		 unsigned width, unsigned height, unsigned tile_size);
+
+  // Calculate TILE_STATS, using NUM_THREADS threads.
+  //
+  void compare (unsigned num_threads);
+
+  // Return error statistics for the whole image.  ImageComparer::compare
+  // must be called first.
+  //
+  ErrStats total_stats () const;
+
+  // Number of tiles in each direction.
+  //
+  unsigned num_tiles_x, num_tiles_y;
+
+  // Error statistics for each tile, in row-major order.
+  //
+  std::vector<ErrStats> tile_stats;
+
+private:
+
+  // Main loop for comparison threads.
+  //
+  void run_worker ();
+
+  // Calculate error statistics for tile number TILE into STATS.
+  //
+  void compare_tile (unsigned tile, ErrStats &stats) const;
+
+  // Return the SSIM of the luminance of the window from X0, Y0 to
+  // X1, Y1 (exclusive).
+  //
+  float ssim (unsigned x0, unsigned y0, unsigned x1, unsigned y1) const;
+
+  // Return the CIE76 color difference between the linear RGB colors
+  // RGB1 and RGB2.
+  //
+  static float delta_e (const float *rgb1, const float *rgb2);
+
+  // Convert the linear RGB color RGB to CIE L*a*b* (with a D65 white
+  // point) in LAB.  RGB is clamped to the displayable range first.
+  //
+  static void rgb_to_lab (const float *rgb, float *lab);
+
+  const std::vector<float> &pixels1, &pixels2;
+
+  unsigned width, height, tile_size;
+
+  // The next tile to be compared by a thread.
+  //
+  unsigned next_tile;
+
+#if USE_THREADS
+  // Protects NEXT_TILE.
+  //
+  Mutex mutex;
+#endif
+};
+
+
+// Make a comparer for images with size WIDTH x HEIGHT, whose pixels
+// are in PIXELS1 and PIXELS2 (three floats, red, green, and blue, per
+// pixel, in row-major order), using tiles of TILE_SIZE x TILE_SIZE
+// pixels.
+//
+ImageComparer::ImageComparer (const std::vector<float> &_pixels1,
+			      const std::vector<float> &_pixels2,
+			      unsigned _width, unsigned _height,
+			      unsigned _tile_size)
+  : num_tiles_x ((_width + _tile_size - 1) / _tile_size),
+    num_tiles_y ((_height + _tile_size - 1) / _tile_size),
+    tile_stats (num_tiles_x * num_tiles_y),
+    pixels1 (_pixels1), pixels2 (_pixels2),
+    width (_width), height (_height), tile_size (_tile_size),
+    next_tile (0)
+{
+}
+
+// Calculate TILE_STATS, using NUM_THREADS threads.
+//
+void
+ImageComparer::compare (unsigned num_threads)
+{
+  next_tile = 0;
+
+#if USE_THREADS
+  if (num_threads > 1)
+    {
+      std::vector<Thread *> threads;
+      for (unsigned i = 0; i < num_threads; i++)
+	threads.push_back (new Thread (&ImageComparer::run_worker, this));
+
+      for (std::vector<Thread *>::iterator ti = threads.begin ();
+	   ti != threads.end (); ++ti)
+	{
+	  (*ti)->join ();
+	  delete *ti;
+	}
+
+      return;
+    }
+#endif
+
+  run_worker ();
+}
+
+// Main loop for comparison threads.
+//
+void
+ImageComparer::run_worker ()
+{
+  for (;;)
+    {
+      unsigned tile;
+      {
+#if USE_THREADS
+	LockGuard guard (mutex);
+#endif
+	tile = next_tile++;
+      }
+
+      if (tile >= tile_stats.size ())
+	break;
+
+      compare_tile (tile, tile_stats[tile]);
+    }
+}
+
+// Return error statistics for the whole image.  ImageComparer::compare
+// must be called first.
+//
+ErrStats
+ImageComparer::total_stats () const
+{
+  // Tiles are summed in order, so the result doesn't depend on the
+  // number of threads.
+  //
+  ErrStats total;
+  for (std::vector<ErrStats>::const_iterator si = tile_stats.begin ();
+       si != tile_stats.end (); ++si)
+    total += *si;
+  return total;
+}
+
+
+// Calculate error statistics for tile number TILE into STATS.
+//
+void
+ImageComparer::compare_tile (unsigned tile, ErrStats &stats) const
+{
+  unsigned x0 = (tile % num_tiles_x) * tile_size;
+  unsigned y0 = (tile / num_tiles_x) * tile_size;
+  unsigned x1 = min (x0 + tile_size, width);
+  unsigned y1 = min (y0 + tile_size, height);
+
+  stats.num_pixels = (x1 - x0) * (y1 - y0);
+
+  for (unsigned y = y0; y < y1; y++)
+    {
+      const float *p1 = &pixels1[(y * width + x0) * 3];
+      const float *p2 = &pixels2[(y * width + x0) * 3];
+      unsigned num_comps = (x1 - x0) * 3;
+
+      // This loop works on plain float arrays, and is simple enough to
+      // be vectorized by the compiler.
+      //
+      float sq_err = 0, rel_sq_err = 0;
+      for (unsigned i = 0; i < num_comps; i++)
+	{
+	  float err = p1[i] - p2[i];
+	  sq_err += err * err;
+	  rel_sq_err += err * err / (p2[i] * p2[i] + rel_mse_eps ());
+	}
+      stats.sq_err_sum += sq_err;
+      stats.rel_sq_err_sum += rel_sq_err;
+
+      float delta_e_sum = 0;
+      for (unsigned i = 0; i < num_comps; i += 3)
+	{
+	  float de = delta_e (p1 + i, p2 + i);
+	  delta_e_sum += de;
+	  stats.max_delta_e = max (stats.max_delta_e, de);
+	}
+      stats.delta_e_sum += delta_e_sum;
+    }
+
+  for (unsigned wy = y0; wy < y1; wy += SSIM_WINDOW)
+    for (unsigned wx = x0; wx < x1; wx += SSIM_WINDOW)
+      {
+	stats.ssim_sum += ssim (wx, wy, min (wx + SSIM_WINDOW, x1),
+				min (wy + SSIM_WINDOW, y1));
+	stats.num_ssim_windows++;
+      }
+}
+
+
+// Return the SSIM of the luminance of the window from X0, Y0 to
+// X1, Y1 (exclusive).
+//
+float
+ImageComparer::ssim (unsigned x0, unsigned y0, unsigned x1, unsigned y1) const
+{
+  // Stabilizing constants, for a dynamic range of 1.
+  //
+  const float C1 = 0.01f * 0.01f, C2 = 0.03f * 0.03f;
+
+  float sum1 = 0, sum2 = 0, sq_sum1 = 0, sq_sum2 = 0, cross_sum = 0;
+
+  for (unsigned y = y0; y < y1; y++)
+    {
+      const float *p1 = &pixels1[(y * width + x0) * 3];
+      const float *p2 = &pixels2[(y * width + x0) * 3];
+
+      for (unsigned i = 0; i < (x1 - x0) * 3; i += 3)
+	{
+	  float l1 = 0.2126f * p1[i] + 0.7152f * p1[i+1] + 0.0722f * p1[i+2];
+	  float l2 = 0.2126f * p2[i] + 0.7152f * p2[i+1] + 0.0722f * p2[i+2];
+	  sum1 += l1;
+	  sum2 += l2;
+	  sq_sum1 += l1 * l1;
+	  sq_sum2 += l2 * l2;
+	  cross_sum += l1 * l2;
+	}
+    }
+
+  float inv_n = 1 / float ((x1 - x0) * (y1 - y0));
+  float mean1 = sum1 * inv_n, mean2 = sum2 * inv_n;
+  float var1 = sq_sum1 * inv_n - mean1 * mean1;
+  float var2 = sq_sum2 * inv_n - mean2 * mean2;
+  float covar = cross_sum * inv_n - mean1 * mean2;
+
+  return ((2 * mean1 * mean2 + C1) * (2 * covar + C2))
+    / ((mean1 * mean1 + mean2 * mean2 + C1) * (var1 + var2 + C2));
+}
+
+
+// Return the CIE76 color difference between the linear RGB colors
+// RGB1 and RGB2.
+//
+float
+ImageComparer::delta_e (const float *rgb1, const float *rgb2)
+{
+  float lab1[3], lab2[3];
+  rgb_to_lab (rgb1, lab1);
+  rgb_to_lab (rgb2, lab2);
+
+  float dl = lab1[0] - lab2[0], da = lab1[1] - lab2[1];
+  float db = lab1[2] - lab2[2];
+  return sqrt (dl * dl + da * da + db * db);
+}
+
+// Return the real cube root of X.  This is used instead of std::cbrt,
+// which isn't available before C++11; pow only handles non-negative
+// bases for fractional exponents, so the sign is handled separately.
+//
+static float
+cube_root (float x)
+{
+  return x < 0 ? -pow (-x, 1.f / 3) : pow (x, 1.f / 3);
+}
+
+
+// Convert the linear RGB color RGB to CIE L*a*b* (with a D65 white
+// point) in LAB.  RGB is clamped to the displayable range first.
+//
+void
+ImageComparer::rgb_to_lab (const float *rgb, float *lab)
+{
+  float r = clamp (rgb[0], 0.f, 1.f);
+  float g = clamp (rgb[1], 0.f, 1.f);
+  float b = clamp (rgb[2], 0.f, 1.f);
+
+  // sRGB primaries to CIE XYZ, normalized by the D65 white point.
+  //
+  float xyz[3];
+  xyz[0] = (0.4124f * r + 0.3576f * g + 0.1805f * b) / 0.9505f;
+  xyz[1] = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+  xyz[2] = (0.0193f * r + 0.1192f * g + 0.9505f * b) / 1.089f;
+
+  for (unsigned c = 0; c < 3; c++)
+    {
+      const float d = 6.f / 29;
+      float t = xyz[c];
+      xyz[c] = t > d * d * d ? cube_root (t) : t / (3 * d * d) + 4.f / 29;
+    }
+
+  lab[0] = 116 * xyz[1] - 16;
+  lab[1] = 500 * (xyz[0] - xyz[1]);
+  lab[2] = 200 * (xyz[1] - xyz[2]);
+}
+
+
+// Metrics output
+
+// Print the error metrics in STATS to OS, one per line, as a metric
+// name followed by its value.
+//
+static void
+print_metrics (const ErrStats &stats, ostream &os)
+{
+  os << "rmse " << stats.rmse () << endl;
+
+  // An infinite PSNR is printed as "inf", which most programs that
+  // read floating-point numbers understand.
+  //
+  double psnr = stats.psnr ();
+  if (stats.mse () == 0)
+    os << "psnr inf" << endl;
+  else
+    os << "psnr " << psnr << endl;
+
+  os << "rel-mse " << stats.rel_mse () << endl;
+  os << "ssim " << stats.ssim () << endl;
+  os << "delta-e " << stats.delta_e () << endl;
+  os << "max-delta-e " << stats.max_delta_e << endl;
+}
+
+// Check the error metrics in STATS against the limits in THRESHOLDS,
+// and print a message to stderr for each one which isn't satisfied.
+// Return true if all were satisfied.  "psnr" and "ssim" thresholds are
+// minimums, all others are maximums.
+//
+static bool
+check_thresholds (const ErrStats &stats, const ValTable &thresholds,
+		  CmdLineParser &clp)
+{
+  bool ok = true;
+
+  for (ValTable::const_iterator ti = thresholds.begin ();
+       ti != thresholds.end (); ++ti)
+    {
+      const std::string &name = ti->first;
+      float limit = ti->second.as_float ();
+
+      double val;
+      bool is_min = false;
+      if (name == "rmse")
+	val = stats.rmse ();
+      else if (name == "psnr")
+	{
+	  // An infinite PSNR always satisfies the threshold.
+	  //
+	  if (stats.mse () == 0)
+	    continue;
+	  val = stats.psnr ();
+	  is_min = true;
+	}
+      else if (name == "rel-mse")
+	val = stats.rel_mse ();
+      else if (name == "ssim")
+	{
+	  val = stats.ssim ();
+	  is_min = true;
+	}
+      else if (name == "delta-e")
+	val = stats.delta_e ();
+      else if (name == "max-delta-e")
+	val = stats.max_delta_e;
+      else
+	throw std::runtime_error ("unknown error metric: " + name);
+
+      if (is_min ? val < limit : val > limit)
+	{
+	  cerr << clp.err_pfx () << name << " " << val
+	       << (is_min ? " is below" : " exceeds")
+	       << " threshold " << limit << endl;
+	  ok = false;
+	}
+    }
+
+  return ok;
+}
+
 
 
 static void
@@ -44,6 +524,23 @@ help (CmdLineParser &clp, ostream &os)
   os <<
   "Output the difference of two images"
 n
+s "  -m, --metrics              Print error metrics comparing SRC_IMAGE_1 to"
+s "                               SRC_IMAGE_2 (the reference) on standard output;"
+s "                               a difference image is only written if"
+s "                               OUTPUT_IMAGE is given"
+s "  -t, --threshold=METRIC=LIMIT[,...]"
+s "                             Exit with status 3 if any METRIC (one of"
+s "                               \"rmse\", \"psnr\", \"rel-mse\", \"ssim\","
+s "                               \"delta-e\", or \"max-delta-e\") is worse than"
+s "                               LIMIT (implies --metrics)"
+s "      --heatmap=IMAGE        Write the RMSE of each tile to IMAGE, one pixel"
+s "                               per tile (implies --metrics)"
+s "      --tile-size=SIZE       Compare images in tiles of SIZE x SIZE pixels"
+s "                               (default 32)"
+#if USE_THREADS
+s "  -j, --threads=NUM          Use NUM threads for comparison (default all cores)"
+#endif
+n
 s IMAGE_INPUT_OPTIONS_HELP
 n
 s IMAGE_OUTPUT_OPTIONS_HELP
@@ -61,17 +558,31 @@ n
 }
 
 
+#define OPT_HEATMAP	1
+#define OPT_TILE_SIZE	2
+
 int main (int argc, char *const *argv)
 {
   // Command-line option specs
   //
   static struct option long_options[] = {
+    { "metrics",	no_argument,	   0, 'm' },
+    { "threshold",	required_argument, 0, 't' },
+    { "heatmap",	required_argument, 0, OPT_HEATMAP },
+    { "tile-size",	required_argument, 0, OPT_TILE_SIZE },
+#if USE_THREADS
+    { "threads",	required_argument, 0, 'j' },
+#endif
     IMAGE_INPUT_LONG_OPTIONS,
     IMAGE_OUTPUT_LONG_OPTIONS,
     CMDLINEPARSER_GENERAL_LONG_OPTIONS,
     { 0, 0, 0, 0 }
   };
   char short_options[] =
+    "mt:"
+#if USE_THREADS
+    "j:"
+#endif
     IMAGE_OUTPUT_SHORT_OPTIONS
     IMAGE_INPUT_SHORT_OPTIONS
     CMDLINEPARSER_GENERAL_SHORT_OPTIONS;
@@ -81,6 +592,11 @@ int main (int argc, char *const *argv)
   // Parameters set from the command line
   //
   ValTable src_params, dst_params;
+  bool metrics = false;		// print error metrics
+  ValTable thresholds;		// limits for error metrics
+  string heatmap_image;		// image file for per-tile errors
+  unsigned tile_size = 32;
+  unsigned num_threads = 0;	// 0 means use all cores
 
   // Parse command-line options
   //
@@ -88,6 +604,29 @@ int main (int argc, char *const *argv)
   while ((opt = clp.get_opt ()) > 0)
     switch (opt)
       {
+      case 'm':
+	metrics = true;
+	break;
+      case 't':
+	clp.parse_opt_arg (",", thresholds);
+	metrics = true;
+	break;
+      case OPT_HEATMAP:
+	heatmap_image = clp.opt_arg ();
+	metrics = true;
+	break;
+      case OPT_TILE_SIZE:
+	tile_size = clp.unsigned_opt_arg ();
+	if (tile_size == 0)
+	  clp.opt_err ("requires a positive argument");
+	break;
+
+#if USE_THREADS
+      case 'j':
+	num_threads = clp.unsigned_opt_arg ();
+	break;
+#endif
+
 	IMAGE_OUTPUT_OPTION_CASES (clp, dst_params);
 	IMAGE_INPUT_OPTION_CASES (clp, src_params);
 	CMDLINEPARSER_GENERAL_OPTION_CASES (clp);
@@ -114,9 +653,24 @@ int main (int argc, char *const *argv)
   if (src2.width != width || src2.height != height)
     clp.err ("Input images must be the same size");
 
-  // Open the output image using the resulting adjust size.
+  // Open the output image using the resulting adjust size.  When
+  // printing metrics, a difference image is only written if one is
+  // explicitly named.
   //
-  ImageOutput dst (clp.get_arg (), width, height, dst_params);
+  const char *dst_name = clp.get_arg ();
+  UniquePtr<ImageOutput> dst;
+  if (dst_name || !metrics)
+    dst.reset (new ImageOutput (dst_name ? dst_name : "", width, height,
+				dst_params));
+
+  // Pixels of both images, for calculating metrics.
+  //
+  std::vector<float> pixels1, pixels2;
+  if (metrics)
+    {
+      pixels1.reserve (width * height * 3);
+      pixels2.reserve (width * height * 3);
+    }
 
   // These are temp rows we use during reading
   //
@@ -131,18 +685,83 @@ int main (int argc, char *const *argv)
 
       for (unsigned x = 0; x < width; x++)
 	{
-	  Color p = row1[x].alpha_scaled_color() - row2[x].alpha_scaled_color();
+	  Color c1 = row1[x].alpha_scaled_color ();
+	  Color c2 = row2[x].alpha_scaled_color ();
 
-	  // We care about the absolute value of the difference
-	  // (negative values aren't useful), so invert any negative
-	  // components.
-	  //
-	  Color::component_t r = abs (p.r()), g = abs (p.g()), b = abs (p.b());
-	  p.set_rgb (r, g, b);
+	  if (metrics)
+	    {
+	      pixels1.push_back (c1.r ());
+	      pixels1.push_back (c1.g ());
+	      pixels1.push_back (c1.b ());
+	      pixels2.push_back (c2.r ());
+	      pixels2.push_back (c2.g ());
+	      pixels2.push_back (c2.b ());
+	    }
+
+	  if (dst)
+	    {
+	      Color p = c1 - c2;
 
-	  dst.add_sample (x + 0.5f, y + 0.5f, p);
+	      // We care about the absolute value of the difference
+	      // (negative values aren't useful), so invert any negative
+	      // components.
+	      //
+	      Color::component_t r = abs (p.r()), g = abs (p.g()), b = abs (p.b());
+	      p.set_rgb (r, g, b);
+
+	      dst->add_sample (x + 0.5f, y + 0.5f, p);
+	    }
 	}
     }
+
+  // Finish writing the output image, reporting any error.
+  //
+  if (dst)
+    CMDLINEPARSER_CATCH (clp, dst->close ());
+
+  if (! metrics)
+    return 0;
+
+  if (width == 0 || height == 0)
+    clp.err ("Input images are empty");
+
+  if (num_threads == 0)
+    num_threads = num_cores (1);
+
+  ImageComparer comparer (pixels1, pixels2, width, height, tile_size);
+  comparer.compare (num_threads);
+
+  ErrStats stats = comparer.total_stats ();
+
+  print_metrics (stats, cout);
+
+  // Write a heatmap image if requested.
+  //
+  if (! heatmap_image.empty ())
+    {
+      ValTable heatmap_params;
+      heatmap_params.set ("filter", "none");
+
+      ImageOutput heatmap (heatmap_image,
+			   comparer.num_tiles_x, comparer.num_tiles_y,
+			   heatmap_params);
+
+      for (unsigned ty = 0; ty < comparer.num_tiles_y; ty++)
+	for (unsigned tx = 0; tx < comparer.num_tiles_x; tx++)
+	  {
+	    const ErrStats &tile_stats
+	      = comparer.tile_stats[ty * comparer.num_tiles_x + tx];
+	    heatmap.add_sample (tx + 0.5f, ty + 0.5f,
+				Color (float (tile_stats.rmse ())));
+	  }
+
+      CMDLINEPARSER_CATCH (clp, heatmap.close ());
+    }
+
+  bool ok = true;
+  CMDLINEPARSER_CATCH (clp, ok = check_thresholds (stats, thresholds, clp));
+
+  return ok ? 0 : 3;
 }
 
 // arch-tag: 7e0ac89a-194f-4ebb-be2f-ca8714bca63c
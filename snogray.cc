@@ -35,7 +35,10 @@
 #include "camera.h"
 #include "light.h"
 #include "render-mgr.h"
+#include "renderer.h"
 #include "recover.h"
+#include "render-checkpoint.h"
+#include "unique-ptr.h"
 #include "image-output.h"
 #include "image-input.h"
 #include "image-cmdline.h"
@@ -62,6 +65,11 @@ using namespace std;
 //
 #define RECOVER_BACKUP_LIMIT 100
 
+// The default interval between checkpoints, in seconds, when resuming
+// from a checkpoint without an explicit --checkpoint option.
+//
+#define DEFAULT_CHECKPOINT_INTERVAL 300
+
 
 // Floating-point exceptions
 
@@ -290,6 +298,8 @@ s "  -j, --threads=NUM          Use NUM threads for rendering (default all cores
 n
 #endif
 s "  -C, --continue             Continue a previously aborted render"
+s "  -K, --checkpoint=SECS      Save a checkpoint every SECS seconds, from which"
+s "                               --continue can resume exactly"
 n
 s "  -q, --quiet                Do not output informational or progress messages"
 s "  -P, --no-progress          Do not output progress indicator"
@@ -313,6 +323,7 @@ int main (int argc, char *const *argv)
     { "progress",	no_argument,	   0, 'p' },
     { "no-progress",	no_argument,	   0, 'P' },
     { "continue",	no_argument,	   0, 'C' },
+    { "checkpoint",	required_argument, 0, 'K' },
     { "camera",		required_argument, 0, 'c' },
 #if USE_THREADS
     { "threads",	required_argument, 0, 'j' },
@@ -326,7 +337,7 @@ int main (int argc, char *const *argv)
   };
   //
   char short_options[] =
-    "L:qpPCc:"
+    "L:qpPCK:c:"
 #if USE_THREADS
     "j:"
 #endif
@@ -344,6 +355,7 @@ int main (int argc, char *const *argv)
   LimitSpec limit_max_x_spec ("max-x", 1.0), limit_max_y_spec ("max-y", 1.0);
   unsigned num_threads = 0;	// autodetect
   bool recover = false;
+  float checkpoint_interval = 0;
   Progress::Verbosity verbosity = Progress::CHATTY;
   bool progress_set = false;
   ValTable output_params, render_params;
@@ -375,6 +387,9 @@ int main (int argc, char *const *argv)
       case 'C':
 	recover = true;
 	break;
+      case 'K':
+	checkpoint_interval = clp.float_opt_arg ();
+	break;
 
 	// Verbosity options
 	//
@@ -425,6 +440,17 @@ int main (int argc, char *const *argv)
   output_params.set ("filename", clp.get_arg ());
 
 
+  // If the user didn't specify how many threads to use, try to use as
+  // many as there are CPU cores.  Image formats which can do their own
+  // encoding or decoding in multiple threads should use the same
+  // number; this is set before loading the scene, as it may read
+  // images too.
+  //
+  if (num_threads == 0)
+    num_threads = num_cores (1);
+  ImageIo::set_num_threads (num_threads);
+
+
   // Start of "overall elapsed" time
   //
   Timeval beg_time (Timeval::TIME_OF_DAY);
@@ -473,7 +499,7 @@ int main (int argc, char *const *argv)
 
   // Do post-load scene setup (nothing can be added to scene after this).
   //
-  Octree::BuilderFactory octree_builder_factory;
+  Octree::BuilderFactory octree_builder_factory (render_params);
   scene.setup (octree_builder_factory);
 
   // Do camera manipulation specified on the command-line.
@@ -518,6 +544,33 @@ int main (int argc, char *const *argv)
   unsigned limit_height
     = limit_max_y_spec.apply (clp, height, limit_y) - limit_y;
 
+  // If the render is being checkpointed, or there's a checkpoint we
+  // can resume from, make a checkpoint object.  This must be created
+  // before the output image, as the output image refers to it.
+  //
+  std::string checkpoint_name = file_name + ".ckpt";
+  UniquePtr<RenderCheckpoint> checkpoint;
+  if (checkpoint_interval > 0 || recover)
+    checkpoint.reset (
+      new RenderCheckpoint (checkpoint_name,
+			    (checkpoint_interval > 0
+			     ? checkpoint_interval
+			     : DEFAULT_CHECKPOINT_INTERVAL)));
+  bool resume = recover && checkpoint->exists ();
+  if (checkpoint && !resume && checkpoint_interval <= 0)
+    checkpoint.reset ();
+
+  // Metropolis light transport adds samples to arbitrary pixels, so
+  // there's no consistent point at which a checkpoint could be saved,
+  // and the rows of a partial image can't be recovered either.
+  //
+  bool mlt = render_params.get_bool ("mlt", false);
+  if (mlt && checkpoint)
+    clp.err ("Metropolis light transport (-R mlt) cannot be checkpointed");
+  if (mlt && recover)
+    clp.err ("Metropolis light transport (-R mlt) cannot recover"
+	     " a partial image");
+
   // If possible, try to recover a previously aborted render.
   //
   ImageInput *recover_input = 0;
@@ -528,7 +581,11 @@ int main (int argc, char *const *argv)
 	// Recover a previous aborted render
 	try
 	  {
-	    recover_input = new ImageInput (file_name);
+	    // If resuming from a checkpoint, the old output image isn't
+	    // used at all, but we still make a backup of it.
+	    //
+	    if (! resume)
+	      recover_input = new ImageInput (file_name);
 
 	    string recover_backup
 	      = rename_to_backup_file (file_name, RECOVER_BACKUP_LIMIT);
@@ -576,6 +633,40 @@ int main (int argc, char *const *argv)
   //
   ImageOutput output (file_name, limit_width, limit_height, output_params);
 
+  // Add extra output layers for any AOVs being rendered.
+  //
+  CMDLINEPARSER_CATCH (clp, Renderer::add_aov_layers (render_params, output));
+
+  // Start checkpointing, restoring the state saved in an existing
+  // checkpoint if we're resuming.
+  //
+  if (resume)
+    {
+      CMDLINEPARSER_CATCH (clp, checkpoint->resume (output));
+
+      if (! quiet)
+	cout << "* resume: " << checkpoint_name
+	     << ": Resuming from checkpoint (" << output.num_rows_written ()
+	     << " rows complete)" << endl;
+
+      // If the checkpointed render started by recovering rows from an
+      // earlier image, those rows weren't part of its render pattern,
+      // so leave them out of ours as well (they're already in the
+      // restored output).
+      //
+      limit_y += checkpoint->skipped_rows ();
+      limit_height -= checkpoint->skipped_rows ();
+
+      // Don't just repeat the random samples used when the original
+      // render started.
+      //
+      render_params.set ("random-seed",
+			 render_params.get_uint ("random-seed", 0)
+			 + checkpoint->num_resumes ());
+    }
+  else if (checkpoint)
+    CMDLINEPARSER_CATCH (clp, checkpoint->start (output));
+
   if (output_params.get_bool ("alpha-channel,alpha")
       && !output.has_alpha_channel())
     {
@@ -587,6 +678,10 @@ int main (int argc, char *const *argv)
 
   if (recover_input)
     {
+      if (output.tile_size ())
+	clp.err (file_name + ": Cannot recover a previous render"
+		 " when streaming output tiles");
+
       unsigned num_rows_recovered = recover_image (recover_input, output);
       recover_input = 0;
 
@@ -605,6 +700,11 @@ int main (int argc, char *const *argv)
       //
       limit_y += num_rows_recovered;
       limit_height -= num_rows_recovered;
+
+      // Resuming from a checkpoint must use the same render area.
+      //
+      if (checkpoint)
+	checkpoint->set_skipped_rows (num_rows_recovered);
     }
 
   if (! quiet)
@@ -627,12 +727,6 @@ int main (int argc, char *const *argv)
     }
 
 
-  // If the user didn't specify how many threads to use, try to use as
-  // many as there are CPU cores.
-  //
-  if (num_threads == 0)
-    num_threads = num_cores (1);
-
   if (num_threads != 1)
     std::cout << "* using " << num_threads << " threads" << std::endl;
 
@@ -653,24 +747,57 @@ int main (int argc, char *const *argv)
   Rusage render_beg_ru;
 
   // The pattern of pixels we will render; we add a small margin around
-  // the output image to keep the edges clean.
+  // the output image to keep the edges clean.  If the output image is
+  // written as tiles, each tile is rendered separately, with its own
+  // margin.
   //
   unsigned margin = output.filter_radius ();
-  RenderPattern pattern (limit_x - margin, limit_y - margin,
-			 limit_width + margin*2, limit_height + margin*2);
+  RenderPattern pattern (limit_x, limit_y, limit_width, limit_height,
+			 margin, output.tile_size ());
+
+  // Where rendering starts in PATTERN; this is only different from
+  // the beginning when resuming from a checkpoint.
+  //
+  unsigned start_pos = pattern.position (pattern.begin ());
+  if (checkpoint)
+    CMDLINEPARSER_CATCH (clp,
+      start_pos = pattern.position (checkpoint->start_position (pattern)));
 
   // Start progress indicator
   //
   Progress prog (std::cout, "rendering...",
-		 pattern.position (pattern.begin ()),
-		 (pattern.position (pattern.end ())
-		  - pattern.position (pattern.begin ())),
+		 mlt ? 0 : start_pos,
+		 (mlt
+		  ? limit_width * limit_height
+		  : pattern.position (pattern.end ()) - start_pos),
 		 verbosity);
 
   // Do the actual rendering.
   //
   RenderMgr render_mgr (global_render_state, camera, width, height);
-  render_mgr.render (num_threads, pattern, output, prog, render_stats);
+  if (mlt)
+    {
+      CMDLINEPARSER_CATCH (clp,
+	render_mgr.render_mlt (num_threads, limit_x, limit_y,
+			       limit_width, limit_height,
+			       output, prog, render_stats));
+    }
+  else
+    {
+      CMDLINEPARSER_CATCH (clp,
+	render_mgr.render (num_threads, pattern, output, prog, render_stats,
+			   checkpoint.get ()));
+    }
+
+  // Finish writing the output image (the image may still be being
+  // written by another thread), reporting any error.
+  //
+  CMDLINEPARSER_CATCH (clp, output.close ());
+
+  // The checkpoint isn't needed once the output image is complete.
+  //
+  if (checkpoint)
+    checkpoint->remove ();
 
   // Done rendering.
   //
@@ -479,7 +479,7 @@ local function postproc_material (mat, params)
       local bump = params.bump_map or params.bump
       -- we ignore scalar bump maps, as they have no effect
       if bump and type (bump) ~= 'number' then
-	 mat.bump_map = float_tex (bump)
+	 mat.bump_map = raw.compiled_tex (float_tex (bump))
       end
 
       -- opacity (alpha transparency)
@@ -785,22 +785,97 @@ function gc_ref (from, to)
 end
 
 
+----------------------------------------------------------------
+--
+-- background mesh loading
+--
+-- Meshes in formats handled directly by the C++ core (e.g., "ply" and
+-- "msh" files) can be loaded concurrently by worker threads.  The
+-- function "async_mesh" returns a mesh which may still be loading; it
+-- may be added to the scene immediately, but should not otherwise be
+-- used until all pending loads are finished (which happens
+-- automatically when the scene loader returns).
+--
+-- Because of that restriction, the "mesh" constructor still loads
+-- files synchronously, and background loading must be requested
+-- explicitly using "async_mesh":  scenes commonly use a mesh right
+-- after loading it (e.g., to compute a transform from its bounding
+-- box, or to add it to a surface group), which would silently see an
+-- empty mesh if loading were done in the background.
+
+-- The queue used to load meshes in the background; it is only created
+-- when first needed.
+--
+local mesh_load_queue = nil
+
+-- Meshes which are still being loaded.  This prevents them from being
+-- garbage-collected while a worker thread is using them.
+--
+local pending_meshes = {}
+
+-- Return a new mesh with material MAT, to be loaded from FILENAME in
+-- the background.  If SMOOTH is not false, vertex normals are computed
+-- for the mesh after loading.  If XFORM is given, the mesh is
+-- transformed by it after loading.
+--
+-- The number of loading threads can be controlled with the
+-- "load-threads" scene option (the default is one per CPU core).
+--
+function async_mesh (mat, filename, smooth, xform)
+   if not mesh_load_queue then
+      local num_threads = params and tonumber (params["load-threads"]) or 0
+      mesh_load_queue = raw.MeshLoadQueue (num_threads)
+   end
+
+   local m = raw.Mesh (mat)
+   pending_meshes[m] = true
+
+   mesh_load_queue:load (m, filename, smooth ~= false,
+			 xform or identity_xform)
+
+   return m
+end
+
+-- Wait for all meshes being loaded by async_mesh to finish loading, and
+-- add those which were given to "scene:add" to the scene.
+--
+function finish_async_meshes ()
+   if mesh_load_queue then
+      local queue = mesh_load_queue
+      mesh_load_queue = nil
+      queue:finish ()
+      pending_meshes = {}
+   end
+end
+
+
 ----------------------------------------------------------------
 --
 -- scene object
 --
 -- We don't use the raw scene object directly because we need to
--- gc-protect objects handed to the scene.
+-- gc-protect objects handed to the scene, and route additions through
+-- the background loading queue while meshes are still being loaded.
 
 local function init_scene (raw_scene)
    scene = raw_scene		-- this is exported
 
-   if scene_obj_gc_protect and not has_index_wrappers (scene) then
+   if not has_index_wrappers (scene) then
       local wrap = index_wrappers (scene)
 
       function wrap:add (thing)
-	 gc_ref (self, thing)
-	 return nowrap_meth_call (self, "add", thing)
+	 if scene_obj_gc_protect then
+	    gc_ref (self, thing)
+	 end
+	 -- While background loads are pending, all additions go
+	 -- through the loading queue, so that they're added to the
+	 -- scene in the same order they were requested.
+	 --
+	 if mesh_load_queue then
+	    return mesh_load_queue:add (self, thing)
+	 else
+	    return nowrap_meth_call (self, "add", thing)
+	 end
       end
    end
 end
@@ -1833,7 +1908,22 @@ function load_scene (filename, fmt, rscene, rcamera, rparams, ...)
 
       -- Call the loader.
       --
-      return loader (filename, scene, camera, params, ...)
+      local ok, result = pcall (loader, filename, scene, camera, params, ...)
+
+      if not ok then
+	 -- Don't leave background mesh loads pending after an error;
+	 -- any error from them is ignored in favor of the original one.
+	 --
+	 pcall (finish_async_meshes)
+	 error (result, 0)
+      end
+
+      -- Make sure any meshes being loaded in the background are
+      -- complete before returning to the C++ core.
+      --
+      finish_async_meshes ()
+
+      return result
    else
       return false
    end
@@ -25,27 +25,45 @@ using namespace snogray;
 struct ClosestIntersectCallback : Space::IntersectCallback
 {
   ClosestIntersectCallback (Ray &_ray, RenderContext &_context)
-    : ray (_ray), closest (0), context (_context)
+    : ray (_ray), closest_surf (0), context (_context)
   { }
 
+  // Only the parameters of each intersection are recorded during the
+  // search; the (mempool-allocated) IsecInfo object is made just once,
+  // for the surface which ends up being closest.
+  //
   virtual bool operator() (const Surface *surf)
   {
-    const Surface::IsecInfo *isec_info = surf->intersect (ray, context);
-    if (isec_info)
+    Surface::IsecParams isec_params;
+    if (surf->find_intersection (ray, isec_params, context))
       {
-	closest = isec_info;
+	closest_surf = surf;
+	closest_params = isec_params;
 	return true;
       }
 
     return false;
   }
 
+  // Return a Surface::IsecInfo object describing the closest
+  // intersection found, or zero if there was none.
+  //
+  const Surface::IsecInfo *closest () const
+  {
+    if (closest_surf)
+      return closest_surf->make_isec_info (ray, closest_params, context);
+    else
+      return 0;
+  }
+
 
   Ray &ray;
 
-  // Information about the closest intersection we've found
+  // The closest surface we've found, and the parameters of its
+  // intersection with RAY.
   //
-  const Surface::IsecInfo *closest;
+  const Surface *closest_surf;
+  Surface::IsecParams closest_params;
 
   RenderContext &context;
 };
@@ -66,7 +84,7 @@ Space::intersect (Ray &ray, RenderContext &context) const
   for_each_possible_intersector (ray, closest_isec_cb, context,
 				 context.stats.intersect);
 
-  return closest_isec_cb.closest;
+  return closest_isec_cb.closest ();
 }
 
 
@@ -124,14 +142,17 @@ struct OccludesCallback : Space::IntersectCallback
 		    Color &_total_transmittance,
 		    RenderContext &_context)
     : ray (_ray), total_transmittance (_total_transmittance),
-      medium (_medium), context (_context), occludes (false)
+      medium (_medium), context (_context), occludes (false), occluder (0)
   { }
 
   virtual bool operator() (const Surface *surf)
   {
     occludes = surf->occludes (ray, medium, total_transmittance, context);
     if (occludes)
-      stop_iteration ();
+      {
+	occluder = surf;
+	stop_iteration ();
+      }
     return occludes;
   }
 
@@ -150,6 +171,10 @@ struct OccludesCallback : Space::IntersectCallback
   // True if we found a totally-occluding object.
   //
   bool occludes;
+
+  // The totally-occluding object, if any.
+  //
+  const Surface *occluder;
 };
 
 
@@ -175,12 +200,28 @@ Space::occludes (const Ray &ray, const Medium &medium,
 		 Color &total_transmittance,
 		 RenderContext &context)
   const
+{
+  const Surface *occluder;
+  return occludes (ray, medium, total_transmittance, occluder, context);
+}
+
+// A variant of Space::occludes which also returns the surface which
+// completely occluded RAY in OCCLUDER (if RAY wasn't completely
+// occluded, OCCLUDER is set to zero).
+//
+bool
+Space::occludes (const Ray &ray, const Medium &medium,
+		 Color &total_transmittance, const Surface *&occluder,
+		 RenderContext &context)
+  const
 {
   OccludesCallback occludes_cb (ray, medium, total_transmittance, context);
 
   for_each_possible_intersector (ray, occludes_cb, context,
 				 context.stats.shadow);
 
+  occluder = occludes_cb.occluder;
+
   return occludes_cb.occludes;
 }
 
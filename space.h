@@ -61,6 +61,15 @@ public:
 			 RenderContext &context)
     const;
 
+  // A variant of Space::occludes which also returns the surface which
+  // completely occluded RAY in OCCLUDER (if RAY wasn't completely
+  // occluded, OCCLUDER is set to zero).
+  //
+  bool occludes (const Ray &ray, const Medium &medium,
+		 Color &total_transmittance, const Surface *&occluder,
+		 RenderContext &context)
+    const;
+
   // Call CALLBACK for each surface in the voxel tree that _might_
   // intersect RAY (any further intersection testing needs to be done
   // directly on the resulting surfaces).  CONTEXT is used to access
@@ -191,4 +191,30 @@ SphereLight::eval (const Intersect &isec, const Vec &dir) const
 }
 
 
+// SphereLight::free_sample_pdf
+
+// Return the pdf which the free-sampling variant of Light::sample
+// would have for a sample that reaches VIEWPOINT from direction DIR
+// (in world coordinates, pointing from VIEWPOINT towards the light).
+//
+float
+SphereLight::free_sample_pdf (const Pos &viewpoint, const Vec &dir) const
+{
+  // Free samples leave the outside of the sphere, so VIEWPOINT must be
+  // outside it, and DIR must hit it.
+  //
+  dist_t dist;
+  if ((viewpoint - pos).length_squared () > radius * radius
+      && sphere_intersects (pos, radius, viewpoint, dir, dist))
+    {
+      // As in SphereLight::sample, this is the area pdf times the
+      // (constant) projected-solid-angle pdf of a cosine distribution.
+      //
+      return 1 / (radius*radius * 4 * PIf) * INV_PIf;
+    }
+
+  return 0;
+}
+
+
 // arch-tag: 1caf0ba2-7ec6-4814-be51-b57bbda71fe8
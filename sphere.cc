@@ -28,14 +28,43 @@ using namespace snogray;
 //
 const Surface::IsecInfo *
 Sphere::intersect (Ray &ray, RenderContext &context) const
+{
+  IsecParams isec_params;
+  if (find_intersection (ray, isec_params, context))
+    return make_isec_info (ray, isec_params, context);
+  else
+    return 0;
+}
+
+// "Two-phase" version of Surface::intersect:  If this surface
+// intersects RAY, change RAY's maximum bound (Ray::t1) to reflect the
+// point of intersection, store the intersection's parameters in
+// ISEC_PARAMS, and return true; otherwise return false.
+//
+bool
+Sphere::find_intersection (Ray &ray, IsecParams &,
+			   RenderContext &)
+  const
 {
   dist_t t;
   if (sphere_intersects (frame.origin, radius, ray, t))
     {
       ray.t1 = t;
-      return new (context) IsecInfo (ray, *this);
+      return true;
     }
-  return 0;
+  return false;
+}
+
+// Return a Surface::IsecInfo object describing the intersection of
+// this surface with RAY, found by a previous call to
+// Sphere::find_intersection which returned ISEC_PARAMS.
+//
+const Surface::IsecInfo *
+Sphere::make_isec_info (const Ray &ray, const IsecParams &,
+			RenderContext &context)
+  const
+{
+  return new (context) IsecInfo (ray, *this);
 }
 
 // Create an Intersect object for this intersection.
@@ -128,4 +128,34 @@ SurfaceLight::eval (const Intersect &isec, const Vec &dir) const
 }
 
 
+// SurfaceLight::free_sample_pdf
+
+// Return the pdf which the free-sampling variant of Light::sample
+// would have for a sample that reaches VIEWPOINT from direction DIR
+// (in world coordinates, pointing from VIEWPOINT towards the light).
+//
+float
+SurfaceLight::free_sample_pdf (const Pos &viewpoint, const Vec &dir) const
+{
+  Surface::Sampler::AngularSample samp
+    = sampler->eval_from_viewpoint (viewpoint, dir);
+
+  // Free samples are only emitted from the front of the surface.
+  //
+  float cos_light = -dot (samp.normal, dir);
+
+  if (samp.pdf > 0 && cos_light > 0)
+    {
+      // Convert SAMP's angular pdf to an area pdf, and then, as in
+      // the free-sampling variant of SurfaceLight::sample, include
+      // the projected-solid-angle pdf of a cosine distribution.
+      //
+      float area_pdf = samp.pdf * cos_light / (samp.dist * samp.dist);
+      return area_pdf * INV_PIf;
+    }
+
+  return 0;
+}
+
+
 // arch-tag: 60165b73-d34e-4f49-9a90-958daefdeb78
@@ -45,6 +45,39 @@ bool Surface::occludes (const Ray &, const Medium &, Color &, RenderContext &) c
 BBox Surface::bbox () const { barf (); }
 
 
+
+// Two-phase intersection defaults
+
+// If this surface intersects RAY, change RAY's maximum bound (Ray::t1)
+// to reflect the point of intersection, store information about the
+// intersection in ISEC_PARAMS, and return true; otherwise return false.
+//
+// This default implementation just uses Surface::intersect, so
+// surfaces which don't override it still allocate an IsecInfo object
+// for every intersection found.
+//
+bool
+Surface::find_intersection (Ray &ray, IsecParams &isec_params,
+			    RenderContext &context)
+  const
+{
+  isec_params.isec_info = intersect (ray, context);
+  return isec_params.isec_info != 0;
+}
+
+// Return a Surface::IsecInfo object describing the intersection of
+// this surface with RAY, found by a previous call to
+// Surface::find_intersection which returned ISEC_PARAMS.
+//
+const Surface::IsecInfo *
+Surface::make_isec_info (const Ray &, const IsecParams &isec_params,
+			 RenderContext &)
+  const
+{
+  return isec_params.isec_info;
+}
+
+
 
 // Surface::Sampler
 
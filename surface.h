@@ -37,6 +37,7 @@ class Surface
 public:
 
   class IsecInfo;	  // Used to return info about an intersection
+  struct IsecParams;	  // Raw parameters of a not-yet-chosen intersection
   class Sampler;	  // Surface-sampling interface
 
 
@@ -51,6 +52,33 @@ public:
   //
   virtual const IsecInfo *intersect (Ray &ray, RenderContext &context) const;
 
+  // "Two-phase" version of Surface::intersect, used when searching for
+  // the closest intersection:  If this surface intersects RAY, change
+  // RAY's maximum bound (Ray::t1) to reflect the point of intersection,
+  // store any surface-specific information about the intersection in
+  // ISEC_PARAMS, and return true; otherwise return false.
+  //
+  // No IsecInfo object is allocated; once the search has finished,
+  // Surface::make_isec_info is called for the closest surface only.
+  //
+  // The default implementation just calls Surface::intersect, and
+  // remembers the resulting IsecInfo object in ISEC_PARAMS.
+  //
+  virtual bool find_intersection (Ray &ray, IsecParams &isec_params,
+				  RenderContext &context)
+    const;
+
+  // Return a Surface::IsecInfo object describing the intersection of
+  // this surface with RAY, found by a previous call to
+  // Surface::find_intersection which returned ISEC_PARAMS (and
+  // adjusted RAY's maximum bound).  The object should be allocated
+  // using placement-new with CONTEXT.
+  //
+  virtual const IsecInfo *make_isec_info (const Ray &ray,
+					  const IsecParams &isec_params,
+					  RenderContext &context)
+    const;
+
   // Return true if this surface intersects RAY.
   //
   virtual bool intersects (const Ray &ray, RenderContext &context) const;
@@ -100,6 +128,32 @@ public:
 
 
 
+// ----------------------------------------------------------------
+// Surface::IsecParams
+
+
+// A small fixed-size record used to pass information from
+// Surface::find_intersection to Surface::make_isec_info.  It is
+// copied by value for every intersection found during a search, so it
+// should stay small and trivial.
+//
+struct Surface::IsecParams
+{
+  IsecParams () : u (0), v (0), isec_info (0) { }
+
+  // Surface-specific parameters of the intersection (e.g., barycentric
+  // coordinates for triangles).
+  //
+  dist_t u, v;
+
+  // For surfaces which don't implement two-phase intersection, the
+  // IsecInfo object returned by Surface::intersect.
+  //
+  const IsecInfo *isec_info;
+};
+
+
+
 // ----------------------------------------------------------------
 // Surface::IsecInfo
 
@@ -0,0 +1,508 @@
+// tex-cache.cc -- Cache of mipmapped image-texture tiles
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "snogmath.h"
+#include "color.h"
+#include "image-input.h"
+
+#include "tex-cache.h"
+
+
+using namespace snogray;
+
+
+// The global texture cache.
+//
+TexCache snogray::tex_cache;
+
+
+// A single cached tile.
+//
+struct TexCache::Tile
+{
+  Tile (Slot &_slot, unsigned _image_id)
+    : slot (_slot), image_id (_image_id), used (true)
+  { }
+
+  // The slot which points to this tile, and the id of the image it
+  // belongs to.
+  //
+  Slot &slot;
+  unsigned image_id;
+
+  // Texel data, in row-major order, with TILE_SIZE texels per row
+  // (tiles at the right and bottom edges of a level may only be
+  // partially used).
+  //
+  std::vector<float> data;
+
+  // True if this tile has been used since the last time
+  // TexCache::evict considered it.
+  //
+  Atomic<bool> used;
+};
+
+
+TexCache::~TexCache ()
+{
+  for (std::vector<Tile *>::iterator ti = tiles.begin ();
+       ti != tiles.end (); ++ti)
+    delete *ti;
+}
+
+// Set the maximum amount of memory used for cached tiles to
+// MAX_BYTES; zero means that the cache is disabled.
+//
+void
+TexCache::set_max_size (unsigned long _max_bytes)
+{
+  LockGuard guard (mutex);
+  max_bytes = _max_bytes;
+  evict ();
+}
+
+// Add a tile for SLOT, which belongs to the image with id IMAGE_ID,
+// with contents DATA (which is swapped out of DATA) to the cache,
+// evicting old tiles if necessary.  If REQUIRED is false, the tile is
+// only added if that can be done without evicting anything.  MUTEX
+// must be locked by the caller.
+//
+void
+TexCache::add (Slot &slot, unsigned image_id, std::vector<float> &data,
+	       bool required)
+{
+  unsigned long tile_bytes = data.size () * sizeof (float);
+
+  if (!required && cur_bytes + tile_bytes > max_bytes)
+    return;
+
+  // Another thread may have loaded the same tile while we were busy.
+  //
+  if (slot.tile.load ())
+    return;
+
+  Tile *tile = new Tile (slot, image_id);
+  tile->data.swap (data);
+
+  tiles.push_back (tile);
+  cur_bytes += tile_bytes;
+
+  // Only make the tile visible to readers once it's complete.
+  //
+  slot.tile.store (tile);
+
+  evict (tile);
+}
+
+// Remove all tiles belonging to the image with id IMAGE_ID.
+//
+void
+TexCache::forget (unsigned image_id)
+{
+  LockGuard guard (mutex);
+
+  unsigned index = 0;
+  while (index < tiles.size ())
+    if (tiles[index]->image_id == image_id)
+      remove (index);
+    else
+      index++;
+}
+
+// Discard tiles until the cache fits in MAX_BYTES, but never discard
+// KEEP.  Recently used tiles are discarded last.  MUTEX must be locked
+// by the caller.
+//
+void
+TexCache::evict (const Tile *keep)
+{
+  while (cur_bytes > max_bytes && tiles.size () > (keep ? 1 : 0))
+    {
+      if (clock_hand >= tiles.size ())
+	clock_hand = 0;
+
+      Tile *tile = tiles[clock_hand];
+
+      // A tile which has been used since we last looked at it gets
+      // another chance.
+      //
+      if (tile == keep || tile->used.exchange (false))
+	clock_hand++;
+      else
+	remove (clock_hand);
+    }
+}
+
+// Remove the tile at index INDEX in TILES from the cache, and delete it.
+// MUTEX must be locked by the caller.
+//
+void
+TexCache::remove (unsigned index)
+{
+  Tile *tile = tiles[index];
+
+  // Make the tile invisible to new readers, and then wait for any
+  // threads still reading it to finish (which only takes a few
+  // instructions).
+  //
+  tile->slot.tile.store (0);
+  {
+    UniqueLock readers_lock (readers_mutex);
+    while (tile->slot.readers.load () != 0)
+      readers_done.wait (readers_lock);
+  }
+
+  cur_bytes -= tile->data.size () * sizeof (float);
+
+  tiles[index] = tiles.back ();
+  tiles.pop_back ();
+
+  delete tile;
+}
+
+
+// Stop reading the tile in SLOT (which must have been registered by
+// incrementing SLOT.readers), waking up TexCache::remove if it's
+// waiting for us.
+//
+void
+TexCache::release (Slot &slot)
+{
+  // TexCache::remove clears SLOT.tile before waiting for readers, so
+  // if it's still set, nobody can be waiting.
+  //
+  if (--slot.readers == 0 && ! slot.tile.load ())
+    {
+      LockGuard guard (readers_mutex);
+      readers_done.notify_all ();
+    }
+}
+
+
+// TexCache::Image
+
+// Make an image using the contents of the image file FILE_NAME, with
+// each texel a tuple of TUPLE_LEN floats.  PARAMS are passed to the
+// image reader.  Only the image header is read immediately.
+//
+TexCache::Image::Image (TexCache &_cache, const std::string &_file_name,
+			unsigned _tuple_len, const ValTable &_params)
+  : width (0), height (0), tuple_len (_tuple_len),
+    cache (_cache), file_name (_file_name), params (_params), slots (0),
+    src_rows_read (0), src_top_down (true)
+{
+  if (tuple_len > MAX_TUPLE_LEN)
+    throw std::runtime_error ("Tuple length too large for texture cache");
+
+  {
+    ImageInput src (file_name, params);
+    const_cast<unsigned &> (width) = src.width;
+    const_cast<unsigned &> (height) = src.height;
+  }
+
+  {
+    LockGuard guard (cache.mutex);
+    id = cache.next_image_id++;
+  }
+
+  unsigned w = width, h = height, num_slots = 0;
+  for (;;)
+    {
+      levels.push_back (Level (w, h, num_slots));
+      num_slots += levels.back ().tiles_x * levels.back ().tiles_y;
+
+      if (w <= 1 && h <= 1)
+	break;
+
+      w = (w + 1) / 2;
+      h = (h + 1) / 2;
+    }
+
+  slots = new Slot[num_slots];
+}
+
+TexCache::Image::~Image ()
+{
+  cache.forget (id);
+  delete[] slots;
+}
+
+// Store the value of this image at UV, using MIP level LEVEL, into the
+// TUPLE_LEN floats pointed to by RESULT.  Values are bilinearly
+// interpolated within a level, and linearly interpolated between the
+// two closest levels if LEVEL is not an integer.  LEVEL is clamped to
+// the range of available levels.
+//
+void
+TexCache::Image::lookup (const UV &uv, float level, float *result) const
+{
+  float max_level = float (levels.size () - 1);
+  if (level <= 0)
+    lookup_level (uv, 0, result);
+  else if (level >= max_level)
+    lookup_level (uv, levels.size () - 1, result);
+  else
+    {
+      unsigned lo_level = unsigned (level);
+      float hi_fr = level - float (lo_level);
+
+      lookup_level (uv, lo_level, result);
+
+      if (hi_fr > 0)
+	{
+	  float hi_result[MAX_TUPLE_LEN];
+	  lookup_level (uv, lo_level + 1, hi_result);
+
+	  for (unsigned i = 0; i < tuple_len; i++)
+	    result[i] += (hi_result[i] - result[i]) * hi_fr;
+	}
+    }
+}
+
+// Store the value of this image at UV in MIP level LEVEL into RESULT,
+// using bilinear interpolation.
+//
+void
+TexCache::Image::lookup_level (const UV &uv, unsigned level, float *result)
+  const
+{
+  unsigned xi_lo, yi_lo, xi_hi, yi_hi;
+  float x_lo_fr, y_lo_fr, x_hi_fr, y_hi_fr;
+  levels[level].interp.calc_params (uv, xi_lo, yi_lo, xi_hi, yi_hi,
+				    x_lo_fr, y_lo_fr, x_hi_fr, y_hi_fr);
+
+  for (unsigned i = 0; i < tuple_len; i++)
+    result[i] = 0;
+
+  // Interpolate between the 4 texels surrounding UV.
+  //
+  add_texel (level, xi_lo, yi_lo, x_lo_fr * y_lo_fr, result);
+  add_texel (level, xi_lo, yi_hi, x_lo_fr * y_hi_fr, result);
+  add_texel (level, xi_hi, yi_lo, x_hi_fr * y_lo_fr, result);
+  add_texel (level, xi_hi, yi_hi, x_hi_fr * y_hi_fr, result);
+}
+
+// Add the texel at X, Y in MIP level LEVEL, scaled by WEIGHT, to
+// RESULT, loading its tile if necessary.
+//
+void
+TexCache::Image::add_texel (unsigned level, unsigned x, unsigned y,
+			    float weight, float *result)
+  const
+{
+  const Level &lev = levels[level];
+
+  unsigned tx = x / TILE_SIZE, ty = y / TILE_SIZE;
+  Slot &slot = slots[lev.slot_base + ty * lev.tiles_x + tx];
+
+  unsigned offs = ((y % TILE_SIZE) * TILE_SIZE + (x % TILE_SIZE)) * tuple_len;
+
+  for (;;)
+    {
+      // Register as a reader before looking at the tile, so that it
+      // won't be deleted while we're using it (see TexCache::remove).
+      //
+      ++slot.readers;
+
+      Tile *tile = slot.tile.load ();
+      if (tile)
+	{
+	  // Only write the flag if it changes, to avoid needlessly
+	  // bouncing its cache line between processors.
+	  //
+	  if (! tile->used.load ())
+	    tile->used.store (true);
+
+	  const float *tex = &tile->data[offs];
+	  for (unsigned i = 0; i < tuple_len; i++)
+	    result[i] += weight * tex[i];
+
+	  cache.release (slot);
+	  return;
+	}
+
+      cache.release (slot);
+
+      // Not cached, so we have to load it.  Some other thread may have
+      // loaded it while we were waiting for LOAD_MUTEX.
+      //
+      LockGuard load_guard (load_mutex);
+      if (! slot.tile.load ())
+	load_tile (level, tx, ty);
+    }
+}
+
+// Return the number of rows, in file order, which come before the first
+// row of tile-row TY of MIP level LEVEL in a source image with HEIGHT
+// rows.  TOP_DOWN is true if the image's rows are read starting from
+// the top.
+//
+static unsigned
+tile_row_start (unsigned ty, unsigned level, unsigned height, bool top_down)
+{
+  unsigned y0 = (ty * TexCache::TILE_SIZE) << level;
+  unsigned y1 = std::min (((ty + 1) * TexCache::TILE_SIZE) << level, height);
+  return top_down ? y0 : height - y1;
+}
+
+// Read the source image to create the tile at TX, TY in MIP level
+// LEVEL, and add it to the cache.  The rest of the same row of tiles is
+// added too, as is any other row of tiles at the same level read along
+// the way if there's room for it.  LOAD_MUTEX must be locked by the
+// caller.
+//
+void
+TexCache::Image::load_tile (unsigned level, unsigned tx, unsigned ty) const
+{
+  const Level &lev = levels[level];
+
+  // If the source image hasn't been opened yet, or we've already read
+  // past the start of the tile-row we want, (re-)open it.
+  //
+  if (!src
+      || src_rows_read > tile_row_start (ty, level, height, src_top_down))
+    {
+      src.reset ();
+      src.reset (new ImageInput (file_name, params));
+      ImageIo::RowIndices row_indices = src->row_indices ();
+      src_top_down = row_indices.first <= row_indices.last;
+      src_rows_read = 0;
+    }
+
+  ImageRow row (width);
+
+  unsigned num_comps = std::min (tuple_len, unsigned (Color::NUM_COMPONENTS));
+
+  // Sums of source pixels for the tile-row currently being read, and
+  // whether we read that tile-row from its start (otherwise it's
+  // incomplete, and can't be used).
+  //
+  std::vector<float> sums (TILE_SIZE * lev.width * tuple_len);
+  int cur_ty = -1;
+  bool cur_complete = false;
+
+  try
+    {
+      while (src_rows_read < height)
+	{
+	  unsigned y
+	    = src_top_down ? src_rows_read : height - 1 - src_rows_read;
+	  unsigned ly = y >> level;	// row in LEVEL
+	  int row_ty = ly / TILE_SIZE;
+
+	  if (row_ty != cur_ty)
+	    {
+	      if (cur_ty >= 0 && cur_complete)
+		{
+		  if (unsigned (cur_ty) == ty)
+		    {
+		      add_tile_row (level, cur_ty, sums, true, tx);
+		      return;
+		    }
+
+		  add_tile_row (level, cur_ty, sums, false);
+		}
+
+	      std::fill (sums.begin (), sums.end (), 0.f);
+	      cur_ty = row_ty;
+	      cur_complete
+		= (src_rows_read
+		   == tile_row_start (row_ty, level, height, src_top_down));
+	    }
+
+	  src->read_row (row);
+	  src_rows_read++;
+
+	  float *sum_row = &sums[(ly % TILE_SIZE) * lev.width * tuple_len];
+	  for (unsigned x = 0; x < width; x++)
+	    {
+	      const Color &col = row[x].color;
+	      float *sum = sum_row + (x >> level) * tuple_len;
+	      for (unsigned k = 0; k < num_comps; k++)
+		sum[k] += col[k];
+	    }
+	}
+    }
+  catch (...)
+    {
+      // We don't know what state the source image is in, so start
+      // again next time.
+      //
+      src.reset ();
+      throw;
+    }
+
+  // We've read the whole source image, so close it.
+  //
+  src.reset ();
+
+  if (cur_ty >= 0 && cur_complete)
+    add_tile_row (level, cur_ty, sums, unsigned (cur_ty) == ty, tx);
+}
+
+// Divide SUMS, which holds sums of source pixels for tile-row TY of MIP
+// level LEVEL, into tiles, and add them to the cache.  If REQUIRED is
+// true, old tiles are evicted to make room if necessary, and the tile
+// at column LAST_TX is added last (so it will not be evicted by the
+// others); otherwise tiles are only added if there's room.
+//
+void
+TexCache::Image::add_tile_row (unsigned level, unsigned ty,
+			       const std::vector<float> &sums,
+			       bool required, unsigned last_tx)
+  const
+{
+  const Level &lev = levels[level];
+
+  unsigned row_y0 = ty * TILE_SIZE;
+  unsigned rows = std::min (TILE_SIZE, lev.height - row_y0);
+
+  for (unsigned i = 1; i <= lev.tiles_x; i++)
+    {
+      unsigned tx = (last_tx + i) % lev.tiles_x;
+
+      unsigned tile_x0 = tx * TILE_SIZE;
+      unsigned cols = std::min (TILE_SIZE, lev.width - tile_x0);
+
+      std::vector<float> data (TILE_SIZE * rows * tuple_len, 0.f);
+
+      for (unsigned r = 0; r < rows; r++)
+	{
+	  // Each texel is the average of the source pixels it covers,
+	  // which may be fewer than usual at the image edges.
+	  //
+	  unsigned src_y = (row_y0 + r) << level;
+	  unsigned src_h = std::min (src_y + (1 << level), height) - src_y;
+
+	  for (unsigned c = 0; c < cols; c++)
+	    {
+	      unsigned src_x = (tile_x0 + c) << level;
+	      unsigned src_w = std::min (src_x + (1 << level), width) - src_x;
+	      float inv_area = 1 / float (src_w * src_h);
+
+	      const float *sum
+		= &sums[(r * lev.width + tile_x0 + c) * tuple_len];
+	      float *tex = &data[(r * TILE_SIZE + c) * tuple_len];
+
+	      for (unsigned k = 0; k < tuple_len; k++)
+		tex[k] = sum[k] * inv_area;
+	    }
+	}
+
+      LockGuard guard (cache.mutex);
+      cache.add (slots[lev.slot_base + ty * lev.tiles_x + tx], id, data,
+		 required);
+    }
+}
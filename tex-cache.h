@@ -0,0 +1,294 @@
+// tex-cache.h -- Cache of mipmapped image-texture tiles
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef __TEX_CACHE_H__
+#define __TEX_CACHE_H__
+
+#include <string>
+#include <vector>
+
+#include "ref.h"
+#include "uv.h"
+#include "val-table.h"
+#include "mutex.h"
+#include "cond-var.h"
+#include "atomic.h"
+#include "unique-ptr.h"
+#include "image-input.h"
+#include "matrix-linterp.h"
+
+
+namespace snogray {
+
+
+// A cache of image-texture data, shared by all rendering threads.
+//
+// Instead of holding each texture image entirely in memory, images are
+// divided into a MIP pyramid of fixed-size tiles, which are created on
+// demand by reading the source image file, and discarded when the
+// total size of all cached tiles exceeds a limit.  Only the parts of an
+// image which are actually looked up (at the resolution they are looked
+// up at) occupy memory.
+//
+// MIP level 0 is the image at full resolution, and each further level
+// is half the size of the previous one (in both dimensions), down to a
+// single texel.  Texels in coarser levels are box-filtered averages of
+// the corresponding level-0 texels.
+//
+// Looking up texels in tiles which are already cached doesn't use any
+// locks:  each possible tile has a "slot" holding an atomic pointer to
+// it, and a count of threads currently reading it, which is used to
+// make sure a tile is not deleted while being read.  Only adding and
+// removing tiles needs the cache's mutex.  Tiles to discard are chosen
+// using the "clock" approximation to least-recently-used order, which
+// only needs a flag to be set when a tile is used.
+//
+class TexCache
+{
+public:
+
+  class Image;
+
+  // The width and height of a tile, in texels.
+  //
+  static const unsigned TILE_SIZE = 64;
+
+  TexCache ()
+    : max_bytes (0), cur_bytes (0), clock_hand (0), next_image_id (1)
+  { }
+  ~TexCache ();
+
+  // Set the maximum amount of memory used for cached tiles to
+  // MAX_BYTES; zero means that the cache is disabled.
+  //
+  void set_max_size (unsigned long max_bytes);
+
+  // Return true if the cache is enabled.
+  //
+  bool enabled () const { return max_bytes != 0; }
+
+  // Return the total size, in bytes, of all tiles currently cached.
+  //
+  unsigned long size () const { return cur_bytes; }
+
+private:
+
+  friend class Image;
+
+  struct Tile;
+
+  // The place where a single tile of an image is found, if it is
+  // cached.
+  //
+  struct Slot
+  {
+    Slot () : tile (0), readers (0) { }
+
+    // The tile, or zero if it's not cached.
+    //
+    Atomic<Tile *> tile;
+
+    // The number of threads currently reading TILE.  A tile is only
+    // deleted after setting TILE to zero and waiting for this to
+    // become zero.
+    //
+    Atomic<unsigned> readers;
+  };
+
+  // Stop reading the tile in SLOT (which must have been registered by
+  // incrementing SLOT.readers), waking up TexCache::remove if it's
+  // waiting for us.
+  //
+  void release (Slot &slot);
+
+  // Add a tile for SLOT, which belongs to the image with id IMAGE_ID,
+  // with contents DATA (which is swapped out of DATA) to the cache,
+  // evicting old tiles if necessary.  If REQUIRED is false, the tile
+  // is only added if that can be done without evicting anything.
+  // MUTEX must be locked by the caller.
+  //
+  void add (Slot &slot, unsigned image_id, std::vector<float> &data,
+	    bool required);
+
+  // Remove all tiles belonging to the image with id IMAGE_ID.
+  //
+  void forget (unsigned image_id);
+
+  // Discard tiles until the cache fits in MAX_BYTES, but never discard
+  // KEEP.  Recently used tiles are discarded last.  MUTEX must be
+  // locked by the caller.
+  //
+  void evict (const Tile *keep = 0);
+
+  // Remove the tile at index INDEX in TILES from the cache, and delete
+  // it.  MUTEX must be locked by the caller.
+  //
+  void remove (unsigned index);
+
+  unsigned long max_bytes, cur_bytes;
+
+  // All cached tiles, in no particular order, and the index in TILES
+  // of the next tile to be considered for eviction.
+  //
+  std::vector<Tile *> tiles;
+  unsigned clock_hand;
+
+  unsigned next_image_id;
+
+  // Protects all of the above.
+  //
+  Mutex mutex;
+
+  // Used by TexCache::remove to wait for the readers of a tile to
+  // finish.  This uses a separate mutex, so that MUTEX stays locked
+  // while waiting.
+  //
+  Mutex readers_mutex;
+  CondVar readers_done;
+};
+
+
+// The global texture cache.
+//
+extern TexCache tex_cache;
+
+
+// An image whose contents are fetched through a TexCache.
+//
+class TexCache::Image : public RefCounted
+{
+public:
+
+  // Make an image using the contents of the image file FILE_NAME, with
+  // each texel a tuple of TUPLE_LEN floats.  PARAMS are passed to the
+  // image reader.  Only the image header is read immediately.
+  //
+  Image (TexCache &cache, const std::string &file_name, unsigned tuple_len,
+	 const ValTable &params = ValTable::NONE);
+  ~Image ();
+
+  // Store the value of this image at UV, using MIP level LEVEL, into
+  // the TUPLE_LEN floats pointed to by RESULT.  Values are bilinearly
+  // interpolated within a level, and linearly interpolated between the
+  // two closest levels if LEVEL is not an integer.  LEVEL is clamped
+  // to the range of available levels.
+  //
+  void lookup (const UV &uv, float level, float *result) const;
+
+  // Return the number of MIP levels in this image.
+  //
+  unsigned num_levels () const { return levels.size (); }
+
+  // The size of the full-resolution image.
+  //
+  const unsigned width, height;
+
+  // Number of floats in each texel.
+  //
+  const unsigned tuple_len;
+
+  // The largest supported value of TUPLE_LEN.
+  //
+  static const unsigned MAX_TUPLE_LEN = 4;
+
+private:
+
+  // Information about a single MIP level.
+  //
+  struct Level
+  {
+    Level (unsigned _width, unsigned _height, unsigned _slot_base)
+      : width (_width), height (_height), interp (_width, _height),
+	tiles_x ((_width + TILE_SIZE - 1) / TILE_SIZE),
+	tiles_y ((_height + TILE_SIZE - 1) / TILE_SIZE),
+	slot_base (_slot_base)
+    { }
+
+    unsigned width, height;
+    MatrixLinterp interp;
+
+    // Number of tiles in each row and column of tiles.
+    //
+    unsigned tiles_x, tiles_y;
+
+    // Index in Image::slots of the slot for this level's first tile.
+    //
+    unsigned slot_base;
+  };
+
+  // Store the value of this image at UV in MIP level LEVEL into
+  // RESULT, using bilinear interpolation.
+  //
+  void lookup_level (const UV &uv, unsigned level, float *result) const;
+
+  // Add the texel at X, Y in MIP level LEVEL, scaled by WEIGHT, to
+  // RESULT, loading its tile if necessary.
+  //
+  void add_texel (unsigned level, unsigned x, unsigned y, float weight,
+		  float *result)
+    const;
+
+  // Read the source image to create the tile at TX, TY in MIP level
+  // LEVEL, and add it to the cache.  The rest of the same row of tiles
+  // is added too, as is any other row of tiles at the same level read
+  // along the way if there's room for it.  LOAD_MUTEX must be locked
+  // by the caller.
+  //
+  void load_tile (unsigned level, unsigned tx, unsigned ty) const;
+
+  // Divide SUMS, which holds sums of source pixels for tile-row TY of
+  // MIP level LEVEL, into tiles, and add them to the cache.  If
+  // REQUIRED is true, old tiles are evicted to make room if necessary,
+  // and the tile at column LAST_TX is added last (so it will not be
+  // evicted by the others); otherwise tiles are only added if there's
+  // room.
+  //
+  void add_tile_row (unsigned level, unsigned ty,
+		     const std::vector<float> &sums,
+		     bool required, unsigned last_tx = 0)
+    const;
+
+  TexCache &cache;
+
+  std::string file_name;
+  ValTable params;
+
+  unsigned id;
+
+  std::vector<Level> levels;
+
+  // The slot for every tile in every level.
+  //
+  Slot *slots;
+
+  // The source image, if it's currently open, and the number of rows
+  // which have been read from it.  The source image is left open
+  // between calls to Image::load_tile, so that tiles further on in the
+  // image can be loaded without reading the whole image again.  If
+  // SRC_TOP_DOWN is true, the source image's rows are read from the
+  // top, otherwise they are read from the bottom.
+  //
+  mutable UniquePtr<ImageInput> src;
+  mutable unsigned src_rows_read;
+  mutable bool src_top_down;
+
+  // Serializes reading of the source file, so that different threads
+  // which want the same missing tiles don't all read it.  It also
+  // protects SRC and associated fields.
+  //
+  mutable Mutex load_mutex;
+};
+
+
+}
+
+#endif // __TEX_CACHE_H__
@@ -20,16 +20,34 @@
 namespace snogray {
 
 
+// Coordinates for evaluating a texture.
+//
+// Besides a single point, a TexCoords object can optionally describe
+// the approximate size of the area around that point which the lookup
+// represents (its "footprint"), which textures may use to filter their
+// result.  A width of zero means a point sample.
+//
 class TexCoords
 {
 public:
 
-  TexCoords (const Pos &_pos, const UV &_uv)
-    : pos (_pos), uv (_uv)
+  TexCoords (const Pos &_pos, const UV &_uv,
+	     dist_t _pos_width = 0, float _uv_width = 0)
+    : pos (_pos), uv (_uv), pos_width (_pos_width), uv_width (_uv_width)
   { }
 
+  // Make an uninitialized TexCoords object (for use in arrays).
+  //
+  TexCoords () { }
+
   Pos pos;
   UV uv;
+
+  // The approximate width of the footprint, in the coordinate systems
+  // of POS and UV respectively.
+  //
+  dist_t pos_width;
+  float uv_width;
 };
 
 
@@ -0,0 +1,593 @@
+// tex-program.cc -- Flattened texture programs
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#include <map>
+#include <algorithm>
+
+#include "arith-tex.h"
+#include "cmp-tex.h"
+#include "interp-tex.h"
+#include "xform-tex.h"
+#include "perturb-tex.h"
+#include "misc-map-tex.h"
+#include "intens-tex.h"
+#include "grey-tex.h"
+
+#include "tex-program.h"
+
+
+using namespace snogray;
+
+
+
+// TexProgram::run
+
+// Run this program with coordinates COORDS, using FREGS, CREGS, and
+// XREGS as register files.
+//
+void
+TexProgram::run (const TexCoords &coords,
+		 float *fregs, Color *cregs, TexCoords *xregs)
+  const
+{
+  std::copy (fregs_init.begin (), fregs_init.end (), fregs);
+  std::copy (cregs_init.begin (), cregs_init.end (), cregs);
+
+  xregs[0] = coords;
+
+  const Insn *start = &code[0], *end = start + code.size ();
+
+  for (const Insn *ip = start; ip != end; ++ip)
+    switch (ip->opcode)
+      {
+      case F_CALL:
+	fregs[ip->dst] = ip->ptr.ftex->eval (xregs[ip->a]);
+	break;
+      case C_CALL:
+	cregs[ip->dst] = ip->ptr.ctex->eval (xregs[ip->a]);
+	break;
+
+      case F_ARITH:
+	fregs[ip->dst]
+	  = ArithTex<float>::apply (ArithTex<float>::Op (ip->sub),
+				    fregs[ip->a], fregs[ip->b]);
+	break;
+      case C_ARITH:
+	cregs[ip->dst]
+	  = ArithTex<Color>::apply (ArithTex<Color>::Op (ip->sub),
+				    cregs[ip->a], cregs[ip->b]);
+	break;
+
+      case F_LINTERP:
+	fregs[ip->dst] = linterp (fregs[ip->a], fregs[ip->b], fregs[ip->c]);
+	break;
+      case C_LINTERP:
+	cregs[ip->dst] = linterp (fregs[ip->a], cregs[ip->b], cregs[ip->c]);
+	break;
+      case F_SINTERP:
+	fregs[ip->dst] = sinterp (fregs[ip->a], fregs[ip->b], fregs[ip->c]);
+	break;
+      case C_SINTERP:
+	cregs[ip->dst] = sinterp (fregs[ip->a], cregs[ip->b], cregs[ip->c]);
+	break;
+
+      case F_MOVE:
+	fregs[ip->dst] = fregs[ip->a];
+	break;
+      case C_MOVE:
+	cregs[ip->dst] = cregs[ip->a];
+	break;
+
+      case F_JUMP_UNLESS:
+	if (! CmpTex<float>::compare (CmpTex<float>::Op (ip->sub),
+				      fregs[ip->a], fregs[ip->b]))
+	  ip = start + ip->dst - 1;
+	break;
+      case C_JUMP_UNLESS:
+	if (! CmpTex<Color>::compare (CmpTex<Color>::Op (ip->sub),
+				      fregs[ip->a], fregs[ip->b]))
+	  ip = start + ip->dst - 1;
+	break;
+      case JUMP:
+	ip = start + ip->dst - 1;
+	break;
+
+      case INTENS:
+	fregs[ip->dst] = cregs[ip->a].intensity ();
+	break;
+      case GREY:
+	cregs[ip->dst] = fregs[ip->a];
+	break;
+
+      case X_F_XFORM:
+	xregs[ip->dst] = ip->ptr.fxform->map (xregs[ip->a]);
+	break;
+      case X_C_XFORM:
+	xregs[ip->dst] = ip->ptr.cxform->map (xregs[ip->a]);
+	break;
+
+      case X_PERTURB_POS:
+	{
+	  const TexCoords &x = xregs[ip->a];
+	  Vec offs (fregs[ip->b], fregs[ip->c], fregs[ip->d]);
+	  xregs[ip->dst]
+	    = TexCoords (x.pos + offs, x.uv, x.pos_width, x.uv_width);
+	}
+	break;
+      case X_PERTURB_UV:
+	{
+	  const TexCoords &x = xregs[ip->a];
+	  UV offs (fregs[ip->b], fregs[ip->c]);
+	  xregs[ip->dst]
+	    = TexCoords (x.pos, x.uv + offs, x.pos_width, x.uv_width);
+	}
+	break;
+      case X_PLANE_MAP:
+	{
+	  const TexCoords &x = xregs[ip->a];
+	  xregs[ip->dst] = TexCoords (x.pos, UV (x.pos.x, x.pos.y),
+				      x.pos_width, x.pos_width);
+	}
+	break;
+      }
+}
+
+
+
+// TexCompiler
+
+namespace snogray {
+
+// Compiler for turning a texture tree into a TexProgram.
+//
+class TexCompiler
+{
+public:
+
+  TexCompiler (TexProgram &_prog) : failed (false), prog (_prog), num_xregs (1)
+  { }
+
+  // Emit code to evaluate VAL at coordinates in coordinate register X,
+  // and return the register containing the result.
+  //
+  template<typename T>
+  unsigned compile (const TexVal<T> &val, unsigned x)
+  {
+    if (val.tex)
+      return compile (&*val.tex, x);
+    else
+      return constant (val.default_val);
+  }
+
+  // Return true if register REG of type T holds a constant.
+  //
+  template<typename T>
+  bool is_const (unsigned reg) const
+  {
+    return const_regs (static_cast<T *> (0)).count (reg) != 0;
+  }
+
+  // Return the value of the constant register REG of type T.
+  //
+  template<typename T>
+  const T &const_val (unsigned reg) const
+  {
+    return init_regs (static_cast<T *> (0))[reg];
+  }
+
+  // True if the compiled program wouldn't fit into the program's
+  // register-files.
+  //
+  bool failed;
+
+private:
+
+  // Key used to find duplicate computations.
+  //
+  struct Key
+  {
+    Key (const TexProgram::Insn &insn)
+      : opcode (insn.opcode), sub (insn.sub),
+	a (insn.a), b (insn.b), c (insn.c), d (insn.d), node (insn.ptr.node)
+    { }
+
+    bool operator< (const Key &key) const
+    {
+      if (opcode != key.opcode) return opcode < key.opcode;
+      if (sub != key.sub) return sub < key.sub;
+      if (a != key.a) return a < key.a;
+      if (b != key.b) return b < key.b;
+      if (c != key.c) return c < key.c;
+      if (d != key.d) return d < key.d;
+      return node < key.node;
+    }
+
+    unsigned opcode, sub, a, b, c, d;
+    const void *node;
+  };
+
+  typedef std::map<Key, unsigned> KeyMap;
+
+  template<typename T>
+  unsigned compile (const Tex<T> *tex, unsigned x);
+
+  unsigned compile_other (const Tex<float> *tex, unsigned x);
+  unsigned compile_other (const Tex<Color> *tex, unsigned x);
+
+  // Emit code to evaluate CMP_TEX at coordinates X.
+  //
+  template<typename T>
+  unsigned compile_cmp (const CmpTex<T> *cmp_tex, unsigned x);
+
+  // Return a register of type T holding the constant VAL.
+  //
+  template<typename T>
+  unsigned constant (const T &val)
+  {
+    std::vector<T> &regs = init_regs (static_cast<T *> (0));
+    std::map<unsigned, bool> &consts = const_regs (static_cast<T *> (0));
+
+    for (std::map<unsigned, bool>::iterator ci = consts.begin ();
+	 ci != consts.end (); ++ci)
+      if (regs[ci->first] == val)
+	return ci->first;
+
+    unsigned reg = new_reg<T> (val);
+    consts[reg] = true;
+    return reg;
+  }
+
+  // Return a new register of type T, initialized to INIT_VAL.
+  //
+  template<typename T>
+  unsigned new_reg (const T &init_val = T (0))
+  {
+    std::vector<T> &regs = init_regs (static_cast<T *> (0));
+    if (regs.size () >= max_regs (static_cast<T *> (0)))
+      {
+	failed = true;
+	return 0;
+      }
+    regs.push_back (init_val);
+    return regs.size () - 1;
+  }
+
+  // Return a new coordinate register.
+  //
+  unsigned new_xreg ()
+  {
+    if (num_xregs >= TexProgram::MAX_XREGS)
+      {
+	failed = true;
+	return 0;
+      }
+    return num_xregs++;
+  }
+
+  // Return the variant of the float opcode F_OPCODE for type T.
+  //
+  template<typename T>
+  static unsigned typed (unsigned f_opcode)
+  {
+    return f_opcode + op_offs (static_cast<T *> (0));
+  }
+
+  // Add INSN, whose result has type T, to the program, and return the
+  // register holding its result.  If an identical instruction has
+  // already been emitted, and its result is still valid, no code is
+  // emitted, and the previous result register is returned.
+  //
+  template<typename T>
+  unsigned emit (TexProgram::Insn insn)
+  {
+    KeyMap::iterator prev = values.find (Key (insn));
+    if (prev != values.end ())
+      return prev->second;
+
+    insn.dst = new_reg<T> ();
+    prog.code.push_back (insn);
+    values.insert (std::make_pair (Key (insn), insn.dst));
+
+    return insn.dst;
+  }
+
+  // Like emit, but for instructions resulting in a coordinate register.
+  //
+  unsigned emit_x (TexProgram::Insn insn)
+  {
+    KeyMap::iterator prev = values.find (Key (insn));
+    if (prev != values.end ())
+      return prev->second;
+
+    insn.dst = new_xreg ();
+    prog.code.push_back (insn);
+    values.insert (std::make_pair (Key (insn), insn.dst));
+
+    return insn.dst;
+  }
+
+  // Accessors for per-type state.
+  //
+  std::vector<float> &init_regs (float *) { return prog.fregs_init; }
+  std::vector<Color> &init_regs (Color *) { return prog.cregs_init; }
+  const std::vector<float> &init_regs (float *) const
+  { return prog.fregs_init; }
+  const std::vector<Color> &init_regs (Color *) const
+  { return prog.cregs_init; }
+  std::map<unsigned, bool> &const_regs (float *) { return fconsts; }
+  std::map<unsigned, bool> &const_regs (Color *) { return cconsts; }
+  const std::map<unsigned, bool> &const_regs (float *) const
+  { return fconsts; }
+  const std::map<unsigned, bool> &const_regs (Color *) const
+  { return cconsts; }
+  static unsigned max_regs (float *) { return TexProgram::MAX_FREGS; }
+  static unsigned max_regs (Color *) { return TexProgram::MAX_CREGS; }
+  static unsigned op_offs (float *) { return 0; }
+  static unsigned op_offs (Color *) { return 1; }
+
+  TexProgram &prog;
+
+  unsigned num_xregs;
+
+  // Sets of float and Color registers holding constants.
+  //
+  std::map<unsigned, bool> fconsts, cconsts;
+
+  // Previously computed values which may be reused.
+  //
+  KeyMap values;
+};
+
+}
+
+
+// Emit code to evaluate TEX at coordinates in coordinate register X,
+// and return the register containing the result.
+//
+template<typename T>
+unsigned
+TexCompiler::compile (const Tex<T> *tex, unsigned x)
+{
+  typedef TexProgram::Insn Insn;
+
+  if (const ArithTex<T> *arith = dynamic_cast<const ArithTex<T> *> (tex))
+    {
+      unsigned a = compile (arith->arg1, x);
+      unsigned b = compile (arith->arg2, x);
+
+      if (is_const<T> (a) && is_const<T> (b))
+	return constant (ArithTex<T>::apply (arith->op,
+					     const_val<T> (a),
+					     const_val<T> (b)));
+
+      return emit<T> (Insn (typed<T> (TexProgram::F_ARITH), arith->op, 0, a, b));
+    }
+
+  if (const CmpTex<T> *cmp = dynamic_cast<const CmpTex<T> *> (tex))
+    return compile_cmp (cmp, x);
+
+  if (const LinterpTex<T> *interp = dynamic_cast<const LinterpTex<T> *> (tex))
+    {
+      unsigned c = compile (interp->control, x);
+      unsigned v1 = compile (interp->val1, x);
+      unsigned v2 = compile (interp->val2, x);
+
+      if (is_const<float> (c) && is_const<T> (v1) && is_const<T> (v2))
+	return constant (linterp (const_val<float> (c),
+				  const_val<T> (v1), const_val<T> (v2)));
+
+      return emit<T> (Insn (typed<T> (TexProgram::F_LINTERP), 0, 0, c, v1, v2));
+    }
+
+  if (const SinterpTex<T> *interp = dynamic_cast<const SinterpTex<T> *> (tex))
+    {
+      unsigned c = compile (interp->control, x);
+      unsigned v1 = compile (interp->val1, x);
+      unsigned v2 = compile (interp->val2, x);
+
+      if (is_const<float> (c) && is_const<T> (v1) && is_const<T> (v2))
+	return constant (sinterp (const_val<float> (c),
+				  const_val<T> (v1), const_val<T> (v2)));
+
+      return emit<T> (Insn (typed<T> (TexProgram::F_SINTERP), 0, 0, c, v1, v2));
+    }
+
+  if (const XformTex<T> *xform = dynamic_cast<const XformTex<T> *> (tex))
+    {
+      Insn insn (typed<T> (TexProgram::X_F_XFORM), 0, 0, x);
+      insn.ptr.node = xform;
+      return compile (xform->tex, emit_x (insn));
+    }
+
+  if (const PerturbPosTex<T> *perturb
+      = dynamic_cast<const PerturbPosTex<T> *> (tex))
+    {
+      unsigned dx = compile (perturb->x, x);
+      unsigned dy = compile (perturb->y, x);
+      unsigned dz = compile (perturb->z, x);
+
+      if (is_const<float> (dx) && is_const<float> (dy) && is_const<float> (dz)
+	  && const_val<float> (dx) == 0 && const_val<float> (dy) == 0
+	  && const_val<float> (dz) == 0)
+	return compile (perturb->source, x);
+
+      Insn insn (TexProgram::X_PERTURB_POS, 0, 0, x, dx, dy, dz);
+      return compile (perturb->source, emit_x (insn));
+    }
+
+  if (const PerturbUvTex<T> *perturb
+      = dynamic_cast<const PerturbUvTex<T> *> (tex))
+    {
+      unsigned du = compile (perturb->u, x);
+      unsigned dv = compile (perturb->v, x);
+
+      if (is_const<float> (du) && is_const<float> (dv)
+	  && const_val<float> (du) == 0 && const_val<float> (dv) == 0)
+	return compile (perturb->source, x);
+
+      Insn insn (TexProgram::X_PERTURB_UV, 0, 0, x, du, dv);
+      return compile (perturb->source, emit_x (insn));
+    }
+
+  if (const PlaneMapTex<T> *map = dynamic_cast<const PlaneMapTex<T> *> (tex))
+    {
+      Insn insn (TexProgram::X_PLANE_MAP, 0, 0, x);
+      return compile (&*map->tex, emit_x (insn));
+    }
+
+  return compile_other (tex, x);
+}
+
+// Emit code to evaluate the float texture TEX, which is not handled
+// by the generic TexCompiler::compile method, at coordinates X.
+//
+unsigned
+TexCompiler::compile_other (const Tex<float> *tex, unsigned x)
+{
+  typedef TexProgram::Insn Insn;
+
+  if (const IntensTex *intens = dynamic_cast<const IntensTex *> (tex))
+    {
+      unsigned c = compile (intens->val, x);
+      if (is_const<Color> (c))
+	return constant (const_val<Color> (c).intensity ());
+      return emit<float> (Insn (TexProgram::INTENS, 0, 0, c));
+    }
+
+  Insn insn (TexProgram::F_CALL, 0, 0, x);
+  insn.ptr.node = tex;
+  return emit<float> (insn);
+}
+
+// Emit code to evaluate the Color texture TEX, which is not handled
+// by the generic TexCompiler::compile method, at coordinates X.
+//
+unsigned
+TexCompiler::compile_other (const Tex<Color> *tex, unsigned x)
+{
+  typedef TexProgram::Insn Insn;
+
+  if (const GreyTex *grey = dynamic_cast<const GreyTex *> (tex))
+    {
+      unsigned f = compile (grey->val, x);
+      if (is_const<float> (f))
+	return constant (Color (const_val<float> (f)));
+
+      return emit<Color> (Insn (TexProgram::GREY, 0, 0, f));
+    }
+
+  Insn insn (TexProgram::C_CALL, 0, 0, x);
+  insn.ptr.node = tex;
+  return emit<Color> (insn);
+}
+
+// Emit code to evaluate CMP_TEX at coordinates X.
+//
+template<typename T>
+unsigned
+TexCompiler::compile_cmp (const CmpTex<T> *cmp_tex, unsigned x)
+{
+  typedef TexProgram::Insn Insn;
+
+  unsigned c1 = compile (cmp_tex->cval1, x);
+  unsigned c2 = compile (cmp_tex->cval2, x);
+
+  // If the comparison is constant, just compile the chosen branch.
+  //
+  if (is_const<float> (c1) && is_const<float> (c2))
+    return compile (CmpTex<T>::compare (cmp_tex->op,
+					T (const_val<float> (c1)),
+					T (const_val<float> (c2)))
+		    ? cmp_tex->rval1 : cmp_tex->rval2,
+		    x);
+
+  unsigned result = new_reg<T> ();
+
+  unsigned branch_pc = prog.code.size ();
+  prog.code.push_back (Insn (typed<T> (TexProgram::F_JUMP_UNLESS),
+			     cmp_tex->op, 0, c1, c2));
+
+  // Values computed inside a branch can't be used after it, as the
+  // branch may not have been executed, so save the set of known values
+  // before each branch, and restore it afterwards.
+  //
+  KeyMap saved_values = values;
+
+  unsigned r1 = compile (cmp_tex->rval1, x);
+  prog.code.push_back (Insn (typed<T> (TexProgram::F_MOVE), 0, result, r1));
+
+  unsigned jump_pc = prog.code.size ();
+  prog.code.push_back (Insn (TexProgram::JUMP));
+
+  values = saved_values;
+  prog.code[branch_pc].dst = prog.code.size ();
+
+  unsigned r2 = compile (cmp_tex->rval2, x);
+  prog.code.push_back (Insn (typed<T> (TexProgram::F_MOVE), 0, result, r2));
+
+  values = saved_values;
+  prog.code[jump_pc].dst = prog.code.size ();
+
+  return result;
+}
+
+
+
+// compile_tex
+
+// Return a texture-value equivalent to VAL, compiled if that's
+// worthwhile.
+//
+template<typename T>
+static TexVal<T>
+compile_tex_val (const TexVal<T> &val)
+{
+  if (! val.tex)
+    return val;
+
+  Ref<ProgramTex<T> > prog_tex = new ProgramTex<T> (val.tex);
+  TexProgram &prog = prog_tex->prog;
+  TexCompiler compiler (prog);
+
+  prog.result = compiler.compile (val, 0);
+
+  if (compiler.failed || prog.code.size () > 0xFFFF)
+    return val;
+
+  // If the whole tree turned out to be constant, just use that value.
+  //
+  if (compiler.is_const<T> (prog.result))
+    return TexVal<T> (compiler.const_val<T> (prog.result));
+
+  // If the program consists of nothing but a single call to an
+  // unknown texture, it's better to just use that texture directly.
+  //
+  if (prog.code.size () == 1
+      && (prog.code[0].opcode == TexProgram::F_CALL
+	  || prog.code[0].opcode == TexProgram::C_CALL))
+    return val;
+
+  Ref<Tex<T> > tex = &*prog_tex;
+  return TexVal<T> (tex);
+}
+
+TexVal<float>
+snogray::compile_tex (const TexVal<float> &val)
+{
+  return compile_tex_val (val);
+}
+
+TexVal<Color>
+snogray::compile_tex (const TexVal<Color> &val)
+{
+  return compile_tex_val (val);
+}
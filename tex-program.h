@@ -0,0 +1,187 @@
+// tex-program.h -- Flattened texture programs
+//
+//  Copyright (C) 2011  Miles Bader <miles@gnu.org>
+//
+// This source code is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 3, or (at
+// your option) any later version.  See the file COPYING for more details.
+//
+// Written by Miles Bader <miles@gnu.org>
+//
+
+#ifndef __TEX_PROGRAM_H__
+#define __TEX_PROGRAM_H__
+
+#include <vector>
+
+#include "color.h"
+#include "tex.h"
+
+
+namespace snogray {
+
+
+template<typename T>
+class XformTex;
+
+
+// A texture expression tree "compiled" into a flat sequence of
+// instructions operating on a small set of registers.
+//
+// There are three register files: float values, Color values, and
+// texture coordinates.  Coordinate register 0 holds the coordinates the
+// program is evaluated at.  Registers holding constants are initialized
+// before the program is run; every other register is written exactly
+// once along any path through the program.
+//
+// Texture types the compiler doesn't know about are evaluated by
+// calling their normal Tex::eval method from a "call" instruction.
+//
+class TexProgram
+{
+public:
+
+  // Register-file sizes.  Texture trees needing more registers than
+  // this are not compiled.
+  //
+  static const unsigned MAX_FREGS = 32;
+  static const unsigned MAX_CREGS = 32;
+  static const unsigned MAX_XREGS = 8;
+
+  // Instruction opcodes.  Each float ("F_") opcode is immediately
+  // followed by the corresponding Color ("C_") opcode.
+  //
+  enum Opcode
+  {
+    F_CALL, C_CALL,		// DST = TEX->eval (X[A])
+    F_ARITH, C_ARITH,		// DST = ArithTex::apply (SUB, A, B)
+    F_LINTERP, C_LINTERP,	// DST = linterp (F[A], B, C)
+    F_SINTERP, C_SINTERP,	// DST = sinterp (F[A], B, C)
+    F_MOVE, C_MOVE,		// DST = A
+    F_JUMP_UNLESS, C_JUMP_UNLESS, // unless CmpTex::compare (SUB, F[A], F[B])
+				  //   goto DST
+    JUMP,			// goto DST
+    INTENS,			// F[DST] = C[A].intensity ()
+    GREY,			// C[DST] = F[A]
+    X_F_XFORM, X_C_XFORM,	// X[DST] = XFORM->map (X[A])
+    X_PERTURB_POS,		// X[DST] = X[A] with pos += (F[B], F[C], F[D])
+    X_PERTURB_UV,		// X[DST] = X[A] with uv += (F[B], F[C])
+    X_PLANE_MAP			// X[DST] = X[A] with uv = pos.x, pos.y
+  };
+
+  struct Insn
+  {
+    Insn (unsigned _opcode = JUMP, unsigned _sub = 0, unsigned _dst = 0,
+	  unsigned _a = 0, unsigned _b = 0, unsigned _c = 0, unsigned _d = 0)
+      : opcode (_opcode), sub (_sub), dst (_dst), a (_a), b (_b), c (_c),
+	d (_d)
+    {
+      ptr.node = 0;
+    }
+
+    unsigned char opcode, sub;
+    unsigned short dst, a, b, c, d;
+
+    // Texture node used by "call" and "xform" instructions.
+    //
+    union {
+      const void *node;
+      const Tex<float> *ftex;
+      const Tex<Color> *ctex;
+      const XformTex<float> *fxform;
+      const XformTex<Color> *cxform;
+    } ptr;
+  };
+
+  // Run this program with coordinates COORDS, using FREGS, CREGS, and
+  // XREGS as register files.
+  //
+  void run (const TexCoords &coords,
+	    float *fregs, Color *cregs, TexCoords *xregs)
+    const;
+
+  std::vector<Insn> code;
+
+  // Initial contents of the float and Color registers; these hold
+  // the values of constant registers, and their sizes are the number
+  // of registers used.
+  //
+  std::vector<float> fregs_init;
+  std::vector<Color> cregs_init;
+
+  // Register holding the program's result, in the register file
+  // corresponding to its type.
+  //
+  unsigned result;
+};
+
+
+// A texture which evaluates a TexProgram.
+//
+template<typename T>
+class ProgramTex : public Tex<T>
+{
+public:
+
+  ProgramTex (const Ref<const Tex<T> > &_source) : source (_source) { }
+
+  // Evaluate this texture at TEX_COORDS.
+  //
+  virtual T eval (const TexCoords &tex_coords) const
+  {
+    float fregs[TexProgram::MAX_FREGS];
+    Color cregs[TexProgram::MAX_CREGS];
+    TexCoords xregs[TexProgram::MAX_XREGS];
+
+    prog.run (tex_coords, fregs, cregs, xregs);
+
+    return result (fregs, cregs, static_cast<T *> (0));
+  }
+
+  // Evaluate this texture at each of the NUM coordinates in TEX_COORDS,
+  // storing the results into RESULTS.
+  //
+  virtual void eval_batch (const TexCoords *tex_coords, T *results,
+			   unsigned num)
+    const
+  {
+    for (unsigned i = 0; i < num; i++)
+      results[i] = ProgramTex::eval (tex_coords[i]);
+  }
+
+  TexProgram prog;
+
+private:
+
+  // Return the program's result from the appropriate register file.
+  //
+  float result (const float *fregs, const Color *, float *) const
+  {
+    return fregs[prog.result];
+  }
+  Color result (const float *, const Color *cregs, Color *) const
+  {
+    return cregs[prog.result];
+  }
+
+  // The texture tree PROG was compiled from.  The program refers to
+  // nodes in this tree, so we keep a reference to it.
+  //
+  Ref<const Tex<T> > source;
+};
+
+
+// Return a texture-value equivalent to VAL, but which can be evaluated
+// more efficiently.  Constant sub-expressions are folded, common
+// sub-expressions are only evaluated once, and the remaining tree of
+// texture nodes is flattened into a TexProgram where possible.  If
+// nothing can be gained, VAL is returned unchanged.
+//
+extern TexVal<float> compile_tex (const TexVal<float> &val);
+extern TexVal<Color> compile_tex (const TexVal<Color> &val);
+
+
+}
+
+#endif // __TEX_PROGRAM_H__
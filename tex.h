@@ -34,9 +34,60 @@ public:
   // Evaluate this texture at TEX_COORDS.
   //
   virtual T eval (const TexCoords &tex_coords) const = 0;
+
+  // Evaluate this texture at each of the NUM coordinates in TEX_COORDS,
+  // storing the results into the corresponding elements of RESULTS.
+  //
+  // The default implementation just calls Tex::eval for each element;
+  // subclasses may override it with something more efficient (avoiding
+  // per-element virtual calls, and doing the same operation for all
+  // elements in a tight loop, which the compiler can often vectorize).
+  //
+  virtual void eval_batch (const TexCoords *tex_coords, T *results,
+			   unsigned num)
+    const
+  {
+    for (unsigned i = 0; i < num; i++)
+      results[i] = eval (tex_coords[i]);
+  }
+
+  // Batched evaluation methods which need temporary storage process
+  // their input in chunks of at most this many elements.
+  //
+  static const unsigned BATCH_CHUNK = 64;
 };
 
 
+// Evaluate TEX at each of the NUM coordinates in TEX_COORDS, after
+// transforming them with MAPPER.map, storing the results into
+// RESULTS.  This is a helper for the Tex::eval_batch methods of
+// textures which just transform their coordinates.
+//
+template<typename T, typename Mapper>
+void
+eval_mapped_batch (const Tex<T> &tex, const Mapper &mapper,
+		   const TexCoords *tex_coords, T *results, unsigned num)
+{
+  TexCoords mapped[Tex<T>::BATCH_CHUNK];
+
+  while (num > 0)
+    {
+      unsigned chunk = num;
+      if (chunk > Tex<T>::BATCH_CHUNK)
+	chunk = Tex<T>::BATCH_CHUNK;
+
+      for (unsigned i = 0; i < chunk; i++)
+	mapped[i] = mapper.map (tex_coords[i]);
+
+      tex.eval_batch (mapped, results, chunk);
+
+      tex_coords += chunk;
+      results += chunk;
+      num -= chunk;
+    }
+}
+
+
 // A textured value.  It is either a constant value or refers to a
 // texture which can be used to generate a value.
 //
@@ -78,6 +129,19 @@ public:
     return tex ? tex->eval (tex_coords) : default_val;
   }
 
+  // Evaluate this texture at each of the NUM coordinates in
+  // TEX_COORDS, storing the results into RESULTS.
+  //
+  void eval_batch (const TexCoords *tex_coords, T *results, unsigned num)
+    const
+  {
+    if (tex)
+      tex->eval_batch (tex_coords, results, num);
+    else
+      for (unsigned i = 0; i < num; i++)
+	results[i] = default_val;
+  }
+
   Ref<const Tex<T> > tex;
 
   T default_val;
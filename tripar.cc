@@ -26,14 +26,43 @@ using namespace snogray;
 const Surface::IsecInfo *
 Tripar::intersect (Ray &ray, RenderContext &context) const
 {
-  dist_t t, u, v;
-  if (intersects (ray, t, u, v))
+  IsecParams isec_params;
+  if (find_intersection (ray, isec_params, context))
+    return make_isec_info (ray, isec_params, context);
+  else
+    return 0;
+}
+
+// "Two-phase" version of Surface::intersect:  If this surface
+// intersects RAY, change RAY's maximum bound (Ray::t1) to reflect the
+// point of intersection, store the intersection's parameters in
+// ISEC_PARAMS, and return true; otherwise return false.
+//
+bool
+Tripar::find_intersection (Ray &ray, IsecParams &isec_params,
+			   RenderContext &)
+  const
+{
+  dist_t t;
+  if (intersects (ray, t, isec_params.u, isec_params.v))
     {
       ray.t1 = t;
-      return new (context) IsecInfo (ray, *this, u, v);
+      return true;
     }
 
-  return 0;
+  return false;
+}
+
+// Return a Surface::IsecInfo object describing the intersection of
+// this surface with RAY, found by a previous call to
+// Tripar::find_intersection which returned ISEC_PARAMS.
+//
+const Surface::IsecInfo *
+Tripar::make_isec_info (const Ray &ray, const IsecParams &isec_params,
+			RenderContext &context)
+  const
+{
+  return new (context) IsecInfo (ray, *this, isec_params.u, isec_params.v);
 }
 
 // Create an Intersect object for this intersection.
@@ -52,6 +52,14 @@ public:
     return val;
   }
 
+  virtual void eval_batch (const TexCoords *coords, float *results,
+			   unsigned num)
+    const
+  {
+    for (unsigned i = 0; i < num; i++)
+      results[i] = WorleyTex::eval (coords[i]);
+  }
+
 private:
 
   Worley worley;
@@ -97,6 +105,14 @@ public:
     return float (did) + bias;
   }
 
+  virtual void eval_batch (const TexCoords *coords, float *results,
+			   unsigned num)
+    const
+  {
+    for (unsigned i = 0; i < num; i++)
+      results[i] = WorleyIdTex::eval (coords[i]);
+  }
+
 private:
 
   Worley worley;
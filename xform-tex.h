@@ -13,6 +13,7 @@
 #ifndef __XFORM_TEX_H__
 #define __XFORM_TEX_H__
 
+#include "xform.h"
 #include "tex.h"
 
 
@@ -28,16 +29,40 @@ class XformTex : public Tex<T>
 public:
 
   XformTex (const Xform &_xform, const TexVal<T> &_tex)
-    : xform (_xform), tex (_tex)
+    : xform (_xform), tex (_tex),
+      pos_scale (pow (abs (xform.det ()), 1 / 3.f)),
+      uv_scale (calc_uv_scale (xform))
   { }
 
   // Evaluate this texture at TEX_COORDS.
   //
   virtual T eval (const TexCoords &tex_coords) const
+  {
+    return tex.eval (map (tex_coords));
+  }
+
+  // Evaluate this texture at each of the NUM coordinates in TEX_COORDS,
+  // storing the results into RESULTS.
+  //
+  virtual void eval_batch (const TexCoords *tex_coords, T *results,
+			   unsigned num)
+    const
+  {
+    if (tex.tex)
+      eval_mapped_batch (*tex.tex, *this, tex_coords, results, num);
+    else
+      tex.eval_batch (tex_coords, results, num);
+  }
+
+  // Return TEX_COORDS transformed by this texture's transform.
+  //
+  TexCoords map (const TexCoords &tex_coords) const
   {
     Pos xpos = xform (tex_coords.pos);
     UV xuv = xform (tex_coords.uv);
-    return tex.eval (TexCoords (xpos, xuv));
+    return TexCoords (xpos, xuv,
+		      tex_coords.pos_width * pos_scale,
+		      tex_coords.uv_width * uv_scale);
   }
 
   // Transformation to use.  The same transform is used for both 2d and 3d
@@ -48,6 +73,23 @@ public:
   // Texture which will be used to texture the transformed coordinates.
   //
   TexVal<T> tex;
+
+private:
+
+  // Return the average factor by which XFORM scales lengths in the
+  // 2d texture-coordinate plane.
+  //
+  static float calc_uv_scale (const Xform &xform)
+  {
+    UV org = xform (UV (0, 0));
+    UV x = xform (UV (1, 0)) - org, y = xform (UV (0, 1)) - org;
+    return sqrt (abs (x.u * y.v - x.v * y.u));
+  }
+
+  // Average factors by which XFORM scales lengths in 3d and 2d
+  // texture coordinates, used to transform texture footprints.
+  //
+  float pos_scale, uv_scale;
 };
 
 